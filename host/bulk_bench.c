@@ -0,0 +1,383 @@
+// Library
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "host/ble_hs.h"
+// Local
+#include "check.h"
+#include "cl_ble_bond.h"
+#include "cl_ble_bulk.h"
+#include "cl_ble_conn.h"
+#include "cl_ble_svc.h"
+#include "cl_gpio_hub.h"
+#include "cl_journal.h"
+#include "cl_phy_lock_svc.h"
+#include "cl_power.h"
+#include "gatts/cl_ble_lock_svc.h"
+
+/**
+ * Bulk channel throughput benchmark.
+ *
+ * A paired central opens the bulk channel and pulls the journal, a metrics snapshot and a core dump image through
+ * it, checking what it reassembles from the SDUs: journal records in sequence, the core dump byte for byte, a resumed
+ * core dump and the metrics entries. Every source is pulled with a range of credits granted by the central, and the
+ * throughput is reported against the capacity of the link, the payload rate of back-to-back full PDUs on the PHY in
+ * use. A central that is not bonded must be refused.
+ *
+ * Usage: bulk_bench [journal records] [log level 0-5]
+ */
+
+#define CENTRAL_CONN 1
+#define PAIR_MS 600					 //!< Time of a full LE Secure Connections pairing, user confirmation included
+#define SETTLE_MS 100				 //!< Time given to the PHY and parameter updates before a transfer
+#define TRANSFER_TIMEOUT_MS 60000 //!< Simulated time a transfer may take at most
+#define CENTRAL_MTU 2048		 //!< Largest SDU the central accepts, above CL_BLE_BULK_SDU_MAX
+#define COREDUMP_SIZE 60000	 //!< Core dump image written before the run
+#define RESUME_OFFSET 40000	 //!< Offset the core dump transfer is resumed from
+
+static const ble_addr_t central_addr = {.type = BLE_ADDR_RANDOM, .val = {0x01, 0x00, 0x00, 0x00, 0x00, 0xc0}};
+static const uint16_t credits[] = {4, 16, 64};
+
+/**
+ * A transfer as the central reassembles it.
+ */
+typedef struct
+{
+	uint8_t source;	 //!< Source requested
+	uint8_t *data;	 //!< Payloads, the size of the first SDU excluded
+	size_t len;
+	size_t cap;
+	uint32_t size;	 //!< Size announced in the first SDU
+	uint32_t sdus;
+	int32_t error;	 //!< esp_err_t of a failed transfer
+	bool started;
+	bool ended;
+	bool bad;				 //!< An SDU broke the protocol
+	int64_t end_us;
+} transfer_t;
+
+static transfer_t rx;
+
+/**
+ * Central receive callback, on the NimBLE host task.
+ */
+static void on_sdu(uint16_t conn_handle, const uint8_t *sdu, uint16_t len)
+{
+	(void)conn_handle;
+	if (rx.ended || len < CL_BLE_BULK_HEADER_LEN || sdu[0] != rx.source)
+	{
+		rx.bad = true;
+		return;
+	}
+	uint8_t flags = sdu[1];
+	const uint8_t *payload = &sdu[CL_BLE_BULK_HEADER_LEN];
+	size_t payload_len = len - CL_BLE_BULK_HEADER_LEN;
+	rx.sdus++;
+
+	if (flags & CL_BLE_BULK_F_ERROR)
+	{
+		rx.bad |= payload_len != sizeof(rx.error) || !(flags & CL_BLE_BULK_F_END);
+		memcpy(&rx.error, payload, sizeof(rx.error));
+		rx.ended = true;
+		rx.end_us = host_rtos_time_us();
+		return;
+	}
+	if (flags & CL_BLE_BULK_F_START)
+	{
+		if (rx.started || payload_len < sizeof(rx.size))
+		{
+			rx.bad = true;
+			return;
+		}
+		memcpy(&rx.size, payload, sizeof(rx.size));
+		payload += sizeof(rx.size);
+		payload_len -= sizeof(rx.size);
+		rx.started = true;
+	}
+	else if (!rx.started)
+	{
+		rx.bad = true;
+		return;
+	}
+
+	if (rx.len + payload_len > rx.cap)
+	{
+		rx.cap = (rx.len + payload_len) * 2;
+		rx.data = realloc(rx.data, rx.cap);
+	}
+	memcpy(&rx.data[rx.len], payload, payload_len);
+	rx.len += payload_len;
+	if (flags & CL_BLE_BULK_F_END)
+	{
+		rx.ended = true;
+		rx.end_us = host_rtos_time_us();
+	}
+}
+
+static void connect_central(bool pair)
+{
+	host_ble_connect(CENTRAL_CONN, &central_addr);
+	if (pair)
+	{
+		CHECK(host_ble_pair(CENTRAL_CONN) == 0, "pairing failed");
+		host_rtos_advance_ms(PAIR_MS);
+	}
+	host_rtos_advance_ms(SETTLE_MS);
+}
+
+static void open_channel(uint16_t initial_credits)
+{
+	host_ble_l2cap_peer_t peer = {
+			.mtu = CENTRAL_MTU,
+			.mps = HOST_BLE_L2CAP_COC_MPS,
+			.initial_credits = initial_credits,
+			.rx_cb = on_sdu,
+	};
+	int ret = host_ble_l2cap_connect(CENTRAL_CONN, CL_BLE_BULK_PSM, &peer);
+	CHECK(ret == 0, "channel refused; ret=%d", ret);
+}
+
+/**
+ * Request a transfer and run the link until its last SDU reached the central.
+ *
+ * @return The link counters of the transfer.
+ */
+static host_ble_link_stats_t pull(uint8_t source, uint32_t start, int64_t *elapsed_us)
+{
+	rx.source = source;
+	rx.len = 0;
+	rx.size = 0;
+	rx.sdus = 0;
+	rx.error = ESP_OK;
+	rx.started = false;
+	rx.ended = false;
+	rx.bad = false;
+
+	host_ble_link_stats_t before, after;
+	host_ble_get_link_stats(CENTRAL_CONN, &before);
+	uint8_t request[CL_BLE_BULK_REQUEST_LEN] = {source};
+	memcpy(&request[1], &start, sizeof(start));
+	int64_t start_us = host_rtos_time_us();
+	CHECK(host_ble_l2cap_send(CENTRAL_CONN, request, sizeof(request)) == 0, "request not sent");
+	for (int ms = 0; !rx.ended && ms < TRANSFER_TIMEOUT_MS; ms++)
+	{
+		host_rtos_advance_ms(1);
+	}
+	host_rtos_wait_idle();
+	CHECK(rx.ended, "transfer of source %d not ended after %d ms, %zu bytes", source, TRANSFER_TIMEOUT_MS, rx.len);
+	CHECK(!rx.bad, "transfer of source %d broke the protocol", source);
+	host_ble_get_link_stats(CENTRAL_CONN, &after);
+	*elapsed_us = rx.end_us - start_us;
+
+	host_ble_link_stats_t delta = after;
+	delta.events -= before.events;
+	delta.pdus -= before.pdus;
+	delta.frames -= before.frames;
+	delta.sdus -= before.sdus;
+	delta.stalls -= before.stalls;
+	delta.credits -= before.credits;
+	delta.l2cap_bytes -= before.l2cap_bytes;
+	delta.air_us -= before.air_us;
+	return delta;
+}
+
+static void report(const char *name, uint16_t initial_credits, const host_ble_link_stats_t *link, int64_t elapsed_us)
+{
+	double rate = rx.len * 1e6 / elapsed_us;
+	printf("  %-10s credits %3d: %7zu bytes in %4" PRIu32 " SDUs, %6.1f ms, %6.1f kB/s, %5.1f%% of capacity, "
+				 "%.2f PDUs/frame, %" PRIu32 " events, %" PRIu32 " stalls\n",
+				 name, initial_credits, rx.len, rx.sdus, elapsed_us / 1e3, rate / 1e3, 100.0 * rate / link->capacity_bps,
+				 link->frames ? (double)link->pdus / link->frames : 0, link->events, link->stalls);
+}
+
+static void check_journal(uint32_t written)
+{
+	CHECK(rx.error == ESP_OK && rx.size == CL_BLE_BULK_SIZE_UNKNOWN, "journal transfer failed: %" PRId32, rx.error);
+	CHECK(rx.len % sizeof(cl_journal_record_t) == 0, "journal transfer of %zu bytes", rx.len);
+	size_t count = rx.len / sizeof(cl_journal_record_t);
+	const cl_journal_record_t *records = (const cl_journal_record_t *)rx.data;
+	CHECK(count > 0 && records[count - 1].seq == written, "journal ends at %" PRIu32 " of %" PRIu32,
+				count ? records[count - 1].seq : 0, written);
+	for (size_t i = 1; i < count; i++)
+	{
+		CHECK(records[i].seq == records[i - 1].seq + 1, "journal gap: seq %" PRIu32 " after %" PRIu32, records[i].seq,
+					records[i - 1].seq);
+	}
+}
+
+/**
+ * Byte of the core dump image: its length, then a pattern.
+ */
+static uint8_t coredump_byte(size_t off)
+{
+	uint32_t size = COREDUMP_SIZE;
+	return off < sizeof(size) ? ((const uint8_t *)&size)[off] : (uint8_t)(off * 7 + (off >> 8));
+}
+
+static void check_coredump(uint32_t start)
+{
+	CHECK(rx.error == ESP_OK, "core dump transfer failed: %" PRId32, rx.error);
+	CHECK(rx.size == COREDUMP_SIZE - start && rx.len == rx.size, "core dump of %zu bytes, %" PRIu32 " announced",
+				rx.len, rx.size);
+	for (size_t i = 0; i < rx.len; i++)
+	{
+		CHECK(rx.data[i] == coredump_byte(start + i), "core dump byte %zu differs", start + i);
+	}
+}
+
+static void check_metrics(void)
+{
+	CHECK(rx.error == ESP_OK && rx.len == rx.size, "metrics transfer failed: %" PRId32, rx.error);
+	uint32_t seen = 0;
+	for (size_t off = 0; off < rx.len;)
+	{
+		CHECK(off + 3 <= rx.len, "truncated metric at %zu", off);
+		uint8_t metric = rx.data[off];
+		uint16_t len;
+		memcpy(&len, &rx.data[off + 1], sizeof(len));
+		CHECK(off + 3 + len <= rx.len, "truncated metric %d", metric);
+		seen |= 1u << metric;
+		if (metric == CL_BLE_BULK_METRIC_JOURNAL)
+		{
+			cl_journal_stats_t journal;
+			CHECK(len == sizeof(journal), "journal metric of %d bytes", len);
+			memcpy(&journal, &rx.data[off + 3], sizeof(journal));
+			CHECK(journal.written > 0, "journal metric without records");
+		}
+		off += 3 + len;
+	}
+	CHECK(seen == 0xfe, "metrics 0x%02" PRIx32 " sent", seen);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t records = argc > 1 ? strtoul(argv[1], NULL, 0) : 3000;
+	esp_log_level_set("*", argc > 2 ? (esp_log_level_t)atoi(argv[2]) : ESP_LOG_WARN);
+
+	host_nvs_reset();
+	host_partition_reset();
+	host_gpio_reset();
+	CHECK(gpio_install_isr_service(0) == ESP_OK, "isr service");
+	CHECK(cl_gpio_hub_init() == ESP_OK, "gpio hub");
+	CHECK(cl_power_init() == ESP_OK, "power init");
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, PHY_LOCK_POSITION_CLOSED);
+	CHECK(cl_phy_lock_svc_init() == ESP_OK, "lock init");
+	CHECK(cl_ble_lock_svc_init() == 0, "gatt init");
+	CHECK(cl_ble_bond_init() == ESP_OK, "bond init");
+	CHECK(cl_ble_conn_init() == ESP_OK, "conn init");
+	CHECK(cl_ble_bulk_init() == ESP_OK, "bulk init");
+	CHECK(cl_phy_lock_svc_start() == ESP_OK, "lock start");
+	host_ble_set_gap_cb(ble_gap_event, NULL);
+	host_rtos_wait_idle();
+
+	// the journal of a busy lock, and the core dump of a crash: its length, then the image
+	static const uint8_t owner[16] = {0xc1, 0xa1};
+	for (uint32_t i = 0; i < records; i++)
+	{
+		CHECK(cl_journal_append(i & 1 ? CL_JOURNAL_EVENT_RELEASED : CL_JOURNAL_EVENT_CLAIMED, owner,
+														i & 1 ? PHY_LOCK_STATE_UNCLAIMED : PHY_LOCK_STATE_CLAIMED) == ESP_OK,
+					"journal append");
+		if (i % (CL_JOURNAL_QUEUE_LEN / 2) == 0)
+		{
+			host_rtos_wait_idle();
+		}
+	}
+	host_rtos_wait_idle();
+	cl_journal_stats_t journal;
+	cl_journal_get_stats(&journal);
+	CHECK(journal.dropped == 0 && journal.failures == 0, "journal lost records");
+
+	const esp_partition_t *coredump = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+	CHECK(coredump != NULL, "no coredump partition");
+	uint8_t *image = malloc(COREDUMP_SIZE);
+	for (size_t i = 0; i < COREDUMP_SIZE; i++)
+	{
+		image[i] = coredump_byte(i);
+	}
+	CHECK(esp_partition_write(coredump, 0, image, COREDUMP_SIZE) == ESP_OK, "core dump write");
+	free(image);
+
+	// only a bonded central gets the data
+	connect_central(false);
+	host_ble_l2cap_peer_t stranger = {.mtu = CENTRAL_MTU, .mps = HOST_BLE_L2CAP_COC_MPS, .initial_credits = 1};
+	CHECK(host_ble_l2cap_connect(CENTRAL_CONN, CL_BLE_BULK_PSM, &stranger) == BLE_HS_EENCRYPT, "unbonded channel accepted");
+	host_ble_disconnect(CENTRAL_CONN);
+	host_rtos_wait_idle();
+
+	printf("bulk channel: MPS %d, SDU %d, %" PRIu32 " journal records, %d-byte core dump\n", CL_BLE_BULK_MPS,
+				 CL_BLE_BULK_SDU_MAX, journal.written, COREDUMP_SIZE);
+	double best_utilisation = 0;
+	for (size_t c = 0; c < sizeof(credits) / sizeof(credits[0]); c++)
+	{
+		connect_central(true);
+		open_channel(credits[c]);
+		int64_t elapsed_us;
+		host_ble_link_stats_t link = pull(CL_BLE_BULK_SRC_JOURNAL, 0, &elapsed_us);
+		check_journal(journal.written);
+		CHECK(link.phy == BLE_GAP_LE_PHY_2M && link.tx_octets == CL_BLE_CONN_DATA_LEN_OCTETS,
+					"link not raised: phy %d, %d octets", link.phy, link.tx_octets);
+		// full K-frames fill a single PDU
+		CHECK(link.pdus == link.frames, "%" PRIu32 " PDUs for %" PRIu32 " frames", link.pdus, link.frames);
+		if (c == 0)
+		{
+			printf("link: 2M PHY, %d octets, interval %.2f ms, capacity %.1f kB/s\n", link.tx_octets,
+						 CL_BLE_CONN_FAST_ITVL_MAX * 1.25, link.capacity_bps / 1e3);
+		}
+		report("journal", credits[c], &link, elapsed_us);
+
+		link = pull(CL_BLE_BULK_SRC_COREDUMP, 0, &elapsed_us);
+		check_coredump(0);
+		report("coredump", credits[c], &link, elapsed_us);
+		double utilisation = rx.len * 1e6 / elapsed_us / link.capacity_bps;
+		best_utilisation = utilisation > best_utilisation ? utilisation : best_utilisation;
+
+		link = pull(CL_BLE_BULK_SRC_COREDUMP, RESUME_OFFSET, &elapsed_us);
+		check_coredump(RESUME_OFFSET);
+		report("resumed", credits[c], &link, elapsed_us);
+
+		link = pull(CL_BLE_BULK_SRC_METRICS, 0, &elapsed_us);
+		check_metrics();
+		report("metrics", credits[c], &link, elapsed_us);
+
+		// the connection turns back to the fast parameters once the transfers are over
+		cl_ble_conn_info_t info;
+		CHECK(cl_ble_conn_get_info(CENTRAL_CONN, &info) == ESP_OK && info.phase == CL_BLE_CONN_PHASE_FAST,
+					"connection left in phase %d", info.phase);
+		host_ble_disconnect(CENTRAL_CONN);
+		host_rtos_wait_idle();
+	}
+
+	// a request for a missing source or a bad offset ends with an error, the channel stays usable
+	connect_central(true);
+	open_channel(credits[1]);
+	int64_t elapsed_us;
+	pull(0x7f, 0, &elapsed_us);
+	CHECK(rx.error == ESP_ERR_NOT_SUPPORTED && rx.sdus == 1, "unknown source answered with %" PRId32, rx.error);
+	pull(CL_BLE_BULK_SRC_COREDUMP, COREDUMP_SIZE + 1, &elapsed_us);
+	CHECK(rx.error == ESP_ERR_INVALID_ARG && rx.sdus == 1, "bad offset answered with %" PRId32, rx.error);
+	pull(CL_BLE_BULK_SRC_METRICS, 0, &elapsed_us);
+	check_metrics();
+	host_ble_link_stats_t link;
+	host_ble_get_link_stats(CENTRAL_CONN, &link);
+	host_ble_disconnect(CENTRAL_CONN);
+	host_rtos_wait_idle();
+
+	cl_ble_bulk_stats_t bulk;
+	cl_ble_bulk_get_stats(&bulk);
+	printf("bulk: %" PRIu32 " channels, %" PRIu32 " refused, %" PRIu32 " transfers, %" PRIu32 " aborted, %" PRIu32
+				 " SDUs, %" PRIu32 " bytes, %" PRIu32 " stalls, %" PRIu32 " delayed by the mbuf pool, %" PRIu32 " of %d mbufs used at most\n",
+				 bulk.channels, bulk.refused, bulk.transfers, bulk.aborted, bulk.sdus, bulk.bytes, bulk.stalls, bulk.no_mem,
+				 link.mbufs_peak, CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT + CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT);
+	CHECK(bulk.refused == 1 && bulk.aborted == 0, "unexpected channel counters");
+	CHECK(best_utilisation > 0.8, "best transfer at %.1f%% of the link capacity", 100 * best_utilisation);
+	free(rx.data);
+	return 0;
+}
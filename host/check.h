@@ -0,0 +1,37 @@
+#ifndef _HOST_CHECK_H_
+#define _HOST_CHECK_H_
+
+/**
+ * Helpers shared by the host simulations, tests and benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Fail the program with the condition, its location and a printf-style message unless it holds.
+ */
+#define CHECK(cond, ...)                                                      \
+	do                                                                          \
+	{                                                                           \
+		if (!(cond))                                                              \
+		{                                                                         \
+			fprintf(stderr, "%s:%d check failed: %s: ", __FILE__, __LINE__, #cond); \
+			fprintf(stderr, __VA_ARGS__);                                           \
+			fputc('\n', stderr);                                                    \
+			exit(1);                                                                \
+		}                                                                         \
+	} while (0)
+
+/**
+ * Wall-clock time in nanoseconds, from an arbitrary origin.
+ */
+static inline double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#endif // _HOST_CHECK_H_
@@ -0,0 +1,394 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cl_delta.h"
+#include "delta_encode.h"
+#include "mbedtls/sha256.h"
+
+#define SEED_LEN 8				 //!< Strings of the source indexed to find matches
+#define SEED_HASH_BITS 20
+#define SEED_CHAIN 32			 //!< Occurrences of a string tried, the latest ones
+#define SCORE_MARGIN 8		 //!< Bytes a new match must gain over the current alignment, as bsdiff
+#define LZ_HASH_BITS 16
+#define LZ_CHAIN 64				 //!< Earlier strings tried for a match
+#define LZ_MATCH_PROFIT 4	 //!< Shortest match worth its 3 bytes
+
+/**
+ * Growing output buffer, failed once out of memory.
+ */
+typedef struct
+{
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+	bool failed;
+} buf_t;
+
+/**
+ * Hash chains of the source strings, the latest occurrence first.
+ */
+typedef struct
+{
+	const uint8_t *old;
+	ptrdiff_t oldsize;
+	int32_t *head;
+	int32_t *prev;
+} seeds_t;
+
+static void put(buf_t *buf, const void *data, size_t len)
+{
+	if (buf->failed)
+	{
+		return;
+	}
+	if (buf->len + len > buf->cap)
+	{
+		size_t cap = buf->cap > 0 ? buf->cap : 4096;
+		while (cap < buf->len + len)
+		{
+			cap *= 2;
+		}
+		uint8_t *data_ = realloc(buf->data, cap);
+		if (data_ == NULL)
+		{
+			buf->failed = true;
+			return;
+		}
+		buf->data = data_;
+		buf->cap = cap;
+	}
+	memcpy(&buf->data[buf->len], data, len);
+	buf->len += len;
+}
+
+static void put_byte(buf_t *buf, uint8_t byte)
+{
+	put(buf, &byte, 1);
+}
+
+static void put_u32(buf_t *buf, uint32_t value)
+{
+	uint8_t le[4] = {value, value >> 8, value >> 16, value >> 24};
+	put(buf, le, sizeof(le));
+}
+
+static void put_varint(buf_t *buf, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		put_byte(buf, (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	put_byte(buf, value);
+}
+
+static size_t match_len(const uint8_t *a, const uint8_t *b, size_t max)
+{
+	size_t len = 0;
+	while (len < max && a[len] == b[len])
+	{
+		len++;
+	}
+	return len;
+}
+
+static uint32_t seed_hash(const uint8_t *data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return (uint32_t)((value * 0x9E3779B97F4A7C15ull) >> (64 - SEED_HASH_BITS));
+}
+
+static bool seeds_init(seeds_t *seeds, const uint8_t *old, size_t oldsize)
+{
+	seeds->old = old;
+	seeds->oldsize = oldsize;
+	seeds->head = malloc(sizeof(int32_t) << SEED_HASH_BITS);
+	seeds->prev = malloc(sizeof(int32_t) * (oldsize > 0 ? oldsize : 1));
+	if (seeds->head == NULL || seeds->prev == NULL)
+	{
+		return false;
+	}
+	memset(seeds->head, 0xff, sizeof(int32_t) << SEED_HASH_BITS);
+	for (size_t i = 0; i + SEED_LEN <= oldsize; i++)
+	{
+		uint32_t hash = seed_hash(&old[i]);
+		seeds->prev[i] = seeds->head[hash];
+		seeds->head[hash] = i;
+	}
+	return true;
+}
+
+/**
+ * Longest match of the new bytes in the source, among the occurrences of their first string and the hint, the
+ * current alignment.
+ */
+static ptrdiff_t search(const seeds_t *seeds, const uint8_t *new, ptrdiff_t left, ptrdiff_t hint, ptrdiff_t *pos)
+{
+	ptrdiff_t best = 0;
+	if (hint >= 0 && hint < seeds->oldsize)
+	{
+		best = match_len(&seeds->old[hint], new, left < seeds->oldsize - hint ? left : seeds->oldsize - hint);
+		*pos = hint;
+	}
+	if (left < SEED_LEN)
+	{
+		return best;
+	}
+	int32_t p = seeds->head[seed_hash(new)];
+	for (int n = 0; p >= 0 && n < SEED_CHAIN && best < left; n++, p = seeds->prev[p])
+	{
+		ptrdiff_t len = match_len(&seeds->old[p], new, left < seeds->oldsize - p ? left : seeds->oldsize - p);
+		if (len > best)
+		{
+			best = len;
+			*pos = p;
+		}
+	}
+	return best;
+}
+
+/**
+ * The bsdiff scan: a match found elsewhere than the current alignment ends a record, whose add part is stretched
+ * forward and the next one backward over the bytes that mostly match.
+ */
+static bool diff(const uint8_t *old, ptrdiff_t oldsize, const uint8_t *new, ptrdiff_t newsize, buf_t *out,
+								 delta_encode_stats_t *stats)
+{
+	seeds_t seeds;
+	bool ok = seeds_init(&seeds, old, oldsize);
+	ptrdiff_t scan = 0, len = 0, pos = 0, lastscan = 0, lastpos = 0, lastoffset = 0;
+	while (ok && scan < newsize)
+	{
+		ptrdiff_t oldscore = 0;
+		ptrdiff_t scsc;
+		for (scsc = scan += len; scan < newsize; scan++)
+		{
+			len = search(&seeds, &new[scan], newsize - scan, scan + lastoffset, &pos);
+			for (; scsc < scan + len; scsc++)
+			{
+				if (scsc + lastoffset >= 0 && scsc + lastoffset < oldsize && old[scsc + lastoffset] == new[scsc])
+				{
+					oldscore++;
+				}
+			}
+			if ((len == oldscore && len != 0) || len > oldscore + SCORE_MARGIN)
+			{
+				break;
+			}
+			if (scan + lastoffset >= 0 && scan + lastoffset < oldsize && old[scan + lastoffset] == new[scan])
+			{
+				oldscore--;
+			}
+		}
+		if (len == oldscore && scan != newsize)
+		{
+			continue;
+		}
+
+		ptrdiff_t s = 0, best = 0, lenf = 0;
+		for (ptrdiff_t i = 0; lastscan + i < scan && lastpos + i < oldsize;)
+		{
+			s += old[lastpos + i] == new[lastscan + i];
+			i++;
+			if (s * 2 - i > best * 2 - lenf)
+			{
+				best = s;
+				lenf = i;
+			}
+		}
+		ptrdiff_t lenb = 0;
+		if (scan < newsize)
+		{
+			s = 0;
+			best = 0;
+			for (ptrdiff_t i = 1; scan >= lastscan + i && pos >= i; i++)
+			{
+				s += old[pos - i] == new[scan - i];
+				if (s * 2 - i > best * 2 - lenb)
+				{
+					best = s;
+					lenb = i;
+				}
+			}
+		}
+		if (lastscan + lenf > scan - lenb)
+		{
+			// the two stretches overlap, split them where the most bytes match
+			ptrdiff_t overlap = lastscan + lenf - (scan - lenb);
+			ptrdiff_t lens = 0;
+			s = 0;
+			best = 0;
+			for (ptrdiff_t i = 0; i < overlap; i++)
+			{
+				s += new[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i];
+				s -= new[scan - lenb + i] == old[pos - lenb + i];
+				if (s > best)
+				{
+					best = s;
+					lens = i + 1;
+				}
+			}
+			lenf += lens - overlap;
+			lenb -= lens;
+		}
+
+		ptrdiff_t copy = scan - lenb - (lastscan + lenf);
+		int32_t seek = (int32_t)(pos - lenb - (lastpos + lenf));
+		put_varint(out, lenf);
+		put_varint(out, copy);
+		put_varint(out, (uint32_t)seek << 1 ^ (uint32_t)(seek >> 31));
+		for (ptrdiff_t i = 0; i < lenf; i++)
+		{
+			put_byte(out, new[lastscan + i] - old[lastpos + i]);
+		}
+		put(out, &new[lastscan + lenf], copy);
+		stats->records++;
+		stats->added += lenf;
+		stats->copied += copy;
+
+		lastscan = scan - lenb;
+		lastpos = pos - lenb;
+		lastoffset = pos - scan;
+	}
+	free(seeds.head);
+	free(seeds.prev);
+	return ok && !out->failed;
+}
+
+static uint32_t lz_hash(const uint8_t *data)
+{
+	uint32_t value = (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Longest earlier match of the bytes at pos within the window, the chains holding every position before it.
+ */
+static size_t lz_find(const uint8_t *in, size_t len, size_t pos, size_t window, const int32_t *head,
+											const int32_t *prev, size_t *distance)
+{
+	size_t max = len - pos < CL_DELTA_MATCH_MAX ? len - pos : CL_DELTA_MATCH_MAX;
+	size_t best = 0;
+	if (max < CL_DELTA_MATCH_MIN)
+	{
+		return 0;
+	}
+	int32_t p = head[lz_hash(&in[pos])];
+	for (int n = 0; p >= 0 && pos - p <= window && n < LZ_CHAIN && best < max; n++, p = prev[p])
+	{
+		size_t match = match_len(&in[p], &in[pos], max);
+		if (match > best)
+		{
+			best = match;
+			*distance = pos - p;
+		}
+	}
+	return best;
+}
+
+static bool compress(const uint8_t *in, size_t len, int window_bits, buf_t *out, delta_encode_stats_t *stats)
+{
+	size_t window = (size_t)1 << window_bits;
+	int32_t *head = malloc(sizeof(int32_t) << LZ_HASH_BITS);
+	int32_t *prev = malloc(sizeof(int32_t) * (len > 0 ? len : 1));
+	if (head == NULL || prev == NULL)
+	{
+		free(head);
+		free(prev);
+		return false;
+	}
+	memset(head, 0xff, sizeof(int32_t) << LZ_HASH_BITS);
+
+	size_t inserted = 0;
+	size_t flags_at = 0;
+	int items = 8;
+	for (size_t pos = 0; pos < len && !out->failed;)
+	{
+		while (inserted < pos && inserted + CL_DELTA_MATCH_MIN <= len)
+		{
+			uint32_t hash = lz_hash(&in[inserted]);
+			prev[inserted] = head[hash];
+			head[hash] = inserted++;
+		}
+		size_t distance = 0;
+		size_t match = lz_find(in, len, pos, window, head, prev, &distance);
+		if (match >= LZ_MATCH_PROFIT && pos + 1 < len && inserted + CL_DELTA_MATCH_MIN <= len)
+		{
+			// lazy: a longer match a byte later is worth a literal
+			uint32_t hash = lz_hash(&in[inserted]);
+			prev[inserted] = head[hash];
+			head[hash] = inserted++;
+			size_t next_distance;
+			if (lz_find(in, len, pos + 1, window, head, prev, &next_distance) > match)
+			{
+				match = 0;
+			}
+		}
+
+		if (items == 8)
+		{
+			flags_at = out->len;
+			put_byte(out, 0);
+			items = 0;
+		}
+		if (match >= LZ_MATCH_PROFIT)
+		{
+			put_byte(out, (distance - 1) & 0xff);
+			put_byte(out, (distance - 1) >> 8);
+			put_byte(out, match - CL_DELTA_MATCH_MIN);
+			stats->matches++;
+			pos += match;
+		}
+		else if (!out->failed)
+		{
+			out->data[flags_at] |= 1u << items;
+			put_byte(out, in[pos]);
+			stats->literals++;
+			pos++;
+		}
+		items++;
+	}
+	free(head);
+	free(prev);
+	return !out->failed;
+}
+
+uint8_t *delta_encode(const uint8_t *source, size_t source_size, const uint8_t *target, size_t target_size,
+											int window_bits, delta_encode_stats_t *stats)
+{
+	delta_encode_stats_t unused;
+	stats = stats != NULL ? stats : &unused;
+	memset(stats, 0, sizeof(*stats));
+	if (window_bits < CL_DELTA_WINDOW_BITS_MIN || window_bits > CL_DELTA_WINDOW_BITS_MAX)
+	{
+		return NULL;
+	}
+
+	buf_t delta = {0};
+	buf_t patch = {0};
+	uint8_t hash[CL_DELTA_HASH_LEN];
+	put(&patch, CL_DELTA_MAGIC, 4);
+	put_byte(&patch, CL_DELTA_VERSION);
+	put_byte(&patch, window_bits);
+	put_byte(&patch, 0);
+	put_byte(&patch, 0);
+	put_u32(&patch, source_size);
+	put_u32(&patch, target_size);
+	mbedtls_sha256(source, source_size, hash, 0);
+	put(&patch, hash, sizeof(hash));
+	mbedtls_sha256(target, target_size, hash, 0);
+	put(&patch, hash, sizeof(hash));
+
+	bool ok = diff(source, source_size, target, target_size, &delta, stats) &&
+						compress(delta.data, delta.len, window_bits, &patch, stats);
+	stats->delta_len = delta.len;
+	stats->patch_len = patch.len;
+	free(delta.data);
+	if (!ok)
+	{
+		free(patch.data);
+		return NULL;
+	}
+	return patch.data;
+}
@@ -0,0 +1,42 @@
+#ifndef _HOST_DELTA_ENCODE_H_
+#define _HOST_DELTA_ENCODE_H_
+
+/**
+ * Encoder of the cl_delta patches the lock applies, see src/cl_delta.h for the format.
+ *
+ * The delta follows bsdiff: matches between the images are found through a hash of every 8-byte string of the source,
+ * then stretched over the bytes around them that differ a little, as the addresses moved by a build do, and encoded
+ * as bytes to add. The rest goes as bytes to copy. The delta is then compressed with LZSS, hash chains and a lazy
+ * match.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * What went into a patch.
+ */
+typedef struct
+{
+	uint32_t records;		//!< Records of the delta
+	size_t added;				//!< Image bytes rebuilt by adding to the source
+	size_t copied;			//!< Image bytes carried as they are
+	size_t delta_len;		//!< Delta before compression
+	size_t patch_len;		//!< Patch, header included
+	uint32_t literals;	//!< LZSS literals
+	uint32_t matches;		//!< LZSS matches
+} delta_encode_stats_t;
+
+/**
+ * Make the patch rebuilding target from source.
+ *
+ * @param window_bits LZSS window of the patch, CL_DELTA_WINDOW_BITS_MIN to CL_DELTA_WINDOW_BITS_MAX: the lock
+ * allocates 2^window_bits bytes to decode it.
+ * @param stats Set to what went into the patch, may be NULL.
+ *
+ * @return The patch, stats->patch_len bytes, to free(). NULL if out of memory or window_bits out of range.
+ */
+extern uint8_t *delta_encode(const uint8_t *source, size_t source_size, const uint8_t *target, size_t target_size,
+														 int window_bits, delta_encode_stats_t *stats);
+
+#endif // _HOST_DELTA_ENCODE_H_
@@ -0,0 +1,165 @@
+// Library
+#include <stdio.h>
+#include <stdlib.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "nvs.h"
+// Local
+#include "check.h"
+#include "cl_gpio_hub.h"
+#include "cl_phy_lock_svc.h"
+
+/**
+ * State machine dispatch benchmark.
+ *
+ * Feeds events straight into cl_phy_lock_svc_dispatch, without the GPIO task or the GATT layer in between,
+ * and reports the cost per dispatch for rejected events (table lookup only, on the lock task where events apply
+ * in place) and for a full claim/release cycle, dispatched from this thread and including the in-memory NVS commits
+ * of the persistence worker. It also reports the round trip of an event from another task and the cost of a status
+ * read.
+ *
+ * Usage: dispatch_bench [iterations]
+ */
+
+static void dispatch(cl_phy_lock_event_type_t type, const uint8_t *uuid, esp_err_t expected)
+{
+	cl_phy_lock_event_t event = {
+			.type = type,
+			.uuid = uuid,
+	};
+	esp_err_t ret = cl_phy_lock_svc_dispatch(&event);
+	if (ret != expected)
+	{
+		fprintf(stderr, "event %d: expected %d, got %d in state %d\n", type, expected, ret, cl_phy_lock_svc_get_state());
+		exit(1);
+	}
+}
+
+static const uint8_t owner[16] = {0xc1, 0xa1, 0x00, 0x80, 0x00, 0x40, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+static uint32_t iterations;
+static double reject_ns;
+
+/**
+ * The rejected events loop, run on the lock task.
+ */
+static void bench_on_lock_task(void *arg)
+{
+	(void)arg;
+
+	// rejected events: claimed lock receiving claims
+	dispatch(PHY_LOCK_EVENT_REQUEST_CLAIM, owner, ESP_OK);
+	dispatch(PHY_LOCK_EVENT_SENSOR_CLOSED, NULL, ESP_OK);
+	double start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		dispatch(PHY_LOCK_EVENT_REQUEST_CLAIM, owner, ESP_ERR_INVALID_STATE);
+	}
+	reject_ns = (now_ns() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+	host_nvs_reset();
+	host_gpio_reset();
+	gpio_install_isr_service(0);
+	cl_gpio_hub_init();
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, PHY_LOCK_POSITION_CLOSED);
+	if (cl_phy_lock_svc_init() != ESP_OK || cl_phy_lock_svc_start() != ESP_OK)
+	{
+		fprintf(stderr, "lock init failed\n");
+		return 1;
+	}
+	host_rtos_wait_idle();
+
+	if (cl_phy_lock_svc_run(bench_on_lock_task, NULL) != ESP_OK)
+	{
+		fprintf(stderr, "lock task unavailable\n");
+		return 1;
+	}
+	host_rtos_wait_idle();
+
+	// the commits complete on the persistence worker, wait for it before the next request
+	dispatch(PHY_LOCK_EVENT_REQUEST_RELEASE, owner, ESP_OK);
+	dispatch(PHY_LOCK_EVENT_SENSOR_OPEN, NULL, ESP_OK);
+	host_rtos_wait_idle();
+
+	// full cycles: claim, commit, tamper, release, commit
+	uint32_t cycles = iterations / 100 > 0 ? iterations / 100 : 1;
+	double start = now_ns();
+	for (uint32_t i = 0; i < cycles; i++)
+	{
+		dispatch(PHY_LOCK_EVENT_REQUEST_CLAIM, owner, ESP_OK);
+		dispatch(PHY_LOCK_EVENT_SENSOR_CLOSED, NULL, ESP_OK);
+		host_rtos_wait_idle();
+		dispatch(PHY_LOCK_EVENT_SENSOR_OPEN, NULL, ESP_OK);
+		dispatch(PHY_LOCK_EVENT_SENSOR_CLOSED, NULL, ESP_OK);
+		dispatch(PHY_LOCK_EVENT_REQUEST_RELEASE, owner, ESP_OK);
+		dispatch(PHY_LOCK_EVENT_SENSOR_OPEN, NULL, ESP_OK);
+		host_rtos_wait_idle();
+	}
+	double cycle_ns = (now_ns() - start) / cycles;
+	if (cl_phy_lock_svc_get_state() != PHY_LOCK_STATE_UNCLAIMED)
+	{
+		fprintf(stderr, "cycles ended in state %d\n", cl_phy_lock_svc_get_state());
+		return 1;
+	}
+
+	// a claim that fails to commit stays pending and says so in the status, until one goes through
+	cl_phy_lock_status_t status;
+	dispatch(PHY_LOCK_EVENT_REQUEST_CLAIM, owner, ESP_OK);
+	host_rtos_wait_idle();
+	host_nvs_fail_writes(1, ESP_FAIL);
+	dispatch(PHY_LOCK_EVENT_SENSOR_CLOSED, NULL, ESP_OK);
+	host_rtos_wait_idle();
+	cl_phy_lock_svc_get_status(&status);
+	if (status.state != PHY_LOCK_STATE_REQUESTED_CLAIM || !status.commit_failed)
+	{
+		fprintf(stderr, "failed commit left state %d, commit_failed %d\n", status.state, status.commit_failed);
+		return 1;
+	}
+	dispatch(PHY_LOCK_EVENT_SENSOR_OPEN, NULL, ESP_OK);
+	dispatch(PHY_LOCK_EVENT_SENSOR_CLOSED, NULL, ESP_OK);
+	host_rtos_wait_idle();
+	cl_phy_lock_svc_get_status(&status);
+	if (status.state != PHY_LOCK_STATE_CLAIMED || status.commit_failed)
+	{
+		fprintf(stderr, "retried commit left state %d, commit_failed %d\n", status.state, status.commit_failed);
+		return 1;
+	}
+	dispatch(PHY_LOCK_EVENT_REQUEST_RELEASE, owner, ESP_OK);
+	dispatch(PHY_LOCK_EVENT_SENSOR_OPEN, NULL, ESP_OK);
+	host_rtos_wait_idle();
+
+	// round trips from this thread to the lock task, a thread handoff each way on the host
+	uint32_t round_trips = iterations / 100 > 0 ? iterations / 100 : 1;
+	start = now_ns();
+	for (uint32_t i = 0; i < round_trips; i++)
+	{
+		dispatch(PHY_LOCK_EVENT_REQUEST_RELEASE, owner, ESP_ERR_INVALID_STATE);
+	}
+	double round_trip_ns = (now_ns() - start) / round_trips;
+
+	// status reads never wait for the lock task
+	uint32_t states = 0;
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		cl_phy_lock_svc_get_status(&status);
+		states += status.state;
+	}
+	double read_ns = (now_ns() - start) / iterations;
+	if (states != iterations * PHY_LOCK_STATE_UNCLAIMED)
+	{
+		fprintf(stderr, "unexpected state read\n");
+		return 1;
+	}
+
+	printf("rejected event: %.1f ns/dispatch (%u dispatches)\n", reject_ns, (unsigned)iterations);
+	printf("claim/tamper/release cycle: %.1f ns/cycle, %.1f ns/dispatch (%u cycles)\n", cycle_ns, cycle_ns / 6, (unsigned)cycles);
+	printf("dispatch from another task: %.1f ns/round trip (%u round trips)\n", round_trip_ns, (unsigned)round_trips);
+	printf("status snapshot read: %.1f ns/read (%u reads)\n", read_ns, (unsigned)iterations);
+	return 0;
+}
@@ -0,0 +1,126 @@
+// Library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "esp_log.h"
+// Local
+#include "check.h"
+#include "lazy_log.h"
+#include "stringify.h"
+
+/**
+ * UUID/address formatting benchmark.
+ *
+ * Compares the lookup-table formatters of stringify.h with the sprintf statement expressions they replaced
+ * (kept below), and the cost of a filtered out log line: ESP-IDF evaluates the ESP_LOGx arguments before its
+ * runtime level check, so the eager case formats the UUID and drops it, while LAZY_LOGx skips the formatting.
+ *
+ * Usage: format_bench [iterations]
+ */
+
+#define UUID_SAMPLES 64
+
+// the previous macros, returning a buffer out of its scope
+#define LEGACY_UUID_TO_STRING(uuid, uuid_str)                                             \
+	sprintf(uuid_str,                                                                       \
+					"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",         \
+					uuid[15], uuid[14], uuid[13], uuid[12], uuid[11], uuid[10], uuid[9], uuid[8],   \
+					uuid[7], uuid[6], uuid[5], uuid[4], uuid[3], uuid[2], uuid[1], uuid[0])
+
+#define LEGACY_ADDR_TO_STRING(addr, addr_str) \
+	sprintf(addr_str, "%02X:%02X:%02X:%02X:%02X:%02X", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0])
+
+static const char *LOG_TAG = "bench";
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+	uint8_t uuids[UUID_SAMPLES][16];
+	srand(42);
+	for (int i = 0; i < UUID_SAMPLES; i++)
+	{
+		for (int b = 0; b < 16; b++)
+		{
+			uuids[i][b] = rand();
+		}
+	}
+
+	// same output as before
+	for (int i = 0; i < UUID_SAMPLES; i++)
+	{
+		char legacy[UUID_STR_LEN], formatted[UUID_STR_LEN];
+		LEGACY_UUID_TO_STRING(uuids[i], legacy);
+		if (strcmp(legacy, uuid_to_str(uuids[i], formatted)) != 0)
+		{
+			fprintf(stderr, "uuid mismatch: %s != %s\n", legacy, formatted);
+			return 1;
+		}
+		char legacy_addr[ADDR_STR_LEN], formatted_addr[ADDR_STR_LEN];
+		LEGACY_ADDR_TO_STRING(uuids[i], legacy_addr);
+		if (strcmp(legacy_addr, addr_to_str(uuids[i], formatted_addr)) != 0)
+		{
+			fprintf(stderr, "addr mismatch: %s != %s\n", legacy_addr, formatted_addr);
+			return 1;
+		}
+	}
+
+	volatile char sink = 0;
+	char buf[UUID_STR_LEN];
+
+	double start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		LEGACY_UUID_TO_STRING(uuids[i % UUID_SAMPLES], buf);
+		sink ^= buf[i % 36];
+	}
+	double legacy_uuid_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		uuid_to_str(uuids[i % UUID_SAMPLES], buf);
+		sink ^= buf[i % 36];
+	}
+	double uuid_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		LEGACY_ADDR_TO_STRING(uuids[i % UUID_SAMPLES], buf);
+		sink ^= buf[i % 17];
+	}
+	double legacy_addr_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		addr_to_str(uuids[i % UUID_SAMPLES], buf);
+		sink ^= buf[i % 17];
+	}
+	double addr_ns = (now_ns() - start) / iterations;
+
+	// filtered out debug lines, as in the lock hot paths with the default INFO level
+	esp_log_level_set("*", ESP_LOG_INFO);
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		LEGACY_UUID_TO_STRING(uuids[i % UUID_SAMPLES], buf);
+		ESP_LOGD(LOG_TAG, "owner: %s", buf);
+		sink ^= buf[i % 36];
+	}
+	double eager_log_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		LAZY_LOGD(LOG_TAG, "owner: %s", UUID_TO_STRING(uuids[i % UUID_SAMPLES]));
+	}
+	double lazy_log_ns = (now_ns() - start) / iterations;
+
+	printf("uuid sprintf: %.1f ns, table: %.1f ns (%.1fx)\n", legacy_uuid_ns, uuid_ns, uuid_ns > 0 ? legacy_uuid_ns / uuid_ns : 0);
+	printf("addr sprintf: %.1f ns, table: %.1f ns (%.1fx)\n", legacy_addr_ns, addr_ns, addr_ns > 0 ? legacy_addr_ns / addr_ns : 0);
+	printf("filtered log eager: %.1f ns, lazy: %.1f ns (%u iterations)\n", eager_log_ns, lazy_log_ns, (unsigned)iterations);
+	return 0;
+}
@@ -0,0 +1,235 @@
+// Library
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+// Local
+#include "check.h"
+#include "cl_journal.h"
+
+/**
+ * Journal recovery test.
+ *
+ * Appends records past a wrap of the ring, then restarts the journal over flash left as a reset would leave it: a
+ * sector erased before its first record, a record failing its CRC, a record torn halfway. Each restart must find the
+ * newest and oldest records kept in a number of reads logarithmic in the partition, and cursors must read the records
+ * in order and without gaps from any sequence number, in as few reads.
+ *
+ * Usage: journal_test [log level 0-5]
+ */
+
+#define SLOTS_PER_SECTOR (CL_JOURNAL_SECTOR_SIZE / sizeof(cl_journal_record_t))
+#define SECTORS (HOST_PARTITION_SPIFFS_SIZE / CL_JOURNAL_SECTOR_SIZE)
+#define SLOTS (SECTORS * SLOTS_PER_SECTOR)
+#define READ_CHUNK 64
+
+/**
+ * The records a cursor read from the oldest one on.
+ */
+typedef struct
+{
+	uint32_t first;
+	uint32_t last;
+	uint32_t count;
+} span_t;
+
+static const esp_partition_t *partition;
+static uint32_t appended = 0; //!< Sequence number of the last record appended
+static uint32_t max_reads = 0;
+
+static uint32_t log2_ceil(uint32_t n)
+{
+	uint32_t bits = 0;
+	while ((1u << bits) < n)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+static void append(uint32_t count)
+{
+	static const uint8_t owner[16] = {0x10, 0x0c};
+	for (uint32_t i = 0; i < count; i++)
+	{
+		CHECK(cl_journal_append(CL_JOURNAL_EVENT_CLAIMED, owner, 2) == ESP_OK, "append %" PRIu32 " dropped", appended + 1);
+		appended++;
+		if (i % (CL_JOURNAL_QUEUE_LEN / 2) == 0)
+		{
+			host_rtos_wait_idle();
+		}
+	}
+	host_rtos_wait_idle();
+}
+
+/**
+ * Stop the journal and start it again over the partition, as a reset does.
+ *
+ * @return The records read to recover the ring.
+ */
+static uint32_t restart(const char *what)
+{
+	CHECK(cl_journal_deinit() == ESP_OK, "%s: deinit", what);
+	CHECK(cl_journal_init() == ESP_OK, "%s: init", what);
+	cl_journal_stats_t stats;
+	cl_journal_get_stats(&stats);
+	CHECK(stats.recovery_reads <= max_reads, "%s: recovered in %" PRIu32 " reads, more than %" PRIu32, what,
+				stats.recovery_reads, max_reads);
+	return stats.recovery_reads;
+}
+
+/**
+ * Read the whole journal with a cursor, checking the records follow each other.
+ */
+static span_t read_all(const char *what)
+{
+	span_t span = {0};
+	cl_journal_cursor_t cursor;
+	cl_journal_cursor_init(&cursor, 0);
+	cl_journal_record_t records[READ_CHUNK];
+	size_t count;
+	do
+	{
+		CHECK(cl_journal_read(&cursor, records, READ_CHUNK, &count) == ESP_OK, "%s: read", what);
+		for (size_t i = 0; i < count; i++)
+		{
+			CHECK(span.count == 0 || records[i].seq == span.last + 1, "%s: seq %" PRIu32 " after %" PRIu32, what,
+						records[i].seq, span.last);
+			span.first = span.count == 0 ? records[i].seq : span.first;
+			span.last = records[i].seq;
+			span.count++;
+		}
+	} while (count > 0);
+	return span;
+}
+
+/**
+ * Slot of a record, as long as every record before it was written whole.
+ */
+static uint32_t slot_of(uint32_t seq)
+{
+	return (seq - 1) % SLOTS;
+}
+
+/**
+ * Read from a sequence number on with a new cursor, counting the flash reads it takes.
+ */
+static void check_cursor(uint32_t seq, uint32_t expected, uint32_t max, const char *what)
+{
+	cl_journal_cursor_t cursor;
+	cl_journal_cursor_init(&cursor, seq);
+	cl_journal_record_t records[2];
+	size_t count;
+	host_partition_stats_t before, after;
+	host_partition_get_stats(&before);
+	CHECK(cl_journal_read(&cursor, records, 2, &count) == ESP_OK, "%s: read", what);
+	host_partition_get_stats(&after);
+	CHECK(count == 2 && records[0].seq == expected && records[1].seq == expected + 1,
+				"%s: read %zu records from %" PRIu32 " on", what, count, count > 0 ? records[0].seq : 0);
+	CHECK(after.reads - before.reads <= max, "%s: %" PRIu32 " reads, more than %" PRIu32, what,
+				after.reads - before.reads, max);
+	CHECK(cursor.seq == expected + 2, "%s: cursor at %" PRIu32, what, cursor.seq);
+}
+
+int main(int argc, char **argv)
+{
+	esp_log_level_set("*", argc > 1 ? (esp_log_level_t)atoi(argv[1]) : ESP_LOG_WARN);
+	host_partition_reset();
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CL_JOURNAL_PARTITION);
+	CHECK(partition != NULL, "no journal partition");
+	// a binary search over the sectors then over the slots of the head sector, and the sectors around the head
+	max_reads = log2_ceil(SECTORS) + log2_ceil(SLOTS_PER_SECTOR) + 8;
+
+	CHECK(cl_journal_init() == ESP_OK, "init on erased flash");
+	span_t span = read_all("empty");
+	CHECK(span.count == 0, "empty journal holds %" PRIu32 " records", span.count);
+
+	// before the wrap, every record is kept
+	append(SLOTS / 2);
+	uint32_t reads = restart("half full");
+	span = read_all("half full");
+	CHECK(span.first == 1 && span.last == appended, "half full: %" PRIu32 "-%" PRIu32, span.first, span.last);
+	printf("half full: %" PRIu32 " records recovered in %" PRIu32 " reads\n", span.count, reads);
+
+	// past the wrap, the head sector drops the oldest records of the sector after it
+	append(SLOTS / 2 + SLOTS_PER_SECTOR + 100);
+	reads = restart("wrapped");
+	span = read_all("wrapped");
+	uint32_t head_sector = slot_of(appended) / SLOTS_PER_SECTOR;
+	uint32_t tail_first = (appended / SLOTS - 1) * SLOTS + (head_sector + 1) * SLOTS_PER_SECTOR + 1;
+	CHECK(span.first == tail_first && span.last == appended, "wrapped: %" PRIu32 "-%" PRIu32 ", expected %" PRIu32
+				"-%" PRIu32, span.first, span.last, tail_first, appended);
+	printf("wrapped: %" PRIu32 "-%" PRIu32 " recovered in %" PRIu32 " reads\n", span.first, span.last, reads);
+
+	// reset once the next sector is erased, before its first record: the oldest records are gone with it
+	append(SLOTS_PER_SECTOR - slot_of(appended + 1) % SLOTS_PER_SECTOR);
+	uint32_t next_sector = slot_of(appended + 1) / SLOTS_PER_SECTOR;
+	CHECK(esp_partition_erase_range(partition, next_sector * CL_JOURNAL_SECTOR_SIZE, CL_JOURNAL_SECTOR_SIZE) == ESP_OK,
+				"erase");
+	reads = restart("erased sector");
+	span = read_all("erased sector");
+	tail_first = appended - (SECTORS - 1) * SLOTS_PER_SECTOR + 1;
+	CHECK(span.first == tail_first && span.last == appended, "erased sector: %" PRIu32 "-%" PRIu32 ", expected %" PRIu32
+				"-%" PRIu32, span.first, span.last, tail_first, appended);
+	printf("erased sector: %" PRIu32 "-%" PRIu32 " recovered in %" PRIu32 " reads\n", span.first, span.last, reads);
+
+	// a record failing its CRC is skipped, its sequence number goes to the next one
+	append(10);
+	uint16_t bad_crc = 0;
+	CHECK(esp_partition_write(partition, slot_of(appended) * sizeof(cl_journal_record_t) + offsetof(cl_journal_record_t, crc),
+														&bad_crc, sizeof(bad_crc)) == ESP_OK,
+				"corrupt");
+	reads = restart("corrupt record");
+	span = read_all("corrupt record");
+	CHECK(span.first == tail_first && span.last == appended - 1, "corrupt record: %" PRIu32 "-%" PRIu32, span.first,
+				span.last);
+	appended--;
+	append(1);
+	restart("after corrupt record");
+	span = read_all("after corrupt record");
+	CHECK(span.last == appended, "after corrupt record: ends at %" PRIu32 " of %" PRIu32, span.last, appended);
+	printf("corrupt record: skipped, recovered in %" PRIu32 " reads\n", reads);
+
+	// a record torn by a reset while it was written, in a sector written again with the torn record's first half
+	append(20);
+	uint32_t torn = slot_of(appended) + 1; // the corrupt record holds a slot
+	uint32_t sector = torn / SLOTS_PER_SECTOR;
+	static uint8_t data[CL_JOURNAL_SECTOR_SIZE];
+	CHECK(esp_partition_read(partition, sector * CL_JOURNAL_SECTOR_SIZE, data, sizeof(data)) == ESP_OK, "read");
+	cl_journal_record_t *record = (cl_journal_record_t *)&data[torn % SLOTS_PER_SECTOR * sizeof(cl_journal_record_t)];
+	CHECK(record->seq == appended, "slot %" PRIu32 " holds %" PRIu32 ", not %" PRIu32, torn, record->seq, appended);
+	memset((uint8_t *)record + sizeof(*record) / 2, 0xFF, sizeof(*record) / 2);
+	CHECK(esp_partition_erase_range(partition, sector * CL_JOURNAL_SECTOR_SIZE, CL_JOURNAL_SECTOR_SIZE) == ESP_OK &&
+						esp_partition_write(partition, sector * CL_JOURNAL_SECTOR_SIZE, data, sizeof(data)) == ESP_OK,
+				"tear");
+	reads = restart("torn record");
+	span = read_all("torn record");
+	CHECK(span.first == tail_first && span.last == appended - 1, "torn record: %" PRIu32 "-%" PRIu32, span.first,
+				span.last);
+	appended--;
+	append(1);
+	restart("after torn record");
+	span = read_all("after torn record");
+	CHECK(span.first == tail_first && span.last == appended, "after torn record: %" PRIu32 "-%" PRIu32, span.first,
+				span.last);
+	printf("torn record: skipped, recovered in %" PRIu32 " reads\n", reads);
+
+	// cursors find any record by binary search, an overwritten one gives the oldest kept: the search over the slots
+	// also tells the end of the sector, then the records are read, one more for a record skipped
+	uint32_t max_cursor_reads = log2_ceil(SECTORS) + log2_ceil(SLOTS_PER_SECTOR + 1) + 2;
+	check_cursor(tail_first + SLOTS / 3, tail_first + SLOTS / 3, max_cursor_reads, "middle");
+	check_cursor(appended - 1, appended - 1, max_cursor_reads, "newest");
+	check_cursor(tail_first - 100, tail_first, max_cursor_reads, "overwritten");
+	check_cursor(appended - 21, appended - 21, max_cursor_reads, "across the corrupt record");
+
+	cl_journal_stats_t stats;
+	cl_journal_get_stats(&stats);
+	CHECK(stats.dropped == 0 && stats.failures == 0, "journal lost records");
+	printf("journal: %d sectors of %d records, recovery within %" PRIu32 " reads, cursors within %" PRIu32 "\n",
+				 (int)SECTORS, (int)SLOTS_PER_SECTOR, max_reads, max_cursor_reads);
+	return 0;
+}
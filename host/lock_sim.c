@@ -0,0 +1,685 @@
+// Library
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "nvs.h"
+#include "host/ble_hs.h"
+// Local
+#include "check.h"
+#include "cl_ble_adv.h"
+#include "cl_ble_bond.h"
+#include "cl_ble_broadcast.h"
+#include "cl_ble_conn.h"
+#include "cl_ble_svc.h"
+#include "cl_gpio_hub.h"
+#include "cl_journal.h"
+#include "cl_persist.h"
+#include "cl_phy_lock_svc.h"
+#include "cl_power.h"
+#include "gatts/cl_ble_lock_cmd.h"
+#include "gatts/cl_ble_lock_svc.h"
+#include "siphash.h"
+
+/**
+ * Lock core simulation.
+ *
+ * Drives the lock service through claim, tamper and release cycles the way a central and the physical bolt would:
+ * requests are written through the GATT access callbacks and the bolt is moved by driving the lock sensor pin.
+ * Every transition is checked against the expected state and the run fails on the first mismatch.
+ * The owner reconnects before every release, bonded phones resume encryption while strangers pair and push the
+ * least recently used bond out of the store.
+ * Every fourth cycle claims and releases through the command characteristic instead, confirming each request with a
+ * status request of the same batch.
+ *
+ * Usage: lock_sim [cycles] [log level 0-5]
+ */
+
+#define SETTLE_MS 250 //!< Simulated time given to the lock after every bolt movement, above the debounce window
+#define BOUNCE_EDGES 6 //!< Contact bounces simulated before the bolt settles
+#define BOUNCE_MS 1		 //!< Time between two bounces
+#define GLITCH_MS 20	 //!< Length of a spurious pulse, below the debounce window
+#define ENCRYPT_MS 30	 //!< Time to encrypt a connection with the stored keys
+#define PAIR_MS 600		 //!< Time of a full LE Secure Connections pairing, user confirmation included
+
+// -- CHARACTERISTICS --
+extern const ble_uuid128_t cl_ble_lock_svc_state_char_uuid;
+extern const ble_uuid128_t cl_ble_lock_svc_req_claim_char_uuid;
+extern const ble_uuid128_t cl_ble_lock_svc_req_release_char_uuid;
+extern const ble_uuid128_t cl_ble_lock_svc_cmd_char_uuid;
+extern const ble_uuid128_t cl_ble_lock_svc_rsp_char_uuid;
+
+static const struct ble_gatt_chr_def *state_chr;
+static const struct ble_gatt_chr_def *claim_chr;
+static const struct ble_gatt_chr_def *release_chr;
+static const struct ble_gatt_chr_def *cmd_chr;
+static const struct ble_gatt_chr_def *rsp_chr;
+
+#define SUBSCRIBER_CONN 1 //!< Connection subscribed to the state notifications
+#define OWNER_CONN 2			//!< Connection of the owner, reconnected before every release
+
+static const ble_addr_t subscriber_addr = {.type = BLE_ADDR_RANDOM, .val = {0x00, 0x00, 0x00, 0x00, 0x00, 0xc0}};
+
+static const uint8_t broadcast_key[CL_BLE_BROADCAST_KEY_LEN] = {0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08,
+																																	0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00};
+static uint32_t broadcast_counter = 0; //!< Counter of the last status frame seen by the gateway
+static uint32_t broadcast_frames = 0;	 //!< Distinct status frames seen by the gateway
+
+static uint8_t cmd_rsp[CL_LOCK_CMD_MAX_RESPONSE]; //!< Command responses notified since the last command
+static uint16_t cmd_rsp_len = 0;
+static uint32_t cmd_rsp_notifications = 0; //!< Notifications carrying them
+
+static uint32_t notifications = 0;										 //!< State notifications received by the subscriber
+static uint8_t notified_state = PHY_LOCK_STATE_UNKNOWN; //!< Last state notified to the subscriber
+
+/**
+ * The state advertised in the lock frame of the manufacturer data.
+ */
+static uint8_t advertised_state(void)
+{
+	host_ble_adv_t adv;
+	host_ble_get_adv(&adv);
+	// flags, then the manufacturer data: company identifier and the lock frame
+	const uint8_t *mfg = &adv.data[3];
+	CHECK(adv.data_len == 3 + 4 + sizeof(cl_ble_adv_lock_frame_t) && mfg[1] == BLE_HS_ADV_TYPE_MFG_DATA,
+				"unexpected advertisement; len=%d", adv.data_len);
+	const cl_ble_adv_lock_frame_t *frame = (const cl_ble_adv_lock_frame_t *)&mfg[4];
+	CHECK(frame->frame == CL_BLE_ADV_FRAME_LOCK && memcmp(frame->svc_uuid, cl_ble_lock_svc_uuid.value, 16) == 0,
+				"advertisement without the lock frame");
+	return frame->state;
+}
+
+/**
+ * The status frame broadcast in the scan response, as a gateway would accept it: signed with the fleet key and
+ * never older than the last one seen.
+ */
+static cl_ble_broadcast_frame_t broadcast_status(void)
+{
+	host_ble_adv_t adv;
+	host_ble_get_adv(&adv);
+	cl_ble_broadcast_frame_t frame;
+	CHECK(adv.rsp_data_len == 4 + sizeof(frame) && adv.rsp_data[1] == BLE_HS_ADV_TYPE_MFG_DATA && adv.rsp_data[4] == CL_BLE_ADV_FRAME_STATUS,
+				"scan response without the status frame; len=%d", adv.rsp_data_len);
+	memcpy(&frame, &adv.rsp_data[4], sizeof(frame));
+	uint64_t mac = siphash24(broadcast_key, &frame, offsetof(cl_ble_broadcast_frame_t, mac));
+	CHECK(memcmp(frame.mac, &mac, sizeof(frame.mac)) == 0, "status frame with a bad signature");
+	CHECK(frame.counter >= broadcast_counter, "status frame replayed; counter=%" PRIu32 " last=%" PRIu32, frame.counter, broadcast_counter);
+	if (frame.counter != broadcast_counter)
+	{
+		broadcast_counter = frame.counter;
+		broadcast_frames++;
+	}
+	return frame;
+}
+
+static uint8_t read_state(void)
+{
+	uint8_t state = PHY_LOCK_STATE_UNKNOWN;
+	uint16_t len = sizeof(state);
+	int ret = host_ble_gatt_read(1, state_chr, &state, &len);
+	CHECK(ret == 0 && len == 1, "state read failed; ret=%d len=%d", ret, len);
+	// the subscriber must never lag behind a read
+	CHECK(notified_state == state, "notified state %d, read %d", notified_state, state);
+	// and neither must the advertisement
+	CHECK(advertised_state() == state, "advertised state %d, read %d", advertised_state(), state);
+	// nor the broadcast
+	CHECK(broadcast_status().state == state, "broadcast state %d, read %d", broadcast_status().state, state);
+	return state;
+}
+
+static void on_notify(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, uint16_t len)
+{
+	if (conn_handle == SUBSCRIBER_CONN && attr_handle == *state_chr->val_handle && len == 1)
+	{
+		notifications++;
+		notified_state = data[0];
+	}
+	else if (attr_handle == *rsp_chr->val_handle)
+	{
+		CHECK(cmd_rsp_len + len <= sizeof(cmd_rsp), "too many command responses");
+		memcpy(&cmd_rsp[cmd_rsp_len], data, len);
+		cmd_rsp_len += len;
+		cmd_rsp_notifications++;
+	}
+}
+
+/**
+ * Reconnect the owner connection. Two phones come back in turn, but every eighth cycle a stranger pairs instead
+ * and, four cycles later, a bonded phone that lost its keys pairs again.
+ */
+static void reconnect_owner(uint32_t cycle)
+{
+	ble_addr_t peer = {.type = BLE_ADDR_RANDOM, .val = {0x01 + (cycle & 1), 0x00, 0x00, 0x00, 0x00, 0xc0}};
+	if (cycle % 8 == 7)
+	{
+		peer.val[0] = 0x10;
+		memcpy(&peer.val[1], &cycle, sizeof(cycle));
+	}
+
+	host_ble_disconnect(OWNER_CONN);
+	host_rtos_wait_idle();
+	host_ble_connect(OWNER_CONN, &peer);
+	if (host_ble_security_initiated(OWNER_CONN) && cycle % 8 != 3)
+	{
+		CHECK(host_ble_resume_encryption(OWNER_CONN) == 0, "cycle %u: encryption not resumed", (unsigned)cycle);
+		host_rtos_advance_ms(ENCRYPT_MS);
+	}
+	else
+	{
+		CHECK(host_ble_pair(OWNER_CONN) == 0, "cycle %u: pairing failed", (unsigned)cycle);
+		host_rtos_advance_ms(PAIR_MS);
+	}
+
+	// the request must go out on the fast parameters and fit in one PDU
+	cl_ble_conn_info_t info;
+	CHECK(cl_ble_conn_get_info(OWNER_CONN, &info) == ESP_OK, "cycle %u: owner connection unknown", (unsigned)cycle);
+	CHECK(info.phase == CL_BLE_CONN_PHASE_FAST && info.itvl <= CL_BLE_CONN_FAST_ITVL_MAX && info.mtu == HOST_BLE_CENTRAL_MTU,
+				"cycle %u: owner not fast; phase=%d itvl=%d mtu=%d", (unsigned)cycle, info.phase, info.itvl, info.mtu);
+}
+
+/**
+ * Check that a connection relaxed once the lock moved.
+ */
+static void check_idle(uint16_t conn_handle, uint32_t cycle)
+{
+	cl_ble_conn_info_t info;
+	CHECK(cl_ble_conn_get_info(conn_handle, &info) == ESP_OK, "cycle %u: connection %d unknown", (unsigned)cycle, conn_handle);
+	CHECK(info.phase == CL_BLE_CONN_PHASE_IDLE && info.itvl >= CL_BLE_CONN_IDLE_ITVL_MIN && info.latency == CL_BLE_CONN_IDLE_LATENCY,
+				"cycle %u: connection %d not idle; phase=%d itvl=%d latency=%d", (unsigned)cycle, conn_handle, info.phase, info.itvl, info.latency);
+}
+
+static void subscribe(uint16_t conn_handle)
+{
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_SUBSCRIBE,
+			.subscribe = {
+					.conn_handle = conn_handle,
+					.attr_handle = *state_chr->val_handle,
+					.reason = BLE_GAP_SUBSCRIBE_REASON_WRITE,
+					.cur_notify = 1,
+			},
+	};
+	ble_gap_event(&event, NULL);
+	host_rtos_wait_idle();
+}
+
+static void move_bolt(uint8_t position)
+{
+	// the contact bounces before settling, only the final level must reach the lock
+	for (int i = 0; i < BOUNCE_EDGES; i++)
+	{
+		host_gpio_drive(LOCK_SENSOR_IN_PIN, (i & 1) ? !position : position);
+		host_rtos_advance_ms(BOUNCE_MS);
+	}
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, position);
+	host_rtos_advance_ms(SETTLE_MS);
+}
+
+static void glitch_bolt(uint8_t position)
+{
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, position);
+	host_rtos_advance_ms(GLITCH_MS);
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, !position);
+	host_rtos_advance_ms(SETTLE_MS);
+}
+
+static int write_uuid(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, const char *uuid)
+{
+	int ret = host_ble_gatt_write(conn_handle, chr, uuid, strlen(uuid));
+	host_rtos_wait_idle();
+	return ret;
+}
+
+static int write_uuid_bytes(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, const uint8_t *uuid)
+{
+	int ret = host_ble_gatt_write(conn_handle, chr, uuid, 16);
+	host_rtos_wait_idle();
+	return ret;
+}
+
+/**
+ * The binary form of a UUID string, in the little-endian order expected by the characteristics.
+ */
+/**
+ * Read the first descriptor of a characteristic.
+ */
+static uint16_t read_desc(const struct ble_gatt_chr_def *chr, char *out, uint16_t out_len)
+{
+	CHECK(chr->descriptors != NULL && chr->descriptors[0].access_cb != NULL, "characteristic without descriptor");
+	struct os_mbuf *om = ble_hs_mbuf_from_flat(NULL, 0);
+	struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_READ_DSC, .om = om};
+	CHECK(chr->descriptors[0].access_cb(0, 0, &ctxt, chr->descriptors[0].arg) == 0, "descriptor read failed");
+	uint16_t len = 0;
+	ble_hs_mbuf_to_flat(om, out, out_len - 1, &len);
+	os_mbuf_free_chain(om);
+	out[len] = '\0';
+	return len;
+}
+
+/**
+ * Write a batch of commands, the responses are collected in cmd_rsp.
+ */
+static int write_cmd(uint16_t conn_handle, const uint8_t *req, uint16_t len)
+{
+	cmd_rsp_len = 0;
+	cmd_rsp_notifications = 0;
+	int ret = host_ble_gatt_write(conn_handle, cmd_chr, req, len);
+	host_rtos_wait_idle();
+	return ret;
+}
+
+/**
+ * Write a request on the lock followed by a status request, the state of the status response is returned.
+ */
+static uint8_t write_cmd_confirmed(uint16_t conn_handle, uint8_t opcode, const uint8_t *uuid, uint8_t expected_status, uint32_t cycle)
+{
+	uint8_t req[2 * CL_LOCK_CMD_REQ_HEADER_LEN + 16] = {0x10, opcode, 16};
+	memcpy(&req[CL_LOCK_CMD_REQ_HEADER_LEN], uuid, 16);
+	req[CL_LOCK_CMD_REQ_HEADER_LEN + 16] = 0x11;
+	req[CL_LOCK_CMD_REQ_HEADER_LEN + 17] = CL_LOCK_CMD_OP_STATUS;
+	CHECK(write_cmd(conn_handle, req, sizeof(req)) == 0, "cycle %u: command batch rejected", (unsigned)cycle);
+
+	// one notification for both responses, the status only runs if the request succeeded
+	CHECK(cmd_rsp_notifications == 1 && cmd_rsp[0] == 0x10 && cmd_rsp[1] == opcode && cmd_rsp[2] == expected_status && cmd_rsp[3] == 0,
+				"cycle %u: unexpected response; notifications=%u status=%d", (unsigned)cycle, (unsigned)cmd_rsp_notifications, cmd_rsp[2]);
+	const uint8_t *status_rsp = &cmd_rsp[CL_LOCK_CMD_RSP_HEADER_LEN];
+	if (expected_status != CL_LOCK_CMD_OK)
+	{
+		CHECK(cmd_rsp_len == 2 * CL_LOCK_CMD_RSP_HEADER_LEN && status_rsp[0] == 0x11 && status_rsp[2] == CL_LOCK_CMD_ERR_ABORTED,
+					"cycle %u: status not aborted", (unsigned)cycle);
+		return PHY_LOCK_STATE_UNKNOWN;
+	}
+	CHECK(cmd_rsp_len == 2 * CL_LOCK_CMD_RSP_HEADER_LEN + sizeof(cl_lock_cmd_status_t) && status_rsp[0] == 0x11 &&
+						status_rsp[1] == CL_LOCK_CMD_OP_STATUS && status_rsp[2] == CL_LOCK_CMD_OK && status_rsp[3] == sizeof(cl_lock_cmd_status_t),
+				"cycle %u: unexpected status response", (unsigned)cycle);
+	return status_rsp[CL_LOCK_CMD_RSP_HEADER_LEN];
+}
+
+/**
+ * Malformed and unknown commands are answered with their error, a batch is split across notifications
+ * on a connection without a raised MTU.
+ */
+static void check_cmd_errors(void)
+{
+	const uint8_t truncated[] = {0x20, CL_LOCK_CMD_OP_CLAIM, 16, 0x00, 0x01};
+	CHECK(write_cmd(SUBSCRIBER_CONN, truncated, sizeof(truncated)) == 0 && cmd_rsp_len == CL_LOCK_CMD_RSP_HEADER_LEN &&
+						cmd_rsp[0] == 0x20 && cmd_rsp[2] == CL_LOCK_CMD_ERR_MALFORMED,
+				"truncated batch not rejected");
+
+	const uint8_t bad_payload[] = {0x21, CL_LOCK_CMD_OP_GET_LOG, 2, 0x01, 0x00, 0x22, 0x7f, 0};
+	CHECK(write_cmd(SUBSCRIBER_CONN, bad_payload, sizeof(bad_payload)) == 0 && cmd_rsp_len == 2 * CL_LOCK_CMD_RSP_HEADER_LEN &&
+						cmd_rsp[2] == CL_LOCK_CMD_ERR_MALFORMED && cmd_rsp[6] == CL_LOCK_CMD_ERR_ABORTED,
+				"malformed payload not reported");
+	const uint8_t unknown_only[] = {0x23, 0x7f, 0};
+	CHECK(write_cmd(SUBSCRIBER_CONN, unknown_only, sizeof(unknown_only)) == 0 && cmd_rsp[2] == CL_LOCK_CMD_ERR_OPCODE,
+				"unknown opcode not reported");
+
+	uint8_t statuses[(CL_LOCK_CMD_MAX_BATCH + 1) * CL_LOCK_CMD_REQ_HEADER_LEN] = {0};
+	for (int i = 0; i <= CL_LOCK_CMD_MAX_BATCH; i++)
+	{
+		statuses[i * CL_LOCK_CMD_REQ_HEADER_LEN] = 0x30 + i;
+		statuses[i * CL_LOCK_CMD_REQ_HEADER_LEN + 1] = CL_LOCK_CMD_OP_STATUS;
+	}
+	CHECK(write_cmd(SUBSCRIBER_CONN, statuses, sizeof(statuses)) == 0 && cmd_rsp_len == CL_LOCK_CMD_RSP_HEADER_LEN &&
+						cmd_rsp[2] == CL_LOCK_CMD_ERR_MALFORMED,
+				"oversized batch not rejected");
+
+	// 8 responses of 8 bytes in 20 byte notifications: 2 per notification
+	// straight to the access callback, past the ATT permissions: a connection the lock doesn't know has the default MTU
+	const uint16_t unknown_conn = 9;
+	struct os_mbuf *om = ble_hs_mbuf_from_flat(statuses, sizeof(statuses) - CL_LOCK_CMD_REQ_HEADER_LEN);
+	struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_WRITE_CHR, .om = om, .chr = cmd_chr};
+	cmd_rsp_len = 0;
+	cmd_rsp_notifications = 0;
+	int ret = cmd_chr->access_cb(unknown_conn, *cmd_chr->val_handle, &ctxt, cmd_chr->arg);
+	os_mbuf_free_chain(om);
+	host_rtos_wait_idle();
+	CHECK(ret == 0 && cmd_rsp_len == CL_LOCK_CMD_MAX_BATCH * (CL_LOCK_CMD_RSP_HEADER_LEN + sizeof(cl_lock_cmd_status_t)) &&
+						cmd_rsp_notifications == 4 && cmd_rsp[7 * 8] == 0x37,
+				"responses not split; len=%d notifications=%u", cmd_rsp_len, (unsigned)cmd_rsp_notifications);
+}
+
+/**
+ * GET_LOG answers with the latest records, or the ones from a sequence number on, within a single response.
+ *
+ * @param head_seq Sequence number the next record will get.
+ */
+static void check_get_log(uint32_t head_seq)
+{
+	const uint8_t latest[] = {0x40, CL_LOCK_CMD_OP_GET_LOG, 0};
+	CHECK(write_cmd(SUBSCRIBER_CONN, latest, sizeof(latest)) == 0 && cmd_rsp_notifications == 1 && cmd_rsp[2] == CL_LOCK_CMD_OK,
+				"latest records not read; status=%d", cmd_rsp[2]);
+	uint8_t expected = head_seq > CL_LOCK_CMD_LOG_RECORDS ? CL_LOCK_CMD_LOG_RECORDS : head_seq - 1;
+	cl_journal_record_t last;
+	memcpy(&last, &cmd_rsp[CL_LOCK_CMD_RSP_HEADER_LEN + cmd_rsp[3] - sizeof(last)], sizeof(last));
+	CHECK(cmd_rsp[3] == expected * sizeof(cl_journal_record_t) && last.seq == head_seq - 1,
+				"%u bytes of latest records, last seq %" PRIu32 " of %" PRIu32, cmd_rsp[3], last.seq, head_seq - 1);
+
+	uint8_t from[CL_LOCK_CMD_REQ_HEADER_LEN + sizeof(uint32_t)] = {0x41, CL_LOCK_CMD_OP_GET_LOG, sizeof(uint32_t)};
+	memcpy(&from[CL_LOCK_CMD_REQ_HEADER_LEN], &head_seq, sizeof(head_seq));
+	CHECK(write_cmd(SUBSCRIBER_CONN, from, sizeof(from)) == 0 && cmd_rsp[2] == CL_LOCK_CMD_OK && cmd_rsp[3] == 0,
+				"records past the head; len=%u", cmd_rsp[3]);
+	uint32_t seq = head_seq - 1;
+	memcpy(&from[CL_LOCK_CMD_REQ_HEADER_LEN], &seq, sizeof(seq));
+	CHECK(write_cmd(SUBSCRIBER_CONN, from, sizeof(from)) == 0 && cmd_rsp[2] == CL_LOCK_CMD_OK && cmd_rsp[3] == sizeof(last),
+				"last record not read; len=%u", cmd_rsp[3]);
+	memcpy(&last, &cmd_rsp[CL_LOCK_CMD_RSP_HEADER_LEN], sizeof(last));
+	CHECK(last.seq == seq, "read record %" PRIu32 " for %" PRIu32, last.seq, seq);
+}
+
+static void uuid_string_to_le(const char *uuid, uint8_t *bytes)
+{
+	int i = 15;
+	for (const char *c = uuid; *c != '\0' && i >= 0; c++)
+	{
+		if (*c == '-')
+		{
+			continue;
+		}
+		unsigned int byte;
+		sscanf(c, "%2x", &byte);
+		bytes[i--] = byte;
+		c++;
+	}
+}
+
+/**
+ * Handler of an input that is never served.
+ */
+static void unserved_input(const cl_gpio_event_t *event, void *arg)
+{
+	(void)arg;
+	CHECK(0, "event from an input that failed to be added; pin=%d", event->pin);
+}
+
+/**
+ * Account the power of each lock state, as main.c does.
+ */
+static void lock_state_changed(uint8_t state, void *arg)
+{
+	(void)arg;
+	cl_power_set_phase(state);
+}
+
+static void run_cycle(uint32_t cycle)
+{
+	char owner[BLE_UUID_STR_LEN];
+	char intruder[BLE_UUID_STR_LEN];
+	snprintf(owner, sizeof(owner), "%08x-0000-4000-8000-00000000c1a1", (unsigned)cycle);
+	snprintf(intruder, sizeof(intruder), "%08x-ffff-4fff-bfff-ffffffffffff", (unsigned)cycle);
+
+	// claim: the user opens the bolt and closes it again to commit the ownership
+	uint8_t owner_bytes[16];
+	uint8_t intruder_bytes[16];
+	uuid_string_to_le(owner, owner_bytes);
+	uuid_string_to_le(intruder, intruder_bytes);
+	int use_cmd = cycle % 4 == 0;
+	CHECK(read_state() == PHY_LOCK_STATE_UNCLAIMED, "cycle %u: not unclaimed", (unsigned)cycle);
+	if (use_cmd)
+	{
+		CHECK(write_cmd_confirmed(SUBSCRIBER_CONN, CL_LOCK_CMD_OP_CLAIM, owner_bytes, CL_LOCK_CMD_OK, cycle) == PHY_LOCK_STATE_REQUESTED_CLAIM,
+					"cycle %u: claim not confirmed", (unsigned)cycle);
+	}
+	else
+	{
+		CHECK(write_uuid(SUBSCRIBER_CONN, claim_chr, owner) == 0, "cycle %u: claim rejected", (unsigned)cycle);
+	}
+	CHECK(read_state() == PHY_LOCK_STATE_REQUESTED_CLAIM, "cycle %u: claim not requested", (unsigned)cycle);
+	check_idle(SUBSCRIBER_CONN, cycle);
+	if (use_cmd)
+	{
+		write_cmd_confirmed(SUBSCRIBER_CONN, CL_LOCK_CMD_OP_CLAIM, intruder_bytes, CL_LOCK_CMD_ERR_STATE, cycle);
+	}
+	else
+	{
+		CHECK(write_uuid(SUBSCRIBER_CONN, claim_chr, intruder) != 0, "cycle %u: second claim accepted", (unsigned)cycle);
+	}
+	move_bolt(PHY_LOCK_POSITION_OPEN);
+	move_bolt(PHY_LOCK_POSITION_CLOSED);
+	CHECK(read_state() == PHY_LOCK_STATE_CLAIMED, "cycle %u: claim not committed", (unsigned)cycle);
+
+	// a pulse shorter than the debounce window is not a tamper
+	glitch_bolt(PHY_LOCK_POSITION_OPEN);
+	CHECK(host_gpio_get_output(LOCK_SENSOR_ALARM_PIN) == 0, "cycle %u: alarm raised by a glitch", (unsigned)cycle);
+
+	// tamper: the bolt is forced open while claimed
+	move_bolt(PHY_LOCK_POSITION_OPEN);
+	CHECK(host_gpio_get_output(LOCK_SENSOR_ALARM_PIN) == 1, "cycle %u: alarm not raised", (unsigned)cycle);
+	CHECK(broadcast_status().flags == CL_BLE_BROADCAST_F_ALARM, "cycle %u: alarm not broadcast", (unsigned)cycle);
+	move_bolt(PHY_LOCK_POSITION_CLOSED);
+	CHECK(host_gpio_get_output(LOCK_SENSOR_ALARM_PIN) == 0, "cycle %u: alarm not cleared", (unsigned)cycle);
+	CHECK(broadcast_status().flags == CL_BLE_BROADCAST_F_CLOSED, "cycle %u: alarm still broadcast", (unsigned)cycle);
+	CHECK(read_state() == PHY_LOCK_STATE_CLAIMED, "cycle %u: tamper changed the state", (unsigned)cycle);
+
+	// release: only the owner can release, the ownership is cleared once the bolt opens
+	// the binary form is used on odd cycles, it must match the ownership claimed with the string form
+	reconnect_owner(cycle);
+	if (use_cmd)
+	{
+		write_cmd_confirmed(OWNER_CONN, CL_LOCK_CMD_OP_RELEASE, intruder_bytes, CL_LOCK_CMD_ERR_NOT_OWNER, cycle);
+		CHECK(write_cmd_confirmed(OWNER_CONN, CL_LOCK_CMD_OP_RELEASE, owner_bytes, CL_LOCK_CMD_OK, cycle) == PHY_LOCK_STATE_REQUESTED_RELEASE,
+					"cycle %u: release not confirmed", (unsigned)cycle);
+	}
+	else
+	{
+		CHECK(write_uuid(OWNER_CONN, release_chr, intruder) != 0, "cycle %u: foreign release accepted", (unsigned)cycle);
+		CHECK((cycle & 1 ? write_uuid_bytes(OWNER_CONN, release_chr, owner_bytes) : write_uuid(OWNER_CONN, release_chr, owner)) == 0,
+					"cycle %u: release rejected", (unsigned)cycle);
+	}
+	CHECK(read_state() == PHY_LOCK_STATE_REQUESTED_RELEASE, "cycle %u: release not requested", (unsigned)cycle);
+	check_idle(OWNER_CONN, cycle);
+	move_bolt(PHY_LOCK_POSITION_OPEN);
+	CHECK(read_state() == PHY_LOCK_STATE_UNCLAIMED, "cycle %u: release not committed", (unsigned)cycle);
+	move_bolt(PHY_LOCK_POSITION_CLOSED);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t cycles = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+	if (argc > 2)
+	{
+		esp_log_level_set("*", (esp_log_level_t)atoi(argv[2]));
+	}
+
+	// boot with the bolt closed, as main.c does
+	host_nvs_reset();
+	host_partition_reset();
+	host_gpio_reset();
+	CHECK(cl_gpio_hub_init() == ESP_OK, "gpio hub");
+	// an input the ISR service can't take is left neither served nor debounced
+	const cl_debounce_config_t debounce = CL_DEBOUNCE_CONFIG_DEFAULT();
+	CHECK(cl_gpio_hub_add(LOCK_SENSOR_IN_PIN, &debounce, unserved_input, NULL) == ESP_ERR_INVALID_STATE &&
+						cl_gpio_hub_set_wake(LOCK_SENSOR_IN_PIN) == ESP_ERR_NOT_FOUND && cl_debounce_remove(LOCK_SENSOR_IN_PIN) == ESP_ERR_NOT_FOUND,
+				"input left registered after a failed add");
+	CHECK(gpio_install_isr_service(0) == ESP_OK, "isr service");
+	CHECK(cl_power_init() == ESP_OK, "power init");
+	CHECK(cl_phy_lock_svc_add_state_cb(lock_state_changed, NULL) == ESP_OK, "power phases");
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, PHY_LOCK_POSITION_CLOSED);
+	// the lock is ready once its record is read back, in one lookup
+	host_nvs_stats_t nvs_boot;
+	host_nvs_get_stats(&nvs_boot);
+	double boot_start = now_ns();
+	CHECK(cl_phy_lock_svc_init() == ESP_OK, "lock init");
+	double boot_ns = now_ns() - boot_start;
+	host_nvs_stats_t nvs_ready;
+	host_nvs_get_stats(&nvs_ready);
+	// the bolt edges now come from the level interrupts that wake the device
+	CHECK(cl_power_add_wake_input(LOCK_SENSOR_IN_PIN) == ESP_OK, "wake input");
+	// the sensor loop, the alarm and the wake input must all work through light sleep
+	CHECK(!host_gpio_sleep_isolated(LOCK_SENSOR_OUT_PIN) && !host_gpio_sleep_isolated(LOCK_SENSOR_ALARM_PIN) &&
+						!host_gpio_sleep_isolated(LOCK_SENSOR_IN_PIN),
+				"lock pins isolated in light sleep");
+	CHECK(cl_ble_lock_svc_init() == 0, "gatt init");
+	CHECK(cl_ble_bond_init() == ESP_OK, "bond init");
+	CHECK(cl_ble_conn_init() == ESP_OK, "conn init");
+	CHECK(cl_ble_adv_init() == ESP_OK, "adv init");
+	CHECK(cl_ble_broadcast_init() == ESP_OK, "broadcast init");
+	CHECK(cl_phy_lock_svc_start() == ESP_OK, "lock start");
+	// the lock task reads the callbacks without a lock, they can't change any more
+	CHECK(cl_phy_lock_svc_add_state_cb(lock_state_changed, NULL) == ESP_ERR_INVALID_STATE, "callback added once started");
+	host_rtos_advance_ms(SETTLE_MS);
+
+	state_chr = host_ble_find_chr(&cl_ble_lock_svc_state_char_uuid.u);
+	claim_chr = host_ble_find_chr(&cl_ble_lock_svc_req_claim_char_uuid.u);
+	release_chr = host_ble_find_chr(&cl_ble_lock_svc_req_release_char_uuid.u);
+	cmd_chr = host_ble_find_chr(&cl_ble_lock_svc_cmd_char_uuid.u);
+	rsp_chr = host_ble_find_chr(&cl_ble_lock_svc_rsp_char_uuid.u);
+	CHECK(state_chr != NULL && claim_chr != NULL && release_chr != NULL && cmd_chr != NULL && rsp_chr != NULL,
+				"characteristics not registered");
+	char desc[256];
+	read_desc(state_chr, desc, sizeof(desc));
+	CHECK(strncmp(desc, "[uint 0] Unclaimed: ", 20) == 0, "unexpected state descriptor: %s", desc);
+	CHECK(read_desc(claim_chr, desc, sizeof(desc)) > 0 && strstr(desc, "claim") != NULL, "unexpected claim descriptor: %s", desc);
+	CHECK(read_desc(release_chr, desc, sizeof(desc)) > 0 && strstr(desc, "release") != NULL, "unexpected release descriptor: %s", desc);
+	host_ble_set_notify_cb(on_notify);
+	host_ble_set_gap_cb(ble_gap_event, NULL);
+	cl_ble_adv_start(0, ble_gap_event, NULL);
+	host_ble_adv_t adv;
+	host_ble_get_adv(&adv);
+	CHECK(adv.active && adv.params.itvl_max == CL_BLE_ADV_FAST_ITVL_MAX, "not advertising fast after boot");
+	CHECK(adv.rsp_data_len >= 2 + strlen(CL_BLE_DEVICE_NAME) && memcmp(&adv.rsp_data[2], CL_BLE_DEVICE_NAME, strlen(CL_BLE_DEVICE_NAME)) == 0,
+				"name not in the scan response");
+	// the gateway provisions the key once, the status replaces the name
+	CHECK(cl_ble_broadcast_set_key(broadcast_key) == ESP_OK, "broadcast key");
+	CHECK(broadcast_status().flags == CL_BLE_BROADCAST_F_CLOSED && broadcast_status().battery == CL_BLE_BROADCAST_BATTERY_UNKNOWN,
+				"unexpected status broadcast");
+	host_ble_connect(SUBSCRIBER_CONN, &subscriber_addr);
+	// the lock only takes requests on an encrypted link, Just Works pairing is enough
+	const uint8_t status_req[CL_LOCK_CMD_REQ_HEADER_LEN] = {0x01, CL_LOCK_CMD_OP_STATUS, 0};
+	CHECK(write_cmd(SUBSCRIBER_CONN, status_req, sizeof(status_req)) == BLE_ATT_ERR_INSUFFICIENT_AUTHEN && cmd_rsp_len == 0,
+				"request accepted before pairing");
+	CHECK(host_ble_pair(SUBSCRIBER_CONN) == 0, "subscriber pairing");
+	subscribe(SUBSCRIBER_CONN);
+	CHECK(notifications == 1, "subscriber not brought up to date");
+	check_cmd_errors();
+	// the errors the request descriptors tell: a value that is no UUID, of any length, is told from a refusal
+	CHECK(write_uuid(SUBSCRIBER_CONN, claim_chr, "0000000-00000-0000-0000-00000000000g") == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN &&
+						write_uuid(SUBSCRIBER_CONN, claim_chr, "0000") == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN &&
+						write_uuid(SUBSCRIBER_CONN, release_chr, "00000000-0000-0000-0000-000000000001") == BLE_ATT_ERR_UNLIKELY,
+				"request errors not as described");
+
+	host_ble_adv_t adv_before;
+	host_ble_get_adv(&adv_before);
+	host_nvs_stats_t nvs_before;
+	host_nvs_get_stats(&nvs_before);
+	uint32_t notifications_before = notifications;
+	uint32_t broadcast_frames_before = broadcast_frames;
+	double start = now_ns();
+
+	for (uint32_t i = 0; i < cycles; i++)
+	{
+		run_cycle(i);
+	}
+
+	double elapsed = (now_ns() - start) / 1e9;
+	host_nvs_stats_t nvs_after;
+	host_nvs_get_stats(&nvs_after);
+
+	double per_cycle = cycles > 0 ? 1.0 / cycles : 0;
+	printf("cycles: %u (claim + tamper + release)\n", (unsigned)cycles);
+	printf("wall time: %.3f s, %.0f cycles/s\n", elapsed, elapsed > 0 ? cycles / elapsed : 0);
+	printf("simulated time: %.1f s\n", host_rtos_time_us() / 1e6);
+	printf("lock init: %.1f us, %" PRIu32 " nvs lookups\n", boot_ns / 1e3, nvs_ready.lookups - nvs_boot.lookups);
+	printf("nvs per cycle: %.2f writes, %.2f commits, %.2f lookups\n",
+				 (nvs_after.writes - nvs_before.writes) * per_cycle,
+				 (nvs_after.commits - nvs_before.commits) * per_cycle,
+				 (nvs_after.lookups - nvs_before.lookups) * per_cycle);
+
+	printf("notifications per cycle: %.2f\n", (notifications - notifications_before) * per_cycle);
+
+	// once the owner is gone and the lock stays put, advertising slows down
+	host_ble_disconnect(OWNER_CONN);
+	host_rtos_advance_ms(CL_BLE_ADV_FAST_WINDOW_MS + SETTLE_MS);
+	host_ble_get_adv(&adv);
+	CHECK(adv.active && adv.params.itvl_min == CL_BLE_ADV_SLOW_ITVL_MIN, "not advertising slow after the fast window");
+	CHECK(broadcast_status().state == PHY_LOCK_STATE_UNCLAIMED && (cycles == 0 || broadcast_frames > broadcast_frames_before),
+				"status not broadcast");
+	printf("advertising per cycle: %.2f data uploads, %.2f scan responses, %.2f starts\n",
+				 (adv.data_sets - adv_before.data_sets) * per_cycle, (adv.rsp_data_sets - adv_before.rsp_data_sets) * per_cycle,
+				 (adv.starts - adv_before.starts) * per_cycle);
+
+	cl_gpio_hub_stats_t hub;
+	cl_gpio_hub_get_stats(&hub);
+	printf("gpio hub: %" PRIu32 " edges, %" PRIu32 " dispatched, %" PRIu32 " overflows, max depth %" PRIu32 "\n",
+				 hub.edges, hub.dispatched, hub.overflows, hub.max_depth);
+	cl_persist_stats_t persist;
+	cl_persist_get_stats(&persist);
+	CHECK(persist.failures == 0, "%" PRIu32 " persistence batches failed", persist.failures);
+	printf("persistence: %" PRIu32 " writes, %" PRIu32 " coalesced, %" PRIu32 " batches, %" PRIu32 " journaled\n",
+				 persist.writes, persist.coalesced, persist.batches, persist.journaled);
+	CHECK(hub.overflows == 0, "gpio hub overflowed");
+
+	// the journal keeps the latest records, in order and without gaps, every claim and release with its owner
+	cl_journal_stats_t journal;
+	cl_journal_get_stats(&journal);
+	cl_journal_cursor_t cursor;
+	cl_journal_cursor_init(&cursor, 0);
+	cl_journal_record_t records[7];
+	size_t count;
+	uint32_t kept = 0, claims = 0, next_seq = 0;
+	do
+	{
+		CHECK(cl_journal_read(&cursor, records, sizeof(records) / sizeof(records[0]), &count) == ESP_OK, "journal read failed");
+		for (size_t i = 0; i < count; i++)
+		{
+			CHECK(next_seq == 0 || records[i].seq == next_seq, "journal gap: seq %" PRIu32 " after %" PRIu32, records[i].seq, next_seq - 1);
+			CHECK((records[i].event != CL_JOURNAL_EVENT_CLAIMED && records[i].event != CL_JOURNAL_EVENT_RELEASED) || records[i].owner != 0,
+						"journal record %" PRIu32 " without owner", records[i].seq);
+			next_seq = records[i].seq + 1;
+			claims += records[i].event == CL_JOURNAL_EVENT_CLAIMED;
+			kept++;
+		}
+	} while (count > 0);
+	uint32_t journal_slots = HOST_PARTITION_SPIFFS_SIZE / sizeof(cl_journal_record_t);
+	CHECK(journal.dropped == 0 && journal.failures == 0 && next_seq == journal.written + 1, "journal lost records");
+	CHECK(kept == journal.written || kept >= journal_slots - CL_JOURNAL_SECTOR_SIZE / sizeof(cl_journal_record_t),
+				"journal kept %" PRIu32 " of %" PRIu32 " records", kept, journal.written);
+	CHECK(cycles == 0 || claims > 0, "no claim journaled");
+	check_get_log(next_seq);
+	host_partition_stats_t flash;
+	host_partition_get_stats(&flash);
+	printf("journal: %" PRIu32 " records in %" PRIu32 " writes, %" PRIu32 " sectors erased, %" PRIu32 " kept, head found in %" PRIu32 " reads\n",
+				 journal.written, journal.writes, journal.erases, kept, journal.recovery_reads);
+
+	// every lock taken is released once the bolt and the worker are done
+	cl_power_stats_t power;
+	cl_power_get_stats(&power);
+	CHECK(host_pm_held() == 0, "%" PRIu32 " PM lock holds left", host_pm_held());
+	printf("power: motor held %" PRIu32 " times %.1f s, nvs held %" PRIu32 " times %.1f s\n",
+				 power.locks[CL_POWER_LOCK_MOTOR].acquired, power.locks[CL_POWER_LOCK_MOTOR].held_us / 1e6,
+				 power.locks[CL_POWER_LOCK_NVS].acquired, power.locks[CL_POWER_LOCK_NVS].held_us / 1e6);
+	for (uint8_t state = PHY_LOCK_STATE_UNCLAIMED; state <= PHY_LOCK_STATE_SUPPORT; state++)
+	{
+		const cl_power_phase_stats_t *phase = &power.phases[CL_POWER_PHASE_INDEX(state)];
+		printf("  state %d: %.1f s, awake %.1f%% (motor %.1f%%, nvs %.2f%%)\n", state, phase->time_us / 1e6,
+					 phase->time_us ? 100.0 * phase->blocked_us / phase->time_us : 0,
+					 phase->time_us ? 100.0 * phase->held_us[CL_POWER_LOCK_MOTOR] / phase->time_us : 0,
+					 phase->time_us ? 100.0 * phase->held_us[CL_POWER_LOCK_NVS] / phase->time_us : 0);
+	}
+
+	cl_ble_conn_stats_t conn;
+	cl_ble_conn_get_stats(&conn);
+	printf("connection updates: %" PRIu32 " requested, %" PRIu32 " completed, %" PRIu32 " failed\n",
+				 conn.requested, conn.completed, conn.failed);
+	CHECK(conn.failed == 0, "connection updates failed");
+
+	cl_ble_bond_stats_t bond;
+	cl_ble_bond_get_stats(&bond);
+	printf("reconnect to first write: resumed %" PRIu32 " avg %.1f ms max %.1f ms, paired %" PRIu32 " avg %.1f ms max %.1f ms\n",
+				 bond.resumed.count, bond.resumed.count ? bond.resumed.total_us / 1e3 / bond.resumed.count : 0, bond.resumed.max_us / 1e3,
+				 bond.paired.count, bond.paired.count ? bond.paired.total_us / 1e3 / bond.paired.count : 0, bond.paired.max_us / 1e3);
+	printf("bonds: %d stored, %" PRIu32 " evictions, %" PRIu32 " repeat pairings\n",
+				 host_ble_bond_count(), bond.evictions, bond.repeat_pairings);
+	// the subscriber stays connected, its bond must never be evicted
+	struct ble_store_key_sec key = {.peer_addr = subscriber_addr};
+	struct ble_store_value_sec value;
+	CHECK(ble_store_read_peer_sec(&key, &value) == 0, "subscriber bond evicted");
+	CHECK(cycles < 8 || (bond.resumed.count > 0 && bond.evictions > 0 && bond.repeat_pairings > 0), "bond store not exercised");
+	return 0;
+}
@@ -0,0 +1,169 @@
+// Library
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+// Local
+#include "cl_delta.h"
+#include "delta_encode.h"
+
+/**
+ * Patch generator for delta firmware updates.
+ *
+ * Makes the cl_delta patch rebuilding the new image from the one the locks run, checks it by applying it with the
+ * decoder of the firmware and reports its size against the image's, the bytes a transfer saves:
+ *
+ *   mkdelta [-w window bits] running.bin new.bin patch.bin
+ *
+ * The patch goes to the lock with BEGIN_PATCH on the update channel. The window, 2^15 bytes by default, is the PSRAM
+ * the lock allocates to decode it: a larger one finds more repeats in the delta.
+ */
+
+#define DEFAULT_WINDOW_BITS 15
+
+/**
+ * The image rebuilt by the decoder, compared as it comes.
+ */
+typedef struct
+{
+	const uint8_t *source;
+	const uint8_t *target;
+	size_t pos;
+} check_t;
+
+static esp_err_t read_source(uint32_t offset, void *buf, size_t len, void *arg)
+{
+	const check_t *check = arg;
+	memcpy(buf, &check->source[offset], len);
+	return ESP_OK;
+}
+
+static esp_err_t write_target(const uint8_t *data, size_t len, void *arg)
+{
+	check_t *check = arg;
+	if (memcmp(data, &check->target[check->pos], len) != 0)
+	{
+		return ESP_ERR_INVALID_CRC;
+	}
+	check->pos += len;
+	return ESP_OK;
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		perror(path);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = malloc(len > 0 ? len : 1);
+	if (data == NULL || fread(data, 1, len, file) != (size_t)len)
+	{
+		fprintf(stderr, "%s: read failed\n", path);
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = len;
+	return data;
+}
+
+/**
+ * Apply the patch as the lock does, with an output buffer of a flash sector.
+ */
+static esp_err_t apply(const uint8_t *patch, size_t patch_len, const uint8_t *source, const uint8_t *target,
+											 size_t target_size)
+{
+	cl_delta_header_t header;
+	esp_err_t ret = cl_delta_parse_header(patch, &header);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	if (header.target_size != target_size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	static uint8_t out[4096];
+	uint8_t *window = malloc((size_t)1 << header.window_bits);
+	static cl_delta_t delta;
+	check_t check = {.source = source, .target = target};
+	cl_delta_init(&delta, &header, window, out, sizeof(out), read_source, write_target, &check);
+	ret = cl_delta_feed(&delta, &patch[CL_DELTA_HEADER_LEN], patch_len - CL_DELTA_HEADER_LEN);
+	if (ret == ESP_OK)
+	{
+		ret = cl_delta_finish(&delta);
+	}
+	free(window);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int window_bits = DEFAULT_WINDOW_BITS;
+	int opt;
+	while ((opt = getopt(argc, argv, "w:")) != -1)
+	{
+		if (opt != 'w')
+		{
+			break;
+		}
+		window_bits = atoi(optarg);
+	}
+	if (argc - optind != 3 || window_bits < CL_DELTA_WINDOW_BITS_MIN || window_bits > CL_DELTA_WINDOW_BITS_MAX)
+	{
+		fprintf(stderr, "usage: %s [-w window bits %d-%d] running.bin new.bin patch.bin\n", argv[0],
+						CL_DELTA_WINDOW_BITS_MIN, CL_DELTA_WINDOW_BITS_MAX);
+		return 2;
+	}
+
+	size_t source_size, target_size;
+	uint8_t *source = read_file(argv[optind], &source_size);
+	uint8_t *target = read_file(argv[optind + 1], &target_size);
+	if (source == NULL || target == NULL)
+	{
+		return 1;
+	}
+
+	clock_t start = clock();
+	delta_encode_stats_t stats;
+	uint8_t *patch = delta_encode(source, source_size, target, target_size, window_bits, &stats);
+	double elapsed_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (patch == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	esp_err_t ret = apply(patch, stats.patch_len, source, target, target_size);
+	if (ret != ESP_OK)
+	{
+		fprintf(stderr, "patch does not rebuild %s: error 0x%x\n", argv[optind + 1], ret);
+		return 1;
+	}
+
+	FILE *file = fopen(argv[optind + 2], "wb");
+	if (file == NULL || fwrite(patch, 1, stats.patch_len, file) != stats.patch_len || fclose(file) != 0)
+	{
+		perror(argv[optind + 2]);
+		return 1;
+	}
+
+	printf("%s: %zu bytes for a %zu-byte image from a %zu-byte one, %.1f%% of the image\n", argv[optind + 2],
+				 stats.patch_len, target_size, source_size, 100.0 * stats.patch_len / (target_size > 0 ? target_size : 1));
+	printf("delta: %" PRIu32 " records, %zu bytes added to the running image, %zu copied, %zu bytes before "
+				 "compression, %.1f%% after\n",
+				 stats.records, stats.added, stats.copied, stats.delta_len,
+				 100.0 * (stats.patch_len - CL_DELTA_HEADER_LEN) / (stats.delta_len > 0 ? stats.delta_len : 1));
+	printf("lzss: %d-byte window, %" PRIu32 " literals, %" PRIu32 " matches; made and checked in %.2f s\n",
+				 1 << window_bits, stats.literals, stats.matches, elapsed_s);
+	free(patch);
+	free(source);
+	free(target);
+	return 0;
+}
@@ -0,0 +1,563 @@
+// Library
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "host/ble_hs.h"
+// Local
+#include "check.h"
+#include "cl_ble_bond.h"
+#include "cl_ble_conn.h"
+#include "cl_ble_ota.h"
+#include "cl_ble_svc.h"
+#include "cl_gpio_hub.h"
+#include "cl_ota.h"
+#include "cl_phy_lock_svc.h"
+#include "cl_power.h"
+#include "delta_encode.h"
+#include "gatts/cl_ble_lock_svc.h"
+
+/**
+ * Firmware update benchmark.
+ *
+ * A paired central streams an image over the update channel into ota_1 with flash timings of the ESP32-S3 module,
+ * drops the connection midway, resumes the update from the offset the lock answers with and applies it: the image
+ * must be in ota_1 byte for byte and run after the restart. An image announced with a wrong hash, or with the right
+ * hash but no valid signature, must fail its verification without touching the boot partition, a chunk at a wrong
+ * offset must be refused with the offset expected, and a central that is not bonded must be refused. The throughput
+ * is reported with the projected time of an image filling the slot.
+ *
+ * The next build then goes as a patch against the image now running: it must rebuild the build in ota_0 byte for byte
+ * within the PSRAM of its window, while a patch for another image must fail before the slot is touched. The images
+ * are synthetic builds, code, text and the pointers a build moves, the patch size is reported against the image's.
+ *
+ * Usage: ota_bench [image bytes] [log level 0-5]
+ */
+
+#define CENTRAL_CONN 1
+#define PAIR_MS 600						 //!< Time of a full LE Secure Connections pairing, user confirmation included
+#define SETTLE_MS 100					 //!< Time given to the PHY and parameter updates before a transfer
+#define TIMEOUT_MS 600000			 //!< Simulated time an update may take at most
+#define CENTRAL_MTU 64				 //!< Largest SDU the central accepts, above CL_BLE_OTA_RESPONSE_LEN
+#define CENTRAL_CREDITS 8			 //!< Credits the central grants for the responses
+#define BAD_IMAGE_SIZE 0x20000 //!< Image announced with a wrong hash
+#define DROP_PERCENT 40				 //!< Share of the image sent before the connection drops
+#define PATCH_WINDOW_BITS 15		 //!< LZSS window of the patches, as mkdelta makes them by default
+
+// synthetic builds
+#define IMAGE_BASE 0x42000000 //!< Address the image is mapped at, held by its pointers
+#define OPCODES 512						//!< Distinct instruction words of the code
+#define INSERT_PERCENT 30			//!< Where the next build adds code, moving everything after
+#define INSERT_LEN 0xC00			//!< Code it adds
+#define EDIT_EVERY 997				//!< Instruction words it changes, one in so many
+
+// S3 module flash, typical figures of the datasheets
+static const host_partition_timing_t flash_timing = {
+		.sector_erase_us = 45000,
+		.block_erase_us = 150000,
+		.page_write_us = 600,
+};
+
+static const ble_addr_t central_addr = {.type = BLE_ADDR_RANDOM, .val = {0x02, 0x00, 0x00, 0x00, 0x00, 0xc0}};
+
+/**
+ * The responses as the central saw them.
+ */
+typedef struct
+{
+	bool answered;		 //!< An answer to the last request arrived
+	uint8_t op;				 //!< Op of that answer
+	int32_t status;
+	uint32_t offset;
+	uint32_t acked;		 //!< Bytes written, from the last progress
+	uint32_t progresses;
+	bool done;
+	int32_t done_status;
+	int64_t done_us;
+	bool bad;					 //!< A response broke the protocol
+} responses_t;
+
+static responses_t rx;
+
+/**
+ * Central receive callback, on the NimBLE host task.
+ */
+static void on_sdu(uint16_t conn_handle, const uint8_t *sdu, uint16_t len)
+{
+	(void)conn_handle;
+	if (len != CL_BLE_OTA_RESPONSE_LEN)
+	{
+		rx.bad = true;
+		return;
+	}
+	int32_t status;
+	uint32_t offset;
+	memcpy(&status, &sdu[1], sizeof(status));
+	memcpy(&offset, &sdu[5], sizeof(offset));
+
+	if (sdu[0] == CL_BLE_OTA_OP_DONE)
+	{
+		rx.bad |= rx.done;
+		rx.done = true;
+		rx.done_status = status;
+		rx.done_us = host_rtos_time_us();
+	}
+	else if (sdu[0] == CL_BLE_OTA_OP_DATA && status == ESP_OK)
+	{
+		rx.bad |= offset <= rx.acked;
+		rx.acked = offset;
+		rx.progresses++;
+	}
+	else
+	{
+		rx.answered = true;
+		rx.op = sdu[0];
+		rx.status = status;
+		rx.offset = offset;
+	}
+}
+
+static void connect_central(bool pair)
+{
+	host_ble_connect(CENTRAL_CONN, &central_addr);
+	if (pair)
+	{
+		CHECK(host_ble_pair(CENTRAL_CONN) == 0, "pairing failed");
+		host_rtos_advance_ms(PAIR_MS);
+	}
+	host_rtos_advance_ms(SETTLE_MS);
+}
+
+static void open_channel(void)
+{
+	host_ble_l2cap_peer_t peer = {
+			.mtu = CENTRAL_MTU,
+			.mps = HOST_BLE_L2CAP_COC_MPS,
+			.initial_credits = CENTRAL_CREDITS,
+			.rx_cb = on_sdu,
+	};
+	int ret = host_ble_l2cap_connect(CENTRAL_CONN, CL_BLE_OTA_PSM, &peer);
+	CHECK(ret == 0, "channel refused; ret=%d", ret);
+	memset(&rx, 0, sizeof(rx));
+}
+
+static void disconnect_central(void)
+{
+	host_ble_disconnect(CENTRAL_CONN);
+	host_rtos_wait_idle();
+}
+
+/**
+ * Send a request as soon as the lock has a receive buffer posted, so gives credits.
+ */
+static void send_request(const void *request, uint16_t len)
+{
+	for (int ms = 0;; ms++)
+	{
+		int ret = host_ble_l2cap_send(CENTRAL_CONN, request, len);
+		if (ret == 0)
+		{
+			return;
+		}
+		CHECK(ret == BLE_HS_EBUSY && ms < TIMEOUT_MS, "request not sent; ret=%d", ret);
+		host_rtos_advance_ms(1);
+	}
+}
+
+/**
+ * Send a request and run the link until it is answered.
+ */
+static void request(const void *req, uint16_t len)
+{
+	rx.answered = false;
+	send_request(req, len);
+	for (int ms = 0; !rx.answered && ms < TIMEOUT_MS; ms++)
+	{
+		host_rtos_advance_ms(1);
+	}
+	CHECK(rx.answered && rx.op == ((const uint8_t *)req)[0], "request %d not answered", ((const uint8_t *)req)[0]);
+	CHECK(!rx.bad, "responses broke the protocol");
+}
+
+static void begin(uint32_t size, const uint8_t *hash)
+{
+	uint8_t req[CL_BLE_OTA_BEGIN_LEN] = {CL_BLE_OTA_OP_BEGIN};
+	memcpy(&req[1], &size, sizeof(size));
+	memcpy(&req[CL_BLE_OTA_HEADER_LEN], hash, CL_OTA_HASH_LEN);
+	request(req, sizeof(req));
+}
+
+/**
+ * Send the image from offset on, up to stop, without waiting for the progress.
+ */
+static void send_image(const uint8_t *image, uint32_t offset, uint32_t stop)
+{
+	static uint8_t req[CL_BLE_OTA_RX_MTU];
+	req[0] = CL_BLE_OTA_OP_DATA;
+	rx.answered = false;
+	while (offset < stop)
+	{
+		uint32_t len = stop - offset < CL_OTA_CHUNK_SIZE ? stop - offset : CL_OTA_CHUNK_SIZE;
+		memcpy(&req[1], &offset, sizeof(offset));
+		memcpy(&req[CL_BLE_OTA_HEADER_LEN], &image[offset], len);
+		send_request(req, CL_BLE_OTA_HEADER_LEN + len);
+		offset += len;
+		CHECK(!rx.answered, "chunk at %" PRIu32 " refused: %s", rx.offset, esp_err_to_name(rx.status));
+	}
+}
+
+static void wait_done(void)
+{
+	for (int ms = 0; !rx.done && ms < TIMEOUT_MS; ms++)
+	{
+		host_rtos_advance_ms(1);
+	}
+	host_rtos_wait_idle();
+	CHECK(rx.done, "update not done after %d ms, %" PRIu32 " bytes written", TIMEOUT_MS, rx.acked);
+	CHECK(!rx.bad, "responses broke the protocol");
+}
+
+static void begin_patch(uint32_t size, const uint8_t *hash)
+{
+	uint8_t req[CL_BLE_OTA_BEGIN_LEN] = {CL_BLE_OTA_OP_BEGIN_PATCH};
+	memcpy(&req[1], &size, sizeof(size));
+	memcpy(&req[CL_BLE_OTA_HEADER_LEN], hash, CL_OTA_HASH_LEN);
+	request(req, sizeof(req));
+}
+
+typedef enum
+{
+	WORD_CODE,
+	WORD_POINTER, //!< Offset of a word of the image, IMAGE_BASE added
+	WORD_TEXT,
+} word_kind_t;
+
+typedef struct
+{
+	word_kind_t kind;
+	uint32_t value;
+} word_t;
+
+static uint32_t next_random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**
+ * Words of a synthetic build: runs of code, pointers and text.
+ */
+static word_t *make_build(size_t count)
+{
+	static const char text[] = "Failed to post receive buffer; conn_handle=%d ret=%d lock state changed to %s ";
+	uint32_t opcodes[OPCODES];
+	uint32_t state = 0x2545f491;
+	for (int i = 0; i < OPCODES; i++)
+	{
+		opcodes[i] = next_random(&state);
+	}
+	word_t *words = malloc(count * sizeof(word_t));
+	for (size_t i = 0; i < count;)
+	{
+		uint32_t pick = next_random(&state) % 10;
+		word_kind_t kind = pick < 5 ? WORD_CODE : pick < 7 ? WORD_POINTER : WORD_TEXT;
+		size_t run = kind == WORD_CODE ? 8 + next_random(&state) % 120 : kind == WORD_POINTER ? 1 + next_random(&state) % 6 : 4 + next_random(&state) % 40;
+		for (; run > 0 && i < count; run--, i++)
+		{
+			uint32_t value = next_random(&state);
+			words[i].kind = kind;
+			switch (kind)
+			{
+			case WORD_CODE:
+				words[i].value = opcodes[value % OPCODES];
+				break;
+			case WORD_POINTER:
+				words[i].value = value % count * 4;
+				break;
+			case WORD_TEXT:
+				memcpy(&words[i].value, &text[value % (sizeof(text) - 4)], 4);
+				break;
+			}
+		}
+	}
+	return words;
+}
+
+/**
+ * Lay out the build, or the next one: INSERT_LEN bytes of code added at INSERT_PERCENT, the pointers past it moved
+ * along and a few instructions changed. size bytes, or INSERT_LEN more for the next one.
+ */
+static void render_build(const word_t *words, uint32_t size, bool next, uint8_t *out)
+{
+	size_t count = size / 4;
+	size_t insert = count / 100 * INSERT_PERCENT;
+	uint32_t state = 0x9e3779b9;
+	size_t pos = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		for (size_t n = 0; next && i == insert && n < INSERT_LEN / 4; n++, pos += 4)
+		{
+			uint32_t code = next_random(&state);
+			memcpy(&out[pos], &code, 4);
+		}
+		uint32_t value = words[i].value;
+		if (words[i].kind == WORD_POINTER)
+		{
+			value += IMAGE_BASE + (next && value >= insert * 4 ? INSERT_LEN : 0);
+		}
+		else if (words[i].kind == WORD_CODE && next && i % EDIT_EVERY == 0)
+		{
+			value ^= 0x00100000;
+		}
+		memcpy(&out[pos], &value, 4);
+		pos += 4;
+	}
+	memset(&out[pos], 0, size + (next ? INSERT_LEN : 0) - pos);
+	out[0] = HOST_OTA_IMAGE_MAGIC;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t image_size = argc > 1 ? strtoul(argv[1], NULL, 0) : 1536 * 1024;
+	esp_log_level_set("*", argc > 2 ? (esp_log_level_t)atoi(argv[2]) : ESP_LOG_WARN);
+
+	host_nvs_reset();
+	host_partition_reset();
+	host_gpio_reset();
+	CHECK(gpio_install_isr_service(0) == ESP_OK, "isr service");
+	CHECK(cl_gpio_hub_init() == ESP_OK, "gpio hub");
+	CHECK(cl_power_init() == ESP_OK, "power init");
+	host_gpio_drive(LOCK_SENSOR_IN_PIN, PHY_LOCK_POSITION_CLOSED);
+	CHECK(cl_phy_lock_svc_init() == ESP_OK, "lock init");
+	CHECK(cl_ble_lock_svc_init() == 0, "gatt init");
+	CHECK(cl_ble_bond_init() == ESP_OK, "bond init");
+	CHECK(cl_ble_conn_init() == ESP_OK, "conn init");
+	CHECK(cl_ble_ota_init() == ESP_OK, "ota init");
+	CHECK(cl_phy_lock_svc_start() == ESP_OK, "lock start");
+	host_ble_set_gap_cb(ble_gap_event, NULL);
+	host_rtos_wait_idle();
+	host_partition_set_timing(&flash_timing);
+
+	const esp_partition_t *ota_0 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+	const esp_partition_t *ota_1 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+	CHECK(ota_0 != NULL && ota_1 != NULL, "no ota slots");
+	CHECK(image_size > BAD_IMAGE_SIZE && image_size <= ota_1->size, "image of %" PRIu32 " bytes", image_size);
+	uint32_t next_size = image_size + INSERT_LEN;
+	CHECK(next_size <= ota_0->size, "next build of %" PRIu32 " bytes", next_size);
+	word_t *build = make_build(image_size / 4);
+	uint8_t *image = malloc(image_size);
+	uint8_t *next = malloc(next_size);
+	render_build(build, image_size, false, image);
+	render_build(build, image_size, true, next);
+	host_ota_sign(image, image_size);
+	host_ota_sign(next, next_size);
+	free(build);
+	uint8_t hash[CL_OTA_HASH_LEN];
+	mbedtls_sha256(image, image_size, hash, 0);
+
+	// only a bonded central may update
+	connect_central(false);
+	host_ble_l2cap_peer_t stranger = {.mtu = CENTRAL_MTU, .mps = HOST_BLE_L2CAP_COC_MPS, .initial_credits = 1};
+	CHECK(host_ble_l2cap_connect(CENTRAL_CONN, CL_BLE_OTA_PSM, &stranger) == BLE_HS_EENCRYPT, "unencrypted channel accepted");
+	disconnect_central();
+
+	printf("update channel: %d-byte chunks, %d buffers, %" PRIu32 "-byte image, flash: sector erase %.0f ms, "
+				 "block erase %.0f ms, page write %.1f ms\n",
+				 CL_OTA_CHUNK_SIZE, CL_OTA_BUFFERS, image_size, flash_timing.sector_erase_us / 1e3,
+				 flash_timing.block_erase_us / 1e3, flash_timing.page_write_us / 1e3);
+
+	// an image that doesn't match its hash is written but never booted
+	connect_central(true);
+	open_channel();
+	uint8_t bad_hash[CL_OTA_HASH_LEN];
+	memcpy(bad_hash, hash, sizeof(bad_hash));
+	bad_hash[0] ^= 0x01;
+	begin(BAD_IMAGE_SIZE, bad_hash);
+	CHECK(rx.status == ESP_OK && rx.offset == 0, "bad update not started: %s", esp_err_to_name(rx.status));
+	send_image(image, 0, BAD_IMAGE_SIZE);
+	wait_done();
+	CHECK(rx.done_status == ESP_ERR_INVALID_CRC, "bad image verified with %s", esp_err_to_name(rx.done_status));
+	CHECK(esp_ota_get_boot_partition() == ota_0, "bad image made bootable");
+	uint8_t apply = CL_BLE_OTA_OP_APPLY;
+	request(&apply, sizeof(apply));
+	CHECK(rx.status == ESP_ERR_INVALID_STATE, "bad image applied");
+	disconnect_central();
+
+	// the hash comes from the central, the signature is what lets an image boot
+	connect_central(true);
+	open_channel();
+	uint8_t unsigned_hash[CL_OTA_HASH_LEN];
+	mbedtls_sha256(image, BAD_IMAGE_SIZE, unsigned_hash, 0);
+	begin(BAD_IMAGE_SIZE, unsigned_hash);
+	CHECK(rx.status == ESP_OK && rx.offset == 0, "unsigned update not started: %s", esp_err_to_name(rx.status));
+	send_image(image, 0, BAD_IMAGE_SIZE);
+	wait_done();
+	CHECK(rx.done_status == ESP_ERR_OTA_VALIDATE_FAILED, "unsigned image verified with %s", esp_err_to_name(rx.done_status));
+	CHECK(esp_ota_get_boot_partition() == ota_0, "unsigned image made bootable");
+	disconnect_central();
+
+	// the image, cut short by a disconnection
+	connect_central(true);
+	open_channel();
+	int64_t start_us = host_rtos_time_us();
+	begin(image_size, hash);
+	CHECK(rx.status == ESP_OK && rx.offset == 0, "update not started: %s", esp_err_to_name(rx.status));
+	uint32_t drop = image_size / 100 * DROP_PERCENT / CL_OTA_CHUNK_SIZE * CL_OTA_CHUNK_SIZE;
+	send_image(image, 0, drop);
+	host_rtos_advance_ms(50);
+	int64_t first_us = host_rtos_time_us() - start_us;
+	uint32_t acked = rx.acked;
+	host_ble_link_stats_t link;
+	host_ble_get_link_stats(CENTRAL_CONN, &link);
+	CHECK(link.phy == BLE_GAP_LE_PHY_2M, "update on PHY %d", link.phy);
+	disconnect_central();
+
+	// resumed on a new connection from the bytes received
+	connect_central(true);
+	open_channel();
+	start_us = host_rtos_time_us();
+	begin(image_size, hash);
+	CHECK(rx.status == ESP_OK && rx.offset >= acked && rx.offset <= drop, "resumed at %" PRIu32 ", %" PRIu32 " acked of %" PRIu32 " sent",
+				rx.offset, acked, drop);
+	uint32_t resume = rx.offset;
+	// a chunk out of place is refused with the offset expected
+	uint8_t misplaced[CL_BLE_OTA_HEADER_LEN + 16] = {CL_BLE_OTA_OP_DATA};
+	uint32_t wrong = resume + CL_OTA_CHUNK_SIZE;
+	memcpy(&misplaced[1], &wrong, sizeof(wrong));
+	request(misplaced, sizeof(misplaced));
+	CHECK(rx.status == ESP_ERR_INVALID_ARG && rx.offset == resume, "misplaced chunk answered %s at %" PRIu32,
+				esp_err_to_name(rx.status), rx.offset);
+	send_image(image, resume, image_size);
+	wait_done();
+	int64_t second_us = rx.done_us - start_us;
+	CHECK(rx.done_status == ESP_OK, "update failed: %s", esp_err_to_name(rx.done_status));
+	CHECK(rx.acked == image_size, "%" PRIu32 " bytes acked", rx.acked);
+	cl_ble_conn_info_t info;
+	CHECK(cl_ble_conn_get_info(CENTRAL_CONN, &info) == ESP_OK && info.phase == CL_BLE_CONN_PHASE_FAST,
+				"connection left in phase %d", info.phase);
+
+	uint8_t *slot = malloc(image_size);
+	CHECK(esp_partition_read(ota_1, 0, slot, image_size) == ESP_OK, "slot read");
+	CHECK(memcmp(slot, image, image_size) == 0, "image differs in the slot");
+	free(slot);
+	CHECK(esp_ota_get_boot_partition() == ota_1, "update not bootable");
+
+	// a central that reconnects after the update learns it is done
+	disconnect_central();
+	connect_central(true);
+	open_channel();
+	begin(image_size, hash);
+	CHECK(rx.status == ESP_OK && rx.offset == image_size, "done update resumed at %" PRIu32, rx.offset);
+	wait_done();
+	CHECK(rx.done_status == ESP_OK, "done update reported %s", esp_err_to_name(rx.done_status));
+
+	// not while a claim is pending or the bolt moves, a restart would cut them short
+	const uint8_t owner[16] = {0x42};
+	CHECK(cl_phy_lock_svc_request_claim(owner) == ESP_OK, "claim not requested");
+	host_rtos_wait_idle();
+	request(&apply, sizeof(apply));
+	CHECK(rx.status == ESP_ERR_NOT_FINISHED, "update applied during a claim: %s", esp_err_to_name(rx.status));
+	CHECK(cl_phy_lock_svc_request_release(owner) == ESP_OK, "claim not cancelled");
+	host_rtos_advance_ms(1000);
+	host_rtos_wait_idle();
+	CHECK(!cl_phy_lock_svc_is_busy(), "lock busy in state %d", cl_phy_lock_svc_get_state());
+
+	request(&apply, sizeof(apply));
+	CHECK(rx.status == ESP_OK, "update not applied: %s", esp_err_to_name(rx.status));
+	host_rtos_advance_ms(CL_BLE_OTA_RESTART_MS + 10);
+	host_rtos_wait_idle();
+	CHECK(host_ota_restarts() == 1 && esp_ota_get_running_partition() == ota_1, "not running the update");
+	disconnect_central();
+
+	// the next build as patches: one made against the wrong image, then the right one
+	uint8_t next_hash[CL_OTA_HASH_LEN];
+	mbedtls_sha256(next, next_size, next_hash, 0);
+	delta_encode_stats_t delta;
+	uint8_t *stray = delta_encode(next, next_size, next, next_size, PATCH_WINDOW_BITS, &delta);
+	uint32_t stray_len = delta.patch_len;
+	CHECK(stray_len > CL_OTA_CHUNK_SIZE, "stray patch of %" PRIu32 " bytes", stray_len);
+	uint8_t *patch = delta_encode(image, image_size, next, next_size, PATCH_WINDOW_BITS, &delta);
+	CHECK(stray != NULL && patch != NULL, "patches not made");
+
+	connect_central(true);
+	open_channel();
+	begin_patch(stray_len, next_hash);
+	CHECK(rx.status == ESP_OK && rx.offset == 0, "stray patch not started: %s", esp_err_to_name(rx.status));
+	// refused once its header is in, the central stops at DONE
+	send_image(stray, 0, CL_OTA_CHUNK_SIZE);
+	wait_done();
+	CHECK(rx.done_status == ESP_ERR_INVALID_VERSION, "stray patch ended with %s", esp_err_to_name(rx.done_status));
+	CHECK(esp_ota_get_boot_partition() == ota_1, "stray patch made bootable");
+	disconnect_central();
+
+	connect_central(true);
+	open_channel();
+	start_us = host_rtos_time_us();
+	begin_patch(delta.patch_len, next_hash);
+	CHECK(rx.status == ESP_OK && rx.offset == 0, "patch not started: %s", esp_err_to_name(rx.status));
+	send_image(patch, 0, delta.patch_len);
+	wait_done();
+	int64_t patch_us = rx.done_us - start_us;
+	CHECK(rx.done_status == ESP_OK, "patch failed: %s", esp_err_to_name(rx.done_status));
+	CHECK(rx.acked == delta.patch_len, "%" PRIu32 " bytes of patch acked", rx.acked);
+	slot = malloc(next_size);
+	CHECK(esp_partition_read(ota_0, 0, slot, next_size) == ESP_OK, "slot read");
+	CHECK(memcmp(slot, next, next_size) == 0, "patched image differs in the slot");
+	free(slot);
+	CHECK(esp_ota_get_boot_partition() == ota_0, "patched image not bootable");
+	disconnect_central();
+	host_heap_stats_t psram;
+	host_heap_get_stats(&psram);
+	CHECK(psram.peak == (1u << PATCH_WINDOW_BITS) + CL_OTA_CHUNK_SIZE && psram.used == 0,
+				"%zu bytes of PSRAM at most, %zu left", psram.peak, psram.used);
+
+	cl_ota_stats_t ota;
+	cl_ota_get_stats(&ota);
+	cl_ble_ota_stats_t channel;
+	cl_ble_ota_get_stats(&channel);
+	host_partition_stats_t flash;
+	host_partition_get_stats(&flash);
+	double sent = drop + (image_size - resume);
+	double elapsed_s = (first_us + second_us) / 1e6;
+	double rate = sent / elapsed_s;
+	printf("update: %" PRIu32 " bytes in %.2f s over 2 connections, resumed at %" PRIu32 " of %" PRIu32 " sent, "
+				 "%.1f kB/s\n",
+				 image_size, elapsed_s, resume, drop, rate / 1e3);
+	printf("worker: %" PRIu32 " started, %" PRIu32 " resumed, %" PRIu32 " done, %" PRIu32 " failed, %" PRIu32
+				 " chunks, erase %.2f s, write %.2f s, idle %.2f s\n",
+				 ota.started, ota.resumed, ota.done, ota.failed, ota.chunks, ota.erase_us / 1e6, ota.write_us / 1e6,
+				 ota.idle_us / 1e6);
+	printf("channel: %" PRIu32 " channels, %" PRIu32 " refused, %" PRIu32 " requests, %" PRIu32 " rejected, %" PRIu32
+				 " deferred buffers, %" PRIu32 " responses, %" PRIu32 " stalls; %" PRIu32 " of %d mbufs used at most\n",
+				 channel.channels, channel.refused, channel.requests, channel.rejected, channel.deferred, channel.responses,
+				 channel.stalls, link.mbufs_peak, CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT + CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT);
+	double full_s = HOST_PARTITION_APP_SIZE / rate;
+	printf("projected: %d-byte image filling the slot in %.0f s (%.1f min)\n", HOST_PARTITION_APP_SIZE, full_s, full_s / 60);
+	printf("patch: %zu bytes for the %" PRIu32 "-byte next build, %.1f%% of it, %" PRIu32 " records, %zu bytes of delta; "
+				 "rebuilt in %.2f s against %.2f s for the image at the rate above, %zu bytes of PSRAM\n",
+				 delta.patch_len, next_size, 100.0 * delta.patch_len / next_size, delta.records, delta.delta_len,
+				 patch_us / 1e6, next_size / rate, psram.peak);
+
+	CHECK(ota.started == 5 && ota.resumed == 1 && ota.done == 2 && ota.failed == 3, "unexpected update counters");
+	CHECK(ota.patched == 1 && ota.rebuilt == next_size, "%" PRIu32 " patched, %" PRIu32 " bytes rebuilt", ota.patched,
+				ota.rebuilt);
+	CHECK(channel.refused == 1 && channel.rejected == 3, "unexpected channel counters");
+	CHECK(flash.busy_us > 0, "flash timing not applied");
+	free(stray);
+	free(patch);
+	free(next);
+	free(image);
+	return 0;
+}
@@ -0,0 +1,166 @@
+// Library
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Host stand-ins
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+// Local
+#include "check.h"
+#include "cl_persist.h"
+
+/**
+ * Persistence worker commit test.
+ *
+ * Queues a batch of records over two namespaces and fails NVS in the middle of its commit, after the journal and the
+ * records of the first namespace: the records must be left half written, then a restart of the worker must replay
+ * the journal and find them all. A batch failing on the journal itself must leave every record as it was, and one
+ * committed whole must leave no journal behind.
+ *
+ * Usage: persist_test [log level 0-5]
+ */
+
+#define NS_A "test_a"
+#define NS_B "test_b"
+#define BATCH_LEN 3
+
+/**
+ * A record of the batch, committed in queue order: both of NS_A first, with one commit, then the one of NS_B.
+ */
+typedef struct
+{
+	const char *ns;
+	const char *key;
+} record_key_t;
+
+static const record_key_t batch[BATCH_LEN] = {{NS_A, "first"}, {NS_B, "second"}, {NS_A, "third"}};
+
+static const char *batch_value = NULL; //!< Value the trigger queues the batch with
+static esp_err_t results[BATCH_LEN];
+static int completed = 0;
+
+static void record_done(esp_err_t result, void *arg)
+{
+	results[(intptr_t)arg] = result;
+	completed++;
+}
+
+/**
+ * Completion of the trigger record, on the worker task: the batch is queued before the worker takes the next one, so
+ * it is committed as a single batch.
+ */
+static void queue_batch(esp_err_t result, void *arg)
+{
+	(void)result;
+	(void)arg;
+	for (intptr_t i = 0; i < BATCH_LEN; i++)
+	{
+		CHECK(cl_persist_write(batch[i].ns, batch[i].key, batch_value, strlen(batch_value) + 1, record_done, (void *)i) == ESP_OK,
+					"write %s", batch[i].key);
+	}
+}
+
+/**
+ * Queue the batch with a value, failing the NVS set operations from the `after`-th one on, and wait for its commit.
+ */
+static void commit_batch(const char *value, uint32_t after, uint32_t failures)
+{
+	batch_value = value;
+	completed = 0;
+	host_nvs_fail_writes_after(after, failures, ESP_FAIL);
+	CHECK(cl_persist_write(NS_A, "trigger", "", 1, queue_batch, NULL) == ESP_OK, "write trigger");
+	host_rtos_wait_idle();
+	host_nvs_fail_writes(0, ESP_OK);
+	CHECK(completed == BATCH_LEN, "%d records completed", completed);
+}
+
+/**
+ * Value of a record in NVS, "" if missing or if its namespace is empty.
+ */
+static const char *read_value(const char *ns, const char *key)
+{
+	static char value[CL_PERSIST_MAX_LEN];
+	nvs_handle_t handle;
+	size_t len = sizeof(value);
+	value[0] = '\0';
+	if (nvs_open(ns, NVS_READONLY, &handle) != ESP_OK)
+	{
+		return value;
+	}
+	if (nvs_get_blob(handle, key, value, &len) != ESP_OK)
+	{
+		value[0] = '\0';
+	}
+	nvs_close(handle);
+	return value;
+}
+
+/**
+ * Whether the worker left a batch in its journal.
+ */
+static bool has_journal(void)
+{
+	static uint8_t journal[512];
+	nvs_handle_t handle;
+	size_t len = sizeof(journal);
+	if (nvs_open("PERSIST", NVS_READONLY, &handle) != ESP_OK)
+	{
+		return false;
+	}
+	esp_err_t ret = nvs_get_blob(handle, "JOURNAL", journal, &len);
+	nvs_close(handle);
+	return ret == ESP_OK;
+}
+
+static void check_batch(const char *expected[BATCH_LEN], const char *what)
+{
+	for (int i = 0; i < BATCH_LEN; i++)
+	{
+		const char *value = read_value(batch[i].ns, batch[i].key);
+		CHECK(strcmp(value, expected[i]) == 0, "%s: %s.%s is \"%s\", not \"%s\"", what, batch[i].ns, batch[i].key, value,
+					expected[i]);
+	}
+}
+
+static void restart(void)
+{
+	CHECK(cl_persist_deinit() == ESP_OK, "deinit");
+	CHECK(cl_persist_init() == ESP_OK, "init");
+}
+
+int main(int argc, char **argv)
+{
+	esp_log_level_set("*", argc > 1 ? (esp_log_level_t)atoi(argv[1]) : ESP_LOG_WARN);
+	host_nvs_reset();
+	CHECK(cl_persist_init() == ESP_OK, "init");
+
+	// committed whole: the journal goes once the records are written
+	commit_batch("old", 0, 0);
+	check_batch((const char *[]){"old", "old", "old"}, "committed");
+	CHECK(results[0] == ESP_OK && results[1] == ESP_OK && results[2] == ESP_OK, "commit failed");
+	cl_persist_stats_t stats;
+	cl_persist_get_stats(&stats);
+	CHECK(stats.journaled == 1 && stats.failures == 0, "%u batches journaled, %u failed", (unsigned)stats.journaled,
+				(unsigned)stats.failures);
+	CHECK(!has_journal(), "journal left after a commit");
+
+	// failing on the journal: none of the records is written, and nothing is replayed
+	commit_batch("lost", 1, 1);
+	CHECK(results[0] == ESP_FAIL && results[1] == ESP_FAIL && results[2] == ESP_FAIL, "failure not reported");
+	restart();
+	check_batch((const char *[]){"old", "old", "old"}, "failed journal");
+
+	// failing after the journal and the first namespace: the batch is torn until the replay
+	commit_batch("new", 1 + 1 + 2, 1);
+	CHECK(results[0] == ESP_FAIL && results[1] == ESP_FAIL && results[2] == ESP_FAIL, "failure not reported");
+	check_batch((const char *[]){"new", "old", "new"}, "torn batch");
+	CHECK(has_journal(), "no journal to replay");
+	restart();
+	check_batch((const char *[]){"new", "new", "new"}, "replayed batch");
+	CHECK(!has_journal(), "journal left after the replay");
+
+	printf("persist: a batch of %d records over 2 namespaces committed whole, dropped whole and replayed\n", BATCH_LEN);
+	return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef _HOST_DRIVER_GPIO_H_
+#define _HOST_DRIVER_GPIO_H_
+
+/**
+ * Host stand-in for the ESP-IDF GPIO driver.
+ * Input levels are scripted by the simulation with host_gpio_drive, which also runs the registered ISR handler
+ * in the calling thread when the edge matches the configured interrupt type, as the GPIO ISR service would.
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum
+{
+	GPIO_NUM_NC = -1,
+	GPIO_NUM_0 = 0,
+	GPIO_NUM_1 = 1,
+	GPIO_NUM_2 = 2,
+	GPIO_NUM_3 = 3,
+	GPIO_NUM_4 = 4,
+	GPIO_NUM_5 = 5,
+	GPIO_NUM_6 = 6,
+	GPIO_NUM_7 = 7,
+	GPIO_NUM_8 = 8,
+	GPIO_NUM_9 = 9,
+	GPIO_NUM_10 = 10,
+	GPIO_NUM_11 = 11,
+	GPIO_NUM_12 = 12,
+	GPIO_NUM_13 = 13,
+	GPIO_NUM_14 = 14,
+	GPIO_NUM_15 = 15,
+	GPIO_NUM_16 = 16,
+	GPIO_NUM_17 = 17,
+	GPIO_NUM_18 = 18,
+	GPIO_NUM_19 = 19,
+	GPIO_NUM_20 = 20,
+	GPIO_NUM_21 = 21,
+	GPIO_NUM_22 = 22,
+	GPIO_NUM_23 = 23,
+	GPIO_NUM_24 = 24,
+	GPIO_NUM_25 = 25,
+	GPIO_NUM_26 = 26,
+	GPIO_NUM_27 = 27,
+	GPIO_NUM_28 = 28,
+	GPIO_NUM_29 = 29,
+	GPIO_NUM_30 = 30,
+	GPIO_NUM_31 = 31,
+	GPIO_NUM_32 = 32,
+	GPIO_NUM_33 = 33,
+	GPIO_NUM_34 = 34,
+	GPIO_NUM_35 = 35,
+	GPIO_NUM_36 = 36,
+	GPIO_NUM_37 = 37,
+	GPIO_NUM_38 = 38,
+	GPIO_NUM_39 = 39,
+	GPIO_NUM_40 = 40,
+	GPIO_NUM_41 = 41,
+	GPIO_NUM_42 = 42,
+	GPIO_NUM_43 = 43,
+	GPIO_NUM_44 = 44,
+	GPIO_NUM_45 = 45,
+	GPIO_NUM_46 = 46,
+	GPIO_NUM_47 = 47,
+	GPIO_NUM_48 = 48,
+	GPIO_NUM_MAX,
+} gpio_num_t;
+
+typedef enum
+{
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT = 1,
+	GPIO_MODE_OUTPUT = 2,
+	GPIO_MODE_INPUT_OUTPUT = 3,
+} gpio_mode_t;
+
+typedef enum
+{
+	GPIO_PULLUP_ONLY,
+	GPIO_PULLDOWN_ONLY,
+	GPIO_PULLUP_PULLDOWN,
+	GPIO_FLOATING,
+} gpio_pull_mode_t;
+
+typedef enum
+{
+	GPIO_INTR_DISABLE = 0,
+	GPIO_INTR_POSEDGE = 1,
+	GPIO_INTR_NEGEDGE = 2,
+	GPIO_INTR_ANYEDGE = 3,
+	GPIO_INTR_LOW_LEVEL = 4,
+	GPIO_INTR_HIGH_LEVEL = 5,
+} gpio_int_type_t;
+
+typedef void (*gpio_isr_t)(void *arg);
+
+extern esp_err_t gpio_reset_pin(gpio_num_t gpio_num);
+extern esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+extern esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull);
+extern esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+extern esp_err_t gpio_intr_enable(gpio_num_t gpio_num);
+extern esp_err_t gpio_intr_disable(gpio_num_t gpio_num);
+extern esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+extern int gpio_get_level(gpio_num_t gpio_num);
+extern esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+extern esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args);
+extern esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num);
+extern esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+extern esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num);
+extern esp_err_t gpio_sleep_sel_dis(gpio_num_t gpio_num);
+
+/**
+ * Reset every pin to a floating low input without interrupt handlers.
+ */
+extern void host_gpio_reset(void);
+
+/**
+ * Drive the external level of an input pin and raise its interrupt if the edge matches.
+ *
+ * @param gpio_num The pin to drive.
+ * @param level The new level, 0 or 1.
+ */
+extern void host_gpio_drive(gpio_num_t gpio_num, uint32_t level);
+
+/**
+ * Read back the level last set on an output pin.
+ */
+extern uint32_t host_gpio_get_output(gpio_num_t gpio_num);
+
+/**
+ * Whether light sleep isolates the pin, as CONFIG_PM_SLP_DISABLE_GPIO does to every pin not released with
+ * gpio_sleep_sel_dis.
+ */
+extern int host_gpio_sleep_isolated(gpio_num_t gpio_num);
+
+#endif // _HOST_DRIVER_GPIO_H_
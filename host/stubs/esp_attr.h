@@ -0,0 +1,13 @@
+#ifndef _HOST_ESP_ATTR_H_
+#define _HOST_ESP_ATTR_H_
+
+/**
+ * Host stand-in for the ESP-IDF placement attributes, there is no IRAM or RTC memory on the host.
+ */
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif // _HOST_ESP_ATTR_H_
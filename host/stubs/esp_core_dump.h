@@ -0,0 +1,14 @@
+#ifndef _HOST_ESP_CORE_DUMP_H_
+#define _HOST_ESP_CORE_DUMP_H_
+
+/**
+ * Host stand-in for esp_core_dump: the image saved in the coredump partition starts with its total length, a test
+ * writes one with esp_partition_write.
+ */
+
+#include <stddef.h>
+#include "esp_err.h"
+
+extern esp_err_t esp_core_dump_image_get(size_t *out_addr, size_t *out_size);
+
+#endif // _HOST_ESP_CORE_DUMP_H_
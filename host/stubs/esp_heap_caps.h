@@ -0,0 +1,34 @@
+#ifndef _HOST_ESP_HEAP_CAPS_H_
+#define _HOST_ESP_HEAP_CAPS_H_
+
+/**
+ * Host stand-in for esp_heap_caps: allocations come from malloc, those asking for PSRAM are counted so the
+ * simulation can check how much external RAM a module takes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+extern void *heap_caps_malloc(size_t size, uint32_t caps);
+extern void heap_caps_free(void *ptr);
+
+/**
+ * PSRAM counters of the stand-in.
+ */
+typedef struct
+{
+	uint32_t allocs; //!< Allocations asking for MALLOC_CAP_SPIRAM
+	size_t used;		 //!< Bytes of them not freed yet
+	size_t peak;		 //!< Most bytes used at once
+} host_heap_stats_t;
+
+/**
+ * Read the PSRAM counters since start.
+ */
+extern void host_heap_get_stats(host_heap_stats_t *stats);
+
+#endif // _HOST_ESP_HEAP_CAPS_H_
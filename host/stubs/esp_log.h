@@ -0,0 +1,58 @@
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+/**
+ * Host stand-in for the ESP-IDF logging macros.
+ * Lines are printed to stderr when their level is enabled with esp_log_level_set, nothing is printed by default
+ * so the simulation loops are not dominated by I/O. The arguments are not evaluated for filtered out lines.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+
+typedef enum
+{
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#endif
+
+extern esp_log_level_t host_log_level;
+
+extern void esp_log_level_set(const char *tag, esp_log_level_t level);
+extern esp_log_level_t esp_log_level_get(const char *tag);
+extern void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+extern uint32_t esp_log_timestamp(void);
+
+#define ESP_LOG_LEVEL(level, tag, format, ...)                                           \
+	do                                                                                     \
+	{                                                                                      \
+		if (host_log_level >= (level))                                                       \
+		{                                                                                    \
+			esp_log_write(level, tag, "(%" PRIu32 ") %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__); \
+		}                                                                                    \
+	} while (0)
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)  \
+	do                                                  \
+	{                                                   \
+		if (LOG_LOCAL_LEVEL >= (level))                   \
+		{                                                 \
+			ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__); \
+		}                                                 \
+	} while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif // _HOST_ESP_LOG_H_
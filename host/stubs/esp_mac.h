@@ -0,0 +1,32 @@
+#ifndef _HOST_ESP_MAC_H_
+#define _HOST_ESP_MAC_H_
+
+/**
+ * Host stand-in for esp_mac: a fixed base MAC, the Bluetooth one is derived from it as on the ESP32-S3.
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum
+{
+	ESP_MAC_WIFI_STA,
+	ESP_MAC_WIFI_SOFTAP,
+	ESP_MAC_BT,
+	ESP_MAC_ETH,
+} esp_mac_type_t;
+
+#define HOST_BASE_MAC {0x24, 0x0A, 0xC4, 0x12, 0x34, 0x56} //!< Base MAC of the simulated chip
+
+static inline esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+	const uint8_t base[6] = HOST_BASE_MAC;
+	for (int i = 0; i < 6; i++)
+	{
+		mac[i] = base[i];
+	}
+	mac[5] += type;
+	return ESP_OK;
+}
+
+#endif // _HOST_ESP_MAC_H_
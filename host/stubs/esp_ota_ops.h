@@ -0,0 +1,56 @@
+#ifndef _HOST_ESP_OTA_OPS_H_
+#define _HOST_ESP_OTA_OPS_H_
+
+/**
+ * Host stand-in for esp_ota_ops over the ota_0/ota_1 partitions of esp_partition.h. The device runs from ota_0 until
+ * esp_restart() boots the partition set with esp_ota_set_boot_partition(). esp_ota_end() checks the magic byte of the
+ * image header and, with CONFIG_SECURE_SIGNED_ON_UPDATE, its signature: the last HOST_OTA_SIGNATURE_LEN bytes stand
+ * in for the RSA-PSS signature block and must be the SHA-256 of HOST_OTA_SIGNING_KEY then the rest of the image, see
+ * host_ota_sign(). The chip also verifies the checksum and appended hash.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define ESP_ERR_OTA_BASE 0x1500
+#define ESP_ERR_OTA_PARTITION_CONFLICT (ESP_ERR_OTA_BASE + 0x01)
+#define ESP_ERR_OTA_SELECT_INFO_INVALID (ESP_ERR_OTA_BASE + 0x02)
+#define ESP_ERR_OTA_VALIDATE_FAILED (ESP_ERR_OTA_BASE + 0x03)
+
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+
+#define HOST_OTA_IMAGE_MAGIC 0xE9 //!< First byte of an application image
+#define HOST_OTA_SIGNATURE_LEN 32	//!< Signature at the end of the image
+#define HOST_OTA_SIGNING_KEY "cubelock-host-signing-key"
+
+typedef uint32_t esp_ota_handle_t;
+
+extern const esp_partition_t *esp_ota_get_running_partition(void);
+extern const esp_partition_t *esp_ota_get_boot_partition(void);
+extern const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+extern esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle);
+extern esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+extern esp_err_t esp_ota_end(esp_ota_handle_t handle);
+extern esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+extern esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+extern esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+
+/**
+ * Sign an image as the build does with the signing key: its last HOST_OTA_SIGNATURE_LEN bytes are overwritten.
+ */
+extern void host_ota_sign(uint8_t *image, size_t size);
+
+/**
+ * Restarts done with esp_restart() since the last host_partition_reset().
+ */
+extern uint32_t host_ota_restarts(void);
+
+/**
+ * Run from ota_0 again with no update in progress, called by host_partition_reset().
+ */
+extern void host_ota_reset(void);
+
+#endif // _HOST_ESP_OTA_OPS_H_
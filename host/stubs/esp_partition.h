@@ -0,0 +1,95 @@
+#ifndef _HOST_ESP_PARTITION_H_
+#define _HOST_ESP_PARTITION_H_
+
+/**
+ * Host stand-in for esp_partition, backed by in-memory NOR flash: erasing sets whole sectors to 0xFF and writing
+ * can only clear bits, as on the chip. The data partitions are shrunk so that the simulation wraps them quickly.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define HOST_PARTITION_SECTOR_SIZE 4096
+#define HOST_PARTITION_SPIFFS_SIZE 0x10000 //!< 16 sectors instead of the 1 MB of partitions/custom.csv
+#define HOST_PARTITION_COREDUMP_SIZE 0x10000 //!< As partitions/custom.csv
+#define HOST_PARTITION_APP_SIZE 0x600000			//!< As partitions/custom.csv, allocated when first used
+#define HOST_PARTITION_BLOCK_SIZE 0x10000			//!< Erase unit of the block erase command
+#define HOST_PARTITION_PAGE_SIZE 256					//!< Program unit
+
+typedef enum
+{
+	ESP_PARTITION_TYPE_APP = 0x00,
+	ESP_PARTITION_TYPE_DATA = 0x01,
+	ESP_PARTITION_TYPE_ANY = 0xff,
+} esp_partition_type_t;
+
+typedef enum
+{
+	ESP_PARTITION_SUBTYPE_APP_FACTORY = 0x00,
+	ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+	ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11,
+	ESP_PARTITION_SUBTYPE_DATA_OTA = 0x00,
+	ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+	ESP_PARTITION_SUBTYPE_DATA_COREDUMP = 0x03,
+	ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+	ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct
+{
+	esp_partition_type_t type;
+	esp_partition_subtype_t subtype;
+	uint32_t address;
+	uint32_t size;
+	uint32_t erase_size;
+	char label[17];
+	bool encrypted;
+	bool readonly;
+} esp_partition_t;
+
+extern const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+extern esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+extern esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+extern esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+/**
+ * Flash traffic counters of the in-memory partitions.
+ */
+typedef struct
+{
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t erases; //!< Sectors erased
+	int64_t busy_us; //!< Time spent erasing and writing
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+} host_partition_stats_t;
+
+/**
+ * Time the flash chip is busy, the calling task blocks for it in simulated time. All zero unless set.
+ */
+typedef struct
+{
+	uint32_t sector_erase_us; //!< Erasing a sector
+	uint32_t block_erase_us;	//!< Erasing an aligned block, as esp_partition_erase_range() does where it can
+	uint32_t page_write_us;		//!< Programming a page, or a part of it
+} host_partition_timing_t;
+
+/**
+ * Set the time flash operations take from now on.
+ */
+extern void host_partition_set_timing(const host_partition_timing_t *timing);
+
+/**
+ * Fill every partition with 0xFF, as erased flash, reset the counters, the timing and the OTA state.
+ */
+extern void host_partition_reset(void);
+
+/**
+ * Read the flash traffic counters since the last reset.
+ */
+extern void host_partition_get_stats(host_partition_stats_t *stats);
+
+#endif // _HOST_ESP_PARTITION_H_
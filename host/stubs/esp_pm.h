@@ -0,0 +1,40 @@
+#ifndef _HOST_ESP_PM_H_
+#define _HOST_ESP_PM_H_
+
+/**
+ * Host stand-in for esp_pm.
+ * Locks only count their holds, so the simulation can check that every acquire has its release.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum
+{
+	ESP_PM_CPU_FREQ_MAX,
+	ESP_PM_APB_FREQ_MAX,
+	ESP_PM_NO_LIGHT_SLEEP,
+} esp_pm_lock_type_t;
+
+typedef struct
+{
+	int max_freq_mhz;
+	int min_freq_mhz;
+	bool light_sleep_enable;
+} esp_pm_config_t;
+
+typedef struct esp_pm_lock *esp_pm_lock_handle_t;
+
+extern esp_err_t esp_pm_configure(const void *config);
+extern esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle);
+extern esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle);
+extern esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle);
+extern esp_err_t esp_pm_lock_delete(esp_pm_lock_handle_t handle);
+
+/**
+ * Number of holds of every lock created so far, 0 once each acquire is released.
+ */
+extern uint32_t host_pm_held(void);
+
+#endif // _HOST_ESP_PM_H_
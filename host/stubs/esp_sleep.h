@@ -0,0 +1,15 @@
+#ifndef _HOST_ESP_SLEEP_H_
+#define _HOST_ESP_SLEEP_H_
+
+/**
+ * Host stand-in for esp_sleep: the simulated chip never sleeps, the wake sources only need to be accepted.
+ */
+
+#include "esp_err.h"
+
+static inline esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+	return ESP_OK;
+}
+
+#endif // _HOST_ESP_SLEEP_H_
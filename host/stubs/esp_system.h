@@ -0,0 +1,11 @@
+#ifndef _HOST_ESP_SYSTEM_H_
+#define _HOST_ESP_SYSTEM_H_
+
+/**
+ * Host stand-in for esp_system: esp_restart() returns, after making the boot partition the running one, see
+ * esp_ota_ops.h.
+ */
+
+extern void esp_restart(void);
+
+#endif // _HOST_ESP_SYSTEM_H_
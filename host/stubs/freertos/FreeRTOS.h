@@ -0,0 +1,62 @@
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+/**
+ * Host stand-in for FreeRTOS.
+ * Tasks run as POSIX threads while the tick count is simulated: it only moves when the simulation calls
+ * host_rtos_advance_ms, which makes debounce windows and timeouts deterministic and instantaneous.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <pthread.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define errQUEUE_EMPTY ((BaseType_t)0)
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define configTICK_RATE_HZ 1000
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+#define pdTICKS_TO_MS(xTicks) ((TickType_t)(((uint64_t)(xTicks) * (uint64_t)1000U) / (uint64_t)configTICK_RATE_HZ))
+
+#define configASSERT(x) assert(x)
+
+#define portYIELD_FROM_ISR(x) ((void)(x))
+
+// critical sections only have to exclude the other threads, a mutex is enough on the host
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+#define portENTER_CRITICAL_ISR(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL_ISR(mux) pthread_mutex_unlock(mux)
+
+/**
+ * Advance the simulated time, waking every task whose timeout expired on the way.
+ *
+ * @param ms Number of milliseconds to advance.
+ */
+extern void host_rtos_advance_ms(uint32_t ms);
+
+/**
+ * Block until every task is waiting on a queue, semaphore or notification with nothing left to process.
+ */
+extern void host_rtos_wait_idle(void);
+
+/**
+ * Current simulated time in microseconds.
+ */
+extern int64_t host_rtos_time_us(void);
+
+#endif // _HOST_FREERTOS_H_
@@ -0,0 +1,17 @@
+#ifndef _HOST_FREERTOS_QUEUE_H_
+#define _HOST_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue *QueueHandle_t;
+
+extern QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+extern BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+extern BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken);
+extern BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+extern UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+extern void vQueueDelete(QueueHandle_t xQueue);
+
+#define xQueueSendToBack(q, item, wait) xQueueSend(q, item, wait)
+
+#endif // _HOST_FREERTOS_QUEUE_H_
@@ -0,0 +1,20 @@
+#ifndef _HOST_FREERTOS_TASK_H_
+#define _HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+extern BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *const pcName, const uint32_t usStackDepth,
+															void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pvCreatedTask);
+extern void vTaskDelete(TaskHandle_t xTaskToDelete); //!< Only for the calling task, with NULL or its handle
+extern TickType_t xTaskGetTickCount(void);
+extern void vTaskDelay(const TickType_t xTicksToDelay);
+
+extern uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+extern BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+extern void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken);
+extern TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+#endif // _HOST_FREERTOS_TASK_H_
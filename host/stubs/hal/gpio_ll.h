@@ -0,0 +1,20 @@
+#ifndef _HOST_HAL_GPIO_LL_H_
+#define _HOST_HAL_GPIO_LL_H_
+
+/**
+ * Host stand-in for the GPIO low-level layer, the register accesses ISRs use in place of the driver. They act on the
+ * pins of the host GPIO driver.
+ */
+
+#include <stdint.h>
+#include "driver/gpio.h"
+
+typedef struct gpio_dev_t gpio_dev_t;
+
+#define GPIO_PORT_0 0
+#define GPIO_LL_GET_HW(num) ((gpio_dev_t *)NULL)
+
+extern int gpio_ll_get_level(gpio_dev_t *hw, uint32_t gpio_num);
+extern void gpio_ll_set_intr_type(gpio_dev_t *hw, uint32_t gpio_num, gpio_int_type_t intr_type);
+
+#endif // _HOST_HAL_GPIO_LL_H_
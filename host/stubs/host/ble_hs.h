@@ -0,0 +1,808 @@
+#ifndef _HOST_BLE_HS_H_
+#define _HOST_BLE_HS_H_
+
+/**
+ * Host stand-in for the subset of the NimBLE host API used by the GATT services.
+ * Service definitions registered with ble_gatts_add_svcs can be looked up and their access callbacks invoked
+ * with host_ble_gatt_write/host_ble_gatt_read, as a central would through the ATT server.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+// -- STATUS CODES --
+
+#define BLE_HS_EAGAIN 1
+#define BLE_HS_EALREADY 2
+#define BLE_HS_EINVAL 3
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_ENOENT 5
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ENOTSUP 8
+#define BLE_HS_EBADDATA 10
+#define BLE_HS_ETIMEOUT 13
+#define BLE_HS_EDONE 14
+#define BLE_HS_EBUSY 15
+#define BLE_HS_EENCRYPT 25
+#define BLE_HS_ESTALLED 31
+
+#define BLE_HS_FOREVER INT32_MAX
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+
+#define BLE_ATT_ERR_INVALID_HANDLE 0x01
+#define BLE_ATT_ERR_READ_NOT_PERMITTED 0x02
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define BLE_ATT_ERR_INVALID_PDU 0x04
+#define BLE_ATT_ERR_INSUFFICIENT_AUTHEN 0x05
+#define BLE_ATT_ERR_REQ_NOT_SUPPORTED 0x06
+#define BLE_ATT_ERR_INVALID_OFFSET 0x07
+#define BLE_ATT_ERR_INSUFFICIENT_AUTHOR 0x08
+#define BLE_ATT_ERR_PREPARE_QUEUE_FULL 0x09
+#define BLE_ATT_ERR_ATTR_NOT_FOUND 0x0a
+#define BLE_ATT_ERR_ATTR_NOT_LONG 0x0b
+#define BLE_ATT_ERR_INSUFFICIENT_KEY_SZ 0x0c
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN 0x0d
+#define BLE_ATT_ERR_UNLIKELY 0x0e
+#define BLE_ATT_ERR_INSUFFICIENT_ENC 0x0f
+#define BLE_ATT_ERR_UNSUPPORTED_GROUP 0x10
+#define BLE_ATT_ERR_INSUFFICIENT_RES 0x11
+
+// -- MBUFS --
+
+struct os_mbuf
+{
+	uint8_t *om_data;
+	uint16_t om_len;
+	struct
+	{
+		struct os_mbuf *sle_next;
+	} om_next;
+	uint16_t om_size;
+	uint8_t om_pooled; //!< Allocated from the msys pool stand-in: freed with the chain and extended when appending
+	uint8_t om_databuf[512];
+};
+
+#define SLIST_NEXT(elm, field) ((elm)->field.sle_next)
+#define OS_MBUF_PKTLEN(om) host_os_mbuf_pktlen(om)
+
+extern uint16_t host_os_mbuf_pktlen(const struct os_mbuf *om);
+extern int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+extern int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+extern int os_mbuf_free_chain(struct os_mbuf *om);
+extern int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
+extern struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+extern struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+
+// -- UUIDS --
+
+#define BLE_UUID_TYPE_16 16
+#define BLE_UUID_TYPE_32 32
+#define BLE_UUID_TYPE_128 128
+#define BLE_UUID_STR_LEN 37
+
+typedef struct
+{
+	uint8_t type;
+} ble_uuid_t;
+
+typedef struct
+{
+	ble_uuid_t u;
+	uint16_t value;
+} ble_uuid16_t;
+
+typedef struct
+{
+	ble_uuid_t u;
+	uint32_t value;
+} ble_uuid32_t;
+
+typedef struct
+{
+	ble_uuid_t u;
+	uint8_t value[16];
+} ble_uuid128_t;
+
+typedef union
+{
+	ble_uuid_t u;
+	ble_uuid16_t u16;
+	ble_uuid32_t u32;
+	ble_uuid128_t u128;
+} ble_uuid_any_t;
+
+#define BLE_UUID16_INIT(uuid16) {.u = {.type = BLE_UUID_TYPE_16}, .value = (uuid16)}
+#define BLE_UUID128_INIT(uuid128...) {.u = {.type = BLE_UUID_TYPE_128}, .value = {uuid128}}
+#define BLE_UUID16_DECLARE(uuid16) ((ble_uuid_t *)(&(ble_uuid16_t)BLE_UUID16_INIT(uuid16)))
+
+extern int ble_uuid_init_from_buf(ble_uuid_any_t *uuid, const void *buf, size_t len);
+extern int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2);
+
+// -- NPL --
+
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_event
+{
+	ble_npl_event_fn *fn;
+	void *arg;
+	int queued; //!< Set while the event waits in a queue, putting it again is a no-op
+};
+
+struct ble_npl_eventq;
+
+extern void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+extern void *ble_npl_event_get_arg(struct ble_npl_event *ev);
+extern void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+
+// -- ADDRESSES --
+
+#define BLE_ADDR_PUBLIC 0x00
+#define BLE_ADDR_RANDOM 0x01
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t val[6];
+} ble_addr_t;
+
+static inline int ble_addr_cmp(const ble_addr_t *a, const ble_addr_t *b)
+{
+	int type_diff = a->type - b->type;
+	return type_diff != 0 ? type_diff : memcmp(a->val, b->val, sizeof(a->val));
+}
+
+#define BLE_OWN_ADDR_PUBLIC 0x00
+#define BLE_OWN_ADDR_RANDOM 0x01
+
+extern int ble_hs_id_gen_rnd(int nrpa, ble_addr_t *out_addr);
+extern int ble_hs_id_set_rnd(const uint8_t *rnd_addr);
+extern int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type);
+
+// -- GAP --
+
+#define BLE_GAP_EVENT_CONNECT 0
+#define BLE_GAP_EVENT_DISCONNECT 1
+#define BLE_GAP_EVENT_CONN_UPDATE 3
+#define BLE_GAP_EVENT_ADV_COMPLETE 9
+#define BLE_GAP_EVENT_ENC_CHANGE 10
+#define BLE_GAP_EVENT_PASSKEY_ACTION 11
+#define BLE_GAP_EVENT_NOTIFY_TX 13
+#define BLE_GAP_EVENT_SUBSCRIBE 14
+#define BLE_GAP_EVENT_MTU 15
+#define BLE_GAP_EVENT_REPEAT_PAIRING 17
+#define BLE_GAP_EVENT_PHY_UPDATE_COMPLETE 18
+
+#define BLE_GAP_SUBSCRIBE_REASON_WRITE 1
+#define BLE_GAP_SUBSCRIBE_REASON_TERM 2
+#define BLE_GAP_SUBSCRIBE_REASON_RESTORE 3
+
+#define BLE_GAP_REPEAT_PAIRING_RETRY 1
+#define BLE_GAP_REPEAT_PAIRING_IGNORE 2
+
+#define BLE_GAP_LE_PHY_1M 1
+#define BLE_GAP_LE_PHY_2M 2
+#define BLE_GAP_LE_PHY_CODED 3
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_GAP_LE_PHY_CODED_ANY 0
+
+struct ble_gap_sec_state
+{
+	unsigned encrypted : 1;
+	unsigned authenticated : 1;
+	unsigned bonded : 1;
+	unsigned key_size : 5;
+};
+
+struct ble_gap_conn_desc
+{
+	struct ble_gap_sec_state sec_state;
+	ble_addr_t our_id_addr;
+	ble_addr_t peer_id_addr;
+	ble_addr_t our_ota_addr;
+	ble_addr_t peer_ota_addr;
+	uint16_t conn_handle;
+	uint16_t conn_itvl;
+	uint16_t conn_latency;
+	uint16_t supervision_timeout;
+	uint8_t role;
+};
+
+struct ble_gap_upd_params
+{
+	uint16_t itvl_min;
+	uint16_t itvl_max;
+	uint16_t latency;
+	uint16_t supervision_timeout;
+	uint16_t min_ce_len;
+	uint16_t max_ce_len;
+};
+
+struct ble_gap_passkey_params
+{
+	uint8_t action;
+	uint32_t numcmp;
+};
+
+struct ble_gap_event
+{
+	uint8_t type;
+	union
+	{
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+		} connect;
+
+		struct
+		{
+			int reason;
+			struct ble_gap_conn_desc conn;
+		} disconnect;
+
+		struct
+		{
+			uint16_t conn_handle;
+			uint16_t attr_handle;
+			uint8_t reason;
+			uint8_t prev_notify : 1;
+			uint8_t cur_notify : 1;
+			uint8_t prev_indicate : 1;
+			uint8_t cur_indicate : 1;
+		} subscribe;
+
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+			uint16_t attr_handle;
+			uint8_t indication : 1;
+		} notify_tx;
+
+		struct
+		{
+			int reason;
+		} adv_complete;
+
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+		} conn_update;
+
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+		} enc_change;
+
+		struct
+		{
+			struct ble_gap_passkey_params params;
+			uint16_t conn_handle;
+		} passkey;
+
+		struct
+		{
+			uint16_t conn_handle;
+			uint16_t channel_id;
+			uint16_t value;
+		} mtu;
+
+		struct
+		{
+			uint16_t conn_handle;
+			uint8_t cur_key_size;
+			uint8_t cur_authenticated : 1;
+			uint8_t cur_sc : 1;
+			uint8_t new_key_size;
+			uint8_t new_authenticated : 1;
+			uint8_t new_sc : 1;
+			uint8_t new_bonding : 1;
+		} repeat_pairing;
+
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+			uint8_t tx_phy;
+			uint8_t rx_phy;
+		} phy_updated;
+	};
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+extern int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+extern int ble_gap_conn_find_by_addr(const ble_addr_t *addr, struct ble_gap_conn_desc *out_desc);
+extern int ble_gap_security_initiate(uint16_t conn_handle);
+extern int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params);
+extern int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time);
+extern int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts);
+
+// -- ADVERTISING --
+
+#define BLE_HS_ADV_MAX_SZ 31
+#define BLE_HS_ADV_TYPE_FLAGS 0x01
+#define BLE_HS_ADV_TYPE_COMP_NAME 0x09
+#define BLE_HS_ADV_TYPE_TX_PWR_LVL 0x0a
+#define BLE_HS_ADV_TYPE_MFG_DATA 0xff
+#define BLE_HS_ADV_F_DISC_GEN 0x02
+#define BLE_HS_ADV_F_BREDR_UNSUP 0x04
+#define BLE_HS_ADV_TX_PWR_LVL_AUTO (-128)
+
+#define BLE_GAP_CONN_MODE_NON 0
+#define BLE_GAP_CONN_MODE_UND 2
+#define BLE_GAP_DISC_MODE_NON 0
+#define BLE_GAP_DISC_MODE_GEN 2
+#define BLE_HCI_SCAN_FILT_NO_WL 0
+
+struct ble_hs_adv_fields
+{
+	uint8_t flags;
+	const uint8_t *name;
+	uint8_t name_len;
+	unsigned name_is_complete : 1;
+	int8_t tx_pwr_lvl;
+	unsigned tx_pwr_lvl_is_present : 1;
+	const uint8_t *mfg_data;
+	uint8_t mfg_data_len;
+};
+
+struct ble_gap_adv_params
+{
+	uint8_t conn_mode;
+	uint8_t disc_mode;
+	uint16_t itvl_min;
+	uint16_t itvl_max;
+	uint8_t channel_map;
+	uint8_t filter_policy;
+	uint8_t high_duty_cycle : 1;
+};
+
+extern int ble_gap_adv_set_data(const uint8_t *data, int data_len);
+extern int ble_gap_adv_rsp_set_data(const uint8_t *data, int data_len);
+extern int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields);
+extern int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+														 const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg);
+extern int ble_gap_adv_stop(void);
+extern int ble_gap_adv_active(void);
+
+// -- GATT CLIENT --
+
+struct ble_gatt_error;
+typedef int ble_gatt_mtu_fn(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg);
+
+extern int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb, void *cb_arg);
+
+// -- L2CAP CONNECTION-ORIENTED CHANNELS --
+
+#define BLE_L2CAP_EVENT_COC_CONNECTED 0
+#define BLE_L2CAP_EVENT_COC_DISCONNECTED 1
+#define BLE_L2CAP_EVENT_COC_ACCEPT 2
+#define BLE_L2CAP_EVENT_COC_DATA_RECEIVED 3
+#define BLE_L2CAP_EVENT_COC_TX_UNSTALLED 4
+
+struct ble_l2cap_chan;
+
+struct ble_l2cap_chan_info
+{
+	uint16_t scid;
+	uint16_t dcid;
+	uint16_t our_l2cap_mtu;
+	uint16_t peer_l2cap_mtu;
+	uint16_t psm;
+	uint16_t our_coc_mtu;
+	uint16_t peer_coc_mtu;
+};
+
+struct ble_l2cap_event
+{
+	int type;
+	union
+	{
+		struct
+		{
+			int status;
+			uint16_t conn_handle;
+			struct ble_l2cap_chan *chan;
+		} connect;
+
+		struct
+		{
+			uint16_t conn_handle;
+			struct ble_l2cap_chan *chan;
+		} disconnect;
+
+		struct
+		{
+			uint16_t conn_handle;
+			uint16_t peer_sdu_size;
+			struct ble_l2cap_chan *chan;
+		} accept;
+
+		struct
+		{
+			uint16_t conn_handle;
+			struct ble_l2cap_chan *chan;
+			struct os_mbuf *sdu_rx;
+		} receive;
+
+		struct
+		{
+			uint16_t conn_handle;
+			struct ble_l2cap_chan *chan;
+			int status;
+		} tx_unstalled;
+	};
+};
+
+typedef int ble_l2cap_event_fn(struct ble_l2cap_event *event, void *arg);
+
+extern int ble_l2cap_create_server(uint16_t psm, uint16_t mtu, ble_l2cap_event_fn *cb, void *cb_arg);
+extern int ble_l2cap_send(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_tx);
+extern int ble_l2cap_recv_ready(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_rx);
+extern int ble_l2cap_disconnect(struct ble_l2cap_chan *chan);
+extern int ble_l2cap_get_chan_info(struct ble_l2cap_chan *chan, struct ble_l2cap_chan_info *chan_info);
+
+// -- SECURITY MANAGER --
+
+#define BLE_SM_IO_CAP_NO_IO 0x03
+#define BLE_SM_PAIR_KEY_DIST_ENC 0x01
+#define BLE_SM_PAIR_KEY_DIST_ID 0x02
+
+#define BLE_SM_IOACT_NONE 0
+#define BLE_SM_IOACT_OOB 1
+#define BLE_SM_IOACT_INPUT 2
+#define BLE_SM_IOACT_DISP 3
+#define BLE_SM_IOACT_NUMCMP 4
+
+struct ble_sm_io
+{
+	uint8_t action;
+	union
+	{
+		uint32_t passkey;
+		uint8_t oob[16];
+		uint8_t numcmp_accept;
+	};
+};
+
+extern int ble_sm_inject_io(uint16_t conn_handle, struct ble_sm_io *pkey);
+
+// -- STORE --
+
+#define BLE_STORE_OBJ_TYPE_OUR_SEC 1
+#define BLE_STORE_OBJ_TYPE_PEER_SEC 2
+#define BLE_STORE_OBJ_TYPE_CCCD 3
+
+#define BLE_STORE_EVENT_OVERFLOW 1
+#define BLE_STORE_EVENT_FULL 2
+
+struct ble_store_key_sec
+{
+	ble_addr_t peer_addr;
+	uint8_t idx;
+};
+
+struct ble_store_value_sec
+{
+	ble_addr_t peer_addr;
+	uint8_t key_size;
+	uint8_t ltk[16];
+	unsigned ltk_present : 1;
+	unsigned authenticated : 1;
+	unsigned sc : 1;
+};
+
+struct ble_store_status_event
+{
+	int event_code;
+	union
+	{
+		struct
+		{
+			int obj_type;
+			const void *value;
+		} overflow;
+
+		struct
+		{
+			int obj_type;
+			uint16_t conn_handle;
+		} full;
+	};
+};
+
+typedef int ble_store_status_fn(struct ble_store_status_event *event, void *arg);
+
+extern int ble_store_read_peer_sec(const struct ble_store_key_sec *key_sec, struct ble_store_value_sec *value_sec);
+extern int ble_store_util_delete_peer(const ble_addr_t *peer_id_addr);
+extern int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg);
+
+// -- HOST CONFIGURATION --
+
+typedef void ble_hs_reset_fn(int reason);
+typedef void ble_hs_sync_fn(void);
+
+struct ble_hs_cfg
+{
+	ble_hs_reset_fn *reset_cb;
+	ble_hs_sync_fn *sync_cb;
+	uint8_t sm_io_cap;
+	unsigned sm_bonding : 1;
+	unsigned sm_mitm : 1;
+	unsigned sm_sc : 1;
+	uint8_t sm_our_key_dist;
+	uint8_t sm_their_key_dist;
+	ble_store_status_fn *store_status_cb;
+	void *store_status_arg;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
+
+// -- GATT SERVER --
+
+#define BLE_ATT_F_READ 0x01
+#define BLE_ATT_F_WRITE 0x02
+#define BLE_ATT_F_READ_ENC 0x04
+#define BLE_ATT_F_READ_AUTHEN 0x08
+#define BLE_ATT_F_READ_AUTHOR 0x10
+#define BLE_ATT_F_WRITE_ENC 0x20
+#define BLE_ATT_F_WRITE_AUTHEN 0x40
+#define BLE_ATT_F_WRITE_AUTHOR 0x80
+
+#define BLE_GATT_CHR_F_BROADCAST 0x0001
+#define BLE_GATT_CHR_F_READ 0x0002
+#define BLE_GATT_CHR_F_WRITE_NO_RSP 0x0004
+#define BLE_GATT_CHR_F_WRITE 0x0008
+#define BLE_GATT_CHR_F_NOTIFY 0x0010
+#define BLE_GATT_CHR_F_INDICATE 0x0020
+#define BLE_GATT_CHR_F_AUTH_SIGN_WRITE 0x0040
+#define BLE_GATT_CHR_F_RELIABLE_WRITE 0x0080
+#define BLE_GATT_CHR_F_AUX_WRITE 0x0100
+#define BLE_GATT_CHR_F_READ_ENC 0x0200
+#define BLE_GATT_CHR_F_READ_AUTHEN 0x0400
+#define BLE_GATT_CHR_F_READ_AUTHOR 0x0800
+#define BLE_GATT_CHR_F_WRITE_ENC 0x1000
+#define BLE_GATT_CHR_F_WRITE_AUTHEN 0x2000
+#define BLE_GATT_CHR_F_WRITE_AUTHOR 0x4000
+
+#define BLE_GATT_SVC_TYPE_END 0
+#define BLE_GATT_SVC_TYPE_PRIMARY 1
+#define BLE_GATT_SVC_TYPE_SECONDARY 2
+
+#define BLE_GATT_ACCESS_OP_READ_CHR 0
+#define BLE_GATT_ACCESS_OP_WRITE_CHR 1
+#define BLE_GATT_ACCESS_OP_READ_DSC 2
+#define BLE_GATT_ACCESS_OP_WRITE_DSC 3
+
+struct ble_gatt_access_ctxt;
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+typedef uint16_t ble_gatt_chr_flags;
+
+struct ble_gatt_dsc_def
+{
+	const ble_uuid_t *uuid;
+	uint8_t att_flags;
+	uint8_t min_key_size;
+	ble_gatt_access_fn *access_cb;
+	void *arg;
+};
+
+struct ble_gatt_chr_def
+{
+	const ble_uuid_t *uuid;
+	ble_gatt_access_fn *access_cb;
+	void *arg;
+	struct ble_gatt_dsc_def *descriptors;
+	ble_gatt_chr_flags flags;
+	uint8_t min_key_size;
+	uint16_t *val_handle;
+};
+
+struct ble_gatt_svc_def
+{
+	uint8_t type;
+	const ble_uuid_t *uuid;
+	const struct ble_gatt_svc_def **includes;
+	const struct ble_gatt_chr_def *characteristics;
+};
+
+struct ble_gatt_access_ctxt
+{
+	uint8_t op;
+	struct os_mbuf *om;
+	union
+	{
+		const struct ble_gatt_chr_def *chr;
+		const struct ble_gatt_dsc_def *dsc;
+	};
+};
+
+extern int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs);
+extern int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+extern int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om);
+
+// -- SIMULATION --
+
+/**
+ * Forget every registered service, to be called before the services are initialized again.
+ */
+extern void host_ble_reset(void);
+
+/**
+ * Find a registered characteristic by UUID.
+ */
+extern const struct ble_gatt_chr_def *host_ble_find_chr(const ble_uuid_t *uuid);
+
+/**
+ * Write a value to a characteristic as a central would.
+ * The flags of the characteristic are checked against the security of the connection first, as the ATT server does.
+ *
+ * @return The ATT status returned by the access callback, or the one refusing the write.
+ */
+extern int host_ble_gatt_write(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, const void *data, uint16_t len);
+
+/**
+ * Read a characteristic value as a central would.
+ *
+ * @param out Buffer receiving the value.
+ * @param len In: size of the buffer. Out: length of the value.
+ *
+ * @return The ATT status returned by the access callback, or the one refusing the read.
+ */
+extern int host_ble_gatt_read(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, void *out, uint16_t *len);
+
+/**
+ * Called for every notification sent with ble_gatts_notify_custom.
+ */
+typedef void (*host_ble_notify_cb_t)(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, uint16_t len);
+
+extern void host_ble_set_notify_cb(host_ble_notify_cb_t cb);
+
+/**
+ * Set the handler receiving the GAP events of the simulated connections, standing in for the one passed to
+ * ble_gap_adv_start. As in NimBLE, events are delivered on the host task: the host_ble_* connection functions below
+ * run there and return once the host is idle again.
+ */
+extern void host_ble_set_gap_cb(ble_gap_event_fn *cb, void *cb_arg);
+
+#define HOST_BLE_CONN_ITVL 36		 //!< Interval chosen by the central on connection, 45 ms
+#define HOST_BLE_CENTRAL_MTU 247 //!< ATT MTU offered by the central
+
+/**
+ * Connect a central and deliver BLE_GAP_EVENT_CONNECT.
+ * The connection starts with HOST_BLE_CONN_ITVL and no latency. Parameter updates and the MTU exchange complete on
+ * the NimBLE host task, as they would after a few connection events, with the central accepting the peripheral's
+ * parameters and offering HOST_BLE_CENTRAL_MTU.
+ */
+extern void host_ble_connect(uint16_t conn_handle, const ble_addr_t *peer_addr);
+
+/**
+ * Terminate a connection and deliver BLE_GAP_EVENT_DISCONNECT.
+ */
+extern void host_ble_disconnect(uint16_t conn_handle);
+
+/**
+ * Whether the peripheral asked to encrypt the connection with ble_gap_security_initiate since it was established.
+ */
+extern int host_ble_security_initiated(uint16_t conn_handle);
+
+/**
+ * Pair and bond the connection as a central would, storing its keys and delivering BLE_GAP_EVENT_ENC_CHANGE.
+ * BLE_GAP_EVENT_REPEAT_PAIRING is delivered first if the peer is already bonded and the store status callback
+ * is invoked when the store is full, as the NimBLE security manager does.
+ *
+ * @return 0 if bonded, BLE_HS_EALREADY if the repeat pairing was ignored, BLE_HS_ENOMEM if there was no room.
+ */
+extern int host_ble_pair(uint16_t conn_handle);
+
+/**
+ * Encrypt the connection with the stored keys and deliver BLE_GAP_EVENT_ENC_CHANGE.
+ *
+ * @return 0 if encrypted, BLE_HS_ENOENT if the peer is not bonded.
+ */
+extern int host_ble_resume_encryption(uint16_t conn_handle);
+
+/**
+ * What a scanner would see of the advertising.
+ */
+typedef struct
+{
+	int active;															 //!< Whether the peripheral advertises
+	struct ble_gap_adv_params params;				 //!< Parameters of the running procedure
+	uint8_t data[BLE_HS_ADV_MAX_SZ];				 //!< Advertisement
+	uint8_t data_len;
+	uint8_t rsp_data[BLE_HS_ADV_MAX_SZ];		 //!< Scan response
+	uint8_t rsp_data_len;
+	uint32_t data_sets;											 //!< Uploads of the advertisement
+	uint32_t rsp_data_sets;									 //!< Uploads of the scan response
+	uint32_t starts;												 //!< Advertising procedures started
+} host_ble_adv_t;
+
+extern void host_ble_get_adv(host_ble_adv_t *adv);
+
+/**
+ * Number of bonds held by the store.
+ */
+extern int host_ble_bond_count(void);
+
+#define HOST_BLE_L2CAP_COC_MPS (CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE - 8) //!< K-frame payload, as the NimBLE port derives it
+
+/**
+ * Called for every SDU the stand-in peer received on its channel, once the last K-frame went over the air.
+ * Runs on the NimBLE host task, so it must not call the host_ble_* connection functions.
+ */
+typedef void (*host_ble_l2cap_rx_cb_t)(uint16_t conn_handle, const uint8_t *sdu, uint16_t len);
+
+/**
+ * The central connecting a channel to a server, and the flow control it applies: it grants initial_credits K-frames
+ * and gives back the credits of the frames it received once half of them are used, in its next connection event.
+ */
+typedef struct
+{
+	uint16_t mtu;						 //!< Largest SDU the central accepts
+	uint16_t mps;						 //!< Largest K-frame payload the central accepts
+	uint16_t initial_credits; //!< K-frames the server may send before the central returns credits
+	host_ble_l2cap_rx_cb_t rx_cb;
+} host_ble_l2cap_peer_t;
+
+/**
+ * Connect an L2CAP channel from the central to the server on psm, delivering BLE_L2CAP_EVENT_COC_ACCEPT then
+ * BLE_L2CAP_EVENT_COC_CONNECTED as the NimBLE L2CAP layer does.
+ *
+ * @return 0 if connected, BLE_HS_ENOENT without a server on psm, otherwise the error the server accepted with.
+ */
+extern int host_ble_l2cap_connect(uint16_t conn_handle, uint16_t psm, const host_ble_l2cap_peer_t *peer);
+
+/**
+ * Send an SDU from the central on its channel, in K-frames of HOST_BLE_L2CAP_COC_MPS from the next connection event
+ * on. BLE_L2CAP_EVENT_COC_DATA_RECEIVED is delivered once its last K-frame went over the air.
+ *
+ * @return 0 if queued, BLE_HS_ENOTCONN without a channel, BLE_HS_EBUSY if the server has no receive buffer ready,
+ * so no credits for the central, or the previous SDU is still being sent.
+ */
+extern int host_ble_l2cap_send(uint16_t conn_handle, const void *data, uint16_t len);
+
+/**
+ * Disconnect the channel of the connection from the central, delivering BLE_L2CAP_EVENT_COC_DISCONNECTED.
+ */
+extern void host_ble_l2cap_disconnect(uint16_t conn_handle);
+
+/**
+ * Air time of the link of a connection.
+ * In every connection event the central first sends the K-frames of its SDU, then the controller sends the queued
+ * K-frames back to back, each split into LL PDUs of the data length, and idles until the next event once the queue
+ * is empty or the credits are used. Every PDU is followed by the empty acknowledgement of the other side, both on the
+ * PHY in use and with the MIC once encrypted.
+ */
+typedef struct
+{
+	uint8_t phy;						//!< BLE_GAP_LE_PHY_* in use
+	uint16_t tx_octets;			//!< LL data length in use
+	uint32_t events;				//!< Connection events that carried data
+	uint32_t pdus;					//!< LL data PDUs sent
+	uint32_t frames;				//!< K-frames sent
+	uint32_t sdus;					//!< SDUs received by the central
+	uint32_t stalls;				//!< Sends that ran out of credits
+	uint32_t credits;				//!< Credits returned by the central
+	uint64_t l2cap_bytes;		//!< K-frame payload bytes sent, SDU length fields included
+	int64_t air_us;					//!< Time the radio was busy with them
+	uint32_t rx_pdus;				//!< LL data PDUs received from the central
+	uint32_t rx_sdus;				//!< SDUs received from the central
+	uint64_t rx_bytes;			//!< Bytes of these SDUs
+	uint32_t mbufs_peak;		//!< Peak of the msys blocks in use, all connections
+	uint32_t capacity_bps;	//!< L2CAP payload rate of back-to-back full PDUs on the PHY in use, in bytes/s
+} host_ble_link_stats_t;
+
+extern void host_ble_get_link_stats(uint16_t conn_handle, host_ble_link_stats_t *stats);
+
+#endif // _HOST_BLE_HS_H_
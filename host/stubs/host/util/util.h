@@ -0,0 +1,10 @@
+#ifndef _HOST_BLE_HS_UTIL_H_
+#define _HOST_BLE_HS_UTIL_H_
+
+/**
+ * Host stand-in for the NimBLE host utilities.
+ */
+
+extern int ble_hs_util_ensure_addr(int prefer_random);
+
+#endif // _HOST_BLE_HS_UTIL_H_
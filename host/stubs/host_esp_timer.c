@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include "esp_timer.h"
+#include "host_rtos_internal.h"
+
+// -- INTERNAL TYPES --
+
+struct esp_timer
+{
+	struct esp_timer *next;
+	esp_timer_cb_t callback;
+	void *arg;
+	int64_t expiry_us;	//!< Absolute simulated time of the next expiry
+	uint64_t period_us; //!< 0 for a one-shot timer
+	int active;
+};
+
+// -- RUNTIME VARIABLES --
+
+static struct esp_timer *timers = NULL; //!< Every created timer, guarded by host_rtos_lock
+
+// -- INTERNAL FUNCTIONS --
+
+/**
+ * Returns the closest expiry for peeks, runs the expired callbacks one at a time, earliest first, for runs.
+ */
+static int64_t timer_hook(int op, int64_t now_us)
+{
+	if (op == HOST_RTOS_TIMER_PEEK)
+	{
+		int64_t next_us = INT64_MAX;
+		for (struct esp_timer *it = timers; it != NULL; it = it->next)
+		{
+			if (it->active && it->expiry_us < next_us)
+			{
+				next_us = it->expiry_us;
+			}
+		}
+		return next_us;
+	}
+
+	for (;;)
+	{
+		pthread_mutex_lock(&host_rtos_lock);
+		struct esp_timer *expired = NULL;
+		for (struct esp_timer *it = timers; it != NULL; it = it->next)
+		{
+			if (it->active && it->expiry_us <= now_us && (expired == NULL || it->expiry_us < expired->expiry_us))
+			{
+				expired = it;
+			}
+		}
+		if (expired != NULL)
+		{
+			if (expired->period_us > 0)
+			{
+				expired->expiry_us += expired->period_us;
+			}
+			else
+			{
+				expired->active = 0;
+			}
+		}
+		pthread_mutex_unlock(&host_rtos_lock);
+
+		if (expired == NULL)
+		{
+			return 0;
+		}
+		expired->callback(expired->arg);
+	}
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us, int restart)
+{
+	if (timer == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	esp_err_t ret = ESP_OK;
+	pthread_mutex_lock(&host_rtos_lock);
+	if (timer->active && !restart)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	else
+	{
+		timer->expiry_us = host_rtos_time_us_locked() + (int64_t)timeout_us;
+		timer->period_us = period_us;
+		timer->active = 1;
+	}
+	pthread_mutex_unlock(&host_rtos_lock);
+	return ret;
+}
+
+// -- API --
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+	if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	struct esp_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	timer->callback = create_args->callback;
+	timer->arg = create_args->arg;
+
+	pthread_mutex_lock(&host_rtos_lock);
+	if (timers == NULL)
+	{
+		host_rtos_set_timer_hook(timer_hook);
+	}
+	timer->next = timers;
+	timers = timer;
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	*out_handle = timer;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	return timer_start(timer, timeout_us, 0, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+	return timer_start(timer, period, period, 0);
+}
+
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	if (timer == NULL || !esp_timer_is_active(timer))
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	pthread_mutex_lock(&host_rtos_lock);
+	uint64_t period_us = timer->period_us > 0 ? timeout_us : 0;
+	pthread_mutex_unlock(&host_rtos_lock);
+	return timer_start(timer, timeout_us, period_us, 1);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+	if (timer == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	esp_err_t ret = ESP_OK;
+	pthread_mutex_lock(&host_rtos_lock);
+	if (!timer->active)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	timer->active = 0;
+	pthread_mutex_unlock(&host_rtos_lock);
+	return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+	if (timer == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	pthread_mutex_lock(&host_rtos_lock);
+	if (timer->active)
+	{
+		pthread_mutex_unlock(&host_rtos_lock);
+		return ESP_ERR_INVALID_STATE;
+	}
+	for (struct esp_timer **it = &timers; *it != NULL; it = &(*it)->next)
+	{
+		if (*it == timer)
+		{
+			*it = timer->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	free(timer);
+	return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	bool active = timer->active;
+	pthread_mutex_unlock(&host_rtos_lock);
+	return active;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return host_rtos_time_us();
+}
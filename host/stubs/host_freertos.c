@@ -0,0 +1,536 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "host_rtos_internal.h"
+
+// -- INTERNAL TYPES --
+
+struct host_task
+{
+	pthread_t thread;
+	TaskFunction_t fn;
+	void *arg;
+	uint32_t notify_count; //!< Notification value used as a counting semaphore
+};
+
+struct host_semaphore
+{
+	UBaseType_t max_count;
+	UBaseType_t count;
+};
+
+struct host_queue
+{
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t count;
+	uint8_t *items;
+};
+
+typedef struct host_waiter
+{
+	struct host_waiter *next;
+	const void *object; //!< What the task is waiting on, NULL for a plain delay
+	TickType_t deadline; //!< Absolute tick at which the wait times out, portMAX_DELAY for none
+	int woken;					 //!< Set by the waker, which also accounts the task as busy again
+	int is_task;				 //!< Only tasks are accounted, the simulation thread may block too
+} host_waiter_t;
+
+// -- RUNTIME VARIABLES --
+
+pthread_mutex_t host_rtos_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rtos_cond = PTHREAD_COND_INITIALIZER;
+
+static int64_t now_us = 0;						 //!< Simulated time
+static int busy_tasks = 0;						 //!< Tasks that are running or runnable
+static host_waiter_t *waiters = NULL; //!< Every blocked task
+static host_rtos_timer_hook_t timer_hook = NULL;
+static __thread int current_is_task = 0; //!< Set on the threads backing a task
+static __thread struct host_task *current_task = NULL;
+
+// -- INTERNAL FUNCTIONS --
+
+TickType_t host_rtos_ticks_locked(void)
+{
+	return (TickType_t)(now_us / 1000);
+}
+
+int64_t host_rtos_time_us_locked(void)
+{
+	return now_us;
+}
+
+TickType_t host_rtos_deadline_locked(TickType_t timeout)
+{
+	return timeout == portMAX_DELAY ? portMAX_DELAY : host_rtos_ticks_locked() + timeout;
+}
+
+int host_rtos_block_locked(const void *object, TickType_t deadline)
+{
+	if (deadline != portMAX_DELAY && host_rtos_ticks_locked() >= deadline)
+	{
+		return 0;
+	}
+
+	host_waiter_t waiter = {
+			.next = waiters,
+			.object = object,
+			.deadline = deadline,
+			.is_task = current_is_task,
+	};
+	waiters = &waiter;
+	busy_tasks -= waiter.is_task;
+	pthread_cond_broadcast(&rtos_cond);
+
+	while (!waiter.woken)
+	{
+		pthread_cond_wait(&rtos_cond, &host_rtos_lock);
+	}
+
+	for (host_waiter_t **it = &waiters; *it != NULL; it = &(*it)->next)
+	{
+		if (*it == &waiter)
+		{
+			*it = waiter.next;
+			break;
+		}
+	}
+
+	return waiter.deadline == portMAX_DELAY || host_rtos_ticks_locked() < waiter.deadline;
+}
+
+int host_rtos_wake_locked(const void *object)
+{
+	for (host_waiter_t *it = waiters; it != NULL; it = it->next)
+	{
+		if (!it->woken && it->object == object)
+		{
+			it->woken = 1;
+			busy_tasks += it->is_task;
+			pthread_cond_broadcast(&rtos_cond);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void host_rtos_set_timer_hook(host_rtos_timer_hook_t hook)
+{
+	timer_hook = hook;
+}
+
+static void wait_idle_locked(void)
+{
+	while (busy_tasks > 0)
+	{
+		pthread_cond_wait(&rtos_cond, &host_rtos_lock);
+	}
+}
+
+static void *task_entry(void *param)
+{
+	struct host_task *task = param;
+	current_is_task = 1;
+	current_task = task;
+	task->fn(task->arg);
+
+	// FreeRTOS tasks must not return, treat it as a self-delete
+	pthread_mutex_lock(&host_rtos_lock);
+	busy_tasks--;
+	pthread_cond_broadcast(&rtos_cond);
+	pthread_mutex_unlock(&host_rtos_lock);
+	return NULL;
+}
+
+// -- SIMULATION CONTROL --
+
+void host_rtos_advance_ms(uint32_t ms)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	int64_t target_us = now_us + (int64_t)ms * 1000;
+
+	for (;;)
+	{
+		wait_idle_locked();
+
+		// find the closest task timeout or timer expiry within the window
+		int64_t next_us = target_us;
+		for (host_waiter_t *it = waiters; it != NULL; it = it->next)
+		{
+			if (!it->woken && it->deadline != portMAX_DELAY && (int64_t)it->deadline * 1000 < next_us)
+			{
+				next_us = (int64_t)it->deadline * 1000;
+			}
+		}
+		int64_t timer_us = timer_hook != NULL ? timer_hook(HOST_RTOS_TIMER_PEEK, next_us) : INT64_MAX;
+		if (timer_us < next_us)
+		{
+			next_us = timer_us;
+		}
+		if (next_us > now_us)
+		{
+			now_us = next_us;
+		}
+
+		// wake the timed out tasks
+		TickType_t ticks = host_rtos_ticks_locked();
+		for (host_waiter_t *it = waiters; it != NULL; it = it->next)
+		{
+			if (!it->woken && it->deadline != portMAX_DELAY && it->deadline <= ticks)
+			{
+				it->woken = 1;
+				busy_tasks += it->is_task;
+			}
+		}
+		pthread_cond_broadcast(&rtos_cond);
+
+		// run the expired timers outside of the lock, as the timer task would
+		if (timer_hook != NULL && timer_us <= now_us)
+		{
+			pthread_mutex_unlock(&host_rtos_lock);
+			timer_hook(HOST_RTOS_TIMER_RUN, now_us);
+			pthread_mutex_lock(&host_rtos_lock);
+		}
+
+		if (now_us >= target_us)
+		{
+			wait_idle_locked();
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&host_rtos_lock);
+}
+
+void host_rtos_wait_idle(void)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	wait_idle_locked();
+	pthread_mutex_unlock(&host_rtos_lock);
+}
+
+int64_t host_rtos_time_us(void)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	int64_t time_us = now_us;
+	pthread_mutex_unlock(&host_rtos_lock);
+	return time_us;
+}
+
+// -- TASKS --
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *const pcName, const uint32_t usStackDepth,
+											 void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pvCreatedTask)
+{
+	(void)pcName;
+	(void)usStackDepth;
+	(void)uxPriority;
+
+	struct host_task *task = calloc(1, sizeof(*task));
+	if (task == NULL)
+	{
+		return pdFAIL;
+	}
+	task->fn = pvTaskCode;
+	task->arg = pvParameters;
+
+	pthread_mutex_lock(&host_rtos_lock);
+	busy_tasks++;
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	if (pthread_create(&task->thread, NULL, task_entry, task) != 0)
+	{
+		pthread_mutex_lock(&host_rtos_lock);
+		busy_tasks--;
+		pthread_mutex_unlock(&host_rtos_lock);
+		free(task);
+		return pdFAIL;
+	}
+	pthread_detach(task->thread);
+
+	if (pvCreatedTask != NULL)
+	{
+		*pvCreatedTask = task;
+	}
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+	// only a task deleting itself is supported, another one may hold the global lock
+	if (xTaskToDelete != NULL && xTaskToDelete != current_task)
+	{
+		abort();
+	}
+	pthread_mutex_lock(&host_rtos_lock);
+	busy_tasks--;
+	pthread_cond_broadcast(&rtos_cond);
+	pthread_mutex_unlock(&host_rtos_lock);
+	free(current_task);
+	pthread_exit(NULL);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	TickType_t ticks = host_rtos_ticks_locked();
+	pthread_mutex_unlock(&host_rtos_lock);
+	return ticks;
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	host_rtos_block_locked(NULL, host_rtos_deadline_locked(xTicksToDelay));
+	pthread_mutex_unlock(&host_rtos_lock);
+}
+
+// -- NOTIFICATIONS --
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+	struct host_task *task = current_task;
+	pthread_mutex_lock(&host_rtos_lock);
+	TickType_t deadline = host_rtos_deadline_locked(xTicksToWait);
+	while (task->notify_count == 0)
+	{
+		if (xTicksToWait == 0 || !host_rtos_block_locked(task, deadline))
+		{
+			break;
+		}
+	}
+	uint32_t count = task->notify_count;
+	if (count > 0)
+	{
+		task->notify_count = xClearCountOnExit ? 0 : count - 1;
+	}
+	pthread_mutex_unlock(&host_rtos_lock);
+	return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	xTaskToNotify->notify_count++;
+	host_rtos_wake_locked(xTaskToNotify);
+	pthread_mutex_unlock(&host_rtos_lock);
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	xTaskToNotify->notify_count++;
+	int woken = host_rtos_wake_locked(xTaskToNotify);
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	if (woken && pxHigherPriorityTaskWoken != NULL)
+	{
+		*pxHigherPriorityTaskWoken = pdTRUE;
+	}
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return current_task;
+}
+
+// -- QUEUES --
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+	struct host_queue *queue = calloc(1, sizeof(*queue));
+	if (queue == NULL)
+	{
+		return NULL;
+	}
+	queue->items = calloc(uxQueueLength, uxItemSize);
+	if (queue->items == NULL)
+	{
+		free(queue);
+		return NULL;
+	}
+	queue->length = uxQueueLength;
+	queue->item_size = uxItemSize;
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+	free(xQueue->items);
+	free(xQueue);
+}
+
+/**
+ * @internal
+ * @brief Space waiters block on the second byte of the queue, receivers on the queue itself.
+ */
+static inline const void *queue_space_object(QueueHandle_t queue)
+{
+	return (const uint8_t *)queue + 1;
+}
+
+static int queue_push_locked(QueueHandle_t queue, const void *item)
+{
+	if (queue->count == queue->length)
+	{
+		return 0;
+	}
+	UBaseType_t tail = (queue->head + queue->count) % queue->length;
+	memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+	queue->count++;
+	return 1;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	TickType_t deadline = host_rtos_deadline_locked(xTicksToWait);
+	for (;;)
+	{
+		if (queue_push_locked(xQueue, pvItemToQueue))
+		{
+			host_rtos_wake_locked(xQueue);
+			pthread_mutex_unlock(&host_rtos_lock);
+			return pdPASS;
+		}
+		if (xTicksToWait == 0 || !host_rtos_block_locked(queue_space_object(xQueue), deadline))
+		{
+			pthread_mutex_unlock(&host_rtos_lock);
+			return errQUEUE_FULL;
+		}
+	}
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	if (!queue_push_locked(xQueue, pvItemToQueue))
+	{
+		pthread_mutex_unlock(&host_rtos_lock);
+		return errQUEUE_FULL;
+	}
+	int woken = host_rtos_wake_locked(xQueue);
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	if (woken && pxHigherPriorityTaskWoken != NULL)
+	{
+		*pxHigherPriorityTaskWoken = pdTRUE;
+	}
+	return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	TickType_t deadline = host_rtos_deadline_locked(xTicksToWait);
+	for (;;)
+	{
+		if (xQueue->count > 0)
+		{
+			memcpy(pvBuffer, xQueue->items + xQueue->head * xQueue->item_size, xQueue->item_size);
+			xQueue->head = (xQueue->head + 1) % xQueue->length;
+			xQueue->count--;
+			host_rtos_wake_locked(queue_space_object(xQueue));
+			pthread_mutex_unlock(&host_rtos_lock);
+			return pdTRUE;
+		}
+		if (xTicksToWait == 0 || !host_rtos_block_locked(xQueue, deadline))
+		{
+			pthread_mutex_unlock(&host_rtos_lock);
+			return pdFALSE;
+		}
+	}
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	UBaseType_t count = xQueue->count;
+	pthread_mutex_unlock(&host_rtos_lock);
+	return count;
+}
+
+// -- SEMAPHORES --
+
+static SemaphoreHandle_t semaphore_create(UBaseType_t max_count, UBaseType_t initial_count)
+{
+	struct host_semaphore *semaphore = calloc(1, sizeof(*semaphore));
+	if (semaphore == NULL)
+	{
+		return NULL;
+	}
+	semaphore->max_count = max_count;
+	semaphore->count = initial_count;
+	return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	// priority inheritance does not matter on the host, a mutex is a binary semaphore given once
+	return semaphore_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return semaphore_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+	return semaphore_create(uxMaxCount, uxInitialCount);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	TickType_t deadline = host_rtos_deadline_locked(xBlockTime);
+	for (;;)
+	{
+		if (xSemaphore->count > 0)
+		{
+			xSemaphore->count--;
+			pthread_mutex_unlock(&host_rtos_lock);
+			return pdTRUE;
+		}
+		if (xBlockTime == 0 || !host_rtos_block_locked(xSemaphore, deadline))
+		{
+			pthread_mutex_unlock(&host_rtos_lock);
+			return pdFALSE;
+		}
+	}
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+	return xSemaphoreGiveFromISR(xSemaphore, NULL);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	pthread_mutex_lock(&host_rtos_lock);
+	if (xSemaphore->count == xSemaphore->max_count)
+	{
+		pthread_mutex_unlock(&host_rtos_lock);
+		return pdFALSE;
+	}
+	xSemaphore->count++;
+	int woken = host_rtos_wake_locked(xSemaphore);
+	pthread_mutex_unlock(&host_rtos_lock);
+
+	if (woken && pxHigherPriorityTaskWoken != NULL)
+	{
+		*pxHigherPriorityTaskWoken = pdTRUE;
+	}
+	return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+	free(xSemaphore);
+}
@@ -0,0 +1,287 @@
+#include <pthread.h>
+#include <string.h>
+#include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+
+typedef struct
+{
+	gpio_mode_t mode;
+	gpio_int_type_t intr_type;
+	uint8_t intr_enabled;
+	uint32_t level_in;
+	uint32_t level_out;
+	gpio_isr_t isr;
+	void *isr_arg;
+	uint8_t sleep_kept; //!< Released from the light sleep isolation
+} host_pin_t;
+
+static pthread_mutex_t gpio_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_pin_t pins[GPIO_NUM_MAX];
+static int isr_service_installed = 0;
+
+static inline int valid_pin(gpio_num_t gpio_num)
+{
+	return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+void host_gpio_reset(void)
+{
+	pthread_mutex_lock(&gpio_lock);
+	memset(pins, 0, sizeof(pins));
+	isr_service_installed = 0;
+	pthread_mutex_unlock(&gpio_lock);
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].mode = GPIO_MODE_DISABLE;
+	pins[gpio_num].intr_type = GPIO_INTR_DISABLE;
+	pins[gpio_num].level_out = 0;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].mode = mode;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull)
+{
+	(void)pull;
+	return valid_pin(gpio_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_type = intr_type;
+	pins[gpio_num].intr_enabled = 1;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_enabled = 1;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_enabled = 0;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].level_out = level ? 1 : 0;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	int level = (pins[gpio_num].mode & GPIO_MODE_INPUT) ? pins[gpio_num].level_in : 0;
+	pthread_mutex_unlock(&gpio_lock);
+	return level;
+}
+
+int gpio_ll_get_level(gpio_dev_t *hw, uint32_t gpio_num)
+{
+	(void)hw;
+	return gpio_get_level((gpio_num_t)gpio_num);
+}
+
+void gpio_ll_set_intr_type(gpio_dev_t *hw, uint32_t gpio_num, gpio_int_type_t intr_type)
+{
+	(void)hw;
+	if (!valid_pin((gpio_num_t)gpio_num))
+	{
+		return;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_type = intr_type;
+	pthread_mutex_unlock(&gpio_lock);
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+	(void)intr_alloc_flags;
+	pthread_mutex_lock(&gpio_lock);
+	esp_err_t ret = isr_service_installed ? ESP_ERR_INVALID_STATE : ESP_OK;
+	isr_service_installed = 1;
+	pthread_mutex_unlock(&gpio_lock);
+	return ret;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	if (!isr_service_installed)
+	{
+		pthread_mutex_unlock(&gpio_lock);
+		return ESP_ERR_INVALID_STATE;
+	}
+	pins[gpio_num].isr = isr_handler;
+	pins[gpio_num].isr_arg = args;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].isr = NULL;
+	pins[gpio_num].isr_arg = NULL;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+	if (!valid_pin(gpio_num) || (intr_type != GPIO_INTR_LOW_LEVEL && intr_type != GPIO_INTR_HIGH_LEVEL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	// as on the chip the wakeup level is the interrupt type of the pin, a level already matching only fires on
+	// the next drive
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_type = intr_type;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].intr_type = GPIO_INTR_DISABLE;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+esp_err_t gpio_sleep_sel_dis(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	pins[gpio_num].sleep_kept = 1;
+	pthread_mutex_unlock(&gpio_lock);
+	return ESP_OK;
+}
+
+int host_gpio_sleep_isolated(gpio_num_t gpio_num)
+{
+	return valid_pin(gpio_num) && !pins[gpio_num].sleep_kept;
+}
+
+void host_gpio_drive(gpio_num_t gpio_num, uint32_t level)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&gpio_lock);
+	host_pin_t *pin = &pins[gpio_num];
+	uint32_t previous = pin->level_in;
+	pin->level_in = level ? 1 : 0;
+
+	int fire = 0;
+	if (pin->intr_enabled && pin->isr != NULL)
+	{
+		switch (pin->intr_type)
+		{
+		case GPIO_INTR_POSEDGE:
+			fire = !previous && pin->level_in;
+			break;
+		case GPIO_INTR_NEGEDGE:
+			fire = previous && !pin->level_in;
+			break;
+		case GPIO_INTR_ANYEDGE:
+			fire = previous != pin->level_in;
+			break;
+		case GPIO_INTR_LOW_LEVEL:
+			fire = !pin->level_in;
+			break;
+		case GPIO_INTR_HIGH_LEVEL:
+			fire = pin->level_in;
+			break;
+		default:
+			break;
+		}
+	}
+	gpio_isr_t isr = pin->isr;
+	void *isr_arg = pin->isr_arg;
+	pthread_mutex_unlock(&gpio_lock);
+
+	// the ISR runs in the driving thread, like an interrupt preempting whatever was running
+	if (fire)
+	{
+		isr(isr_arg);
+	}
+}
+
+uint32_t host_gpio_get_output(gpio_num_t gpio_num)
+{
+	if (!valid_pin(gpio_num))
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&gpio_lock);
+	uint32_t level = pins[gpio_num].level_out;
+	pthread_mutex_unlock(&gpio_lock);
+	return level;
+}
@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+
+/**
+ * Every block starts with its size and whether it counts as PSRAM, aligned as malloc would.
+ */
+typedef struct
+{
+	size_t size;
+	uint32_t caps;
+} __attribute__((aligned(16))) block_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_heap_stats_t spiram;
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	block_t *block = malloc(sizeof(block_t) + size);
+	if (block == NULL)
+	{
+		return NULL;
+	}
+	block->size = size;
+	block->caps = caps;
+	if (caps & MALLOC_CAP_SPIRAM)
+	{
+		pthread_mutex_lock(&heap_lock);
+		spiram.allocs++;
+		spiram.used += size;
+		spiram.peak = spiram.used > spiram.peak ? spiram.used : spiram.peak;
+		pthread_mutex_unlock(&heap_lock);
+	}
+	return block + 1;
+}
+
+void heap_caps_free(void *ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	block_t *block = (block_t *)ptr - 1;
+	if (block->caps & MALLOC_CAP_SPIRAM)
+	{
+		pthread_mutex_lock(&heap_lock);
+		spiram.used -= block->size;
+		pthread_mutex_unlock(&heap_lock);
+	}
+	free(block);
+}
+
+void host_heap_get_stats(host_heap_stats_t *stats)
+{
+	pthread_mutex_lock(&heap_lock);
+	*stats = spiram;
+	pthread_mutex_unlock(&heap_lock);
+}
@@ -0,0 +1,82 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+esp_log_level_t host_log_level = ESP_LOG_NONE;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+	// tags are not tracked separately on the host
+	(void)tag;
+	host_log_level = level;
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+	(void)tag;
+	return host_log_level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	static const char level_chars[] = "NEWIDV";
+	(void)tag;
+
+	va_list args;
+	va_start(args, format);
+	fputc(level_chars[level], stderr);
+	fputc(' ', stderr);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+	switch (code)
+	{
+	case 0:
+		return "ESP_OK";
+	case -1:
+		return "ESP_FAIL";
+	case 0x101:
+		return "ESP_ERR_NO_MEM";
+	case 0x102:
+		return "ESP_ERR_INVALID_ARG";
+	case 0x103:
+		return "ESP_ERR_INVALID_STATE";
+	case 0x104:
+		return "ESP_ERR_INVALID_SIZE";
+	case 0x105:
+		return "ESP_ERR_NOT_FOUND";
+	case 0x106:
+		return "ESP_ERR_NOT_SUPPORTED";
+	case 0x107:
+		return "ESP_ERR_TIMEOUT";
+	case 0x109:
+		return "ESP_ERR_INVALID_CRC";
+	case 0x10A:
+		return "ESP_ERR_INVALID_VERSION";
+	case 0x10C:
+		return "ESP_ERR_NOT_FINISHED";
+	case 0x10D:
+		return "ESP_ERR_NOT_ALLOWED";
+	case 0x1102:
+		return "ESP_ERR_NVS_NOT_FOUND";
+	case 0x1105:
+		return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+	case 0x1501:
+		return "ESP_ERR_OTA_PARTITION_CONFLICT";
+	case 0x1503:
+		return "ESP_ERR_OTA_VALIDATE_FAILED";
+	default:
+		return "ESP_ERR_UNKNOWN";
+	}
+}
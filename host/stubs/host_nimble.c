@@ -0,0 +1,1653 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "host/ble_hs.h"
+#include "host/util/util.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#define HOST_BLE_MAX_SVCS 8
+#define HOST_BLE_EVENTQ_LEN 16
+#define HOST_BLE_MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define HOST_BLE_MAX_BONDS CONFIG_BT_NIMBLE_MAX_BONDS
+#define HOST_BLE_MSYS_BLOCKS (CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT + CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT)
+#define HOST_BLE_MSYS_BLOCK_DATA (CONFIG_BT_NIMBLE_MSYS_2_BLOCK_SIZE - 16) //!< Data room of a block, after the mbuf header
+#define HOST_BLE_L2CAP_MAX_SERVERS CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM //!< The port pools servers and channels alike
+#define HOST_BLE_L2CAP_MAX_QUEUED 256 //!< K-frames the controller holds per channel, above any credit window
+#define HOST_BLE_DEFAULT_TX_OCTETS 27 //!< LL data length until it is extended
+#define HOST_BLE_IFS_US 150						//!< Inter frame space
+
+struct ble_npl_eventq
+{
+	QueueHandle_t queue;
+};
+
+static const struct ble_gatt_svc_def *registered_svcs[HOST_BLE_MAX_SVCS];
+static int registered_svcs_count = 0;
+static uint16_t next_handle = 1;
+static struct ble_npl_eventq dflt_eventq;
+static host_ble_notify_cb_t notify_cb = NULL;
+static ble_gap_event_fn *gap_cb = NULL;
+static void *gap_cb_arg = NULL;
+static ble_addr_t rnd_addr = {.type = BLE_ADDR_RANDOM};
+static char device_name[32];
+
+/**
+ * A K-frame waiting in the controller.
+ */
+typedef struct
+{
+	uint16_t len;	 //!< Payload, SDU length field included
+	uint16_t sdu_len;
+	uint8_t *sdu; //!< The whole SDU on its last K-frame, handed to the central once it is received
+} host_ble_frame_t;
+
+/**
+ * A simulated connection.
+ */
+typedef struct
+{
+	struct ble_gap_conn_desc desc;
+	int in_use;
+	int security_initiated;
+	struct ble_gap_upd_params pending_params; //!< Parameters of the update in progress
+	struct ble_npl_event update_ev;						//!< Completes the parameter update
+	struct ble_npl_event mtu_ev;							//!< Completes the MTU exchange
+	struct ble_npl_event phy_ev;							//!< Completes the PHY update
+	struct ble_npl_event chan_disconnect_ev;	//!< Completes a channel disconnection requested by the server
+	int update_pending;
+	int mtu_exchanged;
+	uint8_t pending_phy;
+	int64_t connected_us;						 //!< Anchor of the first connection event
+	struct ble_l2cap_chan *chan;		 //!< The L2CAP channel of the central, NULL without
+	esp_timer_handle_t link_timer;	 //!< Fires at the next connection event carrying data
+	struct ble_npl_event link_ev;		 //!< Runs that connection event on the host task
+	int link_scheduled;
+	host_ble_link_stats_t link;
+} host_ble_conn_t;
+
+static host_ble_conn_t conns[HOST_BLE_MAX_CONNS];
+static uint32_t mbufs_in_use = 0;
+static uint32_t mbufs_peak = 0;
+
+/**
+ * The bonds of the store, oldest first as ble_store_util_status_rr expects.
+ */
+static struct ble_store_value_sec bonds[HOST_BLE_MAX_BONDS];
+static int bonds_count = 0;
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static host_ble_conn_t *find_conn(uint16_t conn_handle);
+static int find_bond(const ble_addr_t *addr);
+
+/**
+ * An L2CAP server registered with ble_l2cap_create_server.
+ */
+typedef struct
+{
+	uint16_t psm;
+	uint16_t mtu;
+	ble_l2cap_event_fn *cb;
+	void *cb_arg;
+} host_ble_l2cap_server_t;
+
+static host_ble_l2cap_server_t l2cap_servers[HOST_BLE_L2CAP_MAX_SERVERS];
+static int l2cap_servers_count = 0;
+
+/**
+ * A connected channel, the server side as seen by the NimBLE L2CAP layer and the central's flow control.
+ */
+struct ble_l2cap_chan
+{
+	host_ble_conn_t *conn;
+	const host_ble_l2cap_server_t *server;
+	host_ble_l2cap_peer_t peer;
+	uint16_t mps;									//!< K-frame payload, the smaller of both sides
+	struct os_mbuf *rx_sdu;				//!< Buffer posted with ble_l2cap_recv_ready
+	struct os_mbuf *tx_sdu;				//!< SDU being segmented, owned by the stack until its last K-frame is queued
+	uint16_t tx_off;							//!< Bytes of tx_sdu already queued
+	int stalled;									//!< The server waits for BLE_L2CAP_EVENT_COC_TX_UNSTALLED
+	uint16_t credits;							//!< K-frames the server may still send
+	uint16_t received;						//!< K-frames the central received since it last returned credits
+	uint16_t returning;						//!< Credits the central sends in its next connection event
+	uint8_t *uplink;							//!< SDU the central is sending, NULL without
+	uint16_t uplink_len;
+	uint16_t uplink_off;					//!< Bytes of uplink already sent
+	host_ble_frame_t queue[HOST_BLE_L2CAP_MAX_QUEUED];
+	uint16_t queue_head;
+	uint16_t queue_len;
+};
+
+static host_ble_adv_t adv;
+static ble_gap_event_fn *adv_cb = NULL;
+static void *adv_cb_arg = NULL;
+static esp_timer_handle_t adv_timer = NULL;
+static struct ble_npl_event adv_timeout_ev;
+
+// -- MBUFS --
+
+static void mbuf_init(struct os_mbuf *om)
+{
+	memset(om, 0, sizeof(*om));
+	om->om_data = om->om_databuf;
+	om->om_size = sizeof(om->om_databuf);
+}
+
+/**
+ * A block of the msys pool, NULL once the pool is exhausted.
+ */
+static struct os_mbuf *mbuf_get(void)
+{
+	if (__atomic_load_n(&mbufs_in_use, __ATOMIC_RELAXED) >= HOST_BLE_MSYS_BLOCKS)
+	{
+		return NULL;
+	}
+	struct os_mbuf *om = malloc(sizeof(*om));
+	if (om == NULL)
+	{
+		return NULL;
+	}
+	mbuf_init(om);
+	om->om_size = HOST_BLE_MSYS_BLOCK_DATA;
+	om->om_pooled = 1;
+	uint32_t in_use = __atomic_add_fetch(&mbufs_in_use, 1, __ATOMIC_RELAXED);
+	if (in_use > mbufs_peak)
+	{
+		mbufs_peak = in_use;
+	}
+	return om;
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+	(void)dsize;
+	(void)user_hdr_len;
+	return mbuf_get();
+}
+
+uint16_t host_os_mbuf_pktlen(const struct os_mbuf *om)
+{
+	uint16_t len = 0;
+	for (; om != NULL; om = SLIST_NEXT(om, om_next))
+	{
+		len += om->om_len;
+	}
+	return len;
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+	const uint8_t *bytes = data;
+	while (SLIST_NEXT(om, om_next) != NULL)
+	{
+		om = SLIST_NEXT(om, om_next);
+	}
+	for (;;)
+	{
+		uint16_t room = om->om_size - (om->om_data - om->om_databuf) - om->om_len;
+		uint16_t count = len < room ? len : room;
+		memcpy(om->om_data + om->om_len, bytes, count);
+		om->om_len += count;
+		bytes += count;
+		len -= count;
+		if (len == 0)
+		{
+			return 0;
+		}
+		// only pool blocks chain, as the caller's stack buffers of the GATT stand-in can't be freed
+		struct os_mbuf *next = om->om_pooled ? mbuf_get() : NULL;
+		if (next == NULL)
+		{
+			return BLE_HS_ENOMEM;
+		}
+		SLIST_NEXT(om, om_next) = next;
+		om = next;
+	}
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+	uint8_t *out = dst;
+	for (; om != NULL && len > 0; om = SLIST_NEXT(om, om_next))
+	{
+		if (off >= om->om_len)
+		{
+			off -= om->om_len;
+			continue;
+		}
+		int count = om->om_len - off < len ? om->om_len - off : len;
+		memcpy(out, om->om_data + off, count);
+		out += count;
+		len -= count;
+		off = 0;
+	}
+	return len > 0 ? -1 : 0;
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om)
+{
+	while (om != NULL)
+	{
+		struct os_mbuf *next = SLIST_NEXT(om, om_next);
+		if (om->om_pooled)
+		{
+			__atomic_sub_fetch(&mbufs_in_use, 1, __ATOMIC_RELAXED);
+		}
+		free(om);
+		om = next;
+	}
+	return 0;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+	uint16_t len = OS_MBUF_PKTLEN(om);
+	uint16_t copy_len = len > max_len ? max_len : len;
+	os_mbuf_copydata(om, 0, copy_len, flat);
+	if (out_copy_len != NULL)
+	{
+		*out_copy_len = copy_len;
+	}
+	return len > max_len ? BLE_HS_EMSGSIZE : 0;
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+	struct os_mbuf *om = mbuf_get();
+	if (om == NULL)
+	{
+		return NULL;
+	}
+	if (os_mbuf_append(om, buf, len) != 0)
+	{
+		os_mbuf_free_chain(om);
+		return NULL;
+	}
+	return om;
+}
+
+// -- UUIDS --
+
+int ble_uuid_init_from_buf(ble_uuid_any_t *uuid, const void *buf, size_t len)
+{
+	switch (len)
+	{
+	case 2:
+		uuid->u.type = BLE_UUID_TYPE_16;
+		memcpy(&uuid->u16.value, buf, 2);
+		return 0;
+	case 4:
+		uuid->u.type = BLE_UUID_TYPE_32;
+		memcpy(&uuid->u32.value, buf, 4);
+		return 0;
+	case 16:
+		uuid->u.type = BLE_UUID_TYPE_128;
+		memcpy(uuid->u128.value, buf, 16);
+		return 0;
+	}
+	return BLE_HS_EINVAL;
+}
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2)
+{
+	if (uuid1->type != uuid2->type)
+	{
+		return uuid1->type - uuid2->type;
+	}
+	switch (uuid1->type)
+	{
+	case BLE_UUID_TYPE_16:
+		return (int)((const ble_uuid16_t *)uuid1)->value - (int)((const ble_uuid16_t *)uuid2)->value;
+	case BLE_UUID_TYPE_32:
+		return (int)(((const ble_uuid32_t *)uuid1)->value - ((const ble_uuid32_t *)uuid2)->value);
+	default:
+		return memcmp(((const ble_uuid128_t *)uuid1)->value, ((const ble_uuid128_t *)uuid2)->value, 16);
+	}
+}
+
+// -- NPL --
+
+/**
+ * The NimBLE host task: runs the events of the default queue one at a time.
+ */
+static void host_ble_task(void *arg)
+{
+	(void)arg;
+	struct ble_npl_event *ev;
+	for (;;)
+	{
+		if (xQueueReceive(dflt_eventq.queue, &ev, portMAX_DELAY))
+		{
+			ev->queued = 0;
+			ev->fn(ev);
+		}
+	}
+}
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void)
+{
+	if (dflt_eventq.queue == NULL)
+	{
+		dflt_eventq.queue = xQueueCreate(HOST_BLE_EVENTQ_LEN, sizeof(struct ble_npl_event *));
+		xTaskCreate(host_ble_task, "nimble_host", 4096, NULL, 21, NULL);
+	}
+	return &dflt_eventq;
+}
+
+esp_err_t nimble_port_init(void)
+{
+	nimble_port_get_dflt_eventq();
+	return ESP_OK;
+}
+
+void nimble_port_run(void)
+{
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn)
+{
+	(void)host_task_fn;
+}
+
+void nimble_port_freertos_deinit(void)
+{
+}
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->fn = fn;
+	ev->arg = arg;
+}
+
+void *ble_npl_event_get_arg(struct ble_npl_event *ev)
+{
+	return ev->arg;
+}
+
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+	if (__atomic_exchange_n(&ev->queued, 1, __ATOMIC_ACQ_REL))
+	{
+		return;
+	}
+	xQueueSend(evq->queue, &ev, portMAX_DELAY);
+}
+
+// -- IDENTITY --
+
+int ble_hs_id_gen_rnd(int nrpa, ble_addr_t *out_addr)
+{
+	// a static random address has its two most significant bits set, a non-resolvable private one cleared
+	static const uint8_t val[6] = {0x5a, 0x3c, 0x96, 0x0f, 0x21, 0xc4};
+	out_addr->type = BLE_ADDR_RANDOM;
+	memcpy(out_addr->val, val, sizeof(val));
+	out_addr->val[5] = nrpa ? out_addr->val[5] & 0x3f : out_addr->val[5] | 0xc0;
+	return 0;
+}
+
+int ble_hs_id_set_rnd(const uint8_t *addr)
+{
+	memcpy(rnd_addr.val, addr, sizeof(rnd_addr.val));
+	return 0;
+}
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type)
+{
+	(void)privacy;
+	*out_addr_type = BLE_OWN_ADDR_RANDOM;
+	return 0;
+}
+
+int ble_hs_util_ensure_addr(int prefer_random)
+{
+	(void)prefer_random;
+	return 0;
+}
+
+// -- GATT SERVER --
+
+int ble_svc_gap_device_name_set(const char *name)
+{
+	if (strlen(name) >= sizeof(device_name))
+	{
+		return BLE_HS_EINVAL;
+	}
+	strcpy(device_name, name);
+	return 0;
+}
+
+const char *ble_svc_gap_device_name(void)
+{
+	return device_name;
+}
+
+void ble_svc_gap_init(void)
+{
+}
+
+void ble_svc_gatt_init(void)
+{
+}
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs)
+{
+	return defs == NULL ? BLE_HS_EINVAL : 0;
+}
+
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs)
+{
+	if (registered_svcs_count == HOST_BLE_MAX_SVCS)
+	{
+		return BLE_HS_ENOMEM;
+	}
+	registered_svcs[registered_svcs_count++] = svcs;
+
+	// assign handles in declaration order: service, then characteristic declaration + value, then descriptors
+	for (const struct ble_gatt_svc_def *svc = svcs; svc->type != BLE_GATT_SVC_TYPE_END; svc++)
+	{
+		next_handle++;
+		for (const struct ble_gatt_chr_def *chr = svc->characteristics; chr != NULL && chr->uuid != NULL; chr++)
+		{
+			next_handle++;
+			if (chr->val_handle != NULL)
+			{
+				*chr->val_handle = next_handle;
+			}
+			next_handle++;
+			for (const struct ble_gatt_dsc_def *dsc = chr->descriptors; dsc != NULL && dsc->uuid != NULL; dsc++)
+			{
+				next_handle++;
+			}
+		}
+	}
+	return 0;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om)
+{
+	uint8_t data[sizeof(om->om_databuf)];
+	uint16_t len = 0;
+	ble_hs_mbuf_to_flat(om, data, sizeof(data), &len);
+	os_mbuf_free_chain(om);
+
+	if (notify_cb != NULL)
+	{
+		notify_cb(conn_handle, att_handle, data, len);
+	}
+	return 0;
+}
+
+// -- ADVERTISING --
+
+static void adv_timeout_event(struct ble_npl_event *ev)
+{
+	(void)ev;
+	if (!adv.active)
+	{
+		return;
+	}
+	adv.active = 0;
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_ADV_COMPLETE,
+			.adv_complete = {.reason = BLE_HS_ETIMEOUT},
+	};
+	adv_cb(&event, adv_cb_arg);
+}
+
+static void adv_timer_cb(void *arg)
+{
+	(void)arg;
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &adv_timeout_ev);
+}
+
+int ble_gap_adv_set_data(const uint8_t *data, int data_len)
+{
+	if (data_len < 0 || data_len > BLE_HS_ADV_MAX_SZ)
+	{
+		return BLE_HS_EINVAL;
+	}
+	memcpy(adv.data, data, data_len);
+	adv.data_len = data_len;
+	adv.data_sets++;
+	return 0;
+}
+
+int ble_gap_adv_rsp_set_data(const uint8_t *data, int data_len)
+{
+	if (data_len < 0 || data_len > BLE_HS_ADV_MAX_SZ)
+	{
+		return BLE_HS_EINVAL;
+	}
+	memcpy(adv.rsp_data, data, data_len);
+	adv.rsp_data_len = data_len;
+	adv.rsp_data_sets++;
+	return 0;
+}
+
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields)
+{
+	uint8_t data[BLE_HS_ADV_MAX_SZ];
+	int len = 0;
+	if (rsp_fields->name != NULL)
+	{
+		if (len + 2 + rsp_fields->name_len > BLE_HS_ADV_MAX_SZ)
+		{
+			return BLE_HS_EMSGSIZE;
+		}
+		data[len++] = rsp_fields->name_len + 1;
+		data[len++] = BLE_HS_ADV_TYPE_COMP_NAME;
+		memcpy(&data[len], rsp_fields->name, rsp_fields->name_len);
+		len += rsp_fields->name_len;
+	}
+	if (rsp_fields->tx_pwr_lvl_is_present)
+	{
+		if (len + 3 > BLE_HS_ADV_MAX_SZ)
+		{
+			return BLE_HS_EMSGSIZE;
+		}
+		data[len++] = 2;
+		data[len++] = BLE_HS_ADV_TYPE_TX_PWR_LVL;
+		data[len++] = rsp_fields->tx_pwr_lvl == BLE_HS_ADV_TX_PWR_LVL_AUTO ? 9 : rsp_fields->tx_pwr_lvl;
+	}
+	return ble_gap_adv_rsp_set_data(data, len);
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+											const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg)
+{
+	(void)own_addr_type;
+	(void)direct_addr;
+	if (adv.active)
+	{
+		return BLE_HS_EALREADY;
+	}
+	if (adv_timer == NULL)
+	{
+		const esp_timer_create_args_t timer_args = {.callback = adv_timer_cb, .name = "host_ble_adv"};
+		esp_timer_create(&timer_args, &adv_timer);
+		ble_npl_event_init(&adv_timeout_ev, adv_timeout_event, NULL);
+	}
+
+	adv.active = 1;
+	adv.params = *adv_params;
+	adv.starts++;
+	adv_cb = cb;
+	adv_cb_arg = cb_arg;
+	if (duration_ms != BLE_HS_FOREVER)
+	{
+		esp_timer_start_once(adv_timer, duration_ms * 1000ULL);
+	}
+	return 0;
+}
+
+int ble_gap_adv_stop(void)
+{
+	if (!adv.active)
+	{
+		return BLE_HS_EALREADY;
+	}
+	adv.active = 0;
+	esp_timer_stop(adv_timer);
+	return 0;
+}
+
+int ble_gap_adv_active(void)
+{
+	return adv.active;
+}
+
+void host_ble_get_adv(host_ble_adv_t *out)
+{
+	*out = adv;
+}
+
+// -- SIMULATION --
+
+void host_ble_set_notify_cb(host_ble_notify_cb_t cb)
+{
+	notify_cb = cb;
+}
+
+void host_ble_reset(void)
+{
+	registered_svcs_count = 0;
+	next_handle = 1;
+}
+
+const struct ble_gatt_chr_def *host_ble_find_chr(const ble_uuid_t *uuid)
+{
+	for (int i = 0; i < registered_svcs_count; i++)
+	{
+		for (const struct ble_gatt_svc_def *svc = registered_svcs[i]; svc->type != BLE_GATT_SVC_TYPE_END; svc++)
+		{
+			for (const struct ble_gatt_chr_def *chr = svc->characteristics; chr != NULL && chr->uuid != NULL; chr++)
+			{
+				if (ble_uuid_cmp(chr->uuid, uuid) == 0)
+				{
+					return chr;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Check the permissions of a characteristic against the security of the connection, as the NimBLE ATT server does
+ * before invoking its access callback.
+ */
+static int check_perms(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, int write)
+{
+	uint16_t flags = chr->flags;
+	if (!(flags & (write ? BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP : BLE_GATT_CHR_F_READ)))
+	{
+		return write ? BLE_ATT_ERR_WRITE_NOT_PERMITTED : BLE_ATT_ERR_READ_NOT_PERMITTED;
+	}
+	int enc = flags & (write ? BLE_GATT_CHR_F_WRITE_ENC : BLE_GATT_CHR_F_READ_ENC);
+	int authen = flags & (write ? BLE_GATT_CHR_F_WRITE_AUTHEN : BLE_GATT_CHR_F_READ_AUTHEN);
+	if (!enc && !authen)
+	{
+		return 0;
+	}
+
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_ATT_ERR_UNLIKELY;
+	}
+	struct ble_gap_sec_state sec_state = conn->desc.sec_state;
+	if (!sec_state.encrypted)
+	{
+		// a bonded peer is told to encrypt with its keys, any other to pair
+		return find_bond(&conn->desc.peer_id_addr) >= 0 ? BLE_ATT_ERR_INSUFFICIENT_ENC : BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+	}
+	if (authen && !sec_state.authenticated)
+	{
+		return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+	}
+	if (chr->min_key_size > sec_state.key_size)
+	{
+		return BLE_ATT_ERR_INSUFFICIENT_KEY_SZ;
+	}
+	return 0;
+}
+
+int host_ble_gatt_write(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, const void *data, uint16_t len)
+{
+	int ret = check_perms(conn_handle, chr, 1);
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	struct os_mbuf om;
+	mbuf_init(&om);
+	if (os_mbuf_append(&om, data, len) != 0)
+	{
+		return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+	}
+
+	struct ble_gatt_access_ctxt ctxt = {
+			.op = BLE_GATT_ACCESS_OP_WRITE_CHR,
+			.om = &om,
+			.chr = chr,
+	};
+	return chr->access_cb(conn_handle, chr->val_handle != NULL ? *chr->val_handle : 0, &ctxt, chr->arg);
+}
+
+int host_ble_gatt_read(uint16_t conn_handle, const struct ble_gatt_chr_def *chr, void *out, uint16_t *len)
+{
+	int ret = check_perms(conn_handle, chr, 0);
+	if (ret != 0)
+	{
+		return ret;
+	}
+
+	struct os_mbuf om;
+	mbuf_init(&om);
+
+	struct ble_gatt_access_ctxt ctxt = {
+			.op = BLE_GATT_ACCESS_OP_READ_CHR,
+			.om = &om,
+			.chr = chr,
+	};
+	ret = chr->access_cb(conn_handle, chr->val_handle != NULL ? *chr->val_handle : 0, &ctxt, chr->arg);
+	if (ret == 0)
+	{
+		ble_hs_mbuf_to_flat(&om, out, *len, len);
+	}
+	return ret;
+}
+
+// -- GAP --
+
+static host_ble_conn_t *find_conn(uint16_t conn_handle)
+{
+	for (int i = 0; i < HOST_BLE_MAX_CONNS; i++)
+	{
+		if (conns[i].in_use && conns[i].desc.conn_handle == conn_handle)
+		{
+			return &conns[i];
+		}
+	}
+	return NULL;
+}
+
+static int deliver_gap_event(struct ble_gap_event *event)
+{
+	return gap_cb != NULL ? gap_cb(event, gap_cb_arg) : 0;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+	host_ble_conn_t *conn = find_conn(handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	*out_desc = conn->desc;
+	return 0;
+}
+
+int ble_gap_conn_find_by_addr(const ble_addr_t *addr, struct ble_gap_conn_desc *out_desc)
+{
+	for (int i = 0; i < HOST_BLE_MAX_CONNS; i++)
+	{
+		if (conns[i].in_use && ble_addr_cmp(&conns[i].desc.peer_id_addr, addr) == 0)
+		{
+			*out_desc = conns[i].desc;
+			return 0;
+		}
+	}
+	return BLE_HS_ENOTCONN;
+}
+
+int ble_gap_security_initiate(uint16_t conn_handle)
+{
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	conn->security_initiated = 1;
+	return 0;
+}
+
+static void update_complete(struct ble_npl_event *ev)
+{
+	host_ble_conn_t *conn = ble_npl_event_get_arg(ev);
+	if (!conn->in_use || !conn->update_pending)
+	{
+		return;
+	}
+	conn->update_pending = 0;
+	conn->desc.conn_itvl = conn->pending_params.itvl_max;
+	conn->desc.conn_latency = conn->pending_params.latency;
+	conn->desc.supervision_timeout = conn->pending_params.supervision_timeout;
+
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_CONN_UPDATE,
+			.conn_update = {.status = 0, .conn_handle = conn->desc.conn_handle},
+	};
+	deliver_gap_event(&event);
+}
+
+static void mtu_complete(struct ble_npl_event *ev)
+{
+	host_ble_conn_t *conn = ble_npl_event_get_arg(ev);
+	if (!conn->in_use)
+	{
+		return;
+	}
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_MTU,
+			.mtu = {.conn_handle = conn->desc.conn_handle, .channel_id = 4, .value = HOST_BLE_CENTRAL_MTU},
+	};
+	deliver_gap_event(&event);
+}
+
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params)
+{
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	if (conn->update_pending)
+	{
+		return BLE_HS_EALREADY;
+	}
+	if (params->itvl_min > params->itvl_max)
+	{
+		return BLE_HS_EINVAL;
+	}
+	conn->pending_params = *params;
+	conn->update_pending = 1;
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->update_ev);
+	return 0;
+}
+
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time)
+{
+	if (tx_octets < 27 || tx_octets > 251 || tx_time < 328 || tx_time > 17040)
+	{
+		return BLE_HS_EINVAL;
+	}
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	// the central supports the maximum data length
+	conn->link.tx_octets = tx_octets;
+	return 0;
+}
+
+static void phy_complete(struct ble_npl_event *ev)
+{
+	host_ble_conn_t *conn = ble_npl_event_get_arg(ev);
+	if (!conn->in_use)
+	{
+		return;
+	}
+	conn->link.phy = conn->pending_phy;
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_PHY_UPDATE_COMPLETE,
+			.phy_updated = {.status = 0, .conn_handle = conn->desc.conn_handle, .tx_phy = conn->link.phy, .rx_phy = conn->link.phy},
+	};
+	deliver_gap_event(&event);
+}
+
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts)
+{
+	(void)phy_opts;
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	if (tx_phys_mask == 0 || rx_phys_mask == 0)
+	{
+		return BLE_HS_EINVAL;
+	}
+	// the central supports the 1M and 2M PHYs and picks the fastest both sides prefer
+	conn->pending_phy = (tx_phys_mask & rx_phys_mask & BLE_GAP_LE_PHY_2M_MASK) ? BLE_GAP_LE_PHY_2M : BLE_GAP_LE_PHY_1M;
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->phy_ev);
+	return 0;
+}
+
+int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb, void *cb_arg)
+{
+	(void)cb;
+	(void)cb_arg;
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	if (conn->mtu_exchanged)
+	{
+		return BLE_HS_EALREADY;
+	}
+	conn->mtu_exchanged = 1;
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->mtu_ev);
+	return 0;
+}
+
+int ble_sm_inject_io(uint16_t conn_handle, struct ble_sm_io *pkey)
+{
+	(void)pkey;
+	return find_conn(conn_handle) != NULL ? 0 : BLE_HS_ENOTCONN;
+}
+
+// -- L2CAP --
+
+int ble_l2cap_create_server(uint16_t psm, uint16_t mtu, ble_l2cap_event_fn *cb, void *cb_arg)
+{
+	if (cb == NULL)
+	{
+		return BLE_HS_EINVAL;
+	}
+	for (int i = 0; i < l2cap_servers_count; i++)
+	{
+		if (l2cap_servers[i].psm == psm)
+		{
+			return BLE_HS_EALREADY;
+		}
+	}
+	if (l2cap_servers_count == HOST_BLE_L2CAP_MAX_SERVERS)
+	{
+		return BLE_HS_ENOMEM;
+	}
+	l2cap_servers[l2cap_servers_count++] = (host_ble_l2cap_server_t){.psm = psm, .mtu = mtu, .cb = cb, .cb_arg = cb_arg};
+	return 0;
+}
+
+static int deliver_l2cap_event(struct ble_l2cap_chan *chan, struct ble_l2cap_event *event)
+{
+	return chan->server->cb(event, chan->server->cb_arg);
+}
+
+/**
+ * Air time of an LL data PDU and of the empty acknowledgement of the central, inter frame spaces included.
+ */
+static int64_t pdu_air_us(const host_ble_conn_t *conn, uint16_t octets)
+{
+	int bits_per_us = conn->link.phy == BLE_GAP_LE_PHY_2M ? 2 : 1;
+	int preamble = bits_per_us;
+	int mic = conn->desc.sec_state.encrypted ? 4 : 0;
+	// preamble, access address, header, payload, MIC and CRC, the acknowledgement without payload nor MIC
+	int data_bytes = preamble + 4 + 2 + octets + mic + 3;
+	int ack_bytes = preamble + 4 + 2 + 3;
+	return (data_bytes + ack_bytes) * 8 / bits_per_us + 2 * HOST_BLE_IFS_US;
+}
+
+/**
+ * Arm the link timer for the first connection event after now.
+ */
+static void link_schedule(host_ble_conn_t *conn)
+{
+	if (conn->link_scheduled)
+	{
+		return;
+	}
+	int64_t itvl_us = conn->desc.conn_itvl * 1250LL;
+	int64_t now_us = esp_timer_get_time();
+	int64_t next_us = conn->connected_us + ((now_us - conn->connected_us) / itvl_us + 1) * itvl_us;
+	conn->link_scheduled = 1;
+	esp_timer_start_once(conn->link_timer, next_us - now_us);
+}
+
+static void link_timer_cb(void *arg)
+{
+	host_ble_conn_t *conn = arg;
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &conn->link_ev);
+}
+
+/**
+ * Queue the K-frames of the SDU being sent to the controller, as long as there are credits.
+ */
+static void continue_tx(struct ble_l2cap_chan *chan)
+{
+	while (chan->tx_sdu != NULL && chan->credits > 0 && chan->queue_len < HOST_BLE_L2CAP_MAX_QUEUED)
+	{
+		uint16_t sdu_len = OS_MBUF_PKTLEN(chan->tx_sdu);
+		// the first K-frame starts with the SDU length
+		uint16_t header = chan->tx_off == 0 ? 2 : 0;
+		uint16_t count = sdu_len - chan->tx_off < chan->mps - header ? sdu_len - chan->tx_off : chan->mps - header;
+		host_ble_frame_t *frame = &chan->queue[(chan->queue_head + chan->queue_len) % HOST_BLE_L2CAP_MAX_QUEUED];
+		*frame = (host_ble_frame_t){.len = header + count};
+		chan->queue_len++;
+		chan->credits--;
+		chan->tx_off += count;
+		if (chan->tx_off == sdu_len)
+		{
+			frame->sdu = malloc(sdu_len > 0 ? sdu_len : 1);
+			frame->sdu_len = sdu_len;
+			os_mbuf_copydata(chan->tx_sdu, 0, sdu_len, frame->sdu);
+			os_mbuf_free_chain(chan->tx_sdu);
+			chan->tx_sdu = NULL;
+			chan->tx_off = 0;
+		}
+	}
+	if (chan->queue_len > 0)
+	{
+		link_schedule(chan->conn);
+	}
+}
+
+/**
+ * Air time of a K-frame and its basic header, split into PDUs of the data length.
+ */
+static int64_t frame_air_us(const host_ble_conn_t *conn, uint16_t len, uint32_t *pdus)
+{
+	int64_t frame_us = 0;
+	*pdus = 0;
+	for (uint16_t left = len + 4; left > 0; (*pdus)++)
+	{
+		uint16_t octets = left < conn->link.tx_octets ? left : conn->link.tx_octets;
+		frame_us += pdu_air_us(conn, octets);
+		left -= octets;
+	}
+	return frame_us;
+}
+
+/**
+ * A connection event: the credits of the central arrive with its first packet, the central sends the K-frames of its
+ * SDU, then the controller sends the queued K-frames back to back until the event would overrun the interval.
+ */
+static void link_event(struct ble_npl_event *ev)
+{
+	host_ble_conn_t *conn = ble_npl_event_get_arg(ev);
+	conn->link_scheduled = 0;
+	struct ble_l2cap_chan *chan = conn->chan;
+	if (!conn->in_use || chan == NULL)
+	{
+		return;
+	}
+
+	if (chan->returning > 0)
+	{
+		chan->credits += chan->returning;
+		conn->link.credits += chan->returning;
+		chan->returning = 0;
+		continue_tx(chan);
+		if (chan->stalled && chan->tx_sdu == NULL)
+		{
+			chan->stalled = 0;
+			struct ble_l2cap_event event = {
+					.type = BLE_L2CAP_EVENT_COC_TX_UNSTALLED,
+					.tx_unstalled = {.conn_handle = conn->desc.conn_handle, .chan = chan, .status = 0},
+			};
+			deliver_l2cap_event(chan, &event);
+		}
+	}
+
+	int64_t budget_us = conn->desc.conn_itvl * 1250LL - HOST_BLE_IFS_US;
+	int64_t used_us = 0;
+	uint32_t pdus;
+	// the server granted credits for a whole SDU along with its receive buffer
+	while (chan->uplink != NULL && chan->rx_sdu != NULL)
+	{
+		uint16_t header = chan->uplink_off == 0 ? 2 : 0;
+		uint16_t left = chan->uplink_len - chan->uplink_off;
+		uint16_t count = left < HOST_BLE_L2CAP_COC_MPS - header ? left : HOST_BLE_L2CAP_COC_MPS - header;
+		int64_t frame_us = frame_air_us(conn, header + count, &pdus);
+		if (used_us > 0 && used_us + frame_us > budget_us)
+		{
+			break;
+		}
+		used_us += frame_us;
+		conn->link.rx_pdus += pdus;
+		chan->uplink_off += count;
+		if (chan->uplink_off < chan->uplink_len)
+		{
+			continue;
+		}
+
+		// the server owns the SDU from the event on and posts a new buffer
+		struct os_mbuf *sdu = chan->rx_sdu;
+		chan->rx_sdu = NULL;
+		int ret = os_mbuf_append(sdu, chan->uplink, chan->uplink_len);
+		free(chan->uplink);
+		chan->uplink = NULL;
+		if (ret != 0)
+		{
+			// dropped when the pool runs dry, the buffer stays posted for the next one
+			os_mbuf_free_chain(SLIST_NEXT(sdu, om_next));
+			SLIST_NEXT(sdu, om_next) = NULL;
+			chan->rx_sdu = sdu;
+			sdu->om_len = 0;
+			break;
+		}
+		conn->link.rx_sdus++;
+		conn->link.rx_bytes += OS_MBUF_PKTLEN(sdu);
+		struct ble_l2cap_event event = {
+				.type = BLE_L2CAP_EVENT_COC_DATA_RECEIVED,
+				.receive = {.conn_handle = conn->desc.conn_handle, .chan = chan, .sdu_rx = sdu},
+		};
+		deliver_l2cap_event(chan, &event);
+	}
+
+	uint16_t credit_batch = chan->peer.initial_credits / 2 > 0 ? chan->peer.initial_credits / 2 : 1;
+	while (chan->queue_len > 0)
+	{
+		host_ble_frame_t frame = chan->queue[chan->queue_head];
+		int64_t frame_us = frame_air_us(conn, frame.len, &pdus);
+		if (used_us > 0 && used_us + frame_us > budget_us)
+		{
+			break;
+		}
+		used_us += frame_us;
+		conn->link.pdus += pdus;
+		conn->link.frames++;
+		conn->link.l2cap_bytes += frame.len;
+		chan->queue_head = (chan->queue_head + 1) % HOST_BLE_L2CAP_MAX_QUEUED;
+		chan->queue_len--;
+
+		if (frame.sdu != NULL)
+		{
+			conn->link.sdus++;
+			if (chan->peer.rx_cb != NULL)
+			{
+				chan->peer.rx_cb(conn->desc.conn_handle, frame.sdu, frame.sdu_len);
+			}
+			free(frame.sdu);
+		}
+		if (++chan->received >= credit_batch)
+		{
+			chan->returning += chan->received;
+			chan->received = 0;
+		}
+	}
+	if (used_us > 0)
+	{
+		conn->link.events++;
+		conn->link.air_us += used_us;
+	}
+	if (chan->queue_len > 0 || chan->returning > 0 || (chan->uplink != NULL && chan->rx_sdu != NULL))
+	{
+		link_schedule(conn);
+	}
+}
+
+/**
+ * Tear down the channel of a connection and tell the server.
+ */
+static void chan_disconnected(struct ble_l2cap_chan *chan)
+{
+	host_ble_conn_t *conn = chan->conn;
+	struct ble_l2cap_event event = {
+			.type = BLE_L2CAP_EVENT_COC_DISCONNECTED,
+			.disconnect = {.conn_handle = conn->desc.conn_handle, .chan = chan},
+	};
+	deliver_l2cap_event(chan, &event);
+
+	conn->chan = NULL;
+	os_mbuf_free_chain(chan->tx_sdu);
+	os_mbuf_free_chain(chan->rx_sdu);
+	free(chan->uplink);
+	for (; chan->queue_len > 0; chan->queue_len--)
+	{
+		free(chan->queue[chan->queue_head].sdu);
+		chan->queue_head = (chan->queue_head + 1) % HOST_BLE_L2CAP_MAX_QUEUED;
+	}
+	free(chan);
+}
+
+static void chan_disconnect_event(struct ble_npl_event *ev)
+{
+	host_ble_conn_t *conn = ble_npl_event_get_arg(ev);
+	if (conn->in_use && conn->chan != NULL)
+	{
+		chan_disconnected(conn->chan);
+	}
+}
+
+int ble_l2cap_send(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_tx)
+{
+	if (chan == NULL || sdu_tx == NULL)
+	{
+		return BLE_HS_EINVAL;
+	}
+	if (chan->tx_sdu != NULL)
+	{
+		return BLE_HS_EBUSY;
+	}
+	if (OS_MBUF_PKTLEN(sdu_tx) > chan->peer.mtu)
+	{
+		return BLE_HS_EBADDATA;
+	}
+	chan->tx_sdu = sdu_tx;
+	chan->tx_off = 0;
+	continue_tx(chan);
+	if (chan->tx_sdu != NULL)
+	{
+		chan->stalled = 1;
+		chan->conn->link.stalls++;
+		return BLE_HS_ESTALLED;
+	}
+	return 0;
+}
+
+int ble_l2cap_recv_ready(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_rx)
+{
+	if (chan == NULL || sdu_rx == NULL)
+	{
+		return BLE_HS_EINVAL;
+	}
+	os_mbuf_free_chain(chan->rx_sdu);
+	chan->rx_sdu = sdu_rx;
+	if (chan->uplink != NULL)
+	{
+		// the credits for the SDU of the central go out with the buffer
+		link_schedule(chan->conn);
+	}
+	return 0;
+}
+
+int ble_l2cap_disconnect(struct ble_l2cap_chan *chan)
+{
+	if (chan == NULL)
+	{
+		return BLE_HS_EINVAL;
+	}
+	// completes once the central answered
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &chan->conn->chan_disconnect_ev);
+	return 0;
+}
+
+int ble_l2cap_get_chan_info(struct ble_l2cap_chan *chan, struct ble_l2cap_chan_info *chan_info)
+{
+	if (chan == NULL || chan_info == NULL)
+	{
+		return BLE_HS_EINVAL;
+	}
+	*chan_info = (struct ble_l2cap_chan_info){
+			.scid = 0x40,
+			.dcid = 0x40,
+			.our_l2cap_mtu = HOST_BLE_L2CAP_COC_MPS,
+			.peer_l2cap_mtu = chan->peer.mps,
+			.psm = chan->server->psm,
+			.our_coc_mtu = chan->server->mtu,
+			.peer_coc_mtu = chan->peer.mtu,
+	};
+	return 0;
+}
+
+// -- STORE --
+
+static int find_bond(const ble_addr_t *addr)
+{
+	for (int i = 0; i < bonds_count; i++)
+	{
+		if (ble_addr_cmp(&bonds[i].peer_addr, addr) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int ble_store_read_peer_sec(const struct ble_store_key_sec *key_sec, struct ble_store_value_sec *value_sec)
+{
+	int index = find_bond(&key_sec->peer_addr);
+	if (index < 0)
+	{
+		return BLE_HS_ENOENT;
+	}
+	*value_sec = bonds[index];
+	return 0;
+}
+
+void ble_store_config_init(void)
+{
+}
+
+int ble_store_util_delete_peer(const ble_addr_t *peer_id_addr)
+{
+	int index = find_bond(peer_id_addr);
+	if (index < 0)
+	{
+		return BLE_HS_ENOENT;
+	}
+	memmove(&bonds[index], &bonds[index + 1], (bonds_count - index - 1) * sizeof(bonds[0]));
+	bonds_count--;
+	return 0;
+}
+
+int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg)
+{
+	(void)arg;
+	if (event->event_code != BLE_STORE_EVENT_FULL || bonds_count == 0)
+	{
+		return BLE_HS_EINVAL;
+	}
+	ble_addr_t oldest = bonds[0].peer_addr;
+	return ble_store_util_delete_peer(&oldest);
+}
+
+// -- SIMULATED CONNECTIONS --
+
+void host_ble_set_gap_cb(ble_gap_event_fn *cb, void *cb_arg)
+{
+	gap_cb = cb;
+	gap_cb_arg = cb_arg;
+}
+
+/**
+ * A simulation step, run on the NimBLE host task where the stack delivers its GAP events.
+ */
+typedef struct
+{
+	struct ble_npl_event ev;
+	int (*fn)(void *arg);
+	void *arg;
+	int ret;
+} host_ble_step_t;
+
+static void step_event(struct ble_npl_event *ev)
+{
+	host_ble_step_t *step = ble_npl_event_get_arg(ev);
+	step->ret = step->fn(step->arg);
+}
+
+/**
+ * Run a step on the NimBLE host task and wait until it and everything it triggered completed.
+ */
+static int run_step(int (*fn)(void *arg), void *arg)
+{
+	host_ble_step_t step = {.fn = fn, .arg = arg};
+	ble_npl_event_init(&step.ev, step_event, &step);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &step.ev);
+	host_rtos_wait_idle();
+	return step.ret;
+}
+
+typedef struct
+{
+	uint16_t conn_handle;
+	const ble_addr_t *peer_addr;
+} connect_args_t;
+
+static int connect_step(void *arg)
+{
+	const connect_args_t *args = arg;
+	uint16_t conn_handle = args->conn_handle;
+	host_ble_conn_t *conn = NULL;
+	for (int i = 0; conn == NULL && i < HOST_BLE_MAX_CONNS; i++)
+	{
+		conn = conns[i].in_use ? NULL : &conns[i];
+	}
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOMEM;
+	}
+	// the link timer of the slot is reused, the simulation connects thousands of times
+	esp_timer_handle_t link_timer = conn->link_timer;
+	memset(conn, 0, sizeof(*conn));
+	conn->in_use = 1;
+	conn->desc.conn_handle = conn_handle;
+	conn->desc.conn_itvl = HOST_BLE_CONN_ITVL;
+	conn->desc.supervision_timeout = 400;
+	conn->link.phy = BLE_GAP_LE_PHY_1M;
+	conn->link.tx_octets = HOST_BLE_DEFAULT_TX_OCTETS;
+	conn->connected_us = esp_timer_get_time();
+	ble_npl_event_init(&conn->update_ev, update_complete, conn);
+	ble_npl_event_init(&conn->mtu_ev, mtu_complete, conn);
+	ble_npl_event_init(&conn->phy_ev, phy_complete, conn);
+	ble_npl_event_init(&conn->link_ev, link_event, conn);
+	ble_npl_event_init(&conn->chan_disconnect_ev, chan_disconnect_event, conn);
+	conn->link_timer = link_timer;
+	if (conn->link_timer == NULL)
+	{
+		const esp_timer_create_args_t timer_args = {.callback = link_timer_cb, .arg = conn, .name = "host_ble_link"};
+		esp_timer_create(&timer_args, &conn->link_timer);
+	}
+	if (adv.active && adv.params.conn_mode != BLE_GAP_CONN_MODE_NON)
+	{
+		ble_gap_adv_stop();
+	}
+	conn->desc.peer_id_addr = *args->peer_addr;
+	conn->desc.peer_ota_addr = *args->peer_addr;
+
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_CONNECT,
+			.connect = {.status = 0, .conn_handle = conn_handle},
+	};
+	deliver_gap_event(&event);
+	return 0;
+}
+
+void host_ble_connect(uint16_t conn_handle, const ble_addr_t *peer_addr)
+{
+	connect_args_t args = {.conn_handle = conn_handle, .peer_addr = peer_addr};
+	run_step(connect_step, &args);
+}
+
+static int disconnect_step(void *arg)
+{
+	host_ble_conn_t *conn = find_conn(*(uint16_t *)arg);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	// the channels go down with the link, before the GAP event
+	if (conn->chan != NULL)
+	{
+		chan_disconnected(conn->chan);
+	}
+	esp_timer_stop(conn->link_timer);
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_DISCONNECT,
+			.disconnect = {.reason = 0x13, .conn = conn->desc},
+	};
+	conn->in_use = 0;
+	deliver_gap_event(&event);
+	return 0;
+}
+
+void host_ble_disconnect(uint16_t conn_handle)
+{
+	run_step(disconnect_step, &conn_handle);
+}
+
+int host_ble_security_initiated(uint16_t conn_handle)
+{
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	return conn != NULL && conn->security_initiated;
+}
+
+static void encrypted(host_ble_conn_t *conn)
+{
+	conn->desc.sec_state.encrypted = 1;
+	conn->desc.sec_state.bonded = 1;
+	conn->desc.sec_state.key_size = 16;
+
+	struct ble_gap_event event = {
+			.type = BLE_GAP_EVENT_ENC_CHANGE,
+			.enc_change = {.status = 0, .conn_handle = conn->desc.conn_handle},
+	};
+	deliver_gap_event(&event);
+}
+
+static int pair_step(void *arg)
+{
+	uint16_t conn_handle = *(uint16_t *)arg;
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+
+	if (find_bond(&conn->desc.peer_id_addr) >= 0)
+	{
+		struct ble_gap_event event = {
+				.type = BLE_GAP_EVENT_REPEAT_PAIRING,
+				.repeat_pairing = {.conn_handle = conn_handle, .cur_key_size = 16, .new_key_size = 16, .new_bonding = 1},
+		};
+		// the handler must delete the bond before asking to retry
+		if (deliver_gap_event(&event) != BLE_GAP_REPEAT_PAIRING_RETRY || find_bond(&conn->desc.peer_id_addr) >= 0)
+		{
+			return BLE_HS_EALREADY;
+		}
+	}
+
+	if (bonds_count == HOST_BLE_MAX_BONDS)
+	{
+		struct ble_store_status_event event = {
+				.event_code = BLE_STORE_EVENT_FULL,
+				.full = {.obj_type = BLE_STORE_OBJ_TYPE_PEER_SEC, .conn_handle = conn_handle},
+		};
+		if (ble_hs_cfg.store_status_cb == NULL || ble_hs_cfg.store_status_cb(&event, ble_hs_cfg.store_status_arg) != 0 ||
+				bonds_count == HOST_BLE_MAX_BONDS)
+		{
+			return BLE_HS_ENOMEM;
+		}
+	}
+
+	struct ble_store_value_sec *bond = &bonds[bonds_count++];
+	memset(bond, 0, sizeof(*bond));
+	bond->peer_addr = conn->desc.peer_id_addr;
+	bond->key_size = 16;
+	bond->ltk_present = 1;
+	bond->sc = 1;
+
+	encrypted(conn);
+	return 0;
+}
+
+int host_ble_pair(uint16_t conn_handle)
+{
+	return run_step(pair_step, &conn_handle);
+}
+
+static int resume_step(void *arg)
+{
+	host_ble_conn_t *conn = find_conn(*(uint16_t *)arg);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	if (find_bond(&conn->desc.peer_id_addr) < 0)
+	{
+		return BLE_HS_ENOENT;
+	}
+	encrypted(conn);
+	return 0;
+}
+
+int host_ble_resume_encryption(uint16_t conn_handle)
+{
+	return run_step(resume_step, &conn_handle);
+}
+
+int host_ble_bond_count(void)
+{
+	return bonds_count;
+}
+
+typedef struct
+{
+	uint16_t conn_handle;
+	uint16_t psm;
+	const host_ble_l2cap_peer_t *peer;
+} l2cap_connect_args_t;
+
+static int l2cap_connect_step(void *arg)
+{
+	const l2cap_connect_args_t *args = arg;
+	host_ble_conn_t *conn = find_conn(args->conn_handle);
+	if (conn == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	if (conn->chan != NULL)
+	{
+		return BLE_HS_EALREADY;
+	}
+	const host_ble_l2cap_server_t *server = NULL;
+	for (int i = 0; server == NULL && i < l2cap_servers_count; i++)
+	{
+		server = l2cap_servers[i].psm == args->psm ? &l2cap_servers[i] : NULL;
+	}
+	if (server == NULL)
+	{
+		return BLE_HS_ENOENT;
+	}
+
+	struct ble_l2cap_chan *chan = calloc(1, sizeof(*chan));
+	chan->conn = conn;
+	chan->server = server;
+	chan->peer = *args->peer;
+	chan->mps = args->peer->mps < HOST_BLE_L2CAP_COC_MPS ? args->peer->mps : HOST_BLE_L2CAP_COC_MPS;
+	chan->credits = args->peer->initial_credits;
+	conn->chan = chan;
+
+	struct ble_l2cap_event event = {
+			.type = BLE_L2CAP_EVENT_COC_ACCEPT,
+			.accept = {.conn_handle = args->conn_handle, .peer_sdu_size = args->peer->mtu, .chan = chan},
+	};
+	int ret = deliver_l2cap_event(chan, &event);
+	if (ret == 0 && chan->rx_sdu == NULL)
+	{
+		// the stack refuses the channel without a receive buffer
+		ret = BLE_HS_ENOMEM;
+	}
+	if (ret != 0)
+	{
+		conn->chan = NULL;
+		os_mbuf_free_chain(chan->rx_sdu);
+		free(chan);
+		return ret;
+	}
+
+	event = (struct ble_l2cap_event){
+			.type = BLE_L2CAP_EVENT_COC_CONNECTED,
+			.connect = {.status = 0, .conn_handle = args->conn_handle, .chan = chan},
+	};
+	deliver_l2cap_event(chan, &event);
+	return 0;
+}
+
+int host_ble_l2cap_connect(uint16_t conn_handle, uint16_t psm, const host_ble_l2cap_peer_t *peer)
+{
+	l2cap_connect_args_t args = {.conn_handle = conn_handle, .psm = psm, .peer = peer};
+	return run_step(l2cap_connect_step, &args);
+}
+
+typedef struct
+{
+	uint16_t conn_handle;
+	const void *data;
+	uint16_t len;
+} l2cap_send_args_t;
+
+static int l2cap_send_step(void *arg)
+{
+	const l2cap_send_args_t *args = arg;
+	host_ble_conn_t *conn = find_conn(args->conn_handle);
+	if (conn == NULL || conn->chan == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	struct ble_l2cap_chan *chan = conn->chan;
+	if (chan->rx_sdu == NULL || chan->uplink != NULL)
+	{
+		return BLE_HS_EBUSY;
+	}
+	if (args->len > chan->server->mtu)
+	{
+		return BLE_HS_EBADDATA;
+	}
+	// goes over the air from the next connection event on
+	chan->uplink = malloc(args->len > 0 ? args->len : 1);
+	memcpy(chan->uplink, args->data, args->len);
+	chan->uplink_len = args->len;
+	chan->uplink_off = 0;
+	link_schedule(conn);
+	return 0;
+}
+
+int host_ble_l2cap_send(uint16_t conn_handle, const void *data, uint16_t len)
+{
+	l2cap_send_args_t args = {.conn_handle = conn_handle, .data = data, .len = len};
+	return run_step(l2cap_send_step, &args);
+}
+
+static int l2cap_disconnect_step(void *arg)
+{
+	host_ble_conn_t *conn = find_conn(*(uint16_t *)arg);
+	if (conn == NULL || conn->chan == NULL)
+	{
+		return BLE_HS_ENOTCONN;
+	}
+	chan_disconnected(conn->chan);
+	return 0;
+}
+
+void host_ble_l2cap_disconnect(uint16_t conn_handle)
+{
+	run_step(l2cap_disconnect_step, &conn_handle);
+}
+
+void host_ble_get_link_stats(uint16_t conn_handle, host_ble_link_stats_t *stats)
+{
+	host_ble_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL)
+	{
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	*stats = conn->link;
+	stats->mbufs_peak = mbufs_peak;
+	stats->capacity_bps = (conn->link.tx_octets - 4) * 1000000LL / pdu_air_us(conn, conn->link.tx_octets);
+}
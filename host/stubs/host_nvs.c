@@ -0,0 +1,361 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define HOST_NVS_MAX_HANDLES 32
+#define HOST_NVS_BLOB_MAX 4000
+
+typedef enum
+{
+	ENTRY_U8,
+	ENTRY_U32,
+	ENTRY_BLOB,
+} entry_type_t;
+
+typedef struct host_nvs_entry
+{
+	struct host_nvs_entry *next;
+	char ns[NVS_KEY_NAME_MAX_SIZE];
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	entry_type_t type;
+	size_t length;
+	uint8_t data[];
+} host_nvs_entry_t;
+
+typedef struct
+{
+	int used;
+	nvs_open_mode_t mode;
+	char ns[NVS_KEY_NAME_MAX_SIZE];
+} host_nvs_handle_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_nvs_entry_t *entries = NULL;
+static host_nvs_handle_t handles[HOST_NVS_MAX_HANDLES];
+static host_nvs_stats_t stats;
+static uint32_t pass_writes = 0; //!< Set operations let through before fail_writes applies
+static uint32_t fail_writes = 0;
+static esp_err_t fail_error = ESP_OK;
+
+static host_nvs_entry_t **find_entry(const char *ns, const char *key)
+{
+	for (host_nvs_entry_t **it = &entries; *it != NULL; it = &(*it)->next)
+	{
+		if (strcmp((*it)->ns, ns) == 0 && strcmp((*it)->key, key) == 0)
+		{
+			return it;
+		}
+	}
+	return NULL;
+}
+
+static int namespace_exists(const char *ns)
+{
+	for (host_nvs_entry_t *it = entries; it != NULL; it = it->next)
+	{
+		if (strcmp(it->ns, ns) == 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static host_nvs_handle_t *get_handle(nvs_handle_t handle)
+{
+	if (handle == 0 || handle > HOST_NVS_MAX_HANDLES || !handles[handle - 1].used)
+	{
+		return NULL;
+	}
+	return &handles[handle - 1];
+}
+
+static esp_err_t set_entry(nvs_handle_t handle, const char *key, entry_type_t type, const void *value, size_t length)
+{
+	if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+	{
+		return ESP_ERR_NVS_KEY_TOO_LONG;
+	}
+	if (length > HOST_NVS_BLOB_MAX)
+	{
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+
+	pthread_mutex_lock(&nvs_lock);
+	host_nvs_handle_t *h = get_handle(handle);
+	if (h == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	if (h->mode != NVS_READWRITE)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_READ_ONLY;
+	}
+	if (pass_writes > 0)
+	{
+		pass_writes--;
+	}
+	else if (fail_writes > 0)
+	{
+		fail_writes--;
+		pthread_mutex_unlock(&nvs_lock);
+		return fail_error;
+	}
+
+	host_nvs_entry_t *entry = malloc(sizeof(*entry) + length);
+	if (entry == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NO_MEM;
+	}
+	strcpy(entry->ns, h->ns);
+	strcpy(entry->key, key);
+	entry->type = type;
+	entry->length = length;
+	memcpy(entry->data, value, length);
+
+	host_nvs_entry_t **existing = find_entry(h->ns, key);
+	if (existing != NULL)
+	{
+		host_nvs_entry_t *old = *existing;
+		entry->next = old->next;
+		*existing = entry;
+		free(old);
+	}
+	else
+	{
+		entry->next = entries;
+		entries = entry;
+	}
+	stats.writes++;
+	pthread_mutex_unlock(&nvs_lock);
+	return ESP_OK;
+}
+
+static esp_err_t get_entry(nvs_handle_t handle, const char *key, entry_type_t type, void *out, size_t *length)
+{
+	pthread_mutex_lock(&nvs_lock);
+	stats.lookups++;
+	host_nvs_handle_t *h = get_handle(handle);
+	if (h == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	host_nvs_entry_t **entry = find_entry(h->ns, key);
+	if (entry == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if ((*entry)->type != type)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_TYPE_MISMATCH;
+	}
+	// like the real blob API, a NULL output only queries the length
+	if (out == NULL)
+	{
+		*length = (*entry)->length;
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_OK;
+	}
+	if (*length < (*entry)->length)
+	{
+		*length = (*entry)->length;
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	}
+	memcpy(out, (*entry)->data, (*entry)->length);
+	*length = (*entry)->length;
+	pthread_mutex_unlock(&nvs_lock);
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+	host_nvs_reset();
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+	if (strlen(namespace_name) >= NVS_KEY_NAME_MAX_SIZE)
+	{
+		return ESP_ERR_NVS_INVALID_NAME;
+	}
+
+	pthread_mutex_lock(&nvs_lock);
+	// a read-only open of a namespace which was never written fails, as on the device
+	if (open_mode == NVS_READONLY && !namespace_exists(namespace_name))
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	for (int i = 0; i < HOST_NVS_MAX_HANDLES; i++)
+	{
+		if (!handles[i].used)
+		{
+			handles[i].used = 1;
+			handles[i].mode = open_mode;
+			strcpy(handles[i].ns, namespace_name);
+			*out_handle = i + 1;
+			pthread_mutex_unlock(&nvs_lock);
+			return ESP_OK;
+		}
+	}
+	pthread_mutex_unlock(&nvs_lock);
+	return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+	pthread_mutex_lock(&nvs_lock);
+	host_nvs_handle_t *h = get_handle(handle);
+	if (h != NULL)
+	{
+		h->used = 0;
+	}
+	pthread_mutex_unlock(&nvs_lock);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	pthread_mutex_lock(&nvs_lock);
+	esp_err_t ret = get_handle(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+	stats.commits++;
+	pthread_mutex_unlock(&nvs_lock);
+	return ret;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+	return set_entry(handle, key, ENTRY_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+	size_t length = sizeof(*out_value);
+	return get_entry(handle, key, ENTRY_U8, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+	return set_entry(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+	size_t length = sizeof(*out_value);
+	return get_entry(handle, key, ENTRY_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+	return set_entry(handle, key, ENTRY_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+	return get_entry(handle, key, ENTRY_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+	pthread_mutex_lock(&nvs_lock);
+	host_nvs_handle_t *h = get_handle(handle);
+	if (h == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	host_nvs_entry_t **entry = find_entry(h->ns, key);
+	if (entry == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	host_nvs_entry_t *old = *entry;
+	*entry = old->next;
+	free(old);
+	stats.writes++;
+	pthread_mutex_unlock(&nvs_lock);
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+	pthread_mutex_lock(&nvs_lock);
+	host_nvs_handle_t *h = get_handle(handle);
+	if (h == NULL)
+	{
+		pthread_mutex_unlock(&nvs_lock);
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	for (host_nvs_entry_t **it = &entries; *it != NULL;)
+	{
+		if (strcmp((*it)->ns, h->ns) == 0)
+		{
+			host_nvs_entry_t *old = *it;
+			*it = old->next;
+			free(old);
+			stats.writes++;
+		}
+		else
+		{
+			it = &(*it)->next;
+		}
+	}
+	pthread_mutex_unlock(&nvs_lock);
+	return ESP_OK;
+}
+
+void host_nvs_reset(void)
+{
+	pthread_mutex_lock(&nvs_lock);
+	while (entries != NULL)
+	{
+		host_nvs_entry_t *old = entries;
+		entries = old->next;
+		free(old);
+	}
+	memset(handles, 0, sizeof(handles));
+	memset(&stats, 0, sizeof(stats));
+	pass_writes = 0;
+	fail_writes = 0;
+	pthread_mutex_unlock(&nvs_lock);
+}
+
+void host_nvs_get_stats(host_nvs_stats_t *out)
+{
+	pthread_mutex_lock(&nvs_lock);
+	*out = stats;
+	pthread_mutex_unlock(&nvs_lock);
+}
+
+void host_nvs_fail_writes(uint32_t count, esp_err_t error)
+{
+	pthread_mutex_lock(&nvs_lock);
+	pass_writes = 0;
+	fail_writes = count;
+	fail_error = error;
+	pthread_mutex_unlock(&nvs_lock);
+}
+
+void host_nvs_fail_writes_after(uint32_t after, uint32_t count, esp_err_t error)
+{
+	pthread_mutex_lock(&nvs_lock);
+	pass_writes = after;
+	fail_writes = count;
+	fail_error = error;
+	pthread_mutex_unlock(&nvs_lock);
+}
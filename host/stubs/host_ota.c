@@ -0,0 +1,250 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+
+typedef struct
+{
+	const esp_partition_t *partition;
+	size_t wrote;				//!< Bytes written
+	size_t erased;			//!< Bytes erased from the start of the partition
+	bool sequential;		//!< Writes erase the sectors they reach, OTA_WITH_SEQUENTIAL_WRITES
+	esp_ota_handle_t id; //!< 0 for a free handle
+} host_ota_handle_t;
+
+static pthread_mutex_t ota_lock = PTHREAD_MUTEX_INITIALIZER;
+static const esp_partition_t *running = NULL;
+static const esp_partition_t *boot = NULL;
+static host_ota_handle_t current;
+static esp_ota_handle_t next_id = 1;
+static uint32_t restarts;
+
+static const esp_partition_t *slot(esp_partition_subtype_t subtype)
+{
+	return esp_partition_find_first(ESP_PARTITION_TYPE_APP, subtype, NULL);
+}
+
+static void signature(const uint8_t *image, size_t size, uint8_t *out)
+{
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+	mbedtls_sha256_update(&ctx, (const uint8_t *)HOST_OTA_SIGNING_KEY, strlen(HOST_OTA_SIGNING_KEY));
+	mbedtls_sha256_update(&ctx, image, size - HOST_OTA_SIGNATURE_LEN);
+	mbedtls_sha256_finish(&ctx, out);
+	mbedtls_sha256_free(&ctx);
+}
+
+/**
+ * Check the signature of the size bytes written to partition.
+ */
+static esp_err_t verify_signature(const esp_partition_t *partition, size_t size)
+{
+	if (size < HOST_OTA_SIGNATURE_LEN)
+	{
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+	uint8_t *image = malloc(size);
+	esp_err_t ret = image != NULL ? esp_partition_read(partition, 0, image, size) : ESP_ERR_NO_MEM;
+	uint8_t expected[HOST_OTA_SIGNATURE_LEN];
+	if (ret == ESP_OK)
+	{
+		signature(image, size, expected);
+		ret = memcmp(expected, &image[size - HOST_OTA_SIGNATURE_LEN], HOST_OTA_SIGNATURE_LEN) == 0 ? ESP_OK
+																																													 : ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+	free(image);
+	return ret;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+	pthread_mutex_lock(&ota_lock);
+	if (running == NULL)
+	{
+		running = slot(ESP_PARTITION_SUBTYPE_APP_OTA_0);
+	}
+	const esp_partition_t *partition = running;
+	pthread_mutex_unlock(&ota_lock);
+	return partition;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+	const esp_partition_t *partition = esp_ota_get_running_partition();
+	pthread_mutex_lock(&ota_lock);
+	partition = boot != NULL ? boot : partition;
+	pthread_mutex_unlock(&ota_lock);
+	return partition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+	const esp_partition_t *from = start_from != NULL ? start_from : esp_ota_get_running_partition();
+	return slot(from->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 ? ESP_PARTITION_SUBTYPE_APP_OTA_1 : ESP_PARTITION_SUBTYPE_APP_OTA_0);
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+	if (partition == NULL || out_handle == NULL || partition->type != ESP_PARTITION_TYPE_APP)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (partition == esp_ota_get_running_partition())
+	{
+		return ESP_ERR_OTA_PARTITION_CONFLICT;
+	}
+	if (image_size != OTA_SIZE_UNKNOWN && image_size != OTA_WITH_SEQUENTIAL_WRITES && image_size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	// a known size is erased at once, in 64 kB blocks where aligned, sequential writes erase sector by sector
+	size_t erase = image_size == OTA_SIZE_UNKNOWN ? partition->size : image_size == OTA_WITH_SEQUENTIAL_WRITES ? 0 : image_size;
+	erase = (erase + partition->erase_size - 1) / partition->erase_size * partition->erase_size;
+	esp_err_t ret = erase > 0 ? esp_partition_erase_range(partition, 0, erase) : ESP_OK;
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	pthread_mutex_lock(&ota_lock);
+	current = (host_ota_handle_t){
+			.partition = partition,
+			.erased = erase,
+			.sequential = image_size == OTA_WITH_SEQUENTIAL_WRITES,
+			.id = next_id++,
+	};
+	*out_handle = current.id;
+	pthread_mutex_unlock(&ota_lock);
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+	if (handle == 0 || handle != current.id || data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (current.wrote == 0 && size > 0 && ((const uint8_t *)data)[0] != HOST_OTA_IMAGE_MAGIC)
+	{
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+	if (current.wrote + size > current.partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	// as in ESP-IDF, the writes past a size given to esp_ota_begin() are not erased
+	while (current.sequential && current.erased < current.wrote + size)
+	{
+		esp_err_t ret = esp_partition_erase_range(current.partition, current.erased, current.partition->erase_size);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		current.erased += current.partition->erase_size;
+	}
+	esp_err_t ret = esp_partition_write(current.partition, current.wrote, data, size);
+	if (ret == ESP_OK)
+	{
+		current.wrote += size;
+	}
+	return ret;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+	if (handle == 0 || handle != current.id)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	uint8_t magic = 0;
+	esp_err_t ret = current.wrote > 0 ? esp_partition_read(current.partition, 0, &magic, 1) : ESP_OK;
+	current.id = 0;
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	if (magic != HOST_OTA_IMAGE_MAGIC)
+	{
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+#if CONFIG_SECURE_SIGNED_ON_UPDATE
+	return verify_signature(current.partition, current.wrote);
+#else
+	return ESP_OK;
+#endif
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+	if (handle == 0 || handle != current.id)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	current.id = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+	if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	uint8_t magic = 0;
+	esp_err_t ret = esp_partition_read(partition, 0, &magic, 1);
+	if (ret != ESP_OK || magic != HOST_OTA_IMAGE_MAGIC)
+	{
+		return ESP_ERR_OTA_VALIDATE_FAILED;
+	}
+	pthread_mutex_lock(&ota_lock);
+	boot = partition;
+	pthread_mutex_unlock(&ota_lock);
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+	return ESP_OK;
+}
+
+void esp_restart(void)
+{
+	const esp_partition_t *partition = esp_ota_get_boot_partition();
+	pthread_mutex_lock(&ota_lock);
+	running = partition;
+	boot = NULL;
+	restarts++;
+	pthread_mutex_unlock(&ota_lock);
+}
+
+void host_ota_sign(uint8_t *image, size_t size)
+{
+	if (size >= HOST_OTA_SIGNATURE_LEN)
+	{
+		signature(image, size, &image[size - HOST_OTA_SIGNATURE_LEN]);
+	}
+}
+
+uint32_t host_ota_restarts(void)
+{
+	pthread_mutex_lock(&ota_lock);
+	uint32_t count = restarts;
+	pthread_mutex_unlock(&ota_lock);
+	return count;
+}
+
+void host_ota_reset(void)
+{
+	pthread_mutex_lock(&ota_lock);
+	running = NULL;
+	boot = NULL;
+	current.id = 0;
+	restarts = 0;
+	pthread_mutex_unlock(&ota_lock);
+}
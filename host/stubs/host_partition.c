@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_core_dump.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+typedef struct
+{
+	esp_partition_t partition;
+	uint8_t *data; //!< Allocated on first use
+} host_partition_t;
+
+static pthread_mutex_t partition_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_partition_t partitions[] = {
+		{.partition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, HOST_PARTITION_APP_SIZE, HOST_PARTITION_SECTOR_SIZE, "ota_0"}},
+		{.partition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x610000, HOST_PARTITION_APP_SIZE, HOST_PARTITION_SECTOR_SIZE, "ota_1"}},
+		{.partition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0xc10000, HOST_PARTITION_SPIFFS_SIZE, HOST_PARTITION_SECTOR_SIZE, "spiffs"}},
+		{.partition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, 0xd10000, HOST_PARTITION_COREDUMP_SIZE, HOST_PARTITION_SECTOR_SIZE, "coredump"}},
+};
+static host_partition_stats_t stats;
+static host_partition_timing_t timing;
+
+/**
+ * Block the calling task while the chip is busy.
+ */
+static void flash_busy(int64_t busy_us)
+{
+	if (busy_us > 0)
+	{
+		pthread_mutex_lock(&partition_lock);
+		stats.busy_us += busy_us;
+		pthread_mutex_unlock(&partition_lock);
+		vTaskDelay(pdMS_TO_TICKS((busy_us + 999) / 1000));
+	}
+}
+
+/**
+ * Backing memory of a partition, under partition_lock.
+ */
+static uint8_t *partition_data(const esp_partition_t *partition)
+{
+	host_partition_t *host = (host_partition_t *)partition;
+	if (host->data == NULL)
+	{
+		host->data = malloc(partition->size);
+		memset(host->data, 0xFF, partition->size);
+	}
+	return host->data;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+	for (size_t i = 0; i < sizeof(partitions) / sizeof(partitions[0]); i++)
+	{
+		const esp_partition_t *partition = &partitions[i].partition;
+		if ((type == ESP_PARTITION_TYPE_ANY || partition->type == type) &&
+				(subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype) &&
+				(label == NULL || strcmp(partition->label, label) == 0))
+		{
+			return partition;
+		}
+	}
+	return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+	if (partition == NULL || dst == NULL || src_offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&partition_lock);
+	memcpy(dst, partition_data(partition) + src_offset, size);
+	stats.reads++;
+	stats.bytes_read += size;
+	pthread_mutex_unlock(&partition_lock);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+	if (partition == NULL || src == NULL || dst_offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&partition_lock);
+	uint8_t *data = partition_data(partition) + dst_offset;
+	const uint8_t *bytes = src;
+	for (size_t i = 0; i < size; i++)
+	{
+		// programming only clears bits
+		data[i] &= bytes[i];
+	}
+	stats.writes++;
+	stats.bytes_written += size;
+	int64_t busy_us = size > 0 ? (int64_t)((dst_offset + size - 1) / HOST_PARTITION_PAGE_SIZE - dst_offset / HOST_PARTITION_PAGE_SIZE + 1) * timing.page_write_us : 0;
+	pthread_mutex_unlock(&partition_lock);
+	flash_busy(busy_us);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+	if (partition == NULL || offset % partition->erase_size != 0 || size % partition->erase_size != 0 ||
+			offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&partition_lock);
+	memset(partition_data(partition) + offset, 0xFF, size);
+	stats.erases += size / partition->erase_size;
+	int64_t busy_us = 0;
+	for (size_t addr = partition->address + offset, end = addr + size; addr < end;)
+	{
+		bool block = addr % HOST_PARTITION_BLOCK_SIZE == 0 && end - addr >= HOST_PARTITION_BLOCK_SIZE;
+		busy_us += block ? timing.block_erase_us : timing.sector_erase_us;
+		addr += block ? HOST_PARTITION_BLOCK_SIZE : partition->erase_size;
+	}
+	pthread_mutex_unlock(&partition_lock);
+	flash_busy(busy_us);
+	return ESP_OK;
+}
+
+esp_err_t esp_core_dump_image_get(size_t *out_addr, size_t *out_size)
+{
+	if (out_addr == NULL || out_size == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+	if (partition == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	// the image starts with its total length, erased flash if none was saved
+	uint32_t size;
+	esp_partition_read(partition, 0, &size, sizeof(size));
+	if (size == 0xFFFFFFFF || size < sizeof(size) || size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	*out_addr = partition->address;
+	*out_size = size;
+	return ESP_OK;
+}
+
+void host_partition_reset(void)
+{
+	pthread_mutex_lock(&partition_lock);
+	for (size_t i = 0; i < sizeof(partitions) / sizeof(partitions[0]); i++)
+	{
+		if (partitions[i].data != NULL)
+		{
+			memset(partitions[i].data, 0xFF, partitions[i].partition.size);
+		}
+	}
+	memset(&stats, 0, sizeof(stats));
+	memset(&timing, 0, sizeof(timing));
+	pthread_mutex_unlock(&partition_lock);
+	host_ota_reset();
+}
+
+void host_partition_set_timing(const host_partition_timing_t *new_timing)
+{
+	pthread_mutex_lock(&partition_lock);
+	timing = *new_timing;
+	pthread_mutex_unlock(&partition_lock);
+}
+
+void host_partition_get_stats(host_partition_stats_t *out)
+{
+	pthread_mutex_lock(&partition_lock);
+	*out = stats;
+	pthread_mutex_unlock(&partition_lock);
+}
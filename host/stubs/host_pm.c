@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "esp_pm.h"
+
+struct esp_pm_lock
+{
+	esp_pm_lock_type_t type;
+	const char *name;
+	uint32_t count;
+};
+
+static pthread_mutex_t pm_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t held = 0;
+
+esp_err_t esp_pm_configure(const void *config)
+{
+	const esp_pm_config_t *pm_config = config;
+	if (pm_config == NULL || pm_config->min_freq_mhz > pm_config->max_freq_mhz)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle)
+{
+	(void)arg;
+	if (out_handle == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	esp_pm_lock_handle_t handle = calloc(1, sizeof(*handle));
+	if (handle == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	handle->type = lock_type;
+	handle->name = name;
+	*out_handle = handle;
+	return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+	if (handle == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	pthread_mutex_lock(&pm_lock);
+	handle->count++;
+	held++;
+	pthread_mutex_unlock(&pm_lock);
+	return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+	if (handle == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	esp_err_t ret = ESP_OK;
+	pthread_mutex_lock(&pm_lock);
+	if (handle->count == 0)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	else
+	{
+		handle->count--;
+		held--;
+	}
+	pthread_mutex_unlock(&pm_lock);
+	return ret;
+}
+
+esp_err_t esp_pm_lock_delete(esp_pm_lock_handle_t handle)
+{
+	if (handle == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (handle->count > 0)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	free(handle);
+	return ESP_OK;
+}
+
+uint32_t host_pm_held(void)
+{
+	pthread_mutex_lock(&pm_lock);
+	uint32_t count = held;
+	pthread_mutex_unlock(&pm_lock);
+	return count;
+}
@@ -0,0 +1,43 @@
+#ifndef _HOST_RTOS_INTERNAL_H_
+#define _HOST_RTOS_INTERNAL_H_
+
+/**
+ * Internals shared by the host FreeRTOS and timer stand-ins.
+ * Every blocking primitive is built on the same global lock so host_rtos_wait_idle can tell when all tasks are blocked.
+ */
+
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+
+#define HOST_RTOS_TIMER_PEEK 0 //!< Return the closest timer expiry, INT64_MAX if none
+#define HOST_RTOS_TIMER_RUN 1	//!< Run every timer expired at the given time
+
+/**
+ * Hook used by the timer stand-in to take part in the simulated time, called with the global lock held for peeks
+ * and without it for runs.
+ */
+typedef int64_t (*host_rtos_timer_hook_t)(int op, int64_t now_us);
+
+extern pthread_mutex_t host_rtos_lock;
+
+extern TickType_t host_rtos_ticks_locked(void);
+extern int64_t host_rtos_time_us_locked(void);
+extern TickType_t host_rtos_deadline_locked(TickType_t timeout);
+
+/**
+ * Block the calling task on an object until woken or until the deadline.
+ *
+ * @return 1 if woken before the deadline, 0 on timeout.
+ */
+extern int host_rtos_block_locked(const void *object, TickType_t deadline);
+
+/**
+ * Wake one task blocked on the object.
+ *
+ * @return 1 if a task was woken.
+ */
+extern int host_rtos_wake_locked(const void *object);
+
+extern void host_rtos_set_timer_hook(host_rtos_timer_hook_t hook);
+
+#endif // _HOST_RTOS_INTERNAL_H_
@@ -0,0 +1,138 @@
+#include <string.h>
+#include "mbedtls/sha256.h"
+
+static const uint32_t K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void transform(uint32_t state[8], const uint8_t block[64])
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+	if (ctx != NULL)
+	{
+		memset(ctx, 0, sizeof(*ctx));
+	}
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224)
+{
+	static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+																	 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	if (is224)
+	{
+		return -1;
+	}
+	memcpy(ctx->state, init, sizeof(init));
+	ctx->total = 0;
+	return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+	size_t fill = ctx->total % 64;
+	ctx->total += ilen;
+	if (fill > 0)
+	{
+		size_t count = 64 - fill < ilen ? 64 - fill : ilen;
+		memcpy(&ctx->buffer[fill], input, count);
+		input += count;
+		ilen -= count;
+		if (fill + count < 64)
+		{
+			return 0;
+		}
+		transform(ctx->state, ctx->buffer);
+	}
+	for (; ilen >= 64; input += 64, ilen -= 64)
+	{
+		transform(ctx->state, input);
+	}
+	memcpy(ctx->buffer, input, ilen);
+	return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+	uint64_t bits = ctx->total * 8;
+	uint8_t pad[72] = {0x80};
+	size_t fill = ctx->total % 64;
+	size_t pad_len = (fill < 56 ? 56 : 120) - fill;
+	for (int i = 0; i < 8; i++)
+	{
+		pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+	}
+	mbedtls_sha256_update(ctx, pad, pad_len + 8);
+	for (int i = 0; i < 8; i++)
+	{
+		output[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+		output[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+		output[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+		output[4 * i + 3] = (uint8_t)ctx->state[i];
+	}
+	return 0;
+}
+
+int mbedtls_sha256(const unsigned char *input, size_t ilen, unsigned char output[32], int is224)
+{
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init(&ctx);
+	int ret = mbedtls_sha256_starts(&ctx, is224);
+	if (ret == 0)
+	{
+		mbedtls_sha256_update(&ctx, input, ilen);
+		mbedtls_sha256_finish(&ctx, output);
+	}
+	mbedtls_sha256_free(&ctx);
+	return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef _HOST_MBEDTLS_SHA256_H_
+#define _HOST_MBEDTLS_SHA256_H_
+
+/**
+ * Host stand-in for the mbed TLS SHA-256 API of ESP-IDF 5, in software. The chip computes it in the SHA peripheral.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+	uint32_t state[8];
+	uint64_t total;			//!< Bytes hashed
+	uint8_t buffer[64]; //!< Bytes of the block being filled
+} mbedtls_sha256_context;
+
+extern void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+extern void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+extern int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224);
+extern int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen);
+extern int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]);
+extern int mbedtls_sha256(const unsigned char *input, size_t ilen, unsigned char output[32], int is224);
+
+#endif // _HOST_MBEDTLS_SHA256_H_
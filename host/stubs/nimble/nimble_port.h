@@ -0,0 +1,16 @@
+#ifndef _HOST_NIMBLE_PORT_H_
+#define _HOST_NIMBLE_PORT_H_
+
+/**
+ * Host stand-in for the NimBLE port: the default event queue is served by a host task created on first use, so
+ * initializing and running the port have nothing left to do.
+ */
+
+#include "esp_err.h"
+#include "host/ble_hs.h"
+
+extern esp_err_t nimble_port_init(void);
+extern void nimble_port_run(void);
+extern struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
+
+#endif // _HOST_NIMBLE_PORT_H_
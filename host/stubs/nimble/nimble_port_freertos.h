@@ -0,0 +1,15 @@
+#ifndef _HOST_NIMBLE_PORT_FREERTOS_H_
+#define _HOST_NIMBLE_PORT_FREERTOS_H_
+
+/**
+ * Host stand-in for the FreeRTOS glue of the NimBLE port. The host task already serves the default event queue, the
+ * one given is not started.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+extern void nimble_port_freertos_init(TaskFunction_t host_task_fn);
+extern void nimble_port_freertos_deinit(void);
+
+#endif // _HOST_NIMBLE_PORT_FREERTOS_H_
@@ -0,0 +1,78 @@
+#ifndef _HOST_NVS_H_
+#define _HOST_NVS_H_
+
+/**
+ * Host stand-in for the ESP-IDF NVS API, backed by an in-memory key/value table.
+ * Every set, erase, commit and get is counted so the simulation can report the flash traffic of each operation.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_KEY_TOO_LONG (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+	NVS_READONLY,
+	NVS_READWRITE
+} nvs_open_mode_t;
+
+extern esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+extern void nvs_close(nvs_handle_t handle);
+extern esp_err_t nvs_commit(nvs_handle_t handle);
+extern esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value);
+extern esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value);
+extern esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+extern esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value);
+extern esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+extern esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+extern esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+extern esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+/**
+ * Flash traffic counters of the in-memory NVS.
+ */
+typedef struct
+{
+	uint32_t writes;	//!< Number of set and erase operations
+	uint32_t lookups; //!< Number of get operations
+	uint32_t commits; //!< Number of commits
+} host_nvs_stats_t;
+
+/**
+ * Erase the whole in-memory NVS and reset the counters.
+ */
+extern void host_nvs_reset(void);
+
+/**
+ * Read the flash traffic counters since the last reset.
+ */
+extern void host_nvs_get_stats(host_nvs_stats_t *stats);
+
+/**
+ * Make the next `count` set operations fail with the given error, 0 disables the injection.
+ */
+extern void host_nvs_fail_writes(uint32_t count, esp_err_t error);
+
+/**
+ * Same as host_nvs_fail_writes, once `after` set operations went through.
+ */
+extern void host_nvs_fail_writes_after(uint32_t after, uint32_t count, esp_err_t error);
+
+#endif // _HOST_NVS_H_
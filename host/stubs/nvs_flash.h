@@ -0,0 +1,9 @@
+#ifndef _HOST_NVS_FLASH_H_
+#define _HOST_NVS_FLASH_H_
+
+#include "esp_err.h"
+
+extern esp_err_t nvs_flash_init(void);
+extern esp_err_t nvs_flash_erase(void);
+
+#endif // _HOST_NVS_FLASH_H_
@@ -0,0 +1,17 @@
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+/**
+ * Host stand-in for the generated sdkconfig.h, mirroring the values of sdkconfig.dev used by the lock core.
+ */
+
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#define CONFIG_BT_NIMBLE_MAX_BONDS 3
+#define CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM 2
+#define CONFIG_BT_NIMBLE_MSYS_1_BLOCK_COUNT 24
+#define CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE 255
+#define CONFIG_BT_NIMBLE_MSYS_2_BLOCK_COUNT 24
+#define CONFIG_BT_NIMBLE_MSYS_2_BLOCK_SIZE 320
+#define CONFIG_SECURE_SIGNED_ON_UPDATE 1
+
+#endif // _HOST_SDKCONFIG_H_
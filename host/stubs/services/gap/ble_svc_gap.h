@@ -0,0 +1,12 @@
+#ifndef _HOST_BLE_SVC_GAP_H_
+#define _HOST_BLE_SVC_GAP_H_
+
+/**
+ * Host stand-in for the NimBLE GAP service, keeping the device name only.
+ */
+
+extern int ble_svc_gap_device_name_set(const char *name);
+extern const char *ble_svc_gap_device_name(void);
+extern void ble_svc_gap_init(void);
+
+#endif // _HOST_BLE_SVC_GAP_H_
@@ -0,0 +1,10 @@
+#ifndef _HOST_BLE_SVC_GATT_H_
+#define _HOST_BLE_SVC_GATT_H_
+
+/**
+ * Host stand-in for the NimBLE GATT service, which the simulated ATT server doesn't expose.
+ */
+
+extern void ble_svc_gatt_init(void);
+
+#endif // _HOST_BLE_SVC_GATT_H_
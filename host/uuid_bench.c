@@ -0,0 +1,144 @@
+// Library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+// Local
+#include "check.h"
+#include "uuid_utils.h"
+
+/**
+ * UUID codec benchmark.
+ *
+ * Compares the table-driven decoder of uuid_utils.c with the sscanf-based one it replaced (kept below as
+ * legacy_convert_uuid_to_bytes), checks that both agree on valid strings, that malformed strings are rejected,
+ * and that the encoder round-trips.
+ *
+ * Usage: uuid_bench [iterations]
+ */
+
+#define UUID_SAMPLES 64 //!< Distinct UUIDs cycled through, so the branch predictor can't learn a single input
+
+/**
+ * The previous implementation, verbatim.
+ */
+static int legacy_convert_uuid_to_bytes(const char *uuid_string, uint8_t *bytes, uint8_t reverse_order)
+{
+	size_t uuid_string_length = strlen(uuid_string);
+	if (uuid_string_length != 36)
+	{
+		// Invalid UUID string length
+		return 1;
+	}
+
+	int start = 0;
+	int end = 16;
+	int step = 1;
+
+	if (reverse_order)
+	{
+		start = 15;
+		end = -1;
+		step = -1;
+	}
+
+	for (int i = start, j = 0; i != end; i += step, j += 2)
+	{
+		while (uuid_string[j] == '-' || uuid_string[j] == '\0')
+		{
+			j++; // Skip dashes and null characters
+		}
+
+		sscanf(&uuid_string[j], "%2hhx", &bytes[i]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+	char samples[UUID_SAMPLES][UUID_STRING_LEN + 1];
+	uint8_t expected[UUID_SAMPLES][16];
+	srand(42);
+	for (int i = 0; i < UUID_SAMPLES; i++)
+	{
+		for (int b = 0; b < 16; b++)
+		{
+			expected[i][b] = rand();
+		}
+		convert_bytes_to_uuid(expected[i], samples[i], 1);
+		// mixed case must decode as well
+		if (i & 1)
+		{
+			for (char *c = samples[i]; *c; c++)
+			{
+				*c = *c >= 'A' && *c <= 'F' ? *c - 'A' + 'a' : *c;
+			}
+		}
+	}
+
+	// both decoders agree and the encoder round-trips
+	for (int i = 0; i < UUID_SAMPLES; i++)
+	{
+		for (uint8_t reverse = 0; reverse <= 1; reverse++)
+		{
+			uint8_t legacy[16], decoded[16];
+			char encoded[UUID_STRING_LEN + 1];
+			CHECK(legacy_convert_uuid_to_bytes(samples[i], legacy, reverse) == 0, "legacy rejected %s", samples[i]);
+			CHECK(convert_uuid_to_bytes(samples[i], decoded, reverse) == 0, "rejected %s", samples[i]);
+			CHECK(memcmp(legacy, decoded, 16) == 0, "decoders disagree on %s", samples[i]);
+			convert_bytes_to_uuid(decoded, encoded, reverse);
+			CHECK(strcasecmp(encoded, samples[i]) == 0, "round trip %s -> %s", samples[i], encoded);
+		}
+	}
+
+	// malformed strings, all accepted by the legacy decoder except the length ones
+	const char *malformed[] = {
+			"91bad492-b950-4226-aa2b-4ede9fa42f5",
+			"91bad492-b950-4226-aa2b-4ede9fa42f590",
+			"91bad492xb950-4226-aa2b-4ede9fa42f59",
+			"91bad492-b950-4226-aa2b-4ede9fa42fg9",
+			"91bad492-b950-4226-aa2b4-ede9fa42f59",
+			"91bad492-b950-4226-aa2b-4ede9fa4 f59",
+	};
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+	{
+		uint8_t decoded[16];
+		CHECK(convert_uuid_to_bytes(malformed[i], decoded, 1) != 0, "accepted %s", malformed[i]);
+	}
+	uint8_t decoded[16];
+	CHECK(convert_uuid_n_to_bytes("91bad492-b950-4226-aa2b-4ede9fa42f59", 37, decoded, 1) == 0, "null-terminated form rejected");
+
+	volatile uint8_t sink = 0;
+	double start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		legacy_convert_uuid_to_bytes(samples[i % UUID_SAMPLES], decoded, 1);
+		sink ^= decoded[i & 15];
+	}
+	double legacy_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		convert_uuid_to_bytes(samples[i % UUID_SAMPLES], decoded, 1);
+		sink ^= decoded[i & 15];
+	}
+	double table_ns = (now_ns() - start) / iterations;
+
+	char encoded[UUID_STRING_LEN + 1];
+	start = now_ns();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		convert_bytes_to_uuid(expected[i % UUID_SAMPLES], encoded, 1);
+		sink ^= encoded[i % UUID_STRING_LEN];
+	}
+	double encode_ns = (now_ns() - start) / iterations;
+
+	printf("decode sscanf: %.1f ns/uuid\n", legacy_ns);
+	printf("decode table:  %.1f ns/uuid (%.1fx)\n", table_ns, table_ns > 0 ? legacy_ns / table_ns : 0);
+	printf("encode table:  %.1f ns/uuid (%u iterations)\n", encode_ns, (unsigned)iterations);
+	return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esp_log.h"
+
+/**
+ * Whether a line of the given level is printed for the tag: checked at compile time against LOG_LOCAL_LEVEL,
+ * then at runtime against the level set for the tag.
+ */
+#define LAZY_LOG_ENABLED(level, tag) (LOG_LOCAL_LEVEL >= (level) && esp_log_level_get(tag) >= (level))
+
+/**
+ * ESP_LOG_LEVEL variant whose arguments are only evaluated when the line is printed.
+ * ESP_LOGx evaluate their arguments before the runtime level check, use these for arguments costly to compute
+ * such as UUID_TO_STRING.
+ */
+#define LAZY_LOG_LEVEL(level, tag, format, ...)          \
+	do                                                     \
+	{                                                      \
+		if (LAZY_LOG_ENABLED(level, tag))                    \
+		{                                                    \
+			ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__);  \
+		}                                                    \
+	} while (0)
+
+#define LAZY_LOGE(tag, format, ...) LAZY_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define LAZY_LOGW(tag, format, ...) LAZY_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define LAZY_LOGI(tag, format, ...) LAZY_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define LAZY_LOGD(tag, format, ...) LAZY_LOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define LAZY_LOGV(tag, format, ...) LAZY_LOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
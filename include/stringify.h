@@ -1,20 +1,69 @@
 #pragma once
 
-#define UUID_TO_STRING(uuid)                                                              \
-	({                                                                                      \
-		char uuid_str[37];                                                                    \
-		sprintf(uuid_str,                                                                     \
-						"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",       \
-						uuid[15], uuid[14], uuid[13], uuid[12], uuid[11], uuid[10], uuid[9], uuid[8], \
-						uuid[7], uuid[6], uuid[5], uuid[4], uuid[3], uuid[2], uuid[1], uuid[0]);      \
-		uuid_str;                                                                             \
-	})
+#include <stdint.h>
 
-#define ADDR_TO_STRING(addr)                                       \
-	({                                                               \
-		char addr_str[18];                                             \
-		sprintf(addr_str,                                              \
-						"%02X:%02X:%02X:%02X:%02X:%02X",                       \
-						addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]); \
-		addr_str;                                                      \
-	})
+#define UUID_STR_LEN 37 //!< Size of a formatted uuid-128, null-terminator included
+#define ADDR_STR_LEN 18 //!< Size of a formatted BLE address, null-terminator included
+
+static const char STRINGIFY_HEX_DIGITS[16] = "0123456789ABCDEF";
+
+/**
+ * Write the two uppercase hex digits of a byte.
+ *
+ * @return The position after the digits.
+ */
+static inline char *stringify_hex_byte(char *out, uint8_t byte)
+{
+	out[0] = STRINGIFY_HEX_DIGITS[byte >> 4];
+	out[1] = STRINGIFY_HEX_DIGITS[byte & 0x0f];
+	return out + 2;
+}
+
+/**
+ * Format a uuid-128 stored in little-endian order (as in ble_uuid128_t) as an 8-4-4-4-12 uppercase string.
+ *
+ * @param uuid The 16 bytes of the uuid.
+ * @param buf Buffer of at least UUID_STR_LEN chars.
+ *
+ * @return buf
+ */
+static inline char *uuid_to_str(const uint8_t *uuid, char *buf)
+{
+	char *out = buf;
+	for (int i = 15; i >= 0; i--)
+	{
+		out = stringify_hex_byte(out, uuid[i]);
+		if (i == 12 || i == 10 || i == 8 || i == 6)
+		{
+			*out++ = '-';
+		}
+	}
+	*out = '\0';
+	return buf;
+}
+
+/**
+ * Format a BLE address stored in little-endian order (as in ble_addr_t) as XX:XX:XX:XX:XX:XX.
+ *
+ * @param addr The 6 bytes of the address.
+ * @param buf Buffer of at least ADDR_STR_LEN chars.
+ *
+ * @return buf
+ */
+static inline char *addr_to_str(const uint8_t *addr, char *buf)
+{
+	char *out = buf;
+	for (int i = 5; i >= 0; i--)
+	{
+		out = stringify_hex_byte(out, addr[i]);
+		*out++ = i > 0 ? ':' : '\0';
+	}
+	return buf;
+}
+
+/**
+ * Format into a buffer living until the end of the enclosing block, so the result can be passed straight to a
+ * log call. Combine with the LAZY_LOGx macros of lazy_log.h to skip the formatting for filtered out lines.
+ */
+#define UUID_TO_STRING(uuid) uuid_to_str((uuid), (char[UUID_STR_LEN]){0})
+#define ADDR_TO_STRING(addr) addr_to_str((addr), (char[ADDR_STR_LEN]){0})
@@ -1,17 +1,175 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
 #include <driver/gpio.h>
+#include "driver/gptimer.h"
+#include "driver/dedic_gpio.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 
 #include "step_motor.h"
 
+#define STEP_PIN_MASK 0x0F			 //!< All four driver inputs in the dedicated GPIO bundle
+#define STEP_PHASE_INDEX_MASK 0x07 //!< Wraps an index into STEP_PHASES
+
 static const char *LOG_TAG = "step_motor";
 
-static const uint8_t STEP_MATRIX[4][4] = {
-		{1, 1, 0, 0},
-		{0, 1, 1, 0},
-		{0, 0, 1, 1},
-		{1, 0, 0, 1}};
+/**
+ * Half-step coil phases as a bundle mask, bit 0 is IN1 and bit 3 is IN4.
+ * The odd entries, with two coils energized, form the full-step sequence.
+ */
+static const DRAM_ATTR uint8_t STEP_PHASES[8] = {
+		0b0001,
+		0b0011,
+		0b0010,
+		0b0110,
+		0b0100,
+		0b1100,
+		0b1000,
+		0b1001};
+
+static gptimer_handle_t step_timer = NULL;						//!< Timer pacing the coil phases
+static dedic_gpio_bundle_handle_t step_bundle = NULL; //!< The four driver inputs, written at once
+static SemaphoreHandle_t step_done = NULL;						//!< Given once a move completes or is stopped
+static portMUX_TYPE step_mux = portMUX_INITIALIZER_UNLOCKED; //!< Lets a single one of the ISR and step_motor_stop() end a move
+
+static uint16_t step_ramp[STEP_RAMP_MAX_LEN]; //!< Phase periods in timer ticks, from standstill to cruise
+static uint16_t step_ramp_len = 0;						//!< Used entries of step_ramp, the last one is the cruise period
+static uint8_t step_increment = 2;						//!< Half-steps per phase of the configured mode
+
+static volatile bool step_busy = false;					 //!< A move is running
+static volatile int32_t step_position = 0;			 //!< Position in half-steps
+static volatile uint32_t step_half_steps_left = 0; //!< Half-steps left to drive in the running move
+static volatile uint32_t step_phases_done = 0;		 //!< Phases driven in the running move
+static int8_t step_direction = 1;								 //!< 1 forward, -1 backward
+static uint8_t step_phase_index = 1;						 //!< Last driven phase, kept across moves so the sequence never skips
+static uint16_t step_period = 0;								 //!< Period currently programmed in the timer alarm
+static step_motor_done_cb_t step_done_cb = NULL;
+static void *step_done_arg = NULL;
+
+/**
+ * @internal
+ * @brief Program the alarm period, only touching the timer if it changes.
+ */
+static inline void IRAM_ATTR step_set_period(uint16_t period)
+{
+	if (period == step_period)
+	{
+		return;
+	}
+	gptimer_alarm_config_t alarm_config = {
+			.alarm_count = period,
+			.reload_count = 0,
+			.flags = {
+					.auto_reload_on_alarm = true,
+			},
+	};
+	gptimer_set_alarm_action(step_timer, &alarm_config);
+	step_period = period;
+}
+
+/**
+ * @internal
+ * @brief De-energize the coils and end the move, called with step_mux held and the timer stopped.
+ */
+static inline void IRAM_ATTR step_motor_finish(void)
+{
+	dedic_gpio_bundle_write(step_bundle, STEP_PIN_MASK, 0);
+	step_busy = false;
+}
+
+/**
+ * @internal
+ * @brief Drive the next coil phase and pick the period of the next one from the ramp, called with step_mux held.
+ */
+static inline void IRAM_ATTR step_drive_phase(void)
+{
+	// in full-step mode, realign on a two coils phase with a single half-step if needed
+	uint32_t increment = step_increment;
+	if (increment == 2 && !(step_phase_index & 1))
+	{
+		increment = 1;
+	}
+	if (increment > step_half_steps_left)
+	{
+		increment = step_half_steps_left;
+	}
+
+	step_phase_index = (step_phase_index + step_direction * (int)increment) & STEP_PHASE_INDEX_MASK;
+	dedic_gpio_bundle_write(step_bundle, STEP_PIN_MASK, STEP_PHASES[step_phase_index]);
+	step_half_steps_left -= increment;
+	step_position += step_direction * (int32_t)increment;
+	step_phases_done++;
+
+	// accelerate from the start, decelerate towards the end, cruise in between
+	uint32_t phases_left = (step_half_steps_left + step_increment - 1) / step_increment;
+	uint32_t ramp_index = step_phases_done < phases_left ? step_phases_done : phases_left;
+	if (ramp_index >= step_ramp_len)
+	{
+		ramp_index = step_ramp_len - 1;
+	}
+	step_set_period(step_ramp[ramp_index]);
+}
+
+/**
+ * @internal
+ * @brief Timer alarm, drives the next coil phase or ends the move once every half-step is driven.
+ */
+static bool IRAM_ATTR step_timer_on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+	bool finished = false;
+
+	portENTER_CRITICAL_ISR(&step_mux);
+	// a move stopped from the other core may leave a last alarm behind
+	if (step_busy && step_half_steps_left == 0)
+	{
+		gptimer_stop(timer);
+		step_motor_finish();
+		finished = true;
+	}
+	else if (step_busy)
+	{
+		step_drive_phase();
+	}
+	portEXIT_CRITICAL_ISR(&step_mux);
+
+	if (!finished)
+	{
+		return false;
+	}
+	if (step_done_cb != NULL)
+	{
+		step_done_cb(step_position, step_done_arg);
+	}
+	BaseType_t task_woken = pdFALSE;
+	xSemaphoreGiveFromISR(step_done, &task_woken);
+	return task_woken == pdTRUE;
+}
+
+/**
+ * @internal
+ * @brief Precompute the ramp periods with the recurrence from D. Austin, "Generate stepper-motor speed
+ * profiles in real time": c0 = 0.676 * f * sqrt(2 / a), cn = cn-1 - 2 * cn-1 / (4n + 1).
+ */
+static void step_compute_ramp(const step_motor_config_t *config)
+{
+	float min_period = (float)STEP_TIMER_RESOLUTION_HZ / config->max_rate;
+	if (min_period > UINT16_MAX)
+	{
+		min_period = UINT16_MAX;
+	}
+
+	step_ramp_len = 0;
+	float period = 0.676f * STEP_TIMER_RESOLUTION_HZ * sqrtf(2.0f / config->accel);
+	for (int n = 1; period > min_period && step_ramp_len < STEP_RAMP_MAX_LEN - 1; n++)
+	{
+		step_ramp[step_ramp_len++] = period > UINT16_MAX ? UINT16_MAX : (uint16_t)period;
+		period -= 2.0f * period / (4 * n + 1);
+	}
+	step_ramp[step_ramp_len++] = (uint16_t)min_period;
+}
 
 esp_err_t step_motor_init()
 {
@@ -20,53 +178,220 @@ esp_err_t step_motor_init()
 	gpio_reset_pin(STEP_DRIVER_PIN_IN2);
 	gpio_reset_pin(STEP_DRIVER_PIN_IN3);
 	gpio_reset_pin(STEP_DRIVER_PIN_IN4);
-	// Sets the GPIO pins to output mode.
-	gpio_set_direction(STEP_DRIVER_PIN_IN1, GPIO_MODE_OUTPUT);
-	gpio_set_direction(STEP_DRIVER_PIN_IN2, GPIO_MODE_OUTPUT);
-	gpio_set_direction(STEP_DRIVER_PIN_IN3, GPIO_MODE_OUTPUT);
-	gpio_set_direction(STEP_DRIVER_PIN_IN4, GPIO_MODE_OUTPUT);
 
+	// Bundle the driver inputs so a phase is a single write.
+	const int bundle_pins[] = {STEP_DRIVER_PIN_IN1, STEP_DRIVER_PIN_IN2, STEP_DRIVER_PIN_IN3, STEP_DRIVER_PIN_IN4};
+	dedic_gpio_bundle_config_t bundle_config = {
+			.gpio_array = bundle_pins,
+			.array_size = sizeof(bundle_pins) / sizeof(bundle_pins[0]),
+			.flags = {
+					.out_en = 1,
+			},
+	};
+	esp_err_t ret = dedic_gpio_new_bundle(&bundle_config, &step_bundle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create GPIO bundle; ret=%s", esp_err_to_name(ret));
+		return ret;
+	}
+	dedic_gpio_bundle_write(step_bundle, STEP_PIN_MASK, 0);
 	ESP_LOGD(LOG_TAG, "GPIO pins initialized");
 
+	step_done = xSemaphoreCreateBinary();
+	if (step_done == NULL)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create done semaphore");
+		return ESP_ERR_NO_MEM;
+	}
+
+	// Phase timer, the alarm reloads so each phase is paced from the previous alarm without drift.
+	gptimer_config_t timer_config = {
+			.clk_src = GPTIMER_CLK_SRC_DEFAULT,
+			.direction = GPTIMER_COUNT_UP,
+			.resolution_hz = STEP_TIMER_RESOLUTION_HZ,
+	};
+	ret = gptimer_new_timer(&timer_config, &step_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create timer; ret=%s", esp_err_to_name(ret));
+		return ret;
+	}
+
+	gptimer_event_callbacks_t timer_callbacks = {
+			.on_alarm = step_timer_on_alarm,
+	};
+	ret = gptimer_register_event_callbacks(step_timer, &timer_callbacks, NULL);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to register timer callbacks; ret=%s", esp_err_to_name(ret));
+		return ret;
+	}
+
+	ret = gptimer_enable(step_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to enable timer; ret=%s", esp_err_to_name(ret));
+		return ret;
+	}
+
+	step_motor_config_t config = STEP_MOTOR_CONFIG_DEFAULT();
+	return step_motor_configure(&config);
+}
+
+esp_err_t step_motor_configure(const step_motor_config_t *config)
+{
+	// a phase takes at least a timer tick, and the first period of the ramp comes from the acceleration
+	if (config == NULL || config->max_rate == 0 || config->max_rate > STEP_TIMER_RESOLUTION_HZ || config->accel == 0)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (step_busy)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	step_increment = config->mode == STEP_MODE_HALF ? 1 : 2;
+	step_compute_ramp(config);
+
+	ESP_LOGD(LOG_TAG, "Configured; mode=%s max_rate=%" PRIu32 " accel=%" PRIu32 " ramp=%d phases (%d -> %dus)",
+					 config->mode == STEP_MODE_HALF ? "half" : "full", config->max_rate, config->accel,
+					 step_ramp_len, step_ramp[0], step_ramp[step_ramp_len - 1]);
+
 	return ESP_OK;
 }
 
-void step_motor_step(int count)
+esp_err_t step_motor_move_to(int32_t position, step_motor_done_cb_t done_cb, void *arg)
+{
+	if (step_timer == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (step_busy)
+	{
+		ESP_LOGE(LOG_TAG, "Move rejected, motor busy");
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	// drop a completion left over from a move nobody waited for
+	xSemaphoreTake(step_done, 0);
+
+	int32_t distance = position - step_position;
+	step_direction = (distance >= 0) ? 1 : -1;
+	step_half_steps_left = (uint32_t)abs(distance);
+	step_phases_done = 0;
+	step_done_cb = done_cb;
+	step_done_arg = arg;
+	step_busy = true;
+
+	// the first phase is driven on the first alarm, one ramp period from now
+	step_set_period(step_ramp[0]);
+	esp_err_t ret = gptimer_set_raw_count(step_timer, 0);
+	if (ret == ESP_OK)
+	{
+		ret = gptimer_start(step_timer);
+	}
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to start timer; ret=%s", esp_err_to_name(ret));
+		step_busy = false;
+		return ret;
+	}
+
+	ESP_LOGD(LOG_TAG, "Move started; from=%" PRId32 " to=%" PRId32, step_position, position);
+	return ESP_OK;
+}
+
+esp_err_t step_motor_move(int steps, step_motor_done_cb_t done_cb, void *arg)
+{
+	return step_motor_move_to(step_position + steps * STEP_HALF_STEPS_PER_STEP, done_cb, arg);
+}
+
+esp_err_t step_motor_rotate(int32_t angle, step_motor_done_cb_t done_cb, void *arg)
+{
+	int32_t half_steps = (int32_t)((int64_t)angle * STEP_HALF_STEPS_PER_REV / 360);
+	return step_motor_move_to(step_position + half_steps, done_cb, arg);
+}
+
+esp_err_t step_motor_wait(TickType_t timeout)
+{
+	if (!step_busy)
+	{
+		return ESP_OK;
+	}
+	if (xSemaphoreTake(step_done, timeout) != pdTRUE)
+	{
+		return ESP_ERR_TIMEOUT;
+	}
+	return ESP_OK;
+}
+
+esp_err_t step_motor_stop(void)
 {
-	uint8_t direction = (count >= 0) ? 1 : 0;
-	count = abs(count);
+	if (!step_busy)
+	{
+		return ESP_OK;
+	}
 
-	int start_index = (direction == 1) ? 0 : 3;
-	int end_index = (direction == 1) ? 4 : -1;
-	int step = (direction == 1) ? 1 : -1;
+	esp_err_t ret = gptimer_stop(step_timer);
 
-	for (int x = 0; x < count; x++)
+	portENTER_CRITICAL(&step_mux);
+	bool finished = step_busy && ret == ESP_OK;
+	if (finished)
 	{
-		for (int i = start_index; i != end_index; i += step)
-		{
-			uint8_t bit = STEP_MATRIX[i][0];
-			gpio_set_level(STEP_DRIVER_PIN_IN1, bit);
-			bit = STEP_MATRIX[i][1];
-			gpio_set_level(STEP_DRIVER_PIN_IN2, bit);
-			bit = STEP_MATRIX[i][2];
-			gpio_set_level(STEP_DRIVER_PIN_IN3, bit);
-			bit = STEP_MATRIX[i][3];
-			gpio_set_level(STEP_DRIVER_PIN_IN4, bit);
+		step_motor_finish();
+	}
+	bool busy = step_busy;
+	portEXIT_CRITICAL(&step_mux);
+	if (!finished)
+	{
+		// the ISR completed the move in the meantime, which also stops the timer
+		return busy ? ret : ESP_OK;
+	}
 
-			vTaskDelay(STEP_DELAY / portTICK_PERIOD_MS);
-		}
+	// on this task rather than the ISR, the callback is documented to run in either
+	if (step_done_cb != NULL)
+	{
+		step_done_cb(step_position, step_done_arg);
 	}
+	xSemaphoreGive(step_done);
+	ESP_LOGD(LOG_TAG, "Move stopped; position=%" PRId32, step_position);
+	return ESP_OK;
+}
 
-	// Reset to default state
-	gpio_set_level(STEP_DRIVER_PIN_IN1, 0);
-	gpio_set_level(STEP_DRIVER_PIN_IN2, 0);
-	gpio_set_level(STEP_DRIVER_PIN_IN3, 0);
-	gpio_set_level(STEP_DRIVER_PIN_IN4, 0);
+bool step_motor_is_busy(void)
+{
+	return step_busy;
+}
 
-	vTaskDelay(STEP_DELAY / portTICK_PERIOD_MS);
+int32_t step_motor_get_position(void)
+{
+	return step_position;
+}
+
+esp_err_t step_motor_set_position(int32_t position)
+{
+	if (step_busy)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	step_position = position;
+	return ESP_OK;
 }
 
-void step_motor_angle(int8_t angle)
+void step_motor_step(int count)
 {
-	step_motor_step(STEP_FULL_ROTATION * angle / 360);
+	if (step_motor_move(count, NULL, NULL) != ESP_OK)
+	{
+		return;
+	}
+	step_motor_wait(portMAX_DELAY);
+}
+
+void step_motor_angle(int32_t angle)
+{
+	if (step_motor_rotate(angle, NULL, NULL) != ESP_OK)
+	{
+		return;
+	}
+	step_motor_wait(portMAX_DELAY);
 }
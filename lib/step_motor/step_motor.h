@@ -1,12 +1,26 @@
 #ifndef _STEP_MOTOR_H_
 #define _STEP_MOTOR_H_
 
+#include <stdbool.h>
 #include <driver/gpio.h>
+#include "freertos/FreeRTOS.h"
 
 /**
  * This driver is meant for a 4-wire stepper motor driver (ULN2003) connected to a 28BYJ-48 stepper motor.
  *
- * Supports forward and backward rotations.
+ * Supports forward and backward rotations, full-step (4 phases, two coils) and half-step (8 phases) sequencing
+ * and trapezoidal acceleration/deceleration ramps.
+ *
+ * Moves are asynchronous: the coil phases are driven from a general purpose timer ISR which writes the four
+ * driver inputs at once through a dedicated GPIO bundle, so the caller is never blocked while the motor turns.
+ * The phase period is read from a ramp table precomputed by step_motor_configure(), the ISR only indexes it.
+ *
+ * Positions are counted in half-steps whatever the sequencing mode, so they remain valid across mode changes.
+ *
+ * @note The dedicated GPIO bundle belongs to the CPU core that called step_motor_init(), the timer interrupt
+ * is allocated on the same core.
+ * @note The timer ISR is IRAM safe (CONFIG_GPTIMER_ISR_IRAM_SAFE and CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM), so flash
+ * writes, e.g. NVS commits, don't hold the phases back.
  */
 
 #define STEP_DRIVER_PIN_IN1 GPIO_NUM_14
@@ -14,18 +28,144 @@
 #define STEP_DRIVER_PIN_IN3 GPIO_NUM_12
 #define STEP_DRIVER_PIN_IN4 GPIO_NUM_11
 
-#define STEP_FULL_ROTATION 511 //!< Approximate number of steps for a full rotation.
-#define STEP_DELAY 15					 //!< Delay between steps in ms.
+#define STEP_FULL_ROTATION 511																//!< Approximate number of steps for a full rotation.
+#define STEP_HALF_STEPS_PER_STEP 8														//!< Half-steps in one step of step_motor_step().
+#define STEP_HALF_STEPS_PER_REV (STEP_FULL_ROTATION * STEP_HALF_STEPS_PER_STEP) //!< Half-steps for a full rotation.
+#define STEP_TIMER_RESOLUTION_HZ 1000000											//!< Resolution of the phase timer, 1 tick = 1 us.
+#define STEP_RAMP_MAX_LEN 512																	//!< Maximum number of phases in the acceleration ramp.
+
+#define STEP_DEFAULT_MAX_RATE 1000 //!< Default cruise rate in phases per second.
+#define STEP_DEFAULT_ACCEL 4000		 //!< Default acceleration in phases per second squared.
+
+/**
+ * Coil sequencing modes.
+ */
+typedef enum
+{
+	STEP_MODE_FULL, //!< 4 phases, two coils energized at a time, 2 half-steps per phase
+	STEP_MODE_HALF, //!< 8 phases, alternating one and two coils, 1 half-step per phase
+} step_motor_mode_t;
+
+/**
+ * Motion configuration.
+ */
+typedef struct
+{
+	step_motor_mode_t mode; //!< Coil sequencing mode
+	uint32_t max_rate;			//!< Cruise rate in phases per second, up to STEP_TIMER_RESOLUTION_HZ
+	uint32_t accel;					//!< Acceleration and deceleration in phases per second squared, not 0
+} step_motor_config_t;
+
+#define STEP_MOTOR_CONFIG_DEFAULT()      \
+	{                                      \
+		.mode = STEP_MODE_HALF,              \
+		.max_rate = STEP_DEFAULT_MAX_RATE,   \
+		.accel = STEP_DEFAULT_ACCEL,         \
+	}
+
+/**
+ * Called once a move completes or is stopped.
+ *
+ * @param position The motor position in half-steps.
+ * @param arg The argument given when starting the move.
+ *
+ * @note Runs in the timer ISR when the move completes, in the calling task when step_motor_stop() ends it: it must
+ * be short, only use ISR safe APIs, and be placed in IRAM (IRAM_ATTR) since the ISR keeps running while the flash
+ * cache is disabled.
+ */
+typedef void (*step_motor_done_cb_t)(int32_t position, void *arg);
 
 /**
- * Initialize the step motor driver.
+ * Initialize the step motor driver with STEP_MOTOR_CONFIG_DEFAULT().
  *
- * @return Always returns ESP_OK.
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
  */
 extern esp_err_t step_motor_init();
 
 /**
- * Rotate the motor by a number of steps.
+ * Change the motion configuration and precompute its ramp.
+ *
+ * @param config The configuration to apply.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if a move is running, ESP_ERR_INVALID_ARG
+ * for a null rate, a rate above STEP_TIMER_RESOLUTION_HZ or a null acceleration.
+ */
+extern esp_err_t step_motor_configure(const step_motor_config_t *config);
+
+/**
+ * Start a move to an absolute position and return immediately.
+ *
+ * @param position Target position in half-steps.
+ * @param done_cb Optional callback invoked from the timer ISR once the move completes.
+ * @param arg Argument given to done_cb.
+ *
+ * @return Returns ESP_OK if the move has started. ESP_ERR_INVALID_STATE if a move is already running.
+ */
+extern esp_err_t step_motor_move_to(int32_t position, step_motor_done_cb_t done_cb, void *arg);
+
+/**
+ * Start rotating the motor by a number of steps and return immediately.
+ *
+ * @param steps Number of steps to rotate, a step being STEP_HALF_STEPS_PER_STEP half-steps.
+ * @param done_cb Optional callback invoked from the timer ISR once the move completes.
+ * @param arg Argument given to done_cb.
+ *
+ * @return Returns ESP_OK if the move has started. ESP_ERR_INVALID_STATE if a move is already running.
+ *
+ * @note If steps is negative, the motor will rotate backwards.
+ * @note A full rotation is set in the `STEP_FULL_ROTATION` macro.
+ */
+extern esp_err_t step_motor_move(int steps, step_motor_done_cb_t done_cb, void *arg);
+
+/**
+ * Start rotating the motor by an angle and return immediately.
+ *
+ * @param angle Angle to rotate in degrees, any range.
+ * @param done_cb Optional callback invoked from the timer ISR once the move completes.
+ * @param arg Argument given to done_cb.
+ *
+ * @return Returns ESP_OK if the move has started. ESP_ERR_INVALID_STATE if a move is already running.
+ *
+ * @note If angle is negative, the motor will rotate backwards.
+ */
+extern esp_err_t step_motor_rotate(int32_t angle, step_motor_done_cb_t done_cb, void *arg);
+
+/**
+ * Wait for the running move to complete.
+ *
+ * @param timeout Maximum ticks to wait.
+ *
+ * @return Returns ESP_OK once the motor is idle. ESP_ERR_TIMEOUT if the move is still running.
+ */
+extern esp_err_t step_motor_wait(TickType_t timeout);
+
+/**
+ * Stop the running move, the coils are de-energized and the done callback is invoked from the calling task.
+ * If the move completes at the same time, only the ISR reports it.
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t step_motor_stop(void);
+
+/**
+ * Whether a move is running.
+ */
+extern bool step_motor_is_busy(void);
+
+/**
+ * Current position in half-steps, updated on every phase.
+ */
+extern int32_t step_motor_get_position(void);
+
+/**
+ * Redefine the current position, e.g. to zero it at a mechanical end stop.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if a move is running.
+ */
+extern esp_err_t step_motor_set_position(int32_t position);
+
+/**
+ * Rotate the motor by a number of steps and wait for the move to complete.
  *
  * @param steps Number of steps to rotate.
  *
@@ -35,12 +175,12 @@ extern esp_err_t step_motor_init();
 extern void step_motor_step(int steps);
 
 /**
- * Rotate the motor forward.
+ * Rotate the motor and wait for the move to complete.
  *
- * @param angle Angle to rotate in degrees.
+ * @param angle Angle to rotate in degrees, any range.
  *
- * @note If steps is negative, the motor will rotate backwards.
+ * @note If angle is negative, the motor will rotate backwards.
  */
-extern void step_motor_angle(int8_t angle);
+extern void step_motor_angle(int32_t angle);
 
 #endif
@@ -0,0 +1,235 @@
+// Library
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_timer.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+// Local
+#include "cl_ble_adv.h"
+#include "cl_ble_svc.h"
+#include "cl_phy_lock_svc.h"
+#include "gatts/cl_ble_lock_svc.h"
+
+// -- DEFINES --
+#define AD_HEADER_LEN 2 //!< Length and type bytes of an AD structure
+
+_Static_assert(3 + AD_HEADER_LEN + 2 + sizeof(cl_ble_adv_lock_frame_t) <= BLE_HS_ADV_MAX_SZ, "the lock frame must fit in a legacy advertisement");
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void append_ad(uint8_t type, const void *data, uint8_t len);
+static void start_advertising(void);
+static void state_changed(uint8_t state, void *arg);
+static void state_event(struct ble_npl_event *ev);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_adv";
+
+// payloads, built once by cl_ble_adv_init
+static uint8_t adv_data[BLE_HS_ADV_MAX_SZ];
+static uint8_t adv_data_len = 0;
+static uint8_t *adv_state; //!< State byte of the lock frame within adv_data
+static struct ble_hs_adv_fields rsp_fields;
+static uint8_t rsp_data[BLE_HS_ADV_MAX_SZ]; //!< Raw scan response set by cl_ble_adv_set_scan_rsp, replaces rsp_fields
+static uint8_t rsp_data_len = 0;
+
+// only accessed from the NimBLE host task once started
+static uint8_t adv_own_addr_type;
+static ble_gap_event_fn *adv_cb = NULL;
+static void *adv_cb_arg = NULL;
+static int64_t fast_until_us = 0; //!< esp_timer_get_time() at which the fast window ends
+
+static struct ble_npl_event state_ev;
+static atomic_uint_fast8_t published_state;
+
+esp_err_t cl_ble_adv_init(void)
+{
+	// flags: general discoverable, BLE only
+	const uint8_t flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+	append_ad(BLE_HS_ADV_TYPE_FLAGS, &flags, sizeof(flags));
+
+	// manufacturer data: company identifier, then the lock frame
+	struct __attribute__((packed))
+	{
+		uint16_t company_id;
+		cl_ble_adv_lock_frame_t lock;
+	} mfg_data = {
+			.company_id = CL_BLE_ADV_COMPANY_ID,
+			.lock = {
+					.frame = CL_BLE_ADV_FRAME_LOCK,
+					.state = cl_phy_lock_svc_get_state(),
+			},
+	};
+	memcpy(mfg_data.lock.svc_uuid, cl_ble_lock_svc_uuid.value, sizeof(mfg_data.lock.svc_uuid));
+	append_ad(BLE_HS_ADV_TYPE_MFG_DATA, &mfg_data, sizeof(mfg_data));
+	adv_state = &adv_data[adv_data_len - 1];
+
+	// scan response: the name, only fetched by active scanners
+	rsp_fields.name = (uint8_t *)CL_BLE_DEVICE_NAME;
+	rsp_fields.name_len = strlen(CL_BLE_DEVICE_NAME);
+	rsp_fields.name_is_complete = 1;
+	rsp_fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+	rsp_fields.tx_pwr_lvl_is_present = 1;
+
+	atomic_store(&published_state, *adv_state);
+	ble_npl_event_init(&state_ev, state_event, NULL);
+	return cl_phy_lock_svc_add_state_cb(state_changed, NULL);
+}
+
+void cl_ble_adv_start(uint8_t own_addr_type, ble_gap_event_fn *cb, void *cb_arg)
+{
+	// the controller keeps the payloads, they are only uploaded again after a reset
+	*adv_state = atomic_load(&published_state);
+	int ret = ble_gap_adv_set_data(adv_data, adv_data_len);
+	if (ret != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to set advertisement data; ret=%d", ret);
+		return;
+	}
+	ret = rsp_data_len > 0 ? ble_gap_adv_rsp_set_data(rsp_data, rsp_data_len) : ble_gap_adv_rsp_set_fields(&rsp_fields);
+	if (ret != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to set scan response data; ret=%d", ret);
+		return;
+	}
+
+	adv_own_addr_type = own_addr_type;
+	adv_cb = cb;
+	adv_cb_arg = cb_arg;
+	fast_until_us = esp_timer_get_time() + CL_BLE_ADV_FAST_WINDOW_MS * 1000LL;
+	start_advertising();
+}
+
+void cl_ble_adv_set_scan_rsp(const uint8_t *data, uint8_t len)
+{
+	memcpy(rsp_data, data, len);
+	rsp_data_len = len;
+	if (adv_cb == NULL)
+	{
+		// not synced yet, cl_ble_adv_start uploads it
+		return;
+	}
+
+	// the controller answers the next scan request with it, the procedure keeps running
+	int ret = ble_gap_adv_rsp_set_data(rsp_data, rsp_data_len);
+	if (ret != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to update scan response data; ret=%d", ret);
+	}
+}
+
+void cl_ble_adv_on_gap_event(const struct ble_gap_event *event)
+{
+	switch (event->type)
+	{
+	case BLE_GAP_EVENT_CONNECT:
+		if (event->connect.status != 0)
+		{
+			start_advertising();
+		}
+		return;
+
+	case BLE_GAP_EVENT_DISCONNECT:
+	case BLE_GAP_EVENT_ADV_COMPLETE:
+		// the fast window is over once the procedure timed out, start_advertising goes slow then
+		start_advertising();
+		return;
+
+	default:
+		return;
+	}
+}
+
+/**
+ * @internal
+ * @brief Append an AD structure to the advertisement.
+ */
+static void append_ad(uint8_t type, const void *data, uint8_t len)
+{
+	adv_data[adv_data_len++] = len + 1;
+	adv_data[adv_data_len++] = type;
+	memcpy(&adv_data[adv_data_len], data, len);
+	adv_data_len += len;
+}
+
+/**
+ * @internal
+ * @brief Advertise unless already advertising: fast until the end of the fast window, slow afterwards.
+ */
+static void start_advertising(void)
+{
+	if (adv_cb == NULL || ble_gap_adv_active())
+	{
+		return;
+	}
+
+	struct ble_gap_adv_params adv_params;
+	memset(&adv_params, 0, sizeof(adv_params));
+	adv_params.filter_policy = BLE_HCI_SCAN_FILT_NO_WL;
+	adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+	adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+
+	int32_t duration_ms = BLE_HS_FOREVER;
+	int64_t fast_left_us = fast_until_us - esp_timer_get_time();
+	if (fast_left_us >= 1000)
+	{
+		adv_params.itvl_min = CL_BLE_ADV_FAST_ITVL_MIN;
+		adv_params.itvl_max = CL_BLE_ADV_FAST_ITVL_MAX;
+		duration_ms = fast_left_us / 1000;
+	}
+	else
+	{
+		adv_params.itvl_min = CL_BLE_ADV_SLOW_ITVL_MIN;
+		adv_params.itvl_max = CL_BLE_ADV_SLOW_ITVL_MAX;
+	}
+
+	int ret = ble_gap_adv_start(adv_own_addr_type, NULL, duration_ms, &adv_params, adv_cb, adv_cb_arg);
+	if (ret != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to start advertising; ret=%d", ret);
+		return;
+	}
+	ESP_LOGD(LOG_TAG, "Advertising %s; duration=%" PRId32 "ms", duration_ms == BLE_HS_FOREVER ? "slow" : "fast", duration_ms);
+}
+
+/**
+ * @internal
+ * @brief Lock state callback: records the state and defers the advertisement update to the NimBLE host task.
+ */
+static void state_changed(uint8_t state, void *arg)
+{
+	atomic_store(&published_state, state);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &state_ev);
+}
+
+/**
+ * @internal
+ * @brief Patch the state into the advertisement and advertise it fast again.
+ * Only the state byte of the cached advertisement changes, nothing is encoded again.
+ */
+static void state_event(struct ble_npl_event *ev)
+{
+	*adv_state = atomic_load(&published_state);
+	if (adv_cb == NULL)
+	{
+		// not synced yet, cl_ble_adv_start uploads the latest state
+		return;
+	}
+
+	int ret = ble_gap_adv_set_data(adv_data, adv_data_len);
+	if (ret != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to update advertisement data; ret=%d", ret);
+	}
+
+	fast_until_us = esp_timer_get_time() + CL_BLE_ADV_FAST_WINDOW_MS * 1000LL;
+	if (ble_gap_adv_active())
+	{
+		// the parameters of a running procedure can't change, restart it
+		ble_gap_adv_stop();
+		start_advertising();
+	}
+}
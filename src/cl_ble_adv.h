@@ -0,0 +1,68 @@
+#ifndef _CL_BLE_ADV_H_
+#define _CL_BLE_ADV_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "host/ble_hs.h"
+
+#define CL_BLE_ADV_COMPANY_ID 0xFFFF //!< Bluetooth SIG company identifier of the manufacturer data, 0xFFFF until one is assigned
+#define CL_BLE_ADV_FRAME_LOCK 0x01	 //!< Type of the manufacturer data frame carrying the lock service and state
+#define CL_BLE_ADV_FRAME_STATUS 0x02 //!< Type of the manufacturer data frame carrying the signed status, see cl_ble_broadcast.h
+
+// Advertising intervals, in 0.625 ms units: fast for a while after boot or a state change so apps pick the lock up
+// quickly, slow afterwards to save power. Both are among the intervals recommended by Apple.
+#define CL_BLE_ADV_FAST_ITVL_MIN 48		 //!< 30 ms
+#define CL_BLE_ADV_FAST_ITVL_MAX 96		 //!< 60 ms
+#define CL_BLE_ADV_SLOW_ITVL_MIN 1636	 //!< 1022.5 ms
+#define CL_BLE_ADV_SLOW_ITVL_MAX 1800	 //!< 1125 ms
+#define CL_BLE_ADV_FAST_WINDOW_MS 30000 //!< Time spent advertising fast after boot or a state change
+
+/**
+ * Manufacturer data of the advertisement, after the company identifier.
+ * Scanners read the service and the lock state from it without connecting.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t frame;				//!< CL_BLE_ADV_FRAME_LOCK
+	uint8_t svc_uuid[16]; //!< cl_ble_lock_svc_uuid, in little-endian order
+	uint8_t state;				//!< Current PHY_LOCK_STATE_* value
+} cl_ble_adv_lock_frame_t;
+
+/**
+ * Initialize the advertising payloads: the advertisement carries the flags and the lock frame as manufacturer data,
+ * the scan response carries the device name. They are built once, only the state byte changes afterwards.
+ *
+ * @note Must be called after cl_phy_lock_svc_init() and before the NimBLE host is started.
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t cl_ble_adv_init(void);
+
+/**
+ * Start advertising fast, to be called once the host is synced.
+ *
+ * @param own_addr_type The address type to advertise with.
+ * @param cb The GAP event handler of the connections made through the advertisement.
+ * @param cb_arg Argument given to cb.
+ */
+extern void cl_ble_adv_start(uint8_t own_addr_type, ble_gap_event_fn *cb, void *cb_arg);
+
+/**
+ * Replace the scan response, e.g. by a broadcast frame. Uploaded right away once advertising started, by
+ * cl_ble_adv_start() otherwise.
+ *
+ * @note Must be called from the NimBLE host task, or before the host is started.
+ *
+ * @param data The raw scan response, made of AD structures.
+ * @param len Length of data, at most BLE_HS_ADV_MAX_SZ.
+ */
+extern void cl_ble_adv_set_scan_rsp(const uint8_t *data, uint8_t len);
+
+/**
+ * Resume advertising when it stopped, to be called from the GAP event handler:
+ * - BLE_GAP_EVENT_CONNECT (failed), BLE_GAP_EVENT_DISCONNECT: resumes in the current mode.
+ * - BLE_GAP_EVENT_ADV_COMPLETE: switches to slow once the fast window elapsed, resumes otherwise.
+ */
+extern void cl_ble_adv_on_gap_event(const struct ble_gap_event *event);
+
+#endif // _CL_BLE_ADV_H_
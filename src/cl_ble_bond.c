@@ -0,0 +1,392 @@
+// Library
+#include <inttypes.h>
+#include <string.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+// Local
+#include "lazy_log.h"
+#include "stringify.h"
+#include "cl_ble_bond.h"
+
+// -- DEFINES --
+#define NVS_BOND_NAMESPACE "BLEBOND" //<! Bond store namespace used in NVS
+#define NVS_BOND_LRU_KEY "LRU"			 //<! Bond usage order key used in NVS, see bond_lru_record_t
+#define BOND_LRU_VERSION 1					 //<! Layout version of the bond_lru_record_t stored in NVS
+#define BOND_MAX CONFIG_BT_NIMBLE_MAX_BONDS
+
+// a bond can only be evicted while its peer is not connected
+_Static_assert(CONFIG_BT_NIMBLE_MAX_BONDS >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS, "every connected peer must be able to keep its bond");
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief Usage of a bonded peer.
+ */
+typedef struct __attribute__((packed))
+{
+	ble_addr_t addr;		//!< Identity address of the peer
+	uint32_t last_used; //!< Value of the usage clock when the peer last encrypted a connection
+} bond_lru_entry_t;
+
+/**
+ * @internal
+ * @brief Bond usage order persisted as a single NVS blob, the keys are kept by the NimBLE store.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t version;	 //!< Layout version, BOND_LRU_VERSION
+	uint8_t count;		 //!< Valid entries
+	uint16_t reserved; //!< Reserved, always 0
+	uint32_t clock;		 //!< Usage clock, incremented on every use
+	bond_lru_entry_t entries[BOND_MAX];
+} bond_lru_record_t;
+
+/**
+ * @internal
+ * @brief A connection, tracked to measure its connect-to-request latency.
+ */
+typedef struct
+{
+	uint16_t conn_handle; //!< BLE_HS_CONN_HANDLE_NONE for a free slot
+	uint8_t bonded;				//!< Whether the peer was bonded when it connected and did not pair again
+	uint8_t requested;		//!< Whether the first request was already recorded
+	int64_t connect_us;		//!< esp_timer_get_time() of the connection
+} bond_conn_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static int bond_store_status_cb(struct ble_store_status_event *event, void *arg);
+static uint8_t is_bonded(const ble_addr_t *addr);
+static void touch_bond(const ble_addr_t *addr);
+static void forget_bond(const ble_addr_t *addr);
+static esp_err_t save_lru(void);
+static bond_conn_t *find_conn(uint16_t conn_handle);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_bond";
+
+static bond_lru_record_t lru = {.version = BOND_LRU_VERSION}; //!< Only accessed from the NimBLE host task
+static bond_conn_t conns[CL_BLE_MAX_CONNECTIONS];
+static cl_ble_bond_stats_t bond_stats;
+
+esp_err_t cl_ble_bond_init(void)
+{
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+	}
+
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_BOND_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	bond_lru_record_t record;
+	size_t record_len = sizeof(record);
+	ret = nvs_get_blob(nvs_handle, NVS_BOND_LRU_KEY, &record, &record_len);
+	nvs_close(nvs_handle);
+	if (ret == ESP_OK && record_len == sizeof(record) && record.version == BOND_LRU_VERSION && record.count <= BOND_MAX)
+	{
+		lru = record;
+		ESP_LOGD(LOG_TAG, "%s Bond usage loaded: %d bonds", __func__, lru.count);
+	}
+	else if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	else
+	{
+		// no usage yet, or from another layout: bonds not listed are evicted first
+		ESP_LOGD(LOG_TAG, "%s No bond usage found", __func__);
+	}
+
+	ble_hs_cfg.store_status_cb = bond_store_status_cb;
+	return ESP_OK;
+}
+
+int cl_ble_bond_on_gap_event(struct ble_gap_event *event)
+{
+	struct ble_gap_conn_desc desc;
+	bond_conn_t *conn;
+	int ret;
+
+	switch (event->type)
+	{
+	case BLE_GAP_EVENT_CONNECT:
+		if (event->connect.status != 0 || ble_gap_conn_find(event->connect.conn_handle, &desc) != 0)
+		{
+			return 0;
+		}
+		conn = find_conn(BLE_HS_CONN_HANDLE_NONE);
+		if (conn != NULL)
+		{
+			conn->conn_handle = event->connect.conn_handle;
+			conn->bonded = is_bonded(&desc.peer_id_addr);
+			conn->requested = 0;
+			conn->connect_us = esp_timer_get_time();
+		}
+		// a bonded peer encrypts with the stored keys, no need to wait for the central to ask
+		if (is_bonded(&desc.peer_id_addr))
+		{
+			ret = ble_gap_security_initiate(event->connect.conn_handle);
+			if (ret != 0)
+			{
+				ESP_LOGE(LOG_TAG, "Failed to resume encryption; conn_handle=%d ret=%d", event->connect.conn_handle, ret);
+			}
+		}
+		return 0;
+
+	case BLE_GAP_EVENT_DISCONNECT:
+		conn = find_conn(event->disconnect.conn.conn_handle);
+		if (conn != NULL)
+		{
+			conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+		}
+		return 0;
+
+	case BLE_GAP_EVENT_ENC_CHANGE:
+		if (event->enc_change.status != 0 || ble_gap_conn_find(event->enc_change.conn_handle, &desc) != 0)
+		{
+			return 0;
+		}
+		if (desc.sec_state.bonded)
+		{
+			touch_bond(&desc.peer_id_addr);
+		}
+		return 0;
+
+	case BLE_GAP_EVENT_REPEAT_PAIRING:
+		// the peer lost its keys: delete ours and let it pair again
+		ret = ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc);
+		if (ret != 0)
+		{
+			return BLE_GAP_REPEAT_PAIRING_IGNORE;
+		}
+		LAZY_LOGI(LOG_TAG, "Repeat pairing, deleting bond; addr=%s", ADDR_TO_STRING(desc.peer_id_addr.val));
+		conn = find_conn(event->repeat_pairing.conn_handle);
+		if (conn != NULL)
+		{
+			conn->bonded = 0;
+		}
+		ble_store_util_delete_peer(&desc.peer_id_addr);
+		forget_bond(&desc.peer_id_addr);
+		bond_stats.repeat_pairings++;
+		return BLE_GAP_REPEAT_PAIRING_RETRY;
+
+	case BLE_GAP_EVENT_PASSKEY_ACTION:
+	{
+		struct ble_sm_io pkey = {
+				.action = event->passkey.params.action,
+		};
+		switch (pkey.action)
+		{
+		case BLE_SM_IOACT_DISP:
+			pkey.passkey = CL_BLE_PASSKEY;
+			break;
+		case BLE_SM_IOACT_NUMCMP:
+			// there is no display to compare on, accept as with just works
+			pkey.numcmp_accept = 1;
+			break;
+		default:
+			ESP_LOGE(LOG_TAG, "Unsupported passkey action; action=%d", pkey.action);
+			return 0;
+		}
+		ret = ble_sm_inject_io(event->passkey.conn_handle, &pkey);
+		if (ret != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to inject passkey; ret=%d", ret);
+		}
+		return 0;
+	}
+
+	default:
+		return 0;
+	}
+}
+
+void cl_ble_bond_on_request(uint16_t conn_handle)
+{
+	bond_conn_t *conn = find_conn(conn_handle);
+	if (conn == NULL || conn->requested)
+	{
+		return;
+	}
+	conn->requested = 1;
+
+	uint32_t latency_us = esp_timer_get_time() - conn->connect_us;
+	cl_ble_bond_latency_t *latency = conn->bonded ? &bond_stats.resumed : &bond_stats.paired;
+	latency->count++;
+	latency->total_us += latency_us;
+	if (latency_us > latency->max_us)
+	{
+		latency->max_us = latency_us;
+	}
+	ESP_LOGD(LOG_TAG, "First request; conn_handle=%d bonded=%d latency=%" PRIu32 "us", conn_handle, conn->bonded, latency_us);
+}
+
+void cl_ble_bond_get_stats(cl_ble_bond_stats_t *stats)
+{
+	*stats = bond_stats;
+}
+
+/**
+ * @internal
+ * @brief Store status callback: when the store is full, evicts the least recently used bond of a peer that
+ * is not connected. Falls back to the NimBLE round-robin policy if no such bond is known.
+ */
+static int bond_store_status_cb(struct ble_store_status_event *event, void *arg)
+{
+	if (event->event_code != BLE_STORE_EVENT_FULL)
+	{
+		return ble_store_util_status_rr(event, arg);
+	}
+
+	int victim = -1;
+	for (int i = 0; i < lru.count; i++)
+	{
+		struct ble_gap_conn_desc desc;
+		if (ble_gap_conn_find_by_addr(&lru.entries[i].addr, &desc) == 0)
+		{
+			continue;
+		}
+		if (victim < 0 || lru.entries[i].last_used < lru.entries[victim].last_used)
+		{
+			victim = i;
+		}
+	}
+	if (victim < 0)
+	{
+		return ble_store_util_status_rr(event, arg);
+	}
+
+	ble_addr_t addr = lru.entries[victim].addr;
+	LAZY_LOGI(LOG_TAG, "Evicting least recently used bond; addr=%s", ADDR_TO_STRING(addr.val));
+	forget_bond(&addr);
+	bond_stats.evictions++;
+	int ret = ble_store_util_delete_peer(&addr);
+	// the entry might have been deleted behind our back, let the default policy make room then
+	return ret == 0 ? 0 : ble_store_util_status_rr(event, arg);
+}
+
+/**
+ * @internal
+ * @brief Whether the NimBLE store holds keys for the peer.
+ */
+static uint8_t is_bonded(const ble_addr_t *addr)
+{
+	struct ble_store_key_sec key = {
+			.peer_addr = *addr,
+	};
+	struct ble_store_value_sec value;
+	return ble_store_read_peer_sec(&key, &value) == 0;
+}
+
+/**
+ * @internal
+ * @brief Mark the bond of the peer as the most recently used and persist the order.
+ */
+static void touch_bond(const ble_addr_t *addr)
+{
+	int index = -1;
+	for (int i = 0; i < lru.count; i++)
+	{
+		if (ble_addr_cmp(&lru.entries[i].addr, addr) == 0)
+		{
+			index = i;
+			break;
+		}
+	}
+	if (index < 0)
+	{
+		// the NimBLE store makes room before a new bond is written, so a slot is only missing for stale entries
+		if (lru.count == BOND_MAX)
+		{
+			index = 0;
+			for (int i = 1; i < lru.count; i++)
+			{
+				if (lru.entries[i].last_used < lru.entries[index].last_used)
+				{
+					index = i;
+				}
+			}
+		}
+		else
+		{
+			index = lru.count++;
+		}
+		lru.entries[index].addr = *addr;
+	}
+
+	lru.entries[index].last_used = ++lru.clock;
+	save_lru();
+}
+
+/**
+ * @internal
+ * @brief Drop the peer from the usage order.
+ * Not persisted on its own: a bond is only forgotten to make room for a pairing, whose completion saves the order.
+ * Should the pairing fail, the stale entry is harmless as eviction falls back to the NimBLE policy.
+ */
+static void forget_bond(const ble_addr_t *addr)
+{
+	for (int i = 0; i < lru.count; i++)
+	{
+		if (ble_addr_cmp(&lru.entries[i].addr, addr) == 0)
+		{
+			lru.entries[i] = lru.entries[--lru.count];
+			return;
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Persist the bond usage order with a single blob write.
+ */
+static esp_err_t save_lru(void)
+{
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_BOND_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	ret = nvs_set_blob(nvs_handle, NVS_BOND_LRU_KEY, &lru, sizeof(lru));
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs_handle);
+	}
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error saving bond usage: %s", __func__, esp_err_to_name(ret));
+	}
+
+	nvs_close(nvs_handle);
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Returns the tracked connection, or a free slot for BLE_HS_CONN_HANDLE_NONE. NULL if not found.
+ */
+static bond_conn_t *find_conn(uint16_t conn_handle)
+{
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		if (conns[i].conn_handle == conn_handle)
+		{
+			return &conns[i];
+		}
+	}
+	return NULL;
+}
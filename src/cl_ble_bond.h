@@ -0,0 +1,67 @@
+#ifndef _CL_BLE_BOND_H_
+#define _CL_BLE_BOND_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "host/ble_hs.h"
+#include "cl_ble_svc.h"
+
+/**
+ * Latency from a connection to its first request (claim or release write).
+ */
+typedef struct
+{
+	uint32_t count;		 //!< Connections that made a request
+	uint64_t total_us; //!< Sum of the latencies
+	uint32_t max_us;	 //!< Highest latency
+} cl_ble_bond_latency_t;
+
+/**
+ * Counters of the bond store, all since boot.
+ */
+typedef struct
+{
+	cl_ble_bond_latency_t resumed; //!< Reconnects of bonded peers, encryption resumed from the stored keys
+	cl_ble_bond_latency_t paired;	 //!< Connections of peers without a bond
+	uint32_t evictions;						 //!< Bonds deleted to make room, least recently used first
+	uint32_t repeat_pairings;			 //!< Bonds deleted because the peer lost its keys and paired again
+} cl_ble_bond_stats_t;
+
+/**
+ * Initialize the bond store: load the bond usage order from NVS and install the store status callback that
+ * evicts the least recently used bond when the NimBLE store is full.
+ * The bonds themselves are persisted in NVS by the NimBLE store (CONFIG_BT_NIMBLE_NVS_PERSIST).
+ *
+ * @note Must be called before the NimBLE host is started.
+ *
+ * @return Returns ESP_OK if successful, otherwise the NVS error.
+ */
+extern esp_err_t cl_ble_bond_init(void);
+
+/**
+ * Handle the security related GAP events, to be called from the GAP event handler:
+ * - BLE_GAP_EVENT_CONNECT: asks a bonded peer to resume encryption right away.
+ * - BLE_GAP_EVENT_ENC_CHANGE: marks the bond as most recently used.
+ * - BLE_GAP_EVENT_REPEAT_PAIRING: deletes the stale bond so the peer can pair again.
+ * - BLE_GAP_EVENT_PASSKEY_ACTION: answers with CL_BLE_PASSKEY or accepts the numeric comparison.
+ * - BLE_GAP_EVENT_DISCONNECT: forgets the connection.
+ *
+ * @return The value the GAP event handler must return for the event.
+ */
+extern int cl_ble_bond_on_gap_event(struct ble_gap_event *event);
+
+/**
+ * Record a request from a connection, the first one completes its connect-to-request latency.
+ *
+ * @param conn_handle The connection the request was written from.
+ */
+extern void cl_ble_bond_on_request(uint16_t conn_handle);
+
+/**
+ * Read the bond store counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_ble_bond_get_stats(cl_ble_bond_stats_t *stats);
+
+#endif // _CL_BLE_BOND_H_
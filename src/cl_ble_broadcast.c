@@ -0,0 +1,278 @@
+// Library
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "nvs.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+// Local
+#include "cl_ble_adv.h"
+#include "cl_ble_broadcast.h"
+#include "cl_phy_lock_svc.h"
+#include "siphash.h"
+
+// -- DEFINES --
+#define NVS_BCAST_NAMESPACE "BLEBCAST" //<! Broadcast namespace used in NVS
+#define NVS_BCAST_KEY_KEY "KEY"				 //<! Fleet key used in NVS
+#define NVS_BCAST_EPOCH_KEY "EPOCH"		 //<! Frame counter epoch used in NVS
+#define MAX_EPOCH UINT16_MAX						 //<! Last epoch the upper bits of the frame counter hold
+
+_Static_assert(offsetof(cl_ble_broadcast_frame_t, mac) + sizeof(((cl_ble_broadcast_frame_t *)0)->mac) == sizeof(cl_ble_broadcast_frame_t), "the MAC must end the frame");
+_Static_assert(2 + 2 + sizeof(cl_ble_broadcast_frame_t) <= BLE_HS_ADV_MAX_SZ, "the status frame must fit in a scan response");
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static esp_err_t next_epoch(void);
+static void send_frame(void);
+static void status_changed(const cl_phy_lock_status_t *status, void *arg);
+static void status_event(struct ble_npl_event *ev);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_bcast";
+
+// only accessed from the NimBLE host task once started
+static uint8_t key[CL_BLE_BROADCAST_KEY_LEN];
+static bool key_set = false;
+static uint8_t device_id[4];
+static uint32_t epoch = 0;			 //!< As persisted, never wraps: the counters of a wrapped epoch were already sent
+static uint16_t seq = 0;				 //!< Sequence of the next frame within the epoch
+static bool exhausted = false; //!< MAX_EPOCH is used up, nothing is broadcast until a new key is provisioned
+
+static struct ble_npl_event status_ev;
+static atomic_uint_fast32_t published_status; //!< state, position << 8, alarm << 16 and commit_failed << 24
+static atomic_uint_fast8_t battery = CL_BLE_BROADCAST_BATTERY_UNKNOWN;
+
+esp_err_t cl_ble_broadcast_init(void)
+{
+	uint8_t mac[6];
+	esp_err_t ret = esp_read_mac(mac, ESP_MAC_BT);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error reading MAC: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	memcpy(device_id, &mac[2], sizeof(device_id));
+
+	nvs_handle_t nvs_handle;
+	ret = nvs_open(NVS_BCAST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	size_t key_len = sizeof(key);
+	ret = nvs_get_blob(nvs_handle, NVS_BCAST_KEY_KEY, key, &key_len);
+	key_set = ret == ESP_OK && key_len == sizeof(key);
+	if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
+	}
+
+	uint32_t stored_epoch = 0;
+	ret = nvs_get_u32(nvs_handle, NVS_BCAST_EPOCH_KEY, &stored_epoch);
+	nvs_close(nvs_handle);
+	if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	epoch = stored_epoch;
+
+	// frames of this boot must count above the ones of the previous boot
+	ret = next_epoch();
+	if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+	{
+		return ret;
+	}
+
+	cl_phy_lock_status_t status;
+	cl_phy_lock_svc_get_status(&status);
+	atomic_store(&published_status, status.state | status.position << 8 | (uint32_t)status.alarm << 16 | (uint32_t)status.commit_failed << 24);
+	ble_npl_event_init(&status_ev, status_event, NULL);
+	ret = cl_phy_lock_svc_add_status_cb(status_changed, NULL);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	if (!key_set)
+	{
+		ESP_LOGW(LOG_TAG, "No broadcast key provisioned, status broadcast disabled");
+		return ESP_OK;
+	}
+	send_frame();
+	return ESP_OK;
+}
+
+esp_err_t cl_ble_broadcast_set_key(const uint8_t *new_key)
+{
+	// frames signed with a new key can't be replayed as frames of the old one, its counter starts over
+	bool new_counter = !key_set || memcmp(new_key, key, sizeof(key)) != 0;
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_BCAST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	ret = nvs_set_blob(nvs_handle, NVS_BCAST_KEY_KEY, new_key, CL_BLE_BROADCAST_KEY_LEN);
+	if (ret == ESP_OK && new_counter)
+	{
+		// committed along with the key, the first epoch of the key is taken already
+		ret = nvs_set_u32(nvs_handle, NVS_BCAST_EPOCH_KEY, 1);
+	}
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs_handle);
+	}
+	nvs_close(nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error saving broadcast key: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	memcpy(key, new_key, sizeof(key));
+	key_set = true;
+	if (new_counter)
+	{
+		epoch = 1;
+		seq = 0;
+		exhausted = false;
+	}
+	send_frame();
+	return ESP_OK;
+}
+
+void cl_ble_broadcast_set_battery(uint8_t percent)
+{
+	if (atomic_exchange(&battery, percent) != percent)
+	{
+		ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &status_ev);
+	}
+}
+
+/**
+ * @internal
+ * @brief Start a new epoch of the frame counter and persist it before any frame of the epoch is sent.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE once MAX_EPOCH is used up, otherwise the NVS error.
+ */
+static esp_err_t next_epoch(void)
+{
+	if (epoch >= MAX_EPOCH)
+	{
+		if (!exhausted)
+		{
+			ESP_LOGE(LOG_TAG, "%s Frame counter exhausted, broadcast stopped until a new key is provisioned", __func__);
+			exhausted = true;
+		}
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_BCAST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	ret = nvs_set_u32(nvs_handle, NVS_BCAST_EPOCH_KEY, epoch + 1);
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs_handle);
+	}
+	nvs_close(nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error saving epoch: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	epoch++;
+	seq = 0;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Build and sign the frame of the latest status, then put it in the scan response.
+ * The name it replaces doesn't fit next to it, apps find the lock by its advertisement anyway.
+ */
+static void send_frame(void)
+{
+	if (!key_set || exhausted)
+	{
+		return;
+	}
+	if (seq == UINT16_MAX && next_epoch() != ESP_OK)
+	{
+		// sending without a persisted epoch could repeat counters after a reboot
+		return;
+	}
+
+	uint32_t status = atomic_load(&published_status);
+	uint8_t position = status >> 8;
+	cl_ble_broadcast_frame_t frame = {
+			.frame = CL_BLE_ADV_FRAME_STATUS,
+			.state = status,
+			.battery = atomic_load(&battery),
+			.counter = (uint32_t)epoch << 16 | seq++,
+	};
+	memcpy(frame.device_id, device_id, sizeof(frame.device_id));
+	if (position == PHY_LOCK_POSITION_CLOSED)
+	{
+		frame.flags |= CL_BLE_BROADCAST_F_CLOSED;
+	}
+	else if (position == PHY_LOCK_POSITION_UNKNOWN)
+	{
+		frame.flags |= CL_BLE_BROADCAST_F_POSITION_UNKNOWN;
+	}
+	if ((status >> 16) & 0xFF)
+	{
+		frame.flags |= CL_BLE_BROADCAST_F_ALARM;
+	}
+	if (status >> 24)
+	{
+		frame.flags |= CL_BLE_BROADCAST_F_COMMIT_FAILED;
+	}
+	uint64_t mac = siphash24(key, &frame, offsetof(cl_ble_broadcast_frame_t, mac));
+	memcpy(frame.mac, &mac, sizeof(frame.mac));
+
+	// manufacturer data: company identifier, then the status frame
+	uint8_t rsp[BLE_HS_ADV_MAX_SZ];
+	uint8_t len = 0;
+	rsp[len++] = 1 + 2 + sizeof(frame);
+	rsp[len++] = BLE_HS_ADV_TYPE_MFG_DATA;
+	rsp[len++] = CL_BLE_ADV_COMPANY_ID & 0xFF;
+	rsp[len++] = CL_BLE_ADV_COMPANY_ID >> 8;
+	memcpy(&rsp[len], &frame, sizeof(frame));
+	len += sizeof(frame);
+	cl_ble_adv_set_scan_rsp(rsp, len);
+}
+
+/**
+ * @internal
+ * @brief Lock status callback: records the status and defers the frame to the NimBLE host task.
+ */
+static void status_changed(const cl_phy_lock_status_t *status, void *arg)
+{
+	atomic_store(&published_status, status->state | status->position << 8 | (uint32_t)status->alarm << 16 | (uint32_t)status->commit_failed << 24);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &status_ev);
+}
+
+/**
+ * @internal
+ * @brief Broadcast the latest status.
+ */
+static void status_event(struct ble_npl_event *ev)
+{
+	send_frame();
+}
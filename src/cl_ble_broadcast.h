@@ -0,0 +1,63 @@
+#ifndef _CL_BLE_BROADCAST_H_
+#define _CL_BLE_BROADCAST_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "siphash.h"
+
+#define CL_BLE_BROADCAST_KEY_LEN SIPHASH_KEY_LEN //!< Length of the key signing the status frames
+#define CL_BLE_BROADCAST_BATTERY_UNKNOWN 0xFF		 //!< Battery level until one is reported
+
+#define CL_BLE_BROADCAST_F_CLOSED 0x01					 //!< The lock sensor reads the bolt as closed
+#define CL_BLE_BROADCAST_F_POSITION_UNKNOWN 0x02 //!< The lock sensor wasn't read yet
+#define CL_BLE_BROADCAST_F_ALARM 0x04						 //!< The alarm is on
+#define CL_BLE_BROADCAST_F_COMMIT_FAILED 0x08		 //!< The last ownership change failed to commit
+
+/**
+ * Status frame broadcast in the scan response as manufacturer data, after the company identifier.
+ * The counter increases with every frame, across reboots too, so a scanner can drop replayed frames.
+ * The MAC is the SipHash-2-4 of every preceding byte of the frame, keyed with the fleet key.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t frame;				//!< CL_BLE_ADV_FRAME_STATUS
+	uint8_t device_id[4]; //!< Last bytes of the Bluetooth MAC, advertising uses a random address
+	uint8_t state;				//!< Current PHY_LOCK_STATE_* value
+	uint8_t flags;				//!< CL_BLE_BROADCAST_F_* bits
+	uint8_t battery;			//!< Battery level in percent, CL_BLE_BROADCAST_BATTERY_UNKNOWN if not reported
+	uint32_t counter;			//!< Boot epoch in the upper 16 bits, frame sequence within the epoch in the lower ones
+	uint8_t mac[8];				//!< SipHash-2-4 of the preceding bytes, little-endian
+} cl_ble_broadcast_frame_t;
+
+/**
+ * Initialize the status broadcast. It is only enabled once a fleet key is provisioned, the scan response keeps
+ * the device name otherwise.
+ * Every boot starts a new epoch of the frame counter, persisted in NVS. Once the last epoch is used up, nothing is
+ * broadcast until a new key is provisioned, which starts the counter over.
+ *
+ * @note Must be called after cl_ble_adv_init() and before the NimBLE host is started.
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t cl_ble_broadcast_init(void);
+
+/**
+ * Provision the fleet key, persist it and start broadcasting. A key other than the current one starts the frame
+ * counter over, frames signed with the previous key can't be replayed under it.
+ *
+ * @note Must be called from the NimBLE host task, or before the host is started.
+ *
+ * @param key The CL_BLE_BROADCAST_KEY_LEN bytes key.
+ *
+ * @return Returns ESP_OK if successful, otherwise the NVS error.
+ */
+extern esp_err_t cl_ble_broadcast_set_key(const uint8_t *key);
+
+/**
+ * Report the battery level, broadcast with the next frame. Safe to call from any task.
+ *
+ * @param percent Battery level in percent.
+ */
+extern void cl_ble_broadcast_set_battery(uint8_t percent);
+
+#endif // _CL_BLE_BROADCAST_H_
@@ -0,0 +1,544 @@
+// Library
+#include <stdbool.h>
+#include <string.h>
+// ESP32
+#include "esp_core_dump.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+// Local
+#include "cl_ble_bond.h"
+#include "cl_ble_bulk.h"
+#include "cl_ble_conn.h"
+#include "cl_gpio_hub.h"
+#include "cl_journal.h"
+#include "cl_persist.h"
+#include "cl_power.h"
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief A source of transfers: open positions it on the start of the request, fill reads the next bytes.
+ */
+typedef struct
+{
+	esp_err_t (*open)(uint32_t start, uint32_t *size);
+	esp_err_t (*fill)(uint8_t *buf, size_t max, size_t *len, bool *end);
+} source_t;
+
+/**
+ * @internal
+ * @brief The channel and its transfer, only accessed from the NimBLE host task.
+ */
+typedef struct
+{
+	struct ble_l2cap_chan *chan; //!< NULL while no central is connected
+	uint16_t conn_handle;
+	uint16_t sdu_size; //!< Size of the SDUs sent, the MTU of the central up to CL_BLE_BULK_SDU_MAX
+	uint8_t source;		 //!< CL_BLE_BULK_SRC_* of the transfer
+	bool active;			 //!< A transfer is in progress
+	bool started;			 //!< The CL_BLE_BULK_F_START SDU was staged
+	bool bulk;				 //!< The connection was moved to CL_BLE_CONN_PHASE_BULK
+	bool stalled;			 //!< The stack holds an SDU until the central returns credits
+	bool last;				 //!< The staged SDU ends the transfer
+	uint16_t staged;	 //!< Length of the SDU in sdu_buf not sent yet, 0 for none
+	uint32_t size;		 //!< Size announced in the first SDU
+	esp_err_t error;	 //!< Failure to report in place of the next SDU
+} channel_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static int l2cap_event(struct ble_l2cap_event *event, void *arg);
+static void receive_request(struct os_mbuf *sdu);
+static void pump(void);
+static void stage(void);
+static void leave_bulk(void);
+static void retry_expired(void *arg);
+static void retry_event(struct ble_npl_event *ev);
+static esp_err_t journal_open(uint32_t start, uint32_t *size);
+static esp_err_t journal_fill(uint8_t *buf, size_t max, size_t *len, bool *end);
+static esp_err_t metrics_open(uint32_t start, uint32_t *size);
+static esp_err_t metrics_fill(uint8_t *buf, size_t max, size_t *len, bool *end);
+static esp_err_t coredump_open(uint32_t start, uint32_t *size);
+static esp_err_t coredump_fill(uint8_t *buf, size_t max, size_t *len, bool *end);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_bulk";
+
+static const source_t sources[] = {
+		[CL_BLE_BULK_SRC_JOURNAL] = {.open = journal_open, .fill = journal_fill},
+		[CL_BLE_BULK_SRC_METRICS] = {.open = metrics_open, .fill = metrics_fill},
+		[CL_BLE_BULK_SRC_COREDUMP] = {.open = coredump_open, .fill = coredump_fill},
+};
+
+static channel_t channel;
+static uint8_t sdu_buf[CL_BLE_BULK_SDU_MAX]; //!< SDU staged until an mbuf chain holds it
+static esp_timer_handle_t retry_timer;
+static struct ble_npl_event retry_ev;
+static cl_ble_bulk_stats_t bulk_stats;
+
+// journal source
+static cl_journal_cursor_t journal_cursor;
+
+// metrics source
+static uint8_t metrics_buf[CL_BLE_BULK_METRICS_MAX];
+static size_t metrics_len;
+static size_t metrics_off;
+
+// coredump source
+static const esp_partition_t *coredump_partition;
+static size_t coredump_offset; //!< Offset of the image in the partition
+static size_t coredump_size;
+static size_t coredump_off; //!< Next byte of the image to send
+
+// -- FUNCTIONS --
+
+esp_err_t cl_ble_bulk_init(void)
+{
+	memset(&channel, 0, sizeof(channel));
+	ble_npl_event_init(&retry_ev, retry_event, NULL);
+
+	const esp_timer_create_args_t timer_args = {
+			.callback = retry_expired,
+			.name = "ble_bulk_retry",
+	};
+	esp_err_t ret = esp_timer_create(&timer_args, &retry_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create retry timer; ret=%d", ret);
+		return ret;
+	}
+
+	int rc = ble_l2cap_create_server(CL_BLE_BULK_PSM, CL_BLE_BULK_RX_MTU, l2cap_event, NULL);
+	if (rc != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create L2CAP server; psm=0x%04x ret=%d", CL_BLE_BULK_PSM, rc);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+void cl_ble_bulk_get_stats(cl_ble_bulk_stats_t *stats)
+{
+	*stats = bulk_stats;
+}
+
+/**
+ * @internal
+ * @brief L2CAP event callback of the server, on the NimBLE host task.
+ */
+static int l2cap_event(struct ble_l2cap_event *event, void *arg)
+{
+	struct ble_gap_conn_desc desc;
+	struct ble_l2cap_chan_info info;
+	struct os_mbuf *sdu;
+	int ret;
+
+	switch (event->type)
+	{
+	case BLE_L2CAP_EVENT_COC_ACCEPT:
+		// the journal and core dumps are only for a bonded central, the link of a passing one is only encrypted
+		if (ble_gap_conn_find(event->accept.conn_handle, &desc) != 0 || !desc.sec_state.encrypted ||
+				!desc.sec_state.bonded)
+		{
+			bulk_stats.refused++;
+			ESP_LOGW(LOG_TAG, "Refused channel on unbonded link; conn_handle=%d", event->accept.conn_handle);
+			return BLE_HS_EENCRYPT;
+		}
+		if (channel.chan != NULL)
+		{
+			return BLE_HS_ENOMEM;
+		}
+		sdu = os_msys_get_pkthdr(CL_BLE_BULK_RX_MTU, 0);
+		if (sdu == NULL)
+		{
+			return BLE_HS_ENOMEM;
+		}
+		ret = ble_l2cap_recv_ready(event->accept.chan, sdu);
+		if (ret != 0)
+		{
+			os_mbuf_free_chain(sdu);
+		}
+		return ret;
+
+	case BLE_L2CAP_EVENT_COC_CONNECTED:
+		if (event->connect.status != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to connect channel; conn_handle=%d ret=%d", event->connect.conn_handle,
+							 event->connect.status);
+			return 0;
+		}
+		memset(&channel, 0, sizeof(channel));
+		channel.chan = event->connect.chan;
+		channel.conn_handle = event->connect.conn_handle;
+		channel.sdu_size = CL_BLE_BULK_SDU_MAX;
+		if (ble_l2cap_get_chan_info(channel.chan, &info) == 0 && info.peer_coc_mtu < channel.sdu_size)
+		{
+			channel.sdu_size = info.peer_coc_mtu;
+		}
+		bulk_stats.channels++;
+		ESP_LOGI(LOG_TAG, "channel connected; conn_handle=%d sdu_size=%d", channel.conn_handle, channel.sdu_size);
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+		if (event->receive.sdu_rx != NULL)
+		{
+			receive_request(event->receive.sdu_rx);
+			os_mbuf_free_chain(event->receive.sdu_rx);
+		}
+		// the stack stops receiving until it gets a new buffer
+		sdu = os_msys_get_pkthdr(CL_BLE_BULK_RX_MTU, 0);
+		ret = sdu != NULL ? ble_l2cap_recv_ready(event->receive.chan, sdu) : BLE_HS_ENOMEM;
+		if (ret != 0)
+		{
+			os_mbuf_free_chain(sdu);
+			ESP_LOGE(LOG_TAG, "Failed to post receive buffer; conn_handle=%d ret=%d", event->receive.conn_handle, ret);
+		}
+		pump();
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+		channel.stalled = false;
+		pump();
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+		if (channel.active)
+		{
+			bulk_stats.aborted++;
+		}
+		channel.active = false;
+		channel.stalled = false;
+		leave_bulk();
+		ESP_LOGI(LOG_TAG, "channel disconnected; conn_handle=%d", event->disconnect.conn_handle);
+		memset(&channel, 0, sizeof(channel));
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @internal
+ * @brief Start the transfer a request SDU asks for, ending the one in progress.
+ */
+static void receive_request(struct os_mbuf *sdu)
+{
+	uint8_t request[CL_BLE_BULK_REQUEST_LEN] = {0};
+	uint16_t len = OS_MBUF_PKTLEN(sdu);
+	os_mbuf_copydata(sdu, 0, len < sizeof(request) ? len : sizeof(request), request);
+
+	if (channel.active)
+	{
+		bulk_stats.aborted++;
+	}
+	channel.active = true;
+	channel.started = false;
+	channel.staged = 0;
+	channel.source = request[0];
+	channel.size = CL_BLE_BULK_SIZE_UNKNOWN;
+	channel.error = ESP_OK;
+
+	uint32_t start;
+	memcpy(&start, &request[1], sizeof(start));
+	if (len != CL_BLE_BULK_REQUEST_LEN)
+	{
+		channel.error = ESP_ERR_INVALID_SIZE;
+	}
+	else if (channel.source >= sizeof(sources) / sizeof(sources[0]) || sources[channel.source].open == NULL)
+	{
+		channel.error = ESP_ERR_NOT_SUPPORTED;
+	}
+	else
+	{
+		channel.error = sources[channel.source].open(start, &channel.size);
+	}
+	if (channel.error != ESP_OK)
+	{
+		ESP_LOGW(LOG_TAG, "Failed to open transfer; source=%d start=%lu: %s", channel.source, (unsigned long)start,
+						 esp_err_to_name(channel.error));
+		return;
+	}
+
+	// the error SDU of a failed request fits a single K-frame, a transfer is worth a faster link
+	if (!channel.bulk && cl_ble_conn_set_bulk(channel.conn_handle, true) == ESP_OK)
+	{
+		channel.bulk = true;
+	}
+}
+
+/**
+ * @internal
+ * @brief Send SDUs until the transfer ends, the central runs out of credits or the mbuf pool is exhausted.
+ */
+static void pump(void)
+{
+	while (channel.chan != NULL && channel.active && !channel.stalled)
+	{
+		if (channel.staged == 0)
+		{
+			stage();
+		}
+
+		// an SDU taken from the source stays staged until the pool has room for it
+		struct os_mbuf *sdu = os_msys_get_pkthdr(channel.staged, 0);
+		if (sdu == NULL || os_mbuf_append(sdu, sdu_buf, channel.staged) != 0)
+		{
+			os_mbuf_free_chain(sdu);
+			bulk_stats.no_mem++;
+			esp_timer_stop(retry_timer);
+			esp_timer_start_once(retry_timer, CL_BLE_BULK_RETRY_MS * 1000);
+			return;
+		}
+
+		int ret = ble_l2cap_send(channel.chan, sdu);
+		if (ret != 0 && ret != BLE_HS_ESTALLED)
+		{
+			os_mbuf_free_chain(sdu);
+			ESP_LOGE(LOG_TAG, "Failed to send SDU; conn_handle=%d ret=%d", channel.conn_handle, ret);
+			bulk_stats.aborted++;
+			channel.active = false;
+			leave_bulk();
+			return;
+		}
+		// with BLE_HS_ESTALLED the stack keeps the SDU and sends the rest of it on TX_UNSTALLED
+		bulk_stats.sdus++;
+		bulk_stats.bytes += channel.staged;
+		channel.staged = 0;
+		if (ret == BLE_HS_ESTALLED)
+		{
+			bulk_stats.stalls++;
+			channel.stalled = true;
+		}
+		if (channel.last)
+		{
+			bulk_stats.transfers++;
+			channel.active = false;
+		}
+	}
+	leave_bulk();
+}
+
+/**
+ * @internal
+ * @brief Take the next SDU of the transfer from its source into sdu_buf.
+ */
+static void stage(void)
+{
+	uint8_t *payload = &sdu_buf[CL_BLE_BULK_HEADER_LEN];
+	size_t room = channel.sdu_size - CL_BLE_BULK_HEADER_LEN;
+	uint8_t flags = 0;
+	size_t len = 0;
+	bool end = false;
+	esp_err_t ret = channel.error;
+
+	if (ret == ESP_OK && !channel.started)
+	{
+		// the ESP32 is little-endian, as the protocol
+		flags |= CL_BLE_BULK_F_START;
+		memcpy(payload, &channel.size, sizeof(channel.size));
+		len = sizeof(channel.size);
+		channel.started = true;
+	}
+	if (ret == ESP_OK)
+	{
+		size_t count = 0;
+		ret = sources[channel.source].fill(&payload[len], room - len, &count, &end);
+		len += count;
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to read transfer; source=%d: %s", channel.source, esp_err_to_name(ret));
+		}
+	}
+	if (ret != ESP_OK)
+	{
+		int32_t error = ret;
+		flags = CL_BLE_BULK_F_ERROR;
+		memcpy(payload, &error, sizeof(error));
+		len = sizeof(error);
+		end = true;
+	}
+	if (end)
+	{
+		flags |= CL_BLE_BULK_F_END;
+	}
+
+	sdu_buf[0] = channel.source;
+	sdu_buf[1] = flags;
+	channel.staged = CL_BLE_BULK_HEADER_LEN + len;
+	channel.last = end;
+}
+
+/**
+ * @internal
+ * @brief Give the connection back to the connection manager once the last SDU left the stack.
+ */
+static void leave_bulk(void)
+{
+	if (!channel.bulk || channel.active || channel.stalled)
+	{
+		return;
+	}
+	channel.bulk = false;
+	// the connection may already be gone along with the channel
+	cl_ble_conn_set_bulk(channel.conn_handle, false);
+}
+
+/**
+ * @internal
+ * @brief Retry timer callback: defers sending to the NimBLE host task.
+ */
+static void retry_expired(void *arg)
+{
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &retry_ev);
+}
+
+static void retry_event(struct ble_npl_event *ev)
+{
+	pump();
+}
+
+// -- SOURCES --
+
+/**
+ * @internal
+ * @brief Records from the sequence number start on, up to the head of the journal when the last SDU is staged.
+ */
+static esp_err_t journal_open(uint32_t start, uint32_t *size)
+{
+	cl_journal_cursor_init(&journal_cursor, start);
+	*size = CL_BLE_BULK_SIZE_UNKNOWN;
+	return ESP_OK;
+}
+
+static esp_err_t journal_fill(uint8_t *buf, size_t max, size_t *len, bool *end)
+{
+	// records are packed, so they can be read in place
+	cl_journal_record_t *records = (cl_journal_record_t *)buf;
+	size_t max_records = max / sizeof(cl_journal_record_t);
+	size_t total = 0;
+
+	*end = false;
+	while (total < max_records)
+	{
+		// fewer records than asked for may only mean skipped torn ones, the head is reached once none is left
+		size_t count;
+		esp_err_t ret = cl_journal_read(&journal_cursor, &records[total], max_records - total, &count);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		if (count == 0)
+		{
+			*end = true;
+			break;
+		}
+		total += count;
+	}
+	*len = total * sizeof(cl_journal_record_t);
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Append a metric to the snapshot.
+ */
+static esp_err_t put_metric(uint8_t metric, const void *counters, uint16_t size)
+{
+	if (metrics_len + 3 + size > sizeof(metrics_buf))
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	metrics_buf[metrics_len++] = metric;
+	memcpy(&metrics_buf[metrics_len], &size, sizeof(size));
+	metrics_len += sizeof(size);
+	memcpy(&metrics_buf[metrics_len], counters, size);
+	metrics_len += size;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Snapshot every counter at once, so they are consistent with each other. Start is ignored.
+ */
+static esp_err_t metrics_open(uint32_t start, uint32_t *size)
+{
+	cl_persist_stats_t persist;
+	cl_gpio_hub_stats_t gpio_hub;
+	cl_journal_stats_t journal;
+	cl_power_stats_t power;
+	cl_ble_conn_stats_t conn;
+	cl_ble_bond_stats_t bond;
+
+	cl_persist_get_stats(&persist);
+	cl_gpio_hub_get_stats(&gpio_hub);
+	cl_journal_get_stats(&journal);
+	cl_power_get_stats(&power);
+	cl_ble_conn_get_stats(&conn);
+	cl_ble_bond_get_stats(&bond);
+
+	metrics_len = 0;
+	metrics_off = 0;
+	esp_err_t ret = put_metric(CL_BLE_BULK_METRIC_PERSIST, &persist, sizeof(persist));
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_GPIO_HUB, &gpio_hub, sizeof(gpio_hub)) : ret;
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_JOURNAL, &journal, sizeof(journal)) : ret;
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_POWER, &power, sizeof(power)) : ret;
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_CONN, &conn, sizeof(conn)) : ret;
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_BOND, &bond, sizeof(bond)) : ret;
+	ret = ret == ESP_OK ? put_metric(CL_BLE_BULK_METRIC_BULK, &bulk_stats, sizeof(bulk_stats)) : ret;
+	*size = metrics_len;
+	return ret;
+}
+
+static esp_err_t metrics_fill(uint8_t *buf, size_t max, size_t *len, bool *end)
+{
+	*len = metrics_len - metrics_off < max ? metrics_len - metrics_off : max;
+	memcpy(buf, &metrics_buf[metrics_off], *len);
+	metrics_off += *len;
+	*end = metrics_off == metrics_len;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The image saved in the coredump partition from the byte offset start on, so a transfer can be resumed.
+ */
+static esp_err_t coredump_open(uint32_t start, uint32_t *size)
+{
+	size_t addr;
+	esp_err_t ret = esp_core_dump_image_get(&addr, &coredump_size);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	coredump_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+	if (coredump_partition == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (start > coredump_size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	coredump_offset = addr - coredump_partition->address;
+	coredump_off = start;
+	*size = coredump_size - start;
+	return ESP_OK;
+}
+
+static esp_err_t coredump_fill(uint8_t *buf, size_t max, size_t *len, bool *end)
+{
+	*len = coredump_size - coredump_off < max ? coredump_size - coredump_off : max;
+	esp_err_t ret = esp_partition_read(coredump_partition, coredump_offset + coredump_off, buf, *len);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	coredump_off += *len;
+	*end = coredump_off == coredump_size;
+	return ESP_OK;
+}
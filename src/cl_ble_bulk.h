@@ -0,0 +1,100 @@
+#ifndef _CL_BLE_BULK_H_
+#define _CL_BLE_BULK_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "cl_ble_conn.h"
+
+/**
+ * Bulk data channel: an L2CAP connection-oriented channel streaming the journal, a metrics snapshot or the core dump
+ * to a bonded central, paced by the credits of the central.
+ *
+ * The central opens the channel on CL_BLE_BULK_PSM and sends a request SDU:
+ *   [source: u8] [start: u32 little-endian]
+ * The lock answers with SDUs until the transfer ends, each one:
+ *   [source: u8] [flags: u8] [payload]
+ * The first SDU of a transfer has CL_BLE_BULK_F_START and its payload starts with the total size of the transfer as
+ * u32 little-endian, CL_BLE_BULK_SIZE_UNKNOWN for the journal. The last one has CL_BLE_BULK_F_END, along with
+ * CL_BLE_BULK_F_ERROR and the esp_err_t as i32 little-endian for its payload if the transfer failed. A request
+ * during a transfer ends it and starts the new one.
+ *
+ * Every K-frame fills a whole LL PDU once the data length is extended, see CL_BLE_BULK_MPS, and SDUs span a whole
+ * number of K-frames, see CL_BLE_BULK_SDU_MAX.
+ */
+
+#define CL_BLE_BULK_PSM 0x0081		//!< LE PSM of the channel, in the dynamic range
+#define CL_BLE_BULK_RX_MTU 23			//!< Largest SDU accepted from the central, the minimum of the spec
+#define CL_BLE_BULK_REQUEST_LEN 5 //!< Source and start
+#define CL_BLE_BULK_HEADER_LEN 2	//!< Source and flags
+#define CL_BLE_BULK_RETRY_MS 10		//!< Time before sending again once the mbuf pool is exhausted
+
+/**
+ * Payload of a K-frame, as the NimBLE port derives it from the block size of the first msys pool.
+ * Along with the 4-byte basic L2CAP header it must fit the data length of a single LL PDU.
+ */
+#define CL_BLE_BULK_MPS (CONFIG_BT_NIMBLE_MSYS_1_BLOCK_SIZE - 8)
+#define CL_BLE_BULK_FRAMES_PER_SDU 4 //!< K-frames of a full SDU
+/**
+ * Largest SDU sent, the first K-frame also carries the 2-byte SDU length. The central may accept less.
+ */
+#define CL_BLE_BULK_SDU_MAX (CL_BLE_BULK_FRAMES_PER_SDU * CL_BLE_BULK_MPS - 2)
+
+_Static_assert(CL_BLE_BULK_MPS + 4 <= CL_BLE_CONN_DATA_LEN_OCTETS, "a K-frame must fit a single LL PDU");
+
+// sources
+#define CL_BLE_BULK_SRC_JOURNAL 0x01	//!< cl_journal_record_t records from the sequence number start on, 0 for the oldest
+#define CL_BLE_BULK_SRC_METRICS 0x02	//!< Snapshot of the counters, see CL_BLE_BULK_METRIC_*. Start is ignored
+#define CL_BLE_BULK_SRC_COREDUMP 0x03 //!< Core dump image from the byte offset start on, to resume a transfer
+
+// flags
+#define CL_BLE_BULK_F_START 0x01 //!< First SDU of the transfer, the payload starts with the total size
+#define CL_BLE_BULK_F_END 0x02	 //!< Last SDU of the transfer
+#define CL_BLE_BULK_F_ERROR 0x04 //!< The transfer failed, the payload is the esp_err_t
+
+#define CL_BLE_BULK_SIZE_UNKNOWN 0xffffffff
+
+/**
+ * The metrics snapshot is a sequence of entries:
+ *   [metric: u8] [length: u16 little-endian] [counters, as the struct of the firmware that sent them]
+ */
+#define CL_BLE_BULK_METRIC_PERSIST 0x01 //!< cl_persist_stats_t
+#define CL_BLE_BULK_METRIC_GPIO_HUB 0x02 //!< cl_gpio_hub_stats_t
+#define CL_BLE_BULK_METRIC_JOURNAL 0x03	//!< cl_journal_stats_t
+#define CL_BLE_BULK_METRIC_POWER 0x04		//!< cl_power_stats_t
+#define CL_BLE_BULK_METRIC_CONN 0x05		//!< cl_ble_conn_stats_t
+#define CL_BLE_BULK_METRIC_BOND 0x06		//!< cl_ble_bond_stats_t
+#define CL_BLE_BULK_METRIC_BULK 0x07		//!< cl_ble_bulk_stats_t
+#define CL_BLE_BULK_METRICS_MAX 1024		//!< Room of the snapshot
+
+/**
+ * Counters of the channel, all since boot.
+ */
+typedef struct
+{
+	uint32_t channels;	//!< Channels accepted
+	uint32_t refused;		//!< Channels refused on a connection that is not bonded and encrypted
+	uint32_t transfers; //!< Transfers completed, failed ones included
+	uint32_t aborted;		//!< Transfers ended by a new request or by the channel going down
+	uint32_t sdus;			//!< SDUs sent
+	uint32_t bytes;			//!< Bytes of the SDUs sent
+	uint32_t stalls;		//!< Sends that used up the credits of the central
+	uint32_t no_mem;		//!< Sends delayed by an exhausted mbuf pool
+} cl_ble_bulk_stats_t;
+
+/**
+ * Register the L2CAP server on CL_BLE_BULK_PSM.
+ * Requires CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM, the journal and the connection manager.
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t cl_ble_bulk_init(void);
+
+/**
+ * Read the channel counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_ble_bulk_get_stats(cl_ble_bulk_stats_t *stats);
+
+#endif // _CL_BLE_BULK_H_
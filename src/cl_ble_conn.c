@@ -0,0 +1,357 @@
+// Library
+#include <stdatomic.h>
+#include <stdbool.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_timer.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+// Local
+#include "cl_ble_conn.h"
+#include "cl_phy_lock_svc.h"
+
+// -- DEFINES --
+#define DEFAULT_MTU 23 //!< ATT MTU until the exchange completes
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief A connection and the parameters negotiated for it.
+ */
+typedef struct
+{
+	uint16_t conn_handle;		 //!< BLE_HS_CONN_HANDLE_NONE for a free slot
+	uint8_t phase;					 //!< Requested phase, a cl_ble_conn_phase_t
+	uint8_t update_pending;	 //!< Whether an update procedure is in progress
+	uint16_t itvl;					 //!< Connection interval in use
+	uint16_t latency;				 //!< Peripheral latency in use
+	uint16_t mtu;						 //!< Negotiated ATT MTU
+	uint8_t phy;						 //!< PHY in use
+	uint8_t bulk_count;			 //!< Bulk transfers in progress, one per channel
+	int64_t fast_until_us;	 //!< esp_timer_get_time() at which a fast connection turns idle
+} conn_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void request_phase(conn_t *conn, cl_ble_conn_phase_t phase);
+static void state_changed(uint8_t state, void *arg);
+static void hold_expired(void *arg);
+static void relax_event(struct ble_npl_event *ev);
+static void arm_hold_timer(void);
+static conn_t *find_conn(uint16_t conn_handle);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_conn";
+
+static const struct ble_gap_upd_params phase_params[] = {
+		[CL_BLE_CONN_PHASE_FAST] = {
+				.itvl_min = CL_BLE_CONN_FAST_ITVL_MIN,
+				.itvl_max = CL_BLE_CONN_FAST_ITVL_MAX,
+				.latency = CL_BLE_CONN_FAST_LATENCY,
+				.supervision_timeout = CL_BLE_CONN_FAST_TIMEOUT,
+		},
+		[CL_BLE_CONN_PHASE_IDLE] = {
+				.itvl_min = CL_BLE_CONN_IDLE_ITVL_MIN,
+				.itvl_max = CL_BLE_CONN_IDLE_ITVL_MAX,
+				.latency = CL_BLE_CONN_IDLE_LATENCY,
+				.supervision_timeout = CL_BLE_CONN_IDLE_TIMEOUT,
+		},
+		[CL_BLE_CONN_PHASE_BULK] = {
+				.itvl_min = CL_BLE_CONN_FAST_ITVL_MIN,
+				.itvl_max = CL_BLE_CONN_FAST_ITVL_MAX,
+				.latency = CL_BLE_CONN_FAST_LATENCY,
+				.supervision_timeout = CL_BLE_CONN_FAST_TIMEOUT,
+				.max_ce_len = CL_BLE_CONN_BULK_CE_LEN,
+		},
+};
+
+static conn_t conns[CL_BLE_MAX_CONNECTIONS]; //!< Only accessed from the NimBLE host task
+static cl_ble_conn_stats_t conn_stats;
+static esp_timer_handle_t hold_timer;
+static struct ble_npl_event relax_ev;
+static atomic_bool relax_all; //!< Set by a lock state change: every connection turns idle, not only expired ones
+
+esp_err_t cl_ble_conn_init(void)
+{
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+	}
+	ble_npl_event_init(&relax_ev, relax_event, NULL);
+
+	const esp_timer_create_args_t timer_args = {
+			.callback = hold_expired,
+			.name = "ble_conn_hold",
+	};
+	esp_err_t ret = esp_timer_create(&timer_args, &hold_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create hold timer; ret=%d", ret);
+		return ret;
+	}
+
+	// the claim/release exchange is over once the lock moves
+	return cl_phy_lock_svc_add_state_cb(state_changed, NULL);
+}
+
+void cl_ble_conn_on_gap_event(const struct ble_gap_event *event)
+{
+	struct ble_gap_conn_desc desc;
+	conn_t *conn;
+	int ret;
+
+	switch (event->type)
+	{
+	case BLE_GAP_EVENT_CONNECT:
+		if (event->connect.status != 0 || ble_gap_conn_find(event->connect.conn_handle, &desc) != 0)
+		{
+			return;
+		}
+		conn = find_conn(BLE_HS_CONN_HANDLE_NONE);
+		if (conn == NULL)
+		{
+			return;
+		}
+		conn->conn_handle = event->connect.conn_handle;
+		conn->update_pending = 0;
+		conn->itvl = desc.conn_itvl;
+		conn->latency = desc.conn_latency;
+		conn->mtu = DEFAULT_MTU;
+		conn->phy = BLE_GAP_LE_PHY_1M;
+		conn->bulk_count = 0;
+
+		// a claim or release fits in one PDU once both are raised
+		ret = ble_gattc_exchange_mtu(conn->conn_handle, NULL, NULL);
+		if (ret != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to exchange MTU; conn_handle=%d ret=%d", conn->conn_handle, ret);
+		}
+		ret = ble_gap_set_data_len(conn->conn_handle, CL_BLE_CONN_DATA_LEN_OCTETS, CL_BLE_CONN_DATA_LEN_TIME);
+		if (ret != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to set data length; conn_handle=%d ret=%d", conn->conn_handle, ret);
+		}
+
+		// the central connects to make a request: be quick until it does
+		conn->phase = CL_BLE_CONN_PHASE_IDLE;
+		conn->fast_until_us = esp_timer_get_time() + CL_BLE_CONN_FAST_HOLD_MS * 1000LL;
+		request_phase(conn, CL_BLE_CONN_PHASE_FAST);
+		arm_hold_timer();
+		return;
+
+	case BLE_GAP_EVENT_CONN_UPDATE:
+		conn = find_conn(event->conn_update.conn_handle);
+		if (conn == NULL)
+		{
+			return;
+		}
+		conn->update_pending = 0;
+		if (event->conn_update.status != 0)
+		{
+			conn_stats.failed++;
+			ESP_LOGW(LOG_TAG, "Connection update failed; conn_handle=%d status=%d", conn->conn_handle, event->conn_update.status);
+			return;
+		}
+		if (ble_gap_conn_find(conn->conn_handle, &desc) == 0)
+		{
+			conn->itvl = desc.conn_itvl;
+			conn->latency = desc.conn_latency;
+		}
+		conn_stats.completed++;
+		ESP_LOGD(LOG_TAG, "Connection updated; conn_handle=%d itvl=%d latency=%d", conn->conn_handle, conn->itvl, conn->latency);
+		// the phase might have changed while the update was in progress
+		request_phase(conn, conn->phase);
+		return;
+
+	case BLE_GAP_EVENT_MTU:
+		conn = find_conn(event->mtu.conn_handle);
+		if (conn != NULL)
+		{
+			conn->mtu = event->mtu.value;
+		}
+		return;
+
+	case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+		conn = find_conn(event->phy_updated.conn_handle);
+		if (conn != NULL && event->phy_updated.status == 0)
+		{
+			conn->phy = event->phy_updated.tx_phy;
+		}
+		return;
+
+	case BLE_GAP_EVENT_DISCONNECT:
+		conn = find_conn(event->disconnect.conn.conn_handle);
+		if (conn != NULL)
+		{
+			conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+		}
+		return;
+
+	default:
+		return;
+	}
+}
+
+esp_err_t cl_ble_conn_set_bulk(uint16_t conn_handle, bool bulk)
+{
+	conn_t *conn = conn_handle != BLE_HS_CONN_HANDLE_NONE ? find_conn(conn_handle) : NULL;
+	if (conn == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	if (bulk)
+	{
+		if (conn->bulk_count++ > 0)
+		{
+			return ESP_OK;
+		}
+		// half the air time per byte, the central falls back to 1M if it can't
+		int ret = ble_gap_set_prefered_le_phy(conn->conn_handle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK,
+																					BLE_GAP_LE_PHY_CODED_ANY);
+		if (ret != 0)
+		{
+			ESP_LOGW(LOG_TAG, "Failed to request the 2M PHY; conn_handle=%d ret=%d", conn->conn_handle, ret);
+		}
+		request_phase(conn, CL_BLE_CONN_PHASE_BULK);
+		return ESP_OK;
+	}
+
+	if (conn->bulk_count == 0 || --conn->bulk_count > 0)
+	{
+		return ESP_OK;
+	}
+	// the central may start another transfer, or make a request, before the connection turns idle
+	conn->fast_until_us = esp_timer_get_time() + CL_BLE_CONN_FAST_HOLD_MS * 1000LL;
+	request_phase(conn, CL_BLE_CONN_PHASE_FAST);
+	arm_hold_timer();
+	return ESP_OK;
+}
+
+esp_err_t cl_ble_conn_get_info(uint16_t conn_handle, cl_ble_conn_info_t *info)
+{
+	conn_t *conn = conn_handle != BLE_HS_CONN_HANDLE_NONE ? find_conn(conn_handle) : NULL;
+	if (conn == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	info->phase = conn->phase;
+	info->itvl = conn->itvl;
+	info->latency = conn->latency;
+	info->mtu = conn->mtu;
+	info->phy = conn->phy;
+	return ESP_OK;
+}
+
+void cl_ble_conn_get_stats(cl_ble_conn_stats_t *stats)
+{
+	*stats = conn_stats;
+}
+
+/**
+ * @internal
+ * @brief Move the connection to a phase, requesting its parameters unless they are already in use.
+ * Only one update procedure runs at a time, the CONN_UPDATE event of the current one requests the next.
+ */
+static void request_phase(conn_t *conn, cl_ble_conn_phase_t phase)
+{
+	conn->phase = phase;
+
+	const struct ble_gap_upd_params *params = &phase_params[phase];
+	if (conn->update_pending ||
+			(conn->itvl >= params->itvl_min && conn->itvl <= params->itvl_max && conn->latency == params->latency))
+	{
+		return;
+	}
+
+	int ret = ble_gap_update_params(conn->conn_handle, params);
+	if (ret != 0)
+	{
+		conn_stats.failed++;
+		ESP_LOGE(LOG_TAG, "Failed to request connection update; conn_handle=%d ret=%d", conn->conn_handle, ret);
+		return;
+	}
+	conn->update_pending = 1;
+	conn_stats.requested++;
+}
+
+/**
+ * @internal
+ * @brief Lock state callback: the exchange is over, defers turning every connection idle to the NimBLE host task.
+ */
+static void state_changed(uint8_t state, void *arg)
+{
+	atomic_store(&relax_all, true);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &relax_ev);
+}
+
+/**
+ * @internal
+ * @brief Hold timer callback: defers turning the expired connections idle to the NimBLE host task.
+ */
+static void hold_expired(void *arg)
+{
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &relax_ev);
+}
+
+/**
+ * @internal
+ * @brief Turn idle the fast connections whose hold expired, or all of them after a lock state change.
+ */
+static void relax_event(struct ble_npl_event *ev)
+{
+	bool all = atomic_exchange(&relax_all, false);
+	int64_t now_us = esp_timer_get_time();
+
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		conn_t *conn = &conns[i];
+		if (conn->conn_handle != BLE_HS_CONN_HANDLE_NONE && conn->phase == CL_BLE_CONN_PHASE_FAST &&
+				(all || conn->fast_until_us <= now_us))
+		{
+			request_phase(conn, CL_BLE_CONN_PHASE_IDLE);
+		}
+	}
+	arm_hold_timer();
+}
+
+/**
+ * @internal
+ * @brief Arm the hold timer for the first fast connection to expire, stop it if there is none.
+ */
+static void arm_hold_timer(void)
+{
+	int64_t next_us = INT64_MAX;
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		if (conns[i].conn_handle != BLE_HS_CONN_HANDLE_NONE && conns[i].phase == CL_BLE_CONN_PHASE_FAST &&
+				conns[i].fast_until_us < next_us)
+		{
+			next_us = conns[i].fast_until_us;
+		}
+	}
+
+	esp_timer_stop(hold_timer);
+	if (next_us != INT64_MAX)
+	{
+		int64_t timeout_us = next_us - esp_timer_get_time();
+		esp_timer_start_once(hold_timer, timeout_us > 0 ? timeout_us : 0);
+	}
+}
+
+/**
+ * @internal
+ * @brief Returns the tracked connection, or a free slot for BLE_HS_CONN_HANDLE_NONE. NULL if not found.
+ */
+static conn_t *find_conn(uint16_t conn_handle)
+{
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		if (conns[i].conn_handle == conn_handle)
+		{
+			return &conns[i];
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef _CL_BLE_CONN_H_
+#define _CL_BLE_CONN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "host/ble_hs.h"
+#include "cl_ble_svc.h"
+
+// Connection parameters of the claim/release exchange: Apple's minimum interval, no latency.
+#define CL_BLE_CONN_FAST_ITVL_MIN 12		 //!< 15 ms, in 1.25 ms units
+#define CL_BLE_CONN_FAST_ITVL_MAX 24		 //!< 30 ms, in 1.25 ms units
+#define CL_BLE_CONN_FAST_LATENCY 0			 //!< Connection events the peripheral may skip
+#define CL_BLE_CONN_FAST_TIMEOUT 400		 //!< 4 s, in 10 ms units
+#define CL_BLE_CONN_FAST_HOLD_MS 5000		 //!< Time a connection stays fast without a request
+
+// Connection parameters while the lock is idle or waits for the physical close: the peripheral wakes up once a
+// second, within the 2 s limit of Apple's accessory guidelines.
+#define CL_BLE_CONN_IDLE_ITVL_MIN 144		 //!< 180 ms, in 1.25 ms units
+#define CL_BLE_CONN_IDLE_ITVL_MAX 160		 //!< 200 ms, in 1.25 ms units
+#define CL_BLE_CONN_IDLE_LATENCY 4			 //!< Connection events the peripheral may skip
+#define CL_BLE_CONN_IDLE_TIMEOUT 500		 //!< 5 s, in 10 ms units
+
+// Connection parameters of a bulk transfer: the fast interval, with connection events as long as the interval so that
+// the controller keeps sending as long as it has data.
+#define CL_BLE_CONN_BULK_CE_LEN 48			 //!< 30 ms, in 0.625 ms units
+
+// LE Data Length Extension: the largest PDU a single connection event can carry.
+#define CL_BLE_CONN_DATA_LEN_OCTETS 251 //!< Maximum LL payload
+#define CL_BLE_CONN_DATA_LEN_TIME 2120	 //!< Time to send 251 octets on the 1M PHY, in us
+
+/**
+ * Phase of a connection, each with its own parameters.
+ */
+typedef enum
+{
+	CL_BLE_CONN_PHASE_FAST, //!< Claim/release exchange
+	CL_BLE_CONN_PHASE_IDLE, //!< Nothing to exchange, or waiting for the physical close
+	CL_BLE_CONN_PHASE_BULK, //!< Bulk transfer, on the 2M PHY if both sides support it
+} cl_ble_conn_phase_t;
+
+/**
+ * Parameters in use on a connection.
+ */
+typedef struct
+{
+	cl_ble_conn_phase_t phase; //!< Phase requested for the connection
+	uint16_t itvl;						 //!< Connection interval, in 1.25 ms units
+	uint16_t latency;					 //!< Peripheral latency, in connection events
+	uint16_t mtu;							 //!< Negotiated ATT MTU
+	uint8_t phy;							 //!< BLE_GAP_LE_PHY_* in use
+} cl_ble_conn_info_t;
+
+/**
+ * Counters of the parameter updates, all since boot.
+ */
+typedef struct
+{
+	uint32_t requested; //!< Updates requested to the central
+	uint32_t completed; //!< Updates applied, whoever initiated them
+	uint32_t failed;		//!< Updates rejected by the central or the stack
+} cl_ble_conn_stats_t;
+
+/**
+ * Initialize the connection parameter manager: connections are switched to the idle parameters when the lock
+ * state changes or when no request came within CL_BLE_CONN_FAST_HOLD_MS.
+ *
+ * @note Must be called after cl_phy_lock_svc_init().
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t cl_ble_conn_init(void);
+
+/**
+ * Negotiate the connection parameters, to be called from the GAP event handler:
+ * - BLE_GAP_EVENT_CONNECT: exchanges the ATT MTU, extends the data length and requests the fast parameters.
+ * - BLE_GAP_EVENT_CONN_UPDATE: records the parameters and requests them again if the phase changed meanwhile.
+ * - BLE_GAP_EVENT_MTU: records the ATT MTU.
+ * - BLE_GAP_EVENT_PHY_UPDATE_COMPLETE: records the PHY.
+ * - BLE_GAP_EVENT_DISCONNECT: forgets the connection.
+ */
+extern void cl_ble_conn_on_gap_event(const struct ble_gap_event *event);
+
+/**
+ * Start or end a bulk transfer on a connection: the connection switches to the 2M PHY and stays fast until the
+ * transfer ends, then turns idle after CL_BLE_CONN_FAST_HOLD_MS as after a request. Transfers on several channels of
+ * the connection are counted, it leaves the bulk phase with the last one.
+ * Must be called from the NimBLE host task.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the connection is unknown.
+ */
+extern esp_err_t cl_ble_conn_set_bulk(uint16_t conn_handle, bool bulk);
+
+/**
+ * Get the parameters in use on a connection.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the connection is unknown.
+ */
+extern esp_err_t cl_ble_conn_get_info(uint16_t conn_handle, cl_ble_conn_info_t *info);
+
+/**
+ * Read the parameter update counters.
+ */
+extern void cl_ble_conn_get_stats(cl_ble_conn_stats_t *stats);
+
+#endif // _CL_BLE_CONN_H_
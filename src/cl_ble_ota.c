@@ -0,0 +1,494 @@
+// Library
+#include <stdbool.h>
+#include <string.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+// Bluetooth host stack
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+// Local
+#include "cl_ble_conn.h"
+#include "cl_ble_ota.h"
+#include "cl_journal.h"
+#include "cl_ota.h"
+#include "cl_persist.h"
+#include "cl_phy_lock_svc.h"
+
+// -- DEFINES --
+#define RETRY_MS 10 //<! Time before posting the receive buffer or answering again once the mbuf pool is exhausted
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief The channel, only accessed from the NimBLE host task. The update itself lives in cl_ota and outlives it.
+ */
+typedef struct
+{
+	struct ble_l2cap_chan *chan; //!< NULL while no central is connected
+	uint16_t conn_handle;
+	bool bulk;											 //!< The connection was moved to CL_BLE_CONN_PHASE_BULK
+	bool stalled;										 //!< The stack holds a response until the central returns credits
+	bool rx_deferred;								 //!< The receive buffer waits for a chunk buffer or the mbuf pool
+	bool answering;									 //!< The answer to the last request is not sent yet
+	bool attached;									 //!< A BEGIN on this channel ties it to the update, for the progress
+	bool done_sent;									 //!< The DONE response of the update went out
+	uint32_t acked;									 //!< Bytes written last reported to the central
+	uint8_t answer[CL_BLE_OTA_RESPONSE_LEN]; //!< The answer not sent yet
+} channel_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static int l2cap_event(struct ble_l2cap_event *event, void *arg);
+static void receive_request(struct os_mbuf *sdu);
+static void post_rx(void);
+static void flush(void);
+static void answer(uint8_t op, esp_err_t status, uint32_t offset);
+static void encode_response(uint8_t *response, uint8_t op, esp_err_t status, uint32_t offset);
+static void leave_bulk(void);
+static void ota_progress(void *arg);
+static void progress_event(struct ble_npl_event *ev);
+static void retry_expired(void *arg);
+static void restart_expired(void *arg);
+static void restart(void *arg);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_ota";
+
+static channel_t channel;
+static uint8_t request_buf[CL_BLE_OTA_RX_MTU]; //!< The request being handled, flattened
+static struct ble_npl_event progress_ev;
+static esp_timer_handle_t retry_timer;
+static esp_timer_handle_t restart_timer;
+static cl_ble_ota_stats_t ota_stats;
+
+// -- FUNCTIONS --
+
+esp_err_t cl_ble_ota_init(void)
+{
+	memset(&channel, 0, sizeof(channel));
+	ble_npl_event_init(&progress_ev, progress_event, NULL);
+
+	const esp_timer_create_args_t retry_args = {
+			.callback = retry_expired,
+			.name = "ble_ota_retry",
+	};
+	esp_err_t ret = esp_timer_create(&retry_args, &retry_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create retry timer; ret=%d", ret);
+		return ret;
+	}
+	const esp_timer_create_args_t restart_args = {
+			.callback = restart_expired,
+			.name = "ble_ota_restart",
+	};
+	ret = esp_timer_create(&restart_args, &restart_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create restart timer; ret=%d", ret);
+		return ret;
+	}
+
+	ret = cl_ota_init(ota_progress, NULL);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to start updates; ret=%d", ret);
+		return ret;
+	}
+
+	int rc = ble_l2cap_create_server(CL_BLE_OTA_PSM, CL_BLE_OTA_RX_MTU, l2cap_event, NULL);
+	if (rc != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to create L2CAP server; psm=0x%04x ret=%d", CL_BLE_OTA_PSM, rc);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+void cl_ble_ota_get_stats(cl_ble_ota_stats_t *stats)
+{
+	*stats = ota_stats;
+}
+
+/**
+ * @internal
+ * @brief L2CAP event callback of the server, on the NimBLE host task.
+ */
+static int l2cap_event(struct ble_l2cap_event *event, void *arg)
+{
+	struct ble_gap_conn_desc desc;
+	struct os_mbuf *sdu;
+	int ret;
+
+	switch (event->type)
+	{
+	case BLE_L2CAP_EVENT_COC_ACCEPT:
+		// only a bonded central may send an update, and only an image signed with the release key is ever booted
+		if (ble_gap_conn_find(event->accept.conn_handle, &desc) != 0 || !desc.sec_state.encrypted ||
+				!desc.sec_state.bonded)
+		{
+			ota_stats.refused++;
+			ESP_LOGW(LOG_TAG, "Refused channel on unbonded link; conn_handle=%d", event->accept.conn_handle);
+			return BLE_HS_EENCRYPT;
+		}
+		if (channel.chan != NULL)
+		{
+			return BLE_HS_ENOMEM;
+		}
+		// the first request is a BEGIN, it needs no chunk buffer
+		sdu = os_msys_get_pkthdr(CL_BLE_OTA_RX_MTU, 0);
+		if (sdu == NULL)
+		{
+			return BLE_HS_ENOMEM;
+		}
+		ret = ble_l2cap_recv_ready(event->accept.chan, sdu);
+		if (ret != 0)
+		{
+			os_mbuf_free_chain(sdu);
+		}
+		return ret;
+
+	case BLE_L2CAP_EVENT_COC_CONNECTED:
+		if (event->connect.status != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to connect channel; conn_handle=%d ret=%d", event->connect.conn_handle,
+							 event->connect.status);
+			return 0;
+		}
+		memset(&channel, 0, sizeof(channel));
+		channel.chan = event->connect.chan;
+		channel.conn_handle = event->connect.conn_handle;
+		ota_stats.channels++;
+		ESP_LOGI(LOG_TAG, "channel connected; conn_handle=%d", channel.conn_handle);
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+		if (event->receive.sdu_rx != NULL)
+		{
+			receive_request(event->receive.sdu_rx);
+			os_mbuf_free_chain(event->receive.sdu_rx);
+		}
+		// the stack stops receiving, and the central sending, until it gets a new buffer
+		post_rx();
+		flush();
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+		channel.stalled = false;
+		flush();
+		return 0;
+
+	case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+		// the update goes on with the chunks received, the central resumes it with a BEGIN
+		channel.attached = false;
+		leave_bulk();
+		esp_timer_stop(retry_timer);
+		ESP_LOGI(LOG_TAG, "channel disconnected; conn_handle=%d", event->disconnect.conn_handle);
+		memset(&channel, 0, sizeof(channel));
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @internal
+ * @brief Handle a request SDU, answering it unless it is an accepted chunk.
+ */
+static void receive_request(struct os_mbuf *sdu)
+{
+	uint16_t len = OS_MBUF_PKTLEN(sdu);
+	os_mbuf_copydata(sdu, 0, len, request_buf);
+	ota_stats.requests++;
+
+	uint8_t op = len > 0 ? request_buf[0] : 0;
+	uint32_t value = 0;
+	if (len >= CL_BLE_OTA_HEADER_LEN)
+	{
+		memcpy(&value, &request_buf[1], sizeof(value));
+	}
+
+	cl_ota_status_t status;
+	esp_err_t ret;
+	switch (op)
+	{
+	case CL_BLE_OTA_OP_BEGIN:
+	case CL_BLE_OTA_OP_BEGIN_PATCH:
+		if (len != CL_BLE_OTA_BEGIN_LEN)
+		{
+			answer(op, ESP_ERR_INVALID_SIZE, 0);
+			return;
+		}
+		uint32_t offset = 0;
+		ret = cl_ota_begin(op == CL_BLE_OTA_OP_BEGIN_PATCH ? CL_OTA_FORMAT_PATCH : CL_OTA_FORMAT_IMAGE, value,
+											 &request_buf[CL_BLE_OTA_HEADER_LEN], &offset);
+		if (ret == ESP_OK)
+		{
+			channel.attached = true;
+			channel.done_sent = false;
+			channel.acked = offset;
+			// the image is worth a faster link
+			if (!channel.bulk && cl_ble_conn_set_bulk(channel.conn_handle, true) == ESP_OK)
+			{
+				channel.bulk = true;
+			}
+		}
+		answer(op, ret, offset);
+		return;
+
+	case CL_BLE_OTA_OP_DATA:
+		ret = len > CL_BLE_OTA_HEADER_LEN ? cl_ota_write(value, &request_buf[CL_BLE_OTA_HEADER_LEN], len - CL_BLE_OTA_HEADER_LEN)
+																			: ESP_ERR_INVALID_SIZE;
+		if (ret != ESP_OK)
+		{
+			// tells the central where to send from
+			cl_ota_get_status(&status);
+			answer(op, ret, status.received);
+		}
+		return;
+
+	case CL_BLE_OTA_OP_APPLY:
+		cl_ota_get_status(&status);
+		ret = status.state == CL_OTA_STATE_DONE ? ESP_OK : ESP_ERR_INVALID_STATE;
+		if (ret == ESP_OK && cl_phy_lock_svc_is_busy())
+		{
+			// the central applies again once the claim or release is committed and the bolt stopped
+			ret = ESP_ERR_NOT_FINISHED;
+		}
+		if (ret == ESP_OK)
+		{
+			ESP_LOGI(LOG_TAG, "Restarting into the update; conn_handle=%d", channel.conn_handle);
+			esp_timer_start_once(restart_timer, CL_BLE_OTA_RESTART_MS * 1000);
+		}
+		answer(op, ret, status.size);
+		return;
+
+	case CL_BLE_OTA_OP_ABORT:
+		channel.attached = false;
+		leave_bulk();
+		answer(op, cl_ota_abort(), 0);
+		return;
+
+	default:
+		answer(op, ESP_ERR_NOT_SUPPORTED, 0);
+		return;
+	}
+}
+
+/**
+ * @internal
+ * @brief Give the stack a new receive buffer once cl_ota can take the chunk it may carry.
+ */
+static void post_rx(void)
+{
+	if (channel.chan == NULL)
+	{
+		return;
+	}
+
+	cl_ota_status_t status;
+	cl_ota_get_status(&status);
+	if (status.free_buffers == 0)
+	{
+		// the worker frees a buffer before it reports progress
+		if (!channel.rx_deferred)
+		{
+			ota_stats.deferred++;
+		}
+		channel.rx_deferred = true;
+		return;
+	}
+
+	struct os_mbuf *sdu = os_msys_get_pkthdr(CL_BLE_OTA_RX_MTU, 0);
+	int ret = sdu != NULL ? ble_l2cap_recv_ready(channel.chan, sdu) : BLE_HS_ENOMEM;
+	if (ret != 0)
+	{
+		os_mbuf_free_chain(sdu);
+		ESP_LOGE(LOG_TAG, "Failed to post receive buffer; conn_handle=%d ret=%d", channel.conn_handle, ret);
+		channel.rx_deferred = true;
+		esp_timer_stop(retry_timer);
+		esp_timer_start_once(retry_timer, RETRY_MS * 1000);
+		return;
+	}
+	channel.rx_deferred = false;
+}
+
+/**
+ * @internal
+ * @brief Send the pending responses: the answer to the last request, then the progress, then the result.
+ */
+static void flush(void)
+{
+	cl_ota_status_t status;
+	cl_ota_get_status(&status);
+	bool over = status.state == CL_OTA_STATE_DONE || status.state == CL_OTA_STATE_FAILED;
+
+	while (channel.chan != NULL && !channel.stalled)
+	{
+		uint8_t response[CL_BLE_OTA_RESPONSE_LEN];
+		bool progress = false;
+		bool done = false;
+		if (channel.answering)
+		{
+			memcpy(response, channel.answer, sizeof(response));
+		}
+		else if (channel.attached && status.written > channel.acked)
+		{
+			encode_response(response, CL_BLE_OTA_OP_DATA, ESP_OK, status.written);
+			progress = true;
+		}
+		else if (channel.attached && !channel.done_sent && over)
+		{
+			encode_response(response, CL_BLE_OTA_OP_DONE, status.error, status.written);
+			done = true;
+		}
+		else
+		{
+			break;
+		}
+
+		struct os_mbuf *sdu = ble_hs_mbuf_from_flat(response, sizeof(response));
+		if (sdu == NULL)
+		{
+			esp_timer_stop(retry_timer);
+			esp_timer_start_once(retry_timer, RETRY_MS * 1000);
+			return;
+		}
+		int ret = ble_l2cap_send(channel.chan, sdu);
+		if (ret != 0 && ret != BLE_HS_ESTALLED)
+		{
+			os_mbuf_free_chain(sdu);
+			ESP_LOGE(LOG_TAG, "Failed to send response; conn_handle=%d ret=%d", channel.conn_handle, ret);
+			return;
+		}
+		// with BLE_HS_ESTALLED the stack keeps the SDU and sends the rest of it on TX_UNSTALLED
+		ota_stats.responses++;
+		if (ret == BLE_HS_ESTALLED)
+		{
+			ota_stats.stalls++;
+			channel.stalled = true;
+		}
+		if (progress)
+		{
+			channel.acked = status.written;
+		}
+		else if (done)
+		{
+			channel.done_sent = true;
+			leave_bulk();
+			if (status.error != ESP_OK)
+			{
+				ESP_LOGW(LOG_TAG, "Update failed; conn_handle=%d: %s", channel.conn_handle, esp_err_to_name(status.error));
+			}
+		}
+		else
+		{
+			channel.answering = false;
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Answer the request being handled, replacing an answer to a previous one not sent yet.
+ */
+static void answer(uint8_t op, esp_err_t status, uint32_t offset)
+{
+	if (status != ESP_OK)
+	{
+		ota_stats.rejected++;
+		ESP_LOGW(LOG_TAG, "Refused request; op=%d offset=%lu: %s", op, (unsigned long)offset, esp_err_to_name(status));
+	}
+	encode_response(channel.answer, op, status, offset);
+	channel.answering = true;
+}
+
+static void encode_response(uint8_t *response, uint8_t op, esp_err_t status, uint32_t offset)
+{
+	int32_t code = status;
+	response[0] = op;
+	memcpy(&response[1], &code, sizeof(code));
+	memcpy(&response[5], &offset, sizeof(offset));
+}
+
+/**
+ * @internal
+ * @brief Give the connection back to the connection manager once the update is over or left.
+ */
+static void leave_bulk(void)
+{
+	if (!channel.bulk)
+	{
+		return;
+	}
+	channel.bulk = false;
+	// the connection may already be gone along with the channel
+	cl_ble_conn_set_bulk(channel.conn_handle, false);
+}
+
+/**
+ * @internal
+ * @brief Progress callback of cl_ota, on its worker task: defers to the NimBLE host task.
+ */
+static void ota_progress(void *arg)
+{
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &progress_ev);
+}
+
+static void progress_event(struct ble_npl_event *ev)
+{
+	if (channel.rx_deferred)
+	{
+		post_rx();
+	}
+	flush();
+}
+
+/**
+ * @internal
+ * @brief Retry timer callback: the same as progress, once the mbuf pool had time to drain.
+ */
+static void retry_expired(void *arg)
+{
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &progress_ev);
+}
+
+/**
+ * @internal
+ * @brief Restart timer callback: boots the verified image from the lock task, so that no transition starts in between.
+ */
+static void restart_expired(void *arg)
+{
+	esp_err_t ret = cl_phy_lock_svc_run(restart, NULL);
+	if (ret == ESP_ERR_NO_MEM)
+	{
+		esp_timer_start_once(restart_timer, RETRY_MS * 1000);
+	}
+	else if (ret != ESP_OK)
+	{
+		// no lock task, nothing can be in flight
+		restart(NULL);
+	}
+}
+
+/**
+ * @internal
+ * @brief Restart once the lock is idle and the records it queued are written. Runs on the lock task.
+ * No persistence callback can be pending outside of a request, stopping the workers can't wait on the lock task.
+ */
+static void restart(void *arg)
+{
+	if (cl_phy_lock_svc_is_busy())
+	{
+		ESP_LOGI(LOG_TAG, "Restart delayed, the lock is busy");
+		esp_timer_start_once(restart_timer, CL_BLE_OTA_RESTART_MS * 1000);
+		return;
+	}
+
+	cl_persist_deinit();
+	cl_journal_deinit();
+	esp_restart();
+}
@@ -0,0 +1,78 @@
+#ifndef _CL_BLE_OTA_H_
+#define _CL_BLE_OTA_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "cl_ota.h"
+
+/**
+ * Firmware update channel: an L2CAP connection-oriented channel carrying the image from a bonded central to cl_ota, a
+ * whole chunk per SDU. The hash a central announces only guards the transfer: esp_ota_end() checks the signature of the
+ * image (CONFIG_SECURE_SIGNED_ON_UPDATE) before it can boot, so pairing with the lock is not enough to replace its
+ * firmware.
+ *
+ * The central opens the channel on CL_BLE_OTA_PSM and sends request SDUs, all integers little-endian:
+ *   BEGIN        [op] [size: u32] [sha256: 32 bytes]
+ *   BEGIN_PATCH  [op] [patch size: u32] [sha256 of the image it rebuilds: 32 bytes]
+ *   DATA         [op] [offset: u32] [chunk: up to CL_OTA_CHUNK_SIZE bytes]
+ *   APPLY        [op]
+ *   ABORT        [op]
+ * The lock answers with response SDUs:
+ *   [op] [status: i32, an esp_err_t] [offset: u32]
+ * BEGIN is answered with the offset to send the image from, which resumes an update cut short by a disconnection.
+ * BEGIN_PATCH does the same for a cl_delta patch against the running image, the DATA chunks then carry the patch.
+ * DATA is answered as the chunks are written to flash with the bytes written so far, several chunks at once when the
+ * central is slow to return credits, or right away with the offset expected if the chunk is refused. DONE follows the
+ * last chunk with the result of the verification. APPLY restarts into the image once verified, after
+ * CL_BLE_OTA_RESTART_MS for the answer to go out and once the journal and NVS records are written. It is refused
+ * with ESP_ERR_NOT_FINISHED while a claim or release is pending or the bolt is moving.
+ *
+ * The central sends the next chunk without waiting for the answers: the lock posts its receive buffer, and so gives
+ * credits, only while cl_ota has a chunk buffer free, so the central waits on the credits when flash falls behind.
+ */
+
+#define CL_BLE_OTA_PSM 0x0083																 //!< LE PSM of the channel, in the dynamic range
+#define CL_BLE_OTA_HEADER_LEN 5															 //!< Op and offset of a DATA request
+#define CL_BLE_OTA_RX_MTU (CL_BLE_OTA_HEADER_LEN + CL_OTA_CHUNK_SIZE) //!< Largest SDU accepted, a DATA request
+#define CL_BLE_OTA_BEGIN_LEN (5 + CL_OTA_HASH_LEN)									 //!< Op, size and hash, of both begins
+#define CL_BLE_OTA_RESPONSE_LEN 9														 //!< Op, status and offset
+#define CL_BLE_OTA_RESTART_MS 500														 //!< Delay of the restart after APPLY
+
+// ops
+#define CL_BLE_OTA_OP_BEGIN 0x01 //!< Announce the image, answered with the offset to send from
+#define CL_BLE_OTA_OP_DATA 0x02	 //!< A chunk of the image, answered with the bytes written
+#define CL_BLE_OTA_OP_DONE 0x03	 //!< Response only, the image is verified or the update failed
+#define CL_BLE_OTA_OP_APPLY 0x04 //!< Restart into the verified image
+#define CL_BLE_OTA_OP_ABORT 0x05 //!< Abort the update
+#define CL_BLE_OTA_OP_BEGIN_PATCH 0x06 //!< Announce a patch, answered with the offset to send from
+
+/**
+ * Counters of the channel, all since boot.
+ */
+typedef struct
+{
+	uint32_t channels;	//!< Channels accepted
+	uint32_t refused;		//!< Channels refused on a connection that is not bonded and encrypted
+	uint32_t requests;	//!< Request SDUs received, chunks included
+	uint32_t rejected;	//!< Requests answered with an error
+	uint32_t deferred;	//!< Receive buffers held back until cl_ota freed a chunk buffer
+	uint32_t responses; //!< Response SDUs sent
+	uint32_t stalls;		//!< Responses that used up the credits of the central
+} cl_ble_ota_stats_t;
+
+/**
+ * Start cl_ota and register the L2CAP server on CL_BLE_OTA_PSM.
+ * Requires CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM and the connection manager.
+ *
+ * @return Returns ESP_OK if successful, otherwise esp_err accordingly.
+ */
+extern esp_err_t cl_ble_ota_init(void);
+
+/**
+ * Read the channel counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_ble_ota_get_stats(cl_ble_ota_stats_t *stats);
+
+#endif // _CL_BLE_OTA_H_
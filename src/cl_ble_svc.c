@@ -1,5 +1,6 @@
 // ESP32 and utils
 #include "esp_log.h"
+#include "lazy_log.h"
 #include "stringify.h"
 // Bluetooth host stack
 #include "nimble/nimble_port.h"
@@ -11,10 +12,17 @@
 #include "services/gatt/ble_svc_gatt.h"
 // Local
 #include "cl_ble_svc.h"
+#include "cl_ble_adv.h"
+#include "cl_ble_bond.h"
+#include "cl_ble_broadcast.h"
+#include "cl_ble_bulk.h"
+#include "cl_ble_conn.h"
+#include "cl_ble_ota.h"
 #include "gatts/cl_ble_lock_svc.h"
 
 // -- INTERNAL FUNCTIONS --
-void ble_advertise(void);
+// Provided by the NimBLE store configuration, not declared in any header
+void ble_store_config_init(void);
 
 // -- RUNTIME VARIABLES
 static const char *LOG_TAG = "blesvc";
@@ -33,34 +41,45 @@ int ble_gap_event(struct ble_gap_event *event, void *arg)
 		ESP_LOGI(LOG_TAG, "connection %s; status=%d ",
 						 event->connect.status == 0 ? "established" : "failed",
 						 event->connect.status);
-		if (event->connect.status != 0)
-		{
-			// Connection has failed, resume advertising.
-			ble_advertise();
-		}
-		return 0;
+		// If the connection has failed, resume advertising.
+		cl_ble_adv_on_gap_event(event);
+		cl_ble_conn_on_gap_event(event);
+		return cl_ble_bond_on_gap_event(event);
 
 	case BLE_GAP_EVENT_DISCONNECT:
 		ESP_LOGI(LOG_TAG, "disconnect; reason=%d ", event->disconnect.reason);
+		cl_ble_bond_on_gap_event(event);
+		cl_ble_conn_on_gap_event(event);
+		cl_ble_lock_svc_on_gap_event(event);
 		// Connection was terminated, resume advertising.
-		ble_advertise();
+		cl_ble_adv_on_gap_event(event);
 		return 0;
 
 	case BLE_GAP_EVENT_ADV_COMPLETE:
 		ESP_LOGI(LOG_TAG, "advertise complete; reason=%d", event->adv_complete.reason);
-		// Advertise was terminated, resume advertising.
-		ble_advertise();
+		// Advertise was terminated, resume advertising (slow once the fast window elapsed).
+		cl_ble_adv_on_gap_event(event);
 		return 0;
 
 	case BLE_GAP_EVENT_CONN_UPDATE:
 		/* The central has updated the connection parameters. */
 		ESP_LOGI(LOG_TAG, "connection updated; status=%d ", event->conn_update.status);
+		cl_ble_conn_on_gap_event(event);
 		return 0;
 
 	case BLE_GAP_EVENT_ENC_CHANGE:
 		/* Encryption has been enabled or disabled for this connection. */
 		ESP_LOGI(LOG_TAG, "encryption change event; status=%d ", event->enc_change.status);
-		return 0;
+		return cl_ble_bond_on_gap_event(event);
+
+	case BLE_GAP_EVENT_REPEAT_PAIRING:
+		/* The peer is bonded but lost its keys and pairs again. */
+		ESP_LOGI(LOG_TAG, "repeat pairing event; conn_handle=%d", event->repeat_pairing.conn_handle);
+		return cl_ble_bond_on_gap_event(event);
+
+	case BLE_GAP_EVENT_PASSKEY_ACTION:
+		ESP_LOGI(LOG_TAG, "passkey action event; action=%d", event->passkey.params.action);
+		return cl_ble_bond_on_gap_event(event);
 
 	case BLE_GAP_EVENT_NOTIFY_TX:
 		ESP_LOGI(LOG_TAG, "notify_tx event; conn_handle=%d attr_handle=%d "
@@ -81,6 +100,7 @@ int ble_gap_event(struct ble_gap_event *event, void *arg)
 						 event->subscribe.cur_notify,
 						 event->subscribe.prev_indicate,
 						 event->subscribe.cur_indicate);
+		cl_ble_lock_svc_on_gap_event(event);
 		return 0;
 
 	case BLE_GAP_EVENT_MTU:
@@ -88,6 +108,16 @@ int ble_gap_event(struct ble_gap_event *event, void *arg)
 						 event->mtu.conn_handle,
 						 event->mtu.channel_id,
 						 event->mtu.value);
+		cl_ble_conn_on_gap_event(event);
+		return 0;
+
+	case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+		ESP_LOGI(LOG_TAG, "phy update event; conn_handle=%d status=%d tx_phy=%d rx_phy=%d",
+						 event->phy_updated.conn_handle,
+						 event->phy_updated.status,
+						 event->phy_updated.tx_phy,
+						 event->phy_updated.rx_phy);
+		cl_ble_conn_on_gap_event(event);
 		return 0;
 
 	default:
@@ -97,48 +127,6 @@ int ble_gap_event(struct ble_gap_event *event, void *arg)
 	return 0;
 }
 
-void ble_advertise(void)
-{
-	int ret;
-
-	struct ble_hs_adv_fields fields;
-	memset(&fields, 0, sizeof fields);
-
-	/* Advertise two flags:
-	 *     o Discoverability in forthcoming advertisement (general)
-	 *     o BLE-only (BR/EDR unsupported).
-	 */
-	fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
-
-	const char *name = ble_svc_gap_device_name();
-	fields.name = (uint8_t *)name;
-	fields.name_len = strlen(name);
-	fields.name_is_complete = 1;
-	fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
-	fields.tx_pwr_lvl_is_present = 1;
-
-	ret = ble_gap_adv_set_fields(&fields);
-	if (ret != 0)
-	{
-		ESP_LOGE(LOG_TAG, "error setting advertisement data; ret=%d", ret);
-		return;
-	}
-
-	struct ble_gap_adv_params adv_params;
-	memset(&adv_params, 0, sizeof adv_params);
-	adv_params.filter_policy = BLE_HCI_SCAN_FILT_NO_WL;
-	adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-	adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-
-	// Begin advertising.
-	ret = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event, NULL);
-	if (ret != 0)
-	{
-		ESP_LOGE(LOG_TAG, "error enabling advertisement; ret=%d", ret);
-		return;
-	}
-}
-
 void ble_on_reset(int reason)
 {
 	ESP_LOGE(LOG_TAG, "Resetting state; reason=%d", reason);
@@ -181,10 +169,10 @@ void ble_on_sync(void)
 		return;
 	}
 
-	ESP_LOGI(LOG_TAG, "BT device address set; addr=%s", ADDR_TO_STRING(addr.val));
+	LAZY_LOGI(LOG_TAG, "BT device address set; addr=%s", ADDR_TO_STRING(addr.val));
 
 	// Begin advertising after sync
-	ble_advertise();
+	cl_ble_adv_start(own_addr_type, ble_gap_event, NULL);
 }
 
 void ble_host_task(void *param)
@@ -222,6 +210,39 @@ esp_err_t cl_ble_svc_init()
 	// Initialize the GATT service
 	ble_svc_gatt_init();
 
+	// Restore the bonds persisted in NVS and bound the store with LRU eviction
+	ble_store_config_init();
+	ret = cl_ble_bond_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init bond store; ret=%d ", ret);
+		return ret;
+	}
+
+	// Negotiate the connection parameters per phase of the claim/release exchange
+	ret = cl_ble_conn_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init connection manager; ret=%d ", ret);
+		return ret;
+	}
+
+	// Build the advertising payloads once
+	ret = cl_ble_adv_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init advertising; ret=%d ", ret);
+		return ret;
+	}
+
+	// Broadcast the signed lock status in the scan response, once a key is provisioned
+	ret = cl_ble_broadcast_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init status broadcast; ret=%d ", ret);
+		return ret;
+	}
+
 	// Add GATT services
 	ret = cl_ble_lock_svc_init();
 
@@ -232,11 +253,27 @@ esp_err_t cl_ble_svc_init()
 		return ret;
 	}
 
+	// Stream the journal, metrics and core dumps over an L2CAP channel
+	ret = cl_ble_bulk_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init bulk channel; ret=%d ", ret);
+		return ret;
+	}
+
+	// Take firmware updates over an L2CAP channel
+	ret = cl_ble_ota_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init update channel; ret=%d ", ret);
+		return ret;
+	}
+
 	// Host configs
 	ble_hs_cfg.reset_cb = ble_on_reset;
 	ble_hs_cfg.sync_cb = ble_on_sync;
 	// ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
-	ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+	// store_status_cb is set by cl_ble_bond_init()
 
 	// Security Manager configs
 	ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
@@ -1,11 +1,15 @@
 #ifndef _CL_BLE_SVC_H_
 #define _CL_BLE_SVC_H_
 
+#include "sdkconfig.h"
 #include "esp_err.h"
 
 #define CL_BLE_DEVICE_NAME "CubeLock-123456"
 #define CL_BLE_PASSKEY 123456
 #define CL_BLE_MIN_GATT_ENC_KEY_LEN 16
+#define CL_BLE_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+struct ble_gap_event;
 
 /**
  * Initialize the BLE service.
@@ -15,4 +19,10 @@
  */
 extern esp_err_t cl_ble_svc_init();
 
+/**
+ * GAP event handler of the connections, given to the advertising. Forwards each event to the BLE modules following
+ * it: advertising, bonds, connection parameters and the lock service.
+ */
+extern int ble_gap_event(struct ble_gap_event *event, void *arg);
+
 #endif // _CL_BLE_SVC_H_
@@ -0,0 +1,199 @@
+// Library
+#include <inttypes.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+// ESP32
+#include "esp_log.h"
+#include "esp_timer.h"
+// Local
+#include "cl_debounce.h"
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief State of a debounced input.
+ */
+typedef struct
+{
+	gpio_num_t pin;						 //!< The input pin, GPIO_NUM_NC for a free slot
+	esp_timer_handle_t timer;	 //!< One-shot sampling timer, armed while the input is unsettled
+	uint32_t interval_us;			 //!< Time between two samples
+	uint8_t samples;					 //!< Equal samples needed to settle
+	uint8_t stable;						 //!< Equal samples taken so far
+	uint8_t sampling;					 //!< Whether the timer is armed
+	uint32_t sampled_level;		 //!< Level of the last sample
+	uint32_t reported_level;	 //!< Last settled level given to the callback
+	cl_debounce_cb_t cb;
+	void *arg;
+} debounce_input_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void debounce_sample(void *arg);
+static debounce_input_t *find_input(gpio_num_t pin);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "debounce";
+
+static debounce_input_t inputs[CL_DEBOUNCE_MAX_INPUTS]; //!< Debounced inputs, slots with a NULL callback are free
+static portMUX_TYPE inputs_lock = portMUX_INITIALIZER_UNLOCKED; //!< Guards the sampling state between the edge reporter and the timer task
+
+esp_err_t cl_debounce_add(gpio_num_t pin, const cl_debounce_config_t *config, cl_debounce_cb_t cb, void *arg)
+{
+	if (config == NULL || cb == NULL || config->samples == 0 || config->window_us < config->samples)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	debounce_input_t *input = NULL;
+	for (int i = 0; i < CL_DEBOUNCE_MAX_INPUTS; i++)
+	{
+		if (inputs[i].cb == NULL)
+		{
+			input = &inputs[i];
+			break;
+		}
+	}
+	if (input == NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s No free slot for GPIO_%d", __func__, pin);
+		return ESP_ERR_NO_MEM;
+	}
+
+	esp_timer_create_args_t timer_args = {
+			.callback = debounce_sample,
+			.arg = input,
+			.dispatch_method = ESP_TIMER_TASK,
+			.name = "debounce",
+	};
+	esp_err_t ret = esp_timer_create(&timer_args, &input->timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create timer for GPIO_%d: %s", __func__, pin, esp_err_to_name(ret));
+		return ret;
+	}
+
+	input->pin = pin;
+	input->interval_us = config->window_us / config->samples;
+	input->samples = config->samples;
+	input->stable = 0;
+	input->sampling = 0;
+	input->sampled_level = gpio_get_level(pin);
+	input->reported_level = input->sampled_level;
+	input->arg = arg;
+	input->cb = cb;
+
+	ESP_LOGD(LOG_TAG, "%s GPIO_%d debounced: %d samples every %" PRIu32 "us, level %" PRIu32, __func__, pin,
+					 input->samples, input->interval_us, input->reported_level);
+
+	return ESP_OK;
+}
+
+esp_err_t cl_debounce_remove(gpio_num_t pin)
+{
+	debounce_input_t *input = find_input(pin);
+	if (input == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	// stopping a timer that isn't armed only reports it
+	esp_timer_stop(input->timer);
+	esp_timer_delete(input->timer);
+	input->timer = NULL;
+	input->cb = NULL;
+	ESP_LOGD(LOG_TAG, "%s GPIO_%d no longer debounced", __func__, pin);
+	return ESP_OK;
+}
+
+esp_err_t cl_debounce_edge(gpio_num_t pin)
+{
+	debounce_input_t *input = find_input(pin);
+	if (input == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	portENTER_CRITICAL(&inputs_lock);
+	// any edge invalidates the samples taken so far
+	input->stable = 0;
+	uint8_t start = !input->sampling;
+	input->sampling = 1;
+	portEXIT_CRITICAL(&inputs_lock);
+
+	// if the timer is already armed the burst is coalesced into the running sampling
+	if (start)
+	{
+		esp_err_t ret = esp_timer_start_once(input->timer, input->interval_us);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Failed to start sampling GPIO_%d: %s", __func__, pin, esp_err_to_name(ret));
+			portENTER_CRITICAL(&inputs_lock);
+			input->sampling = 0;
+			portEXIT_CRITICAL(&inputs_lock);
+			return ret;
+		}
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Sampling timer callback, re-arms itself until the input is stable for the whole window.
+ */
+static void debounce_sample(void *arg)
+{
+	debounce_input_t *input = arg;
+	uint32_t level = gpio_get_level(input->pin);
+	uint8_t report = 0;
+
+	portENTER_CRITICAL(&inputs_lock);
+	if (level == input->sampled_level)
+	{
+		input->stable++;
+	}
+	else
+	{
+		input->sampled_level = level;
+		input->stable = 1;
+	}
+
+	uint8_t settled = input->stable >= input->samples;
+	if (settled)
+	{
+		input->sampling = 0;
+		input->stable = 0;
+		report = level != input->reported_level;
+		input->reported_level = level;
+	}
+	portEXIT_CRITICAL(&inputs_lock);
+
+	if (!settled)
+	{
+		esp_timer_start_once(input->timer, input->interval_us);
+		return;
+	}
+
+	if (report)
+	{
+		ESP_LOGD(LOG_TAG, "%s GPIO_%d settled: %" PRIu32, __func__, input->pin, level);
+		input->cb(input->pin, level, input->arg);
+	}
+}
+
+/**
+ * @internal
+ * @brief Returns the debounced input of a pin, NULL if not debounced.
+ */
+static debounce_input_t *find_input(gpio_num_t pin)
+{
+	for (int i = 0; i < CL_DEBOUNCE_MAX_INPUTS; i++)
+	{
+		if (inputs[i].cb != NULL && inputs[i].pin == pin)
+		{
+			return &inputs[i];
+		}
+	}
+	return NULL;
+}
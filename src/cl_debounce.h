@@ -0,0 +1,70 @@
+#ifndef _CL_DEBOUNCE_H_
+#define _CL_DEBOUNCE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+#define CL_DEBOUNCE_MAX_INPUTS 4 //!< Maximum number of debounced inputs
+
+/**
+ * Debounce configuration of an input.
+ * The input is sampled every window_us / samples, it is settled once `samples` consecutive samples read the
+ * same level, i.e. once it has been stable for the whole window.
+ */
+typedef struct
+{
+	uint32_t window_us; //!< Time the input must be stable before its level is reported
+	uint8_t samples;		//!< Number of equal samples taken over the window
+} cl_debounce_config_t;
+
+#define CL_DEBOUNCE_CONFIG_DEFAULT() \
+	{                                  \
+		.window_us = 50000,              \
+		.samples = 5,                    \
+	}
+
+/**
+ * Called with the settled level of an input, only when it differs from the last reported one.
+ *
+ * @note Runs in the esp_timer task: it must not block, post the level to the owning task instead.
+ */
+typedef void (*cl_debounce_cb_t)(gpio_num_t pin, uint32_t level, void *arg);
+
+/**
+ * Start debouncing an input. Its current level is taken as the initial settled level.
+ *
+ * @param pin The input pin, already configured as input.
+ * @param config The debounce configuration of the pin.
+ * @param cb Called with each new settled level.
+ * @param arg Argument given to cb.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NO_MEM if CL_DEBOUNCE_MAX_INPUTS are already debounced,
+ * ESP_ERR_INVALID_ARG for an invalid configuration.
+ */
+extern esp_err_t cl_debounce_add(gpio_num_t pin, const cl_debounce_config_t *config, cl_debounce_cb_t cb, void *arg);
+
+/**
+ * Stop debouncing an input and free its slot, e.g. to roll back a cl_debounce_add() when the input can't be served.
+ *
+ * @note Nothing may report edges on the pin any more, a level being sampled is dropped.
+ *
+ * @param pin The input pin.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the pin is not debounced.
+ */
+extern esp_err_t cl_debounce_remove(gpio_num_t pin);
+
+/**
+ * Report an edge on a debounced input. Bursts of edges are coalesced: sampling restarts on each edge and a
+ * single settled level is reported once the input is stable.
+ *
+ * @param pin The input pin.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the pin is not debounced.
+ *
+ * @note Must be called from task context.
+ */
+extern esp_err_t cl_debounce_edge(gpio_num_t pin);
+
+#endif // _CL_DEBOUNCE_H_
@@ -0,0 +1,243 @@
+// Library
+#include <stdbool.h>
+#include <string.h>
+// Local
+#include "cl_delta.h"
+
+// -- DEFINES --
+#define VARINT_SHIFT_MAX 28 //<! Shift of the fifth and last byte of a u32 varint
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief Varints of a record, in order.
+ */
+typedef enum
+{
+	FIELD_ADD,
+	FIELD_COPY,
+	FIELD_SEEK,
+} field_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static esp_err_t decoded_byte(cl_delta_t *delta, uint8_t byte);
+static esp_err_t record_byte(cl_delta_t *delta, uint8_t byte);
+static esp_err_t end_record(cl_delta_t *delta);
+static esp_err_t output(cl_delta_t *delta, uint8_t byte);
+static uint32_t read_u32(const uint8_t *data);
+
+// -- FUNCTIONS --
+
+esp_err_t cl_delta_parse_header(const uint8_t *data, cl_delta_header_t *header)
+{
+	if (memcmp(data, CL_DELTA_MAGIC, 4) != 0 || data[4] != CL_DELTA_VERSION)
+	{
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	header->window_bits = data[5];
+	if (header->window_bits < CL_DELTA_WINDOW_BITS_MIN || header->window_bits > CL_DELTA_WINDOW_BITS_MAX)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	header->source_size = read_u32(&data[8]);
+	header->target_size = read_u32(&data[12]);
+	memcpy(header->source_hash, &data[16], CL_DELTA_HASH_LEN);
+	memcpy(header->target_hash, &data[16 + CL_DELTA_HASH_LEN], CL_DELTA_HASH_LEN);
+	return ESP_OK;
+}
+
+void cl_delta_init(cl_delta_t *delta, const cl_delta_header_t *header, uint8_t *window, uint8_t *out,
+									 size_t out_size, cl_delta_read_cb_t read, cl_delta_write_cb_t write, void *arg)
+{
+	memset(delta, 0, sizeof(*delta));
+	delta->header = *header;
+	delta->window = window;
+	delta->out = out;
+	delta->out_size = out_size;
+	delta->read = read;
+	delta->write = write;
+	delta->arg = arg;
+}
+
+esp_err_t cl_delta_feed(cl_delta_t *delta, const uint8_t *data, size_t len)
+{
+	uint32_t mask = (1u << delta->header.window_bits) - 1;
+	esp_err_t ret = ESP_OK;
+	for (size_t i = 0; i < len && ret == ESP_OK; i++)
+	{
+		if (delta->flag_bits == 0)
+		{
+			delta->flags = data[i];
+			delta->flag_bits = 8;
+			continue;
+		}
+		if (delta->token_len == 0 && (delta->flags & 1))
+		{
+			delta->flags >>= 1;
+			delta->flag_bits--;
+			ret = decoded_byte(delta, data[i]);
+			continue;
+		}
+
+		delta->token[delta->token_len++] = data[i];
+		if (delta->token_len < sizeof(delta->token))
+		{
+			continue;
+		}
+		delta->token_len = 0;
+		delta->flags >>= 1;
+		delta->flag_bits--;
+		uint32_t distance = (delta->token[0] | (uint32_t)delta->token[1] << 8) + 1;
+		uint32_t length = delta->token[2] + CL_DELTA_MATCH_MIN;
+		if (distance > delta->decoded || distance > mask + 1)
+		{
+			return ESP_ERR_INVALID_ARG;
+		}
+		for (uint32_t n = 0; n < length && ret == ESP_OK; n++)
+		{
+			ret = decoded_byte(delta, delta->window[(delta->decoded - distance) & mask]);
+		}
+	}
+	return ret;
+}
+
+esp_err_t cl_delta_finish(cl_delta_t *delta)
+{
+	// a record cut short would leave the image short too, or its seek unread
+	if (delta->token_len != 0 || delta->field != FIELD_ADD || delta->shift != 0 || delta->add != 0 ||
+			delta->copy != 0 || delta->target_pos != delta->header.target_size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	esp_err_t ret = delta->out_len > 0 ? delta->write(delta->out, delta->out_len, delta->arg) : ESP_OK;
+	delta->out_len = 0;
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Keep a byte decoded from LZSS in the window and hand it to the records.
+ */
+static esp_err_t decoded_byte(cl_delta_t *delta, uint8_t byte)
+{
+	delta->window[delta->decoded & ((1u << delta->header.window_bits) - 1)] = byte;
+	delta->decoded++;
+	return record_byte(delta, byte);
+}
+
+/**
+ * @internal
+ * @brief Handle the next byte of the delta: a varint of a record, or a byte of its add or copy part.
+ */
+static esp_err_t record_byte(cl_delta_t *delta, uint8_t byte)
+{
+	esp_err_t ret;
+	// add and copy count down once the whole record is read, up to its seek
+	bool ready = delta->field == FIELD_ADD;
+	if (ready && delta->add > 0)
+	{
+		if (delta->source_used == delta->source_len)
+		{
+			uint32_t run = delta->add < CL_DELTA_SOURCE_RUN ? delta->add : CL_DELTA_SOURCE_RUN;
+			if (run > delta->header.source_size - delta->source_pos)
+			{
+				return ESP_ERR_INVALID_ARG;
+			}
+			ret = delta->read(delta->source_pos, delta->source, run, delta->arg);
+			if (ret != ESP_OK)
+			{
+				return ret;
+			}
+			delta->source_pos += run;
+			delta->source_len = run;
+			delta->source_used = 0;
+		}
+		ret = output(delta, delta->source[delta->source_used++] + byte);
+		if (ret == ESP_OK && --delta->add == 0 && delta->copy == 0)
+		{
+			ret = end_record(delta);
+		}
+		return ret;
+	}
+	if (ready && delta->copy > 0)
+	{
+		ret = output(delta, byte);
+		if (ret == ESP_OK && --delta->copy == 0)
+		{
+			ret = end_record(delta);
+		}
+		return ret;
+	}
+
+	delta->value |= (uint32_t)(byte & 0x7f) << delta->shift;
+	if (byte & 0x80)
+	{
+		delta->shift += 7;
+		return delta->shift > VARINT_SHIFT_MAX ? ESP_ERR_INVALID_ARG : ESP_OK;
+	}
+	uint32_t value = delta->value;
+	delta->value = 0;
+	delta->shift = 0;
+	switch (delta->field)
+	{
+	case FIELD_ADD:
+		delta->add = value;
+		delta->field = FIELD_COPY;
+		return ESP_OK;
+	case FIELD_COPY:
+		delta->copy = value;
+		delta->field = FIELD_SEEK;
+		return ESP_OK;
+	default:
+		delta->seek = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+		delta->field = FIELD_ADD;
+		break;
+	}
+
+	uint32_t left = delta->header.target_size - delta->target_pos;
+	if (delta->add > left || delta->copy > left - delta->add)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+	delta->source_len = 0;
+	delta->source_used = 0;
+	return delta->add == 0 && delta->copy == 0 ? end_record(delta) : ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Move the source position by the seek of the record just rebuilt.
+ */
+static esp_err_t end_record(cl_delta_t *delta)
+{
+	int64_t pos = (int64_t)delta->source_pos + delta->seek;
+	if (pos < 0 || pos > delta->header.source_size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	delta->source_pos = (uint32_t)pos;
+	delta->seek = 0;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Add a byte to the rebuilt image, handing the output buffer to write once full.
+ */
+static esp_err_t output(cl_delta_t *delta, uint8_t byte)
+{
+	delta->out[delta->out_len++] = byte;
+	delta->target_pos++;
+	if (delta->out_len < delta->out_size)
+	{
+		return ESP_OK;
+	}
+	delta->out_len = 0;
+	return delta->write(delta->out, delta->out_size, delta->arg);
+}
+
+static uint32_t read_u32(const uint8_t *data)
+{
+	return data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
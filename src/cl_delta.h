@@ -0,0 +1,131 @@
+#ifndef _CL_DELTA_H_
+#define _CL_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Streaming decoder of delta patches: rebuilds a new image from the running one and a patch fed in pieces of any size,
+ * in the memory handed to cl_delta_init().
+ *
+ * A patch is a header then the delta, compressed, all integers little-endian:
+ *   header [magic "CLDP"] [version: u8] [window bits: u8] [reserved: u16] [source size: u32] [target size: u32]
+ *          [source sha256: 32 bytes] [target sha256: 32 bytes]
+ * The delta is a series of records as bsdiff makes them: [add: varint] [copy: varint] [seek: zigzag varint], then
+ * add bytes each added to the next source byte, then copy bytes taken as they are, after which the source position
+ * moves by seek. A build moving code shifts the addresses it holds by the same few values, so the bytes added are
+ * mostly zero and compress to little.
+ * The delta is compressed with LZSS over a window of 2^window bits bytes: a flag byte announces the next 8 items, LSB
+ * first, a set bit for a literal byte and a clear bit for a match [distance - 1: u16] [length - CL_DELTA_MATCH_MIN: u8]
+ * repeating bytes already decoded.
+ */
+
+#define CL_DELTA_MAGIC "CLDP"
+#define CL_DELTA_VERSION 1
+#define CL_DELTA_HEADER_LEN 80
+#define CL_DELTA_HASH_LEN 32
+#define CL_DELTA_WINDOW_BITS_MIN 8
+#define CL_DELTA_WINDOW_BITS_MAX 16
+#define CL_DELTA_MATCH_MIN 3
+#define CL_DELTA_MATCH_MAX (CL_DELTA_MATCH_MIN + 255)
+#define CL_DELTA_SOURCE_RUN 256 //!< Source bytes read at once
+
+/**
+ * Header of a patch.
+ */
+typedef struct
+{
+	uint8_t window_bits;												 //!< The LZSS window is 2^window_bits bytes
+	uint32_t source_size;												 //!< Size of the image the patch applies to
+	uint32_t target_size;												 //!< Size of the image it rebuilds
+	uint8_t source_hash[CL_DELTA_HASH_LEN]; //!< SHA-256 of the image it applies to
+	uint8_t target_hash[CL_DELTA_HASH_LEN]; //!< SHA-256 of the image it rebuilds
+} cl_delta_header_t;
+
+/**
+ * Read len bytes of the source image at offset.
+ */
+typedef esp_err_t (*cl_delta_read_cb_t)(uint32_t offset, void *buf, size_t len, void *arg);
+
+/**
+ * Take the next len bytes of the rebuilt image, a full output buffer but for the last ones.
+ */
+typedef esp_err_t (*cl_delta_write_cb_t)(const uint8_t *data, size_t len, void *arg);
+
+/**
+ * Decoder state, owned by the caller and only touched through the functions below.
+ */
+typedef struct
+{
+	cl_delta_header_t header;
+	uint8_t *window;
+	uint8_t *out;
+	size_t out_size;
+	size_t out_len;
+	cl_delta_read_cb_t read;
+	cl_delta_write_cb_t write;
+	void *arg;
+	// LZSS
+	uint32_t decoded; //!< Bytes of delta decoded
+	uint8_t flags;
+	uint8_t flag_bits; //!< Items left in the flag byte
+	uint8_t token[3];	 //!< Match being read
+	uint8_t token_len;
+	// records
+	uint8_t field; //!< Varint of the record being read
+	uint8_t shift;
+	uint32_t value;
+	uint32_t add;
+	uint32_t copy;
+	int32_t seek;
+	uint32_t source_pos; //!< Next source byte to read
+	uint32_t target_pos; //!< Bytes of the image rebuilt
+	uint8_t source[CL_DELTA_SOURCE_RUN];
+	uint16_t source_len;
+	uint16_t source_used;
+} cl_delta_t;
+
+/**
+ * Parse the header at the start of a patch.
+ *
+ * @param data CL_DELTA_HEADER_LEN bytes of the patch.
+ * @param header Set to the header.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_SUPPORTED if the data is no patch or of another version,
+ * ESP_ERR_INVALID_ARG if its window is out of range.
+ */
+extern esp_err_t cl_delta_parse_header(const uint8_t *data, cl_delta_header_t *header);
+
+/**
+ * Start decoding the patch of header.
+ *
+ * @param delta Decoder to start.
+ * @param header Header of the patch, the bytes fed next follow it.
+ * @param window 2^window_bits bytes for the LZSS window.
+ * @param out Buffer collecting the rebuilt image for write.
+ * @param out_size Its size.
+ * @param read Reads the source image.
+ * @param write Takes the rebuilt image.
+ * @param arg Argument of the callbacks.
+ */
+extern void cl_delta_init(cl_delta_t *delta, const cl_delta_header_t *header, uint8_t *window, uint8_t *out,
+													size_t out_size, cl_delta_read_cb_t read, cl_delta_write_cb_t write, void *arg);
+
+/**
+ * Decode the next bytes of the patch, calling read and write as they are needed.
+ *
+ * @return Returns ESP_OK if successful, the error of a callback, ESP_ERR_INVALID_ARG if the patch is corrupt or reads
+ * past the source, ESP_ERR_INVALID_SIZE if it rebuilds more than the target size.
+ */
+extern esp_err_t cl_delta_feed(cl_delta_t *delta, const uint8_t *data, size_t len);
+
+/**
+ * Write out the rest of the image once the whole patch is fed.
+ *
+ * @return Returns ESP_OK if successful, the error of write, ESP_ERR_INVALID_SIZE if the patch stopped short of the
+ * target size.
+ */
+extern esp_err_t cl_delta_finish(cl_delta_t *delta);
+
+#endif // _CL_DELTA_H_
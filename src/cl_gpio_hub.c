@@ -0,0 +1,289 @@
+// Library
+#include <stdatomic.h>
+#include <stdbool.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+// ESP32
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hal/gpio_ll.h"
+// Local
+#include "cl_gpio_hub.h"
+
+_Static_assert((CL_GPIO_HUB_RING_LEN & (CL_GPIO_HUB_RING_LEN - 1)) == 0, "CL_GPIO_HUB_RING_LEN must be a power of 2");
+
+// -- DEFINES --
+#define RING_MASK (CL_GPIO_HUB_RING_LEN - 1)
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief An input served by the hub.
+ */
+typedef struct
+{
+	gpio_num_t pin;
+	uint8_t debounced;			//!< Whether raw edges go through the debouncer
+	atomic_bool wake;				//!< Whether the ISR re-arms the level wakeup, see cl_gpio_hub_set_wake()
+	atomic_uint settled;		//!< Settled level + 1 posted by the debouncer, 0 if none pending
+	int64_t last_edge_us;		//!< Time of the last raw edge, reported with the settled level
+	cl_gpio_handler_t handler;
+	void *arg;
+} hub_input_t;
+
+/**
+ * @internal
+ * @brief An edge recorded by an ISR.
+ */
+typedef struct
+{
+	uint8_t input; //!< Index in inputs
+	uint8_t level;
+	int64_t time_us;
+} hub_edge_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void hub_isr_handler(void *arg);
+static void hub_settled_handler(gpio_num_t pin, uint32_t level, void *arg);
+static void hub_dispatch_task(void *arg);
+static void dispatch(hub_input_t *input, uint8_t level, int64_t time_us);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "gpio_hub";
+
+static hub_input_t inputs[CL_GPIO_HUB_MAX_INPUTS];
+static atomic_uint inputs_num = 0;
+static TaskHandle_t hub_task = NULL;
+
+/**
+ * Edges between the ISRs and the dispatcher. All the pin handlers run one after the other in the single GPIO
+ * interrupt of the ISR service, so there is a single producer (writing head) and a single consumer (writing tail).
+ */
+static hub_edge_t ring[CL_GPIO_HUB_RING_LEN];
+static atomic_uint ring_head = 0;
+static atomic_uint ring_tail = 0;
+
+static cl_gpio_hub_stats_t hub_stats;
+
+esp_err_t cl_gpio_hub_init(void)
+{
+	if (hub_task != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	if (xTaskCreate(hub_dispatch_task, "gpio_hub", CL_GPIO_HUB_TASK_STACK, NULL, CL_GPIO_HUB_TASK_PRIO, &hub_task) != pdPASS)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create the dispatcher task", __func__);
+		hub_task = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGD(LOG_TAG, "%s GPIO hub started", __func__);
+	return ESP_OK;
+}
+
+esp_err_t cl_gpio_hub_add(gpio_num_t pin, const cl_debounce_config_t *debounce, cl_gpio_handler_t handler, void *arg)
+{
+	if (handler == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (hub_task == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	unsigned int index = atomic_load(&inputs_num);
+	if (index >= CL_GPIO_HUB_MAX_INPUTS)
+	{
+		ESP_LOGE(LOG_TAG, "%s No free slot for GPIO_%d", __func__, pin);
+		return ESP_ERR_NO_MEM;
+	}
+
+	hub_input_t *input = &inputs[index];
+	input->pin = pin;
+	input->debounced = debounce != NULL;
+	atomic_store(&input->wake, false);
+	atomic_store(&input->settled, 0);
+	input->last_edge_us = 0;
+	input->handler = handler;
+	input->arg = arg;
+
+	esp_err_t ret;
+	if (debounce != NULL)
+	{
+		ret = cl_debounce_add(pin, debounce, hub_settled_handler, input);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+	}
+
+	// the slot is filled before the ISR can reference it, and only published once the input is served
+	ret = gpio_isr_handler_add(pin, hub_isr_handler, (void *)(uintptr_t)index);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to attach GPIO_%d: %s", __func__, pin, esp_err_to_name(ret));
+		if (debounce != NULL)
+		{
+			cl_debounce_remove(pin);
+		}
+		return ret;
+	}
+	atomic_store(&inputs_num, index + 1);
+
+	ESP_LOGD(LOG_TAG, "%s GPIO_%d served%s", __func__, pin, input->debounced ? ", debounced" : "");
+	return ESP_OK;
+}
+
+esp_err_t cl_gpio_hub_set_wake(gpio_num_t pin)
+{
+	unsigned int num = atomic_load(&inputs_num);
+	for (unsigned int i = 0; i < num; i++)
+	{
+		if (inputs[i].pin != pin)
+		{
+			continue;
+		}
+
+		// light sleep isolates the pins otherwise (CONFIG_PM_SLP_DISABLE_GPIO), losing the input and its pull
+		esp_err_t ret = gpio_sleep_sel_dis(pin);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error keeping GPIO_%d through sleep: %s", __func__, pin, esp_err_to_name(ret));
+			return ret;
+		}
+		atomic_store(&inputs[i].wake, true);
+		// a change between the read and the arming fires right away, the level is never missed
+		ret = gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error arming GPIO_%d wakeup: %s", __func__, pin, esp_err_to_name(ret));
+			return ret;
+		}
+		ESP_LOGD(LOG_TAG, "%s GPIO_%d wakes from light sleep", __func__, pin);
+		return ESP_OK;
+	}
+	return ESP_ERR_NOT_FOUND;
+}
+
+void cl_gpio_hub_get_stats(cl_gpio_hub_stats_t *stats)
+{
+	*stats = hub_stats;
+}
+
+/**
+ * @internal
+ * @brief Record the edge with its level and time, and wake the dispatcher. Never blocks, the edge is counted
+ * as an overflow if the ring is full.
+ */
+static void IRAM_ATTR hub_isr_handler(void *arg)
+{
+	hub_input_t *input = &inputs[(uintptr_t)arg];
+	// the low-level calls are inlined in IRAM, the driver ones may sit in flash
+	uint8_t level = gpio_ll_get_level(GPIO_LL_GET_HW(GPIO_PORT_0), input->pin);
+	if (atomic_load_explicit(&input->wake, memory_order_relaxed))
+	{
+		// the level interrupt fires again until the level changes, re-arm it even if the edge is dropped; the wakeup
+		// stays enabled, only the level it waits for changes
+		gpio_ll_set_intr_type(GPIO_LL_GET_HW(GPIO_PORT_0), input->pin, level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+	}
+
+	unsigned int head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+	unsigned int depth = head - tail;
+
+	hub_stats.edges++;
+	if (depth >= CL_GPIO_HUB_RING_LEN)
+	{
+		hub_stats.overflows++;
+		return;
+	}
+
+	hub_edge_t *edge = &ring[head & RING_MASK];
+	edge->input = (uintptr_t)arg;
+	edge->level = level;
+	edge->time_us = esp_timer_get_time();
+	atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+
+	if (depth + 1 > hub_stats.max_depth)
+	{
+		hub_stats.max_depth = depth + 1;
+	}
+
+	BaseType_t task_woken = pdFALSE;
+	vTaskNotifyGiveFromISR(hub_task, &task_woken);
+	portYIELD_FROM_ISR(task_woken);
+}
+
+/**
+ * @internal
+ * @brief Post the settled level of a debounced input to the dispatcher, runs in the esp_timer task.
+ */
+static void hub_settled_handler(gpio_num_t pin, uint32_t level, void *arg)
+{
+	hub_input_t *input = arg;
+	// a level not yet dispatched is simply replaced, only the latest settled level matters
+	atomic_store(&input->settled, level + 1);
+	xTaskNotifyGive(hub_task);
+}
+
+/**
+ * @internal
+ * @brief Dispatcher task: drains the ring and the settled levels, and calls the handlers.
+ */
+static void hub_dispatch_task(void *arg)
+{
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		unsigned int tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+		unsigned int head = atomic_load_explicit(&ring_head, memory_order_acquire);
+		while (tail != head)
+		{
+			hub_edge_t edge = ring[tail & RING_MASK];
+			atomic_store_explicit(&ring_tail, ++tail, memory_order_release);
+
+			hub_input_t *input = &inputs[edge.input];
+			if (input->debounced)
+			{
+				input->last_edge_us = edge.time_us;
+				cl_debounce_edge(input->pin);
+			}
+			else
+			{
+				dispatch(input, edge.level, edge.time_us);
+			}
+		}
+
+		unsigned int num = atomic_load(&inputs_num);
+		for (unsigned int i = 0; i < num; i++)
+		{
+			unsigned int settled = atomic_exchange(&inputs[i].settled, 0);
+			if (settled != 0)
+			{
+				dispatch(&inputs[i], settled - 1, inputs[i].last_edge_us);
+			}
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Give an event to the handler of the input.
+ */
+static void dispatch(hub_input_t *input, uint8_t level, int64_t time_us)
+{
+	cl_gpio_event_t event = {
+			.pin = input->pin,
+			.level = level,
+			.time_us = time_us,
+	};
+	hub_stats.dispatched++;
+	input->handler(&event, input->arg);
+}
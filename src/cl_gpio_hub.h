@@ -0,0 +1,83 @@
+#ifndef _CL_GPIO_HUB_H_
+#define _CL_GPIO_HUB_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "cl_debounce.h"
+
+#define CL_GPIO_HUB_MAX_INPUTS 8		//!< Maximum number of inputs served by the hub
+#define CL_GPIO_HUB_RING_LEN 32			//!< Number of edges buffered between the ISRs and the dispatcher, power of 2
+#define CL_GPIO_HUB_TASK_STACK 4096 //!< Stack size of the dispatcher task
+#define CL_GPIO_HUB_TASK_PRIO 10		//!< Priority of the dispatcher task
+
+/**
+ * An input event as given to the handlers.
+ */
+typedef struct
+{
+	uint8_t pin;		 //!< The GPIO number
+	uint8_t level;	 //!< The level read in the ISR, or the settled level for debounced inputs
+	int64_t time_us; //!< esp_timer_get_time() of the edge, for debounced inputs the last edge before settling
+} cl_gpio_event_t;
+
+/**
+ * Handler of the events of an input, always called from the dispatcher task.
+ */
+typedef void (*cl_gpio_handler_t)(const cl_gpio_event_t *event, void *arg);
+
+/**
+ * Counters of the hub, all since boot.
+ */
+typedef struct
+{
+	uint32_t edges;			 //!< Edges recorded by the ISRs
+	uint32_t overflows;	 //!< Edges lost because the ring was full
+	uint32_t dispatched; //!< Events given to the handlers
+	uint32_t max_depth;	 //!< Highest number of edges waiting in the ring
+} cl_gpio_hub_stats_t;
+
+/**
+ * Start the dispatcher task. The GPIO ISR service must be installed before inputs are added, with ESP_INTR_FLAG_IRAM
+ * so that edges are still recorded while the flash is busy: the hub ISR only runs from IRAM.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if already started, ESP_ERR_NO_MEM if the task
+ * can't be created.
+ */
+extern esp_err_t cl_gpio_hub_init(void);
+
+/**
+ * Serve an input: its edges are timestamped in the ISR and the handler is called from the dispatcher task.
+ * The pin direction, pull and interrupt type must be configured by the caller.
+ *
+ * @param pin The input pin.
+ * @param debounce The debounce configuration, NULL to dispatch every edge as is.
+ * @param handler Called with the events of the input.
+ * @param arg Argument given to handler.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the hub is not started, ESP_ERR_NO_MEM if
+ * CL_GPIO_HUB_MAX_INPUTS are already served, or the error of the debouncer or GPIO driver.
+ */
+extern esp_err_t cl_gpio_hub_add(gpio_num_t pin, const cl_debounce_config_t *debounce, cl_gpio_handler_t handler, void *arg);
+
+/**
+ * Let an input wake the device from light sleep. Edges are not detected in light sleep, so the input is switched
+ * to level interrupts, re-armed by the ISR at the opposite of each level read: every change still gives one edge,
+ * and wakes the device on the way. The pin keeps its configuration through light sleep, released from the isolation of
+ * CONFIG_PM_SLP_DISABLE_GPIO. GPIO wakeup must be enabled with esp_sleep_enable_gpio_wakeup().
+ *
+ * @param pin An input already served by the hub.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the hub doesn't serve the pin, otherwise the error of
+ * the GPIO driver.
+ */
+extern esp_err_t cl_gpio_hub_set_wake(gpio_num_t pin);
+
+/**
+ * Read the hub counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_gpio_hub_get_stats(cl_gpio_hub_stats_t *stats);
+
+#endif // _CL_GPIO_HUB_H_
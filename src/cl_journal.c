@@ -0,0 +1,617 @@
+// Library
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+// ESP32
+#include "esp_log.h"
+#include "esp_partition.h"
+// Local
+#include "cl_journal.h"
+#include "siphash.h"
+
+// -- DEFINES --
+#define SLOTS_PER_SECTOR (CL_JOURNAL_SECTOR_SIZE / sizeof(cl_journal_record_t))
+#define ERASED_SEQ UINT32_MAX			 //<! Sequence number of an erased slot, never given to a record
+#define NO_POS UINT32_MAX					 //<! Cursor position to look up
+#define WRITE_BATCH 16						 //<! Records written to flash at once at most
+#define STOP_EVENT 0x00						 //<! Queued by cl_journal_deinit(), never a CL_JOURNAL_EVENT_* value
+#define RECORD_CRC_LEN offsetof(cl_journal_record_t, crc)
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief A record waiting for the writer task, which numbers it.
+ */
+typedef struct
+{
+	uint32_t time;
+	uint32_t owner;
+	uint8_t event;
+	uint8_t state;
+} pending_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static esp_err_t recover(void);
+static void journal_task_fn(void *arg);
+static void stop_writer(void);
+static esp_err_t enter_sector(uint32_t sector);
+static uint32_t locate(uint32_t seq, uint32_t tail_pos, uint32_t used);
+static uint32_t sector_seq(uint32_t sector, uint32_t slot, uint32_t *reads);
+static esp_err_t read_records(uint32_t pos, cl_journal_record_t *records, size_t count);
+static bool is_valid(const cl_journal_record_t *record);
+static bool is_erased(const cl_journal_record_t *record);
+static uint16_t crc16(const void *data, size_t len);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "journal";
+static const uint8_t OWNER_HASH_KEY[SIPHASH_KEY_LEN] = {0}; //!< Only spreads the UUIDs, the hash is not a secret
+
+static const esp_partition_t *partition = NULL;
+static uint32_t slots_num = 0; //!< Records the partition holds
+static QueueHandle_t journal_queue = NULL;
+static TaskHandle_t journal_task = NULL;
+static SemaphoreHandle_t stopped_sem = NULL; //!< Given by the writer task as it stops
+
+// only written by the writer task once started, read by the readers under journal_mux
+static portMUX_TYPE journal_mux = portMUX_INITIALIZER_UNLOCKED; //!< Guards the ring bounds and stats
+static uint32_t head_pos = 0;																		 //!< Slot of the next record
+static uint32_t head_seq = 1;																		 //!< Sequence number of the next record
+static uint32_t tail_pos = 0;																		 //!< Slot of the oldest record, the start of its sector
+static uint32_t tail_seq = 1;																		 //!< Sequence number of the oldest record, head_seq if empty
+static cl_journal_stats_t stats;
+
+esp_err_t cl_journal_init(void)
+{
+	if (journal_task != NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s Journal already started", __func__);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CL_JOURNAL_PARTITION);
+	if (partition == NULL || partition->size < 2 * CL_JOURNAL_SECTOR_SIZE)
+	{
+		ESP_LOGE(LOG_TAG, "%s No usable partition %s", __func__, CL_JOURNAL_PARTITION);
+		partition = NULL;
+		return ESP_ERR_NOT_FOUND;
+	}
+	slots_num = partition->size / CL_JOURNAL_SECTOR_SIZE * SLOTS_PER_SECTOR;
+
+	esp_err_t ret = recover();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error recovering the journal: %s", __func__, esp_err_to_name(ret));
+		partition = NULL;
+		return ret;
+	}
+
+	journal_queue = xQueueCreate(CL_JOURNAL_QUEUE_LEN, sizeof(pending_t));
+	stopped_sem = xSemaphoreCreateBinary();
+	if (journal_queue == NULL || stopped_sem == NULL ||
+			xTaskCreate(journal_task_fn, "journal", CL_JOURNAL_TASK_STACK, NULL, CL_JOURNAL_TASK_PRIO, &journal_task) != pdPASS)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create the writer task", __func__);
+		journal_task = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(LOG_TAG, "%s Journal holds seq %" PRIu32 "-%" PRIu32 ", head at slot %" PRIu32 "/%" PRIu32 ", found in %" PRIu32 " reads",
+					 __func__, tail_seq, head_seq - 1, head_pos, slots_num, stats.recovery_reads);
+	return ESP_OK;
+}
+
+esp_err_t cl_journal_deinit(void)
+{
+	if (journal_task == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	// queued behind the records appended so far, which the writer task writes first
+	pending_t stop = {.event = STOP_EVENT};
+	xQueueSend(journal_queue, &stop, portMAX_DELAY);
+	xSemaphoreTake(stopped_sem, portMAX_DELAY);
+	vQueueDelete(journal_queue);
+	vSemaphoreDelete(stopped_sem);
+	journal_queue = NULL;
+	stopped_sem = NULL;
+	journal_task = NULL;
+
+	// as at boot, cl_journal_init() finds the ring again from the partition
+	portENTER_CRITICAL(&journal_mux);
+	partition = NULL;
+	head_pos = 0;
+	head_seq = 1;
+	tail_pos = 0;
+	tail_seq = 1;
+	memset(&stats, 0, sizeof(stats));
+	portEXIT_CRITICAL(&journal_mux);
+	return ESP_OK;
+}
+
+esp_err_t cl_journal_append(uint8_t event, const uint8_t *owner, uint8_t state)
+{
+	if (journal_queue == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	pending_t pending = {
+			.time = (uint32_t)time(NULL),
+			.owner = owner != NULL ? cl_journal_owner_hash(owner) : 0,
+			.event = event,
+			.state = state,
+	};
+	// the lock task must never wait for flash, a burst beyond the queue is counted and dropped
+	bool queued = xQueueSend(journal_queue, &pending, 0) == pdTRUE;
+
+	portENTER_CRITICAL(&journal_mux);
+	stats.appended += queued;
+	stats.dropped += !queued;
+	portEXIT_CRITICAL(&journal_mux);
+	return queued ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint32_t cl_journal_owner_hash(const uint8_t *uuid)
+{
+	uint32_t hash = (uint32_t)siphash24(OWNER_HASH_KEY, uuid, 16);
+	return hash != 0 ? hash : 1;
+}
+
+void cl_journal_cursor_init(cl_journal_cursor_t *cursor, uint32_t seq)
+{
+	cursor->seq = seq;
+	cursor->pos = NO_POS;
+}
+
+esp_err_t cl_journal_read(cl_journal_cursor_t *cursor, cl_journal_record_t *records, size_t max, size_t *count)
+{
+	*count = 0;
+	if (partition == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	portENTER_CRITICAL(&journal_mux);
+	uint32_t head = head_pos;
+	uint32_t head_next = head_seq;
+	uint32_t tail = tail_pos;
+	uint32_t oldest = tail_seq;
+	portEXIT_CRITICAL(&journal_mux);
+
+	if (cursor->seq <= oldest)
+	{
+		// overwritten or never positioned, restart from the oldest record kept
+		cursor->seq = oldest;
+		cursor->pos = tail;
+	}
+	if (cursor->seq >= head_next)
+	{
+		return ESP_OK;
+	}
+	if (cursor->pos == NO_POS)
+	{
+		uint32_t used = (head + slots_num - tail) % slots_num;
+		cursor->pos = locate(cursor->seq, tail, used != 0 ? used : slots_num);
+	}
+
+	uint32_t pos = cursor->pos;
+	uint32_t remaining = (head + slots_num - pos) % slots_num;
+	if (remaining == 0 && pos == tail && head == tail)
+	{
+		// a full ring has its head on its tail
+		remaining = slots_num;
+	}
+	while (*count < max && remaining > 0)
+	{
+		// up to the end of the sector or the head, whichever comes first
+		uint32_t n = SLOTS_PER_SECTOR - pos % SLOTS_PER_SECTOR;
+		if (n > remaining)
+		{
+			n = remaining;
+		}
+		if (n > max - *count)
+		{
+			n = max - *count;
+		}
+
+		cl_journal_record_t *chunk = &records[*count];
+		esp_err_t ret = read_records(pos, chunk, n);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		pos = (pos + n) % slots_num;
+		remaining -= n;
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (!is_valid(&chunk[i]) || chunk[i].seq < cursor->seq)
+			{
+				// torn by a reset, or before the record looked up
+				continue;
+			}
+			if (chunk[i].seq >= head_next)
+			{
+				// the sector was recycled while reading, the next read starts again from the tail
+				cursor->pos = NO_POS;
+				return ESP_OK;
+			}
+			records[(*count)++] = chunk[i];
+			cursor->seq = chunk[i].seq + 1;
+		}
+	}
+	cursor->pos = pos;
+	return ESP_OK;
+}
+
+uint32_t cl_journal_head_seq(void)
+{
+	portENTER_CRITICAL(&journal_mux);
+	uint32_t seq = head_seq;
+	portEXIT_CRITICAL(&journal_mux);
+	return seq;
+}
+
+void cl_journal_get_stats(cl_journal_stats_t *out)
+{
+	portENTER_CRITICAL(&journal_mux);
+	*out = stats;
+	portEXIT_CRITICAL(&journal_mux);
+}
+
+/**
+ * @internal
+ * @brief Find the head and the tail of the ring in O(log) reads.
+ * Written sectors start with the lowest sequence number of their records, so going around the ring from sector 0
+ * the first sequence numbers increase up to the head sector, then drop to the tail sector or to erased sectors.
+ * Only the sector being entered at a reset can be erased or torn within the ring.
+ */
+static esp_err_t recover(void)
+{
+	uint32_t sectors = slots_num / SLOTS_PER_SECTOR;
+	uint32_t reads = 0;
+	uint32_t first = sector_seq(0, 0, &reads);
+	uint32_t head_sector;
+	if (first == ERASED_SEQ)
+	{
+		// empty, or reset while entering sector 0 again
+		if (sector_seq(sectors - 1, 0, &reads) == ERASED_SEQ)
+		{
+			stats.recovery_reads = reads;
+			return ESP_OK;
+		}
+		head_sector = sectors - 1;
+	}
+	else
+	{
+		// last sector of the run started by sector 0
+		uint32_t lo = 0, hi = sectors - 1;
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo + 1) / 2;
+			uint32_t seq = sector_seq(mid, 0, &reads);
+			if (seq != ERASED_SEQ && seq >= first)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid - 1;
+			}
+		}
+		head_sector = lo;
+	}
+
+	// written slots of the head sector come first, a torn slot is written too
+	cl_journal_record_t record;
+	uint32_t lo = 0, hi = SLOTS_PER_SECTOR - 1;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo + 1) / 2;
+		esp_err_t ret = read_records(head_sector * SLOTS_PER_SECTOR + mid, &record, 1);
+		reads++;
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		if (!is_erased(&record))
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	uint32_t last_seq = sector_seq(head_sector, 0, &reads);
+	for (uint32_t slot = lo; slot > 0; slot--)
+	{
+		esp_err_t ret = read_records(head_sector * SLOTS_PER_SECTOR + slot, &record, 1);
+		reads++;
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+		if (is_valid(&record))
+		{
+			last_seq = record.seq;
+			break;
+		}
+	}
+	head_pos = (head_sector * SLOTS_PER_SECTOR + lo + 1) % slots_num;
+	head_seq = last_seq + 1;
+
+	// the sectors after the head hold older records once the ring wrapped, the first may be the torn one
+	tail_pos = 0;
+	tail_seq = sector_seq(0, 0, &reads);
+	for (uint32_t k = 1; k <= 2 && k < sectors; k++)
+	{
+		uint32_t sector = (head_sector + k) % sectors;
+		uint32_t seq = sector_seq(sector, 0, &reads);
+		if (seq != ERASED_SEQ && seq < last_seq)
+		{
+			tail_pos = sector * SLOTS_PER_SECTOR;
+			tail_seq = seq;
+			break;
+		}
+	}
+	if (tail_seq == ERASED_SEQ)
+	{
+		// sector 0 is the torn one and nothing wrapped, only the head sector is left
+		tail_pos = head_sector * SLOTS_PER_SECTOR;
+		tail_seq = sector_seq(head_sector, 0, &reads);
+	}
+	stats.recovery_reads = reads;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The writer: numbers the queued records and writes them, several at once when they queued up.
+ */
+static void journal_task_fn(void *arg)
+{
+	pending_t pending[WRITE_BATCH];
+	cl_journal_record_t records[WRITE_BATCH];
+	for (;;)
+	{
+		if (xQueueReceive(journal_queue, &pending[0], portMAX_DELAY) != pdTRUE)
+		{
+			continue;
+		}
+		if (pending[0].event == STOP_EVENT)
+		{
+			stop_writer();
+		}
+
+		uint32_t slot = head_pos % SLOTS_PER_SECTOR;
+		if (slot == 0)
+		{
+			enter_sector(head_pos / SLOTS_PER_SECTOR);
+		}
+		uint32_t n = 1;
+		bool stop = false;
+		while (n < WRITE_BATCH && slot + n < SLOTS_PER_SECTOR && xQueueReceive(journal_queue, &pending[n], 0) == pdTRUE)
+		{
+			if (pending[n].event == STOP_EVENT)
+			{
+				stop = true;
+				break;
+			}
+			n++;
+		}
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			records[i] = (cl_journal_record_t){
+					.seq = head_seq + i,
+					.time = pending[i].time,
+					.owner = pending[i].owner,
+					.event = pending[i].event,
+					.state = pending[i].state,
+			};
+			records[i].crc = crc16(&records[i], RECORD_CRC_LEN);
+		}
+		esp_err_t ret = esp_partition_write(partition, head_pos * sizeof(cl_journal_record_t), records, n * sizeof(cl_journal_record_t));
+		if (ret != ESP_OK)
+		{
+			// the slots are lost either way, the readers skip them
+			ESP_LOGE(LOG_TAG, "%s Error writing %" PRIu32 " records: %s", __func__, n, esp_err_to_name(ret));
+		}
+
+		portENTER_CRITICAL(&journal_mux);
+		head_pos = (head_pos + n) % slots_num;
+		head_seq += n;
+		stats.written += ret == ESP_OK ? n : 0;
+		stats.writes++;
+		stats.failures += ret != ESP_OK;
+		portEXIT_CRITICAL(&journal_mux);
+		if (stop)
+		{
+			stop_writer();
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief End the writer task once the records queued before cl_journal_deinit() are written.
+ */
+static void stop_writer(void)
+{
+	xSemaphoreGive(stopped_sem);
+	vTaskDelete(NULL);
+}
+
+/**
+ * @internal
+ * @brief Erase a sector before its first record, moving the tail past it if it holds the oldest records.
+ */
+static esp_err_t enter_sector(uint32_t sector)
+{
+	uint32_t sectors = slots_num / SLOTS_PER_SECTOR;
+	if (tail_pos / SLOTS_PER_SECTOR == sector && tail_seq != head_seq)
+	{
+		// readers must stop trusting the sector before it is erased
+		uint32_t next = (sector + 1) % sectors;
+		uint32_t next_seq = sector_seq(next, 0, NULL);
+		portENTER_CRITICAL(&journal_mux);
+		tail_pos = next * SLOTS_PER_SECTOR;
+		tail_seq = next_seq != ERASED_SEQ ? next_seq : head_seq;
+		portEXIT_CRITICAL(&journal_mux);
+	}
+
+	esp_err_t ret = esp_partition_erase_range(partition, sector * CL_JOURNAL_SECTOR_SIZE, CL_JOURNAL_SECTOR_SIZE);
+	portENTER_CRITICAL(&journal_mux);
+	stats.erases++;
+	stats.failures += ret != ESP_OK;
+	portEXIT_CRITICAL(&journal_mux);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error erasing sector %" PRIu32 ": %s", __func__, sector, esp_err_to_name(ret));
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Find the slot of the first record at or after seq, by binary search over the sectors then the slots.
+ *
+ * @param seq The sequence number, between tail_seq and head_seq.
+ * @param tail_pos The slot of the oldest record.
+ * @param used The slots between the tail and the head.
+ */
+static uint32_t locate(uint32_t seq, uint32_t tail_pos, uint32_t used)
+{
+	uint32_t sectors = slots_num / SLOTS_PER_SECTOR;
+	uint32_t tail_sector = tail_pos / SLOTS_PER_SECTOR;
+
+	// last sector starting at or before seq
+	uint32_t lo = 0, hi = (used + SLOTS_PER_SECTOR - 1) / SLOTS_PER_SECTOR - 1;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo + 1) / 2;
+		if (sector_seq((tail_sector + mid) % sectors, 0, NULL) <= seq)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	uint32_t sector = (tail_sector + lo) % sectors;
+
+	// first slot at or after seq, an erased slot is past the head
+	uint32_t slot_lo = 0, slot_hi = SLOTS_PER_SECTOR;
+	while (slot_lo < slot_hi)
+	{
+		uint32_t mid = slot_lo + (slot_hi - slot_lo) / 2;
+		if (sector_seq(sector, mid, NULL) < seq)
+		{
+			slot_lo = mid + 1;
+		}
+		else
+		{
+			slot_hi = mid;
+		}
+	}
+	return (sector * SLOTS_PER_SECTOR + slot_lo) % slots_num;
+}
+
+/**
+ * @internal
+ * @brief Sequence number of the first valid record of a sector from a slot on, skipping torn records.
+ *
+ * @param reads Incremented with the records read, can be NULL.
+ *
+ * @return The sequence number, ERASED_SEQ if the rest of the sector is erased or can't be read.
+ */
+static uint32_t sector_seq(uint32_t sector, uint32_t slot, uint32_t *reads)
+{
+	cl_journal_record_t record;
+	for (; slot < SLOTS_PER_SECTOR; slot++)
+	{
+		esp_err_t ret = read_records(sector * SLOTS_PER_SECTOR + slot, &record, 1);
+		if (reads != NULL)
+		{
+			(*reads)++;
+		}
+		if (ret != ESP_OK || is_erased(&record))
+		{
+			return ERASED_SEQ;
+		}
+		if (is_valid(&record))
+		{
+			return record.seq;
+		}
+	}
+	return ERASED_SEQ;
+}
+
+/**
+ * @internal
+ * @brief Read consecutive records of a sector.
+ */
+static esp_err_t read_records(uint32_t pos, cl_journal_record_t *records, size_t count)
+{
+	esp_err_t ret = esp_partition_read(partition, pos * sizeof(cl_journal_record_t), records, count * sizeof(cl_journal_record_t));
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error reading slot %" PRIu32 ": %s", __func__, pos, esp_err_to_name(ret));
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Whether a record was fully written.
+ */
+static bool is_valid(const cl_journal_record_t *record)
+{
+	return record->seq != ERASED_SEQ && record->crc == crc16(record, RECORD_CRC_LEN);
+}
+
+/**
+ * @internal
+ * @brief Whether a slot was never written since its sector was erased.
+ */
+static bool is_erased(const cl_journal_record_t *record)
+{
+	const uint8_t *bytes = (const uint8_t *)record;
+	for (size_t i = 0; i < sizeof(*record); i++)
+	{
+		if (bytes[i] != 0xFF)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @internal
+ * @brief CRC-16/CCITT-FALSE, bitwise: records are short and rare enough not to need a table.
+ */
+static uint16_t crc16(const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)bytes[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
@@ -0,0 +1,146 @@
+#ifndef _CL_JOURNAL_H_
+#define _CL_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Audit journal of the lock, kept in a raw data partition as a ring of fixed-size records.
+ *
+ * The partition is used sector by sector: records are appended to the head sector and, once it is full, the next
+ * sector is erased and becomes the head, dropping the oldest records with it. Every sector is erased in turn, so
+ * the wear is spread over the whole partition. Each record carries its sequence number and a CRC: a record torn by
+ * a reset fails its CRC and is skipped, and the head is found again at boot by binary search over the sectors then
+ * over the records of the head sector.
+ */
+
+#define CL_JOURNAL_PARTITION "spiffs"	//!< Label of the data partition holding the journal
+#define CL_JOURNAL_SECTOR_SIZE 4096		//!< Erase unit of the partition
+#define CL_JOURNAL_QUEUE_LEN 32				//!< Records buffered between the appenders and the writer task
+#define CL_JOURNAL_TASK_STACK 3072		//!< Stack size of the writer task
+#define CL_JOURNAL_TASK_PRIO 2				//!< Priority of the writer task, below the persistence worker
+
+// events
+#define CL_JOURNAL_EVENT_BOOT 0x01			//!< The lock restored its state at boot
+#define CL_JOURNAL_EVENT_CLAIMED 0x02		//!< A claim is committed, owner is the new owner
+#define CL_JOURNAL_EVENT_RELEASED 0x03	//!< A release is committed, owner is the previous owner
+#define CL_JOURNAL_EVENT_ALARM_ON 0x04	//!< The tamper alarm went on
+#define CL_JOURNAL_EVENT_ALARM_OFF 0x05 //!< The tamper alarm went off
+#define CL_JOURNAL_EVENT_SUPPORT 0x06		//!< The lock entered support mode
+
+/**
+ * A journal record, as stored in flash. An erased slot reads as all 0xFF.
+ */
+typedef struct __attribute__((packed))
+{
+	uint32_t seq;		//!< Sequence number, one more than the previous record
+	uint32_t time;	//!< time() of the event: Unix time once the clock is set, seconds since boot before
+	uint32_t owner; //!< cl_journal_owner_hash() of the owner, 0 without owner
+	uint8_t event;	//!< The CL_JOURNAL_EVENT_* value
+	uint8_t state;	//!< The PHY_LOCK_STATE_* value after the event
+	uint16_t crc;		//!< CRC-16/CCITT of the bytes before it
+} cl_journal_record_t;
+
+_Static_assert(CL_JOURNAL_SECTOR_SIZE % sizeof(cl_journal_record_t) == 0, "records must not span sectors");
+
+/**
+ * Position of a reader in the journal, only advanced by cl_journal_read().
+ */
+typedef struct
+{
+	uint32_t seq; //!< Sequence number of the next record to read
+	uint32_t pos; //!< Slot where that record is expected, only a hint
+} cl_journal_cursor_t;
+
+/**
+ * Counters of the journal, all since boot.
+ */
+typedef struct
+{
+	uint32_t appended;			 //!< Records accepted by cl_journal_append()
+	uint32_t dropped;				 //!< Records dropped because the queue was full
+	uint32_t written;				 //!< Records written to flash
+	uint32_t writes;				 //!< Flash writes, the records queued together are written at once
+	uint32_t erases;				 //!< Sectors erased
+	uint32_t failures;			 //!< Flash operations that failed
+	uint32_t recovery_reads; //!< Records read at boot to find the head
+} cl_journal_stats_t;
+
+/**
+ * Find the head of the journal in the CL_JOURNAL_PARTITION partition and start the writer task.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if already started, ESP_ERR_NOT_FOUND if the
+ * partition doesn't exist, ESP_ERR_NO_MEM if the queue or task can't be created, otherwise the flash error.
+ */
+extern esp_err_t cl_journal_init(void);
+
+/**
+ * Stop the writer task once the records queued so far are written, as before a restart. cl_journal_init() then finds
+ * the head again from the partition.
+ *
+ * @note Nothing may be appended nor read until the journal is started again.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the journal is not started.
+ */
+extern esp_err_t cl_journal_deinit(void);
+
+/**
+ * Queue a record for the writer task, without waiting for flash nor for room in the queue.
+ *
+ * @param event The CL_JOURNAL_EVENT_* value.
+ * @param owner The owner UUID, NULL without owner.
+ * @param state The PHY_LOCK_STATE_* value after the event.
+ *
+ * @return Returns ESP_OK if queued. ESP_ERR_INVALID_STATE if the journal is not started, ESP_ERR_NO_MEM if the
+ * queue is full and the record is dropped.
+ */
+extern esp_err_t cl_journal_append(uint8_t event, const uint8_t *owner, uint8_t state);
+
+/**
+ * Hash of an owner UUID as stored in the records, for lookups by owner.
+ *
+ * @param uuid The 16-byte UUID.
+ *
+ * @return The hash, never 0.
+ */
+extern uint32_t cl_journal_owner_hash(const uint8_t *uuid);
+
+/**
+ * Position a cursor on a record.
+ *
+ * @param cursor The cursor to position.
+ * @param seq Sequence number of the first record to read, 0 for the oldest record kept.
+ */
+extern void cl_journal_cursor_init(cl_journal_cursor_t *cursor, uint32_t seq);
+
+/**
+ * Read the records from the cursor on, in order, and advance the cursor past them. Records overwritten since the
+ * cursor was positioned are skipped: the first record read then has a higher sequence number than the cursor.
+ * Safe from any task, concurrently with the writer.
+ *
+ * @param cursor The cursor, positioned with cl_journal_cursor_init().
+ * @param records Receives the records.
+ * @param max Maximum number of records to read.
+ * @param count Set to the number of records read, 0 once the cursor reached the head.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the journal is not started, otherwise the flash
+ * error.
+ */
+extern esp_err_t cl_journal_read(cl_journal_cursor_t *cursor, cl_journal_record_t *records, size_t max, size_t *count);
+
+/**
+ * Sequence number the next record appended will get, one past the latest record written.
+ *
+ * @return The sequence number, 1 while the journal is empty.
+ */
+extern uint32_t cl_journal_head_seq(void);
+
+/**
+ * Read the journal counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_journal_get_stats(cl_journal_stats_t *stats);
+
+#endif // _CL_JOURNAL_H_
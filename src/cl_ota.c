@@ -0,0 +1,708 @@
+// Library
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+// ESP32
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+// Local
+#include "cl_delta.h"
+#include "cl_ota.h"
+
+// -- DEFINES --
+#define QUEUE_LEN (CL_OTA_BUFFERS + 4) //<! The chunks, with the finish and the begins and aborts requested meanwhile
+#define ALL_BUFFERS ((1u << CL_OTA_BUFFERS) - 1)
+#define ERASE_BLOCK 0x10000 //<! Erase unit of the block erase command, several times faster per byte than sectors
+#define SECTOR_SIZE 4096
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief Work for the worker task, dropped once the update it belongs to is over.
+ */
+typedef enum
+{
+	WORK_BEGIN,	 //!< Erase the slot, or wait for the patch header
+	WORK_WRITE,	 //!< Write and hash the chunk of a buffer, or decode it
+	WORK_FINISH, //!< Check the hash and make the slot the boot partition
+	WORK_ABORT,	 //!< Close the slot
+	WORK_ERASE,	 //!< Erase the next block, never queued: done when there is nothing else to do
+} work_op_t;
+
+typedef struct
+{
+	work_op_t op;
+	uint8_t buffer;		//!< Buffer of a WORK_WRITE
+	uint32_t session; //!< Update it belongs to
+} work_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void ota_task_fn(void *arg);
+static esp_err_t queue_work(const work_t *work);
+static esp_err_t begin_image(cl_ota_format_t format, uint32_t size);
+static esp_err_t open_slot(uint32_t size);
+static esp_err_t write_chunk(const uint8_t *data, size_t len);
+static esp_err_t write_patch(const uint8_t *data, size_t len);
+static esp_err_t open_patch(void);
+static esp_err_t check_source(const esp_partition_t *source, const cl_delta_header_t *header, uint8_t *buf);
+static esp_err_t read_source(uint32_t offset, void *buf, size_t len, void *arg);
+static esp_err_t write_rebuilt(const uint8_t *data, size_t len, void *arg);
+static esp_err_t erase_next(void);
+static esp_err_t finish_image(void);
+static void close_image(void);
+static void restore_boot(void);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "ota";
+
+static QueueHandle_t ota_queue = NULL;
+static TaskHandle_t ota_task = NULL;
+static cl_ota_progress_cb_t progress_cb = NULL;
+static void *progress_arg = NULL;
+static uint8_t buffers[CL_OTA_BUFFERS][CL_OTA_CHUNK_SIZE];
+static size_t buffer_len[CL_OTA_BUFFERS]; //!< Set along with the buffer, before its work is queued
+
+// only used by the worker task
+static const esp_partition_t *slot = NULL; //!< The inactive ota slot
+static esp_ota_handle_t ota_handle = 0;
+static bool image_open = false;
+static mbedtls_sha256_context sha_ctx;
+static uint32_t image_end = 0; //!< Size of the image being written
+static uint32_t image_pos = 0; //!< Bytes of it written
+static uint32_t erased = 0;		 //!< Bytes of the slot erased, from its start
+static bool patching = false;	 //!< The update comes as a patch
+static uint8_t patch_header[CL_DELTA_HEADER_LEN];
+static uint32_t patch_header_len = 0; //!< Bytes of the header received, the slot is opened once it is complete
+static uint8_t *patch_mem = NULL;			//!< LZSS window then output buffer, in PSRAM
+static cl_delta_t delta;
+
+// shared between the transport and the worker
+static portMUX_TYPE ota_mux = portMUX_INITIALIZER_UNLOCKED; //!< Guards the update and stats
+static uint32_t session = 0;																 //!< Incremented by every begin and abort
+static cl_ota_state_t state = CL_OTA_STATE_IDLE;
+static cl_ota_format_t image_format = CL_OTA_FORMAT_IMAGE;
+static uint32_t image_size = 0;
+static uint8_t image_hash[CL_OTA_HASH_LEN];
+static uint32_t received = 0;
+static uint32_t written = 0;
+static uint32_t image_written = 0;
+static esp_err_t error = ESP_OK;
+static uint32_t buffers_busy = 0; //!< Bit per buffer handed to the worker
+static cl_ota_stats_t stats;
+
+esp_err_t cl_ota_init(cl_ota_progress_cb_t cb, void *arg)
+{
+	if (ota_task != NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s Worker already started", __func__);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+	if (next == NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s No ota slot to update", __func__);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	progress_cb = cb;
+	progress_arg = arg;
+	ota_queue = xQueueCreate(QUEUE_LEN, sizeof(work_t));
+	if (ota_queue == NULL ||
+			xTaskCreate(ota_task_fn, "ota", CL_OTA_TASK_STACK, NULL, CL_OTA_TASK_PRIO, &ota_task) != pdPASS)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create the worker task", __func__);
+		ota_task = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(LOG_TAG, "%s Updates go to %s at 0x%" PRIx32 ", %" PRIu32 " bytes", __func__, next->label, next->address, next->size);
+	return ESP_OK;
+}
+
+esp_err_t cl_ota_begin(cl_ota_format_t format, uint32_t size, const uint8_t *hash, uint32_t *offset)
+{
+	if (ota_queue == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	// a patch is checked against the slot once its header is in
+	if (size == 0 || size > esp_ota_get_next_update_partition(NULL)->size ||
+			(format == CL_OTA_FORMAT_PATCH && size < CL_DELTA_HEADER_LEN))
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	portENTER_CRITICAL(&ota_mux);
+	bool same = format == image_format && size == image_size && memcmp(hash, image_hash, CL_OTA_HASH_LEN) == 0;
+	if (same && (state == CL_OTA_STATE_RECEIVING || state == CL_OTA_STATE_VERIFYING || state == CL_OTA_STATE_DONE))
+	{
+		*offset = received;
+		stats.resumed += state != CL_OTA_STATE_DONE;
+		portEXIT_CRITICAL(&ota_mux);
+		ESP_LOGI(LOG_TAG, "%s Update of %" PRIu32 " bytes resumed at %" PRIu32, __func__, size, *offset);
+		return ESP_OK;
+	}
+
+	// anything else in progress is dropped by the worker
+	work_t work = {.op = WORK_BEGIN, .session = ++session};
+	state = CL_OTA_STATE_RECEIVING;
+	image_format = format;
+	image_size = size;
+	memcpy(image_hash, hash, CL_OTA_HASH_LEN);
+	received = 0;
+	written = 0;
+	image_written = 0;
+	error = ESP_OK;
+	stats.started++;
+	portEXIT_CRITICAL(&ota_mux);
+
+	*offset = 0;
+	ESP_LOGI(LOG_TAG, "%s Update of %" PRIu32 " bytes started%s", __func__, size,
+					 format == CL_OTA_FORMAT_PATCH ? " as a patch" : "");
+	return queue_work(&work);
+}
+
+esp_err_t cl_ota_write(uint32_t offset, const void *data, size_t len)
+{
+	if (len == 0 || len > CL_OTA_CHUNK_SIZE)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	esp_err_t ret = ESP_OK;
+	uint8_t buffer = 0;
+	portENTER_CRITICAL(&ota_mux);
+	if (state != CL_OTA_STATE_RECEIVING)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	else if (offset != received)
+	{
+		ret = ESP_ERR_INVALID_ARG;
+	}
+	else if (len > image_size - received)
+	{
+		ret = ESP_ERR_INVALID_SIZE;
+	}
+	else if (buffers_busy == ALL_BUFFERS)
+	{
+		ret = ESP_ERR_NO_MEM;
+	}
+	else
+	{
+		while (buffers_busy & (1u << buffer))
+		{
+			buffer++;
+		}
+		buffers_busy |= 1u << buffer;
+		received += len;
+		if (received == image_size)
+		{
+			state = CL_OTA_STATE_VERIFYING;
+		}
+	}
+	bool last = received == image_size;
+	uint32_t current = session;
+	portEXIT_CRITICAL(&ota_mux);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	// the buffer is ours until the worker got its work
+	memcpy(buffers[buffer], data, len);
+	buffer_len[buffer] = len;
+	work_t work = {.op = WORK_WRITE, .buffer = buffer, .session = current};
+	ret = queue_work(&work);
+	if (ret == ESP_OK && last)
+	{
+		work = (work_t){.op = WORK_FINISH, .session = current};
+		ret = queue_work(&work);
+	}
+	return ret;
+}
+
+esp_err_t cl_ota_abort(void)
+{
+	if (ota_queue == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	portENTER_CRITICAL(&ota_mux);
+	work_t work = {.op = WORK_ABORT, .session = ++session};
+	state = CL_OTA_STATE_IDLE;
+	image_format = CL_OTA_FORMAT_IMAGE;
+	image_size = 0;
+	received = 0;
+	written = 0;
+	image_written = 0;
+	error = ESP_OK;
+	portEXIT_CRITICAL(&ota_mux);
+
+	ESP_LOGI(LOG_TAG, "%s Update aborted", __func__);
+	return queue_work(&work);
+}
+
+void cl_ota_get_status(cl_ota_status_t *status)
+{
+	portENTER_CRITICAL(&ota_mux);
+	*status = (cl_ota_status_t){
+			.state = state,
+			.format = image_format,
+			.size = image_size,
+			.received = received,
+			.written = written,
+			.image_written = image_written,
+			.error = error,
+	};
+	for (int i = 0; i < CL_OTA_BUFFERS; i++)
+	{
+		status->free_buffers += !(buffers_busy & (1u << i));
+	}
+	portEXIT_CRITICAL(&ota_mux);
+}
+
+void cl_ota_get_stats(cl_ota_stats_t *out)
+{
+	portENTER_CRITICAL(&ota_mux);
+	*out = stats;
+	portEXIT_CRITICAL(&ota_mux);
+}
+
+/**
+ * @internal
+ * @brief Hand work to the worker without waiting. A full queue fails the update it belongs to.
+ */
+static esp_err_t queue_work(const work_t *work)
+{
+	if (xQueueSend(ota_queue, work, 0) == pdTRUE)
+	{
+		return ESP_OK;
+	}
+
+	portENTER_CRITICAL(&ota_mux);
+	if (work->op == WORK_WRITE)
+	{
+		buffers_busy &= ~(1u << work->buffer);
+	}
+	if (work->session == session && state != CL_OTA_STATE_IDLE)
+	{
+		state = CL_OTA_STATE_FAILED;
+		error = ESP_ERR_NO_MEM;
+		stats.failed++;
+	}
+	portEXIT_CRITICAL(&ota_mux);
+	ESP_LOGE(LOG_TAG, "%s Worker queue full", __func__);
+	return ESP_ERR_NO_MEM;
+}
+
+/**
+ * @internal
+ * @brief The worker: writes and hashes the chunks as they come and checks the image. The work of an update that
+ * failed or was replaced is only dropped, its buffers freed.
+ *
+ * The slot is erased a block ahead of the writes while the worker waits for the transport, which is the slowest: a
+ * chunk is received in about the time a block takes to erase, so the buffers filled meanwhile hide most of it.
+ */
+static void ota_task_fn(void *arg)
+{
+	work_t work;
+	for (;;)
+	{
+		bool ahead = image_open && erased < image_end && erased < image_pos + ERASE_BLOCK;
+		int64_t wait_us = esp_timer_get_time();
+		if (xQueueReceive(ota_queue, &work, ahead ? 0 : portMAX_DELAY) != pdTRUE)
+		{
+			if (!ahead)
+			{
+				continue;
+			}
+			portENTER_CRITICAL(&ota_mux);
+			work = (work_t){.op = WORK_ERASE, .session = session};
+			portEXIT_CRITICAL(&ota_mux);
+		}
+		wait_us = esp_timer_get_time() - wait_us;
+
+		portENTER_CRITICAL(&ota_mux);
+		bool current = work.session == session && state != CL_OTA_STATE_FAILED;
+		cl_ota_format_t format = image_format;
+		uint32_t size = image_size;
+		stats.idle_us += image_open && work.op == WORK_WRITE ? wait_us : 0;
+		portEXIT_CRITICAL(&ota_mux);
+
+		esp_err_t ret = ESP_OK;
+		int64_t start_us = esp_timer_get_time();
+		if (current)
+		{
+			switch (work.op)
+			{
+			case WORK_BEGIN:
+				ret = begin_image(format, size);
+				break;
+			case WORK_WRITE:
+				ret = patching ? write_patch(buffers[work.buffer], buffer_len[work.buffer])
+											 : write_chunk(buffers[work.buffer], buffer_len[work.buffer]);
+				break;
+			case WORK_FINISH:
+				ret = finish_image();
+				break;
+			case WORK_ABORT:
+				close_image();
+				restore_boot();
+				break;
+			case WORK_ERASE:
+				ret = erase_next();
+				break;
+			}
+		}
+		int64_t spent_us = esp_timer_get_time() - start_us;
+
+		portENTER_CRITICAL(&ota_mux);
+		if (work.op == WORK_WRITE)
+		{
+			buffers_busy &= ~(1u << work.buffer);
+		}
+		if (current && ret == ESP_OK)
+		{
+			switch (work.op)
+			{
+			case WORK_BEGIN:
+			case WORK_ERASE:
+				stats.erase_us += spent_us;
+				break;
+			case WORK_WRITE:
+				written += buffer_len[work.buffer];
+				image_written = image_pos;
+				stats.chunks++;
+				stats.bytes += buffer_len[work.buffer];
+				stats.write_us += spent_us;
+				break;
+			case WORK_FINISH:
+				state = CL_OTA_STATE_DONE;
+				stats.done++;
+				stats.patched += patching;
+				stats.rebuilt += patching ? image_pos : 0;
+				break;
+			case WORK_ABORT:
+				break;
+			}
+		}
+		else if (current)
+		{
+			state = CL_OTA_STATE_FAILED;
+			error = ret;
+			stats.failed++;
+		}
+		portEXIT_CRITICAL(&ota_mux);
+
+		if (current && ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error updating the firmware: %s", __func__, esp_err_to_name(ret));
+			close_image();
+		}
+		else if (current && work.op == WORK_FINISH)
+		{
+			ESP_LOGI(LOG_TAG, "%s Image verified, %s boots next", __func__, slot->label);
+		}
+
+		if (progress_cb != NULL && work.op != WORK_ERASE)
+		{
+			progress_cb(progress_arg);
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Start an update. The slot is opened right away for an image, once the header is in for a patch.
+ */
+static esp_err_t begin_image(cl_ota_format_t format, uint32_t size)
+{
+	close_image();
+	// a slot left bootable by a previous update must not boot half erased
+	restore_boot();
+
+	slot = esp_ota_get_next_update_partition(NULL);
+	if (format == CL_OTA_FORMAT_PATCH)
+	{
+		patching = true;
+		patch_header_len = 0;
+		return ESP_OK;
+	}
+	return open_slot(size);
+}
+
+/**
+ * @internal
+ * @brief Open the slot for an image of size and start hashing. esp_ota_begin() only erases the first block, the
+ * writes past it are left to the worker.
+ */
+static esp_err_t open_slot(uint32_t size)
+{
+	uint32_t first = size < ERASE_BLOCK ? size : ERASE_BLOCK;
+	esp_err_t ret = esp_ota_begin(slot, first, &ota_handle);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	erased = (first + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+	image_end = size;
+	image_pos = 0;
+	mbedtls_sha256_init(&sha_ctx);
+	mbedtls_sha256_starts(&sha_ctx, 0);
+	image_open = true;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Write the next chunk of the image and add it to the hash.
+ */
+static esp_err_t write_chunk(const uint8_t *data, size_t len)
+{
+	if (!image_open)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	esp_err_t ret = ESP_OK;
+	while (ret == ESP_OK && image_pos + len > erased)
+	{
+		// the transport outran the erase
+		ret = erase_next();
+	}
+	if (ret == ESP_OK)
+	{
+		ret = esp_ota_write(ota_handle, data, len);
+	}
+	if (ret == ESP_OK)
+	{
+		mbedtls_sha256_update(&sha_ctx, data, len);
+		image_pos += len;
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Decode the next chunk of a patch, opening the slot once its header is complete.
+ */
+static esp_err_t write_patch(const uint8_t *data, size_t len)
+{
+	if (patch_header_len < CL_DELTA_HEADER_LEN)
+	{
+		size_t take = len < CL_DELTA_HEADER_LEN - patch_header_len ? len : CL_DELTA_HEADER_LEN - patch_header_len;
+		memcpy(&patch_header[patch_header_len], data, take);
+		patch_header_len += take;
+		data += take;
+		len -= take;
+		if (patch_header_len < CL_DELTA_HEADER_LEN)
+		{
+			return ESP_OK;
+		}
+		esp_err_t ret = open_patch();
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+	}
+	return len > 0 ? cl_delta_feed(&delta, data, len) : ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Check the patch header against the running image and the image announced, then open the slot for the
+ * image it rebuilds.
+ */
+static esp_err_t open_patch(void)
+{
+	cl_delta_header_t header;
+	esp_err_t ret = cl_delta_parse_header(patch_header, &header);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	portENTER_CRITICAL(&ota_mux);
+	bool match = memcmp(header.target_hash, image_hash, CL_OTA_HASH_LEN) == 0;
+	portEXIT_CRITICAL(&ota_mux);
+	if (!match)
+	{
+		return ESP_ERR_INVALID_CRC;
+	}
+	if (header.target_size == 0 || header.target_size > slot->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	// the window is read a byte at a time, at random, PSRAM is fast enough for it and internal RAM is scarce
+	size_t window = 1u << header.window_bits;
+	patch_mem = heap_caps_malloc(window + CL_OTA_CHUNK_SIZE, MALLOC_CAP_SPIRAM);
+	if (patch_mem == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	const esp_partition_t *source = esp_ota_get_running_partition();
+	ret = check_source(source, &header, &patch_mem[window]);
+	if (ret == ESP_OK)
+	{
+		ret = open_slot(header.target_size);
+	}
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	cl_delta_init(&delta, &header, patch_mem, &patch_mem[window], CL_OTA_CHUNK_SIZE, read_source, write_rebuilt,
+								(void *)source);
+	ESP_LOGI(LOG_TAG, "%s Patch rebuilding %" PRIu32 " bytes from %" PRIu32 " of %s, %u-byte window", __func__,
+					 header.target_size, header.source_size, source->label, (unsigned)window);
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Hash the part of the running image the patch applies to, a buffer of CL_OTA_CHUNK_SIZE at a time.
+ */
+static esp_err_t check_source(const esp_partition_t *source, const cl_delta_header_t *header, uint8_t *buf)
+{
+	if (header->source_size > source->size)
+	{
+		return ESP_ERR_INVALID_VERSION;
+	}
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+	esp_err_t ret = ESP_OK;
+	for (uint32_t pos = 0; pos < header->source_size && ret == ESP_OK; pos += CL_OTA_CHUNK_SIZE)
+	{
+		uint32_t len = header->source_size - pos < CL_OTA_CHUNK_SIZE ? header->source_size - pos : CL_OTA_CHUNK_SIZE;
+		ret = esp_partition_read(source, pos, buf, len);
+		mbedtls_sha256_update(&ctx, buf, len);
+	}
+	uint8_t hash[CL_DELTA_HASH_LEN];
+	mbedtls_sha256_finish(&ctx, hash);
+	mbedtls_sha256_free(&ctx);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	return memcmp(hash, header->source_hash, CL_DELTA_HASH_LEN) == 0 ? ESP_OK : ESP_ERR_INVALID_VERSION;
+}
+
+/**
+ * @internal
+ * @brief Source callback of the decoder: the running image.
+ */
+static esp_err_t read_source(uint32_t offset, void *buf, size_t len, void *arg)
+{
+	return esp_partition_read((const esp_partition_t *)arg, offset, buf, len);
+}
+
+/**
+ * @internal
+ * @brief Output callback of the decoder: the image rebuilt goes to the slot as a received one would.
+ */
+static esp_err_t write_rebuilt(const uint8_t *data, size_t len, void *arg)
+{
+	return write_chunk(data, len);
+}
+
+/**
+ * @internal
+ * @brief Erase the block after the erased part of the slot.
+ */
+static esp_err_t erase_next(void)
+{
+	uint32_t len = slot->size - erased < ERASE_BLOCK ? slot->size - erased : ERASE_BLOCK;
+	esp_err_t ret = esp_partition_erase_range(slot, erased, len);
+	if (ret == ESP_OK)
+	{
+		erased += len;
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Check the hash of the image written, then close the slot and make it the boot partition.
+ */
+static esp_err_t finish_image(void)
+{
+	if (!image_open)
+	{
+		// a patch shorter than its header never opened the slot
+		return patching ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_STATE;
+	}
+	if (patching)
+	{
+		esp_err_t ret = cl_delta_finish(&delta);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+	}
+
+	uint8_t hash[CL_OTA_HASH_LEN];
+	mbedtls_sha256_finish(&sha_ctx, hash);
+	portENTER_CRITICAL(&ota_mux);
+	bool match = memcmp(hash, image_hash, CL_OTA_HASH_LEN) == 0;
+	portEXIT_CRITICAL(&ota_mux);
+	if (!match)
+	{
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	mbedtls_sha256_free(&sha_ctx);
+	image_open = false;
+	heap_caps_free(patch_mem);
+	patch_mem = NULL;
+	esp_err_t ret = esp_ota_end(ota_handle);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	return esp_ota_set_boot_partition(slot);
+}
+
+/**
+ * @internal
+ * @brief Drop the image being written, if any, and the patch it is rebuilt from.
+ */
+static void close_image(void)
+{
+	if (image_open)
+	{
+		esp_ota_abort(ota_handle);
+		mbedtls_sha256_free(&sha_ctx);
+		image_open = false;
+	}
+	heap_caps_free(patch_mem);
+	patch_mem = NULL;
+	patching = false;
+}
+
+/**
+ * @internal
+ * @brief Boot the running partition again if an update made the slot the boot partition.
+ */
+static void restore_boot(void)
+{
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	if (esp_ota_get_boot_partition() != running)
+	{
+		esp_err_t ret = esp_ota_set_boot_partition(running);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error restoring the boot partition: %s", __func__, esp_err_to_name(ret));
+		}
+	}
+}
@@ -0,0 +1,152 @@
+#ifndef _CL_OTA_H_
+#define _CL_OTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Streaming firmware update into the inactive ota slot, independent of the transport carrying the image.
+ *
+ * The transport hands the image over in chunks, in order, each copied into one of CL_OTA_BUFFERS static buffers. The
+ * worker task writes a chunk to flash and hashes it while the transport receives the next one, so the radio and the
+ * flash work at the same time. The slot is erased in 64 kB blocks, several times faster than sector by sector, each one
+ * ahead of the writes while the worker waits for the transport. Once the whole image is written its SHA-256 must match
+ * the one announced at the start, and esp_ota_end() must accept its signature, before the slot is made the boot
+ * partition.
+ *
+ * The image can also come as a cl_delta patch against the running image, a fraction of its size. The worker decodes
+ * the patch as it comes, reading the running slot, and writes and hashes the image it rebuilds the same way, with the
+ * LZSS window and the output buffer in PSRAM. The running image must match the hash in the patch header before the slot
+ * is touched.
+ *
+ * An update survives the transport going away: announcing the same image again resumes it from the bytes already
+ * received. A reset starts it over.
+ */
+
+#define CL_OTA_CHUNK_SIZE 4096 //!< Largest chunk written at once, a flash sector
+#define CL_OTA_BUFFERS 2			 //!< Chunks buffered for the worker, one written while the next is received
+#define CL_OTA_HASH_LEN 32		 //!< SHA-256 of the image
+#define CL_OTA_TASK_STACK 4096 //!< Stack size of the worker task, mbedtls_sha256 included
+#define CL_OTA_TASK_PRIO 2		 //!< Priority of the worker task, below the NimBLE host task feeding it
+
+typedef enum
+{
+	CL_OTA_FORMAT_IMAGE, //!< The image itself
+	CL_OTA_FORMAT_PATCH, //!< A cl_delta patch rebuilding the image from the running one
+} cl_ota_format_t;
+
+typedef enum
+{
+	CL_OTA_STATE_IDLE,			//!< No update since boot, or aborted
+	CL_OTA_STATE_RECEIVING, //!< Receiving the image
+	CL_OTA_STATE_VERIFYING, //!< Received, being written and checked
+	CL_OTA_STATE_DONE,			//!< Verified, the slot boots at the next restart
+	CL_OTA_STATE_FAILED,		//!< Failed with error, a new update must start over
+} cl_ota_state_t;
+
+/**
+ * Progress of the update.
+ */
+typedef struct
+{
+	cl_ota_state_t state;
+	cl_ota_format_t format;
+	uint32_t size;					//!< Size of the image, or of the patch
+	uint32_t received;			//!< Bytes accepted by cl_ota_write(), the offset to resume from
+	uint32_t written;				//!< Bytes written to the slot and hashed, or decoded for a patch
+	uint32_t image_written; //!< Bytes of the image written to the slot, the same as written but for a patch
+	uint8_t free_buffers; //!< Chunks cl_ota_write() accepts without waiting for the worker
+	esp_err_t error;			//!< Failure of a CL_OTA_STATE_FAILED update
+} cl_ota_status_t;
+
+/**
+ * Counters of the updates, all since boot.
+ */
+typedef struct
+{
+	uint32_t started;	 //!< Updates started
+	uint32_t resumed;	 //!< Updates resumed by announcing the same image again
+	uint32_t done;		 //!< Updates verified
+	uint32_t failed;	 //!< Updates failed, on flash or on the hash
+	uint32_t chunks;	 //!< Chunks written
+	uint32_t bytes;		 //!< Bytes written, or decoded for a patch
+	uint32_t patched;	 //!< Updates verified that came as a patch
+	uint32_t rebuilt;	 //!< Bytes of image rebuilt from patches
+	int64_t erase_us;	 //!< Time spent erasing the slot
+	int64_t write_us;	 //!< Time spent writing the chunks
+	int64_t idle_us;	 //!< Time the worker waited for a chunk during an update, the transport being the bottleneck
+} cl_ota_stats_t;
+
+/**
+ * Called from the worker task once it handled a chunk or a change of state, to read the new status with
+ * cl_ota_get_status(). It must not block, defer the work to another task instead.
+ */
+typedef void (*cl_ota_progress_cb_t)(void *arg);
+
+/**
+ * Start the worker task.
+ *
+ * @param cb Progress callback, NULL for none.
+ * @param arg Argument of the callback.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if already started, ESP_ERR_NOT_FOUND without an ota
+ * slot to update, ESP_ERR_NO_MEM if the queue or task can't be created.
+ */
+extern esp_err_t cl_ota_init(cl_ota_progress_cb_t cb, void *arg);
+
+/**
+ * Announce the image to write. The same image as the update in progress resumes it, any other one aborts it and
+ * starts over.
+ *
+ * A patch fails the update with ESP_ERR_NOT_SUPPORTED if it is no cl_delta patch, ESP_ERR_INVALID_VERSION if it
+ * applies to another image than the running one, ESP_ERR_INVALID_CRC if it rebuilds another image than hash.
+ *
+ * @param format What the chunks carry.
+ * @param size Size of the image, or of the patch.
+ * @param hash SHA-256 of the image, CL_OTA_HASH_LEN bytes, the one rebuilt for a patch.
+ * @param offset Set to the offset to send the image or patch from: 0 for a new update, the bytes already received to
+ * resume, size if this image is already verified.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if not started, ESP_ERR_INVALID_SIZE if the image
+ * doesn't fit the slot or the patch is shorter than its header, ESP_ERR_NO_MEM if the worker is flooded with requests.
+ */
+extern esp_err_t cl_ota_begin(cl_ota_format_t format, uint32_t size, const uint8_t *hash, uint32_t *offset);
+
+/**
+ * Hand over the next chunk of the image, copied before returning. The chunk completing the image starts the
+ * verification.
+ *
+ * @param offset Offset of the chunk in the image or patch, the bytes received so far.
+ * @param data The chunk.
+ * @param len Its length, at most CL_OTA_CHUNK_SIZE.
+ *
+ * @return Returns ESP_OK if accepted. ESP_ERR_INVALID_STATE without an update receiving, ESP_ERR_INVALID_ARG if
+ * offset is not the bytes received so far, ESP_ERR_INVALID_SIZE if the chunk is too long or goes past the image,
+ * ESP_ERR_NO_MEM if no buffer is free, wait for the progress callback.
+ */
+extern esp_err_t cl_ota_write(uint32_t offset, const void *data, size_t len);
+
+/**
+ * Abort the update. An update already verified is undone too, the running partition boots again.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if not started, ESP_ERR_NO_MEM if the worker is
+ * flooded with requests.
+ */
+extern esp_err_t cl_ota_abort(void);
+
+/**
+ * Read the progress of the update.
+ *
+ * @param status Set to the current progress.
+ */
+extern void cl_ota_get_status(cl_ota_status_t *status);
+
+/**
+ * Read the update counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_ota_get_stats(cl_ota_stats_t *stats);
+
+#endif // _CL_OTA_H_
@@ -0,0 +1,436 @@
+// Library
+#include <stdbool.h>
+#include <string.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+// ESP32
+#include "esp_log.h"
+#include "nvs.h"
+// Local
+#include "cl_persist.h"
+#include "cl_power.h"
+
+// -- DEFINES --
+#define NVS_PERSIST_NAMESPACE "PERSIST"	//<! Persistence worker namespace used in NVS
+#define NVS_JOURNAL_KEY "JOURNAL"				//<! Batch being committed, see journal_t, erased once committed
+#define JOURNAL_VERSION 1								//<! Layout version of the journal_t stored in NVS
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief A record waiting for its commit, and the callbacks waiting on it.
+ */
+typedef struct
+{
+	const char *ns;	 //!< NULL for a free slot
+	const char *key;
+	uint8_t len;
+	uint8_t data[CL_PERSIST_MAX_LEN];
+	uint8_t waiters_num;
+	struct
+	{
+		cl_persist_done_cb_t cb;
+		void *arg;
+	} waiters[CL_PERSIST_MAX_WAITERS];
+} record_t;
+
+/**
+ * @internal
+ * @brief Write-ahead copy of a batch of several records, written with one nvs_set_blob before the records.
+ * Only the first count entries are stored.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t version; //!< Layout version, JOURNAL_VERSION
+	uint8_t count;	 //!< Number of entries
+	struct __attribute__((packed))
+	{
+		char ns[NVS_KEY_NAME_MAX_SIZE];
+		char key[NVS_KEY_NAME_MAX_SIZE];
+		uint8_t len;
+		uint8_t data[CL_PERSIST_MAX_LEN];
+	} entries[CL_PERSIST_MAX_RECORDS];
+} journal_t;
+
+#define JOURNAL_LEN(count) (offsetof(journal_t, entries) + (count) * sizeof(((journal_t *)0)->entries[0]))
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void persist_task(void *arg);
+static int take_batch(void);
+static esp_err_t write_journal(int count);
+static esp_err_t write_records(int count);
+static esp_err_t erase_journal(void);
+static esp_err_t replay_journal(void);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "persist";
+
+static TaskHandle_t persist_task_handle = NULL;
+static SemaphoreHandle_t stopped_sem = NULL; //!< Given by the worker as it stops
+static volatile bool stopping = false;			 //!< Set by cl_persist_deinit(), the worker stops once idle
+static portMUX_TYPE records_mux = portMUX_INITIALIZER_UNLOCKED; //!< Guards records and stats
+static record_t records[CL_PERSIST_MAX_RECORDS];								 //!< Records waiting for the worker
+static cl_persist_stats_t stats;
+
+// only accessed from the worker task
+static record_t batch[CL_PERSIST_MAX_RECORDS]; //!< Records taken from records, being committed
+static journal_t journal;
+
+esp_err_t cl_persist_init(void)
+{
+	if (persist_task_handle != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	// nothing is queued yet, the replay can't race a newer value
+	esp_err_t ret = replay_journal();
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	if (xTaskCreate(persist_task, "persist", CL_PERSIST_TASK_STACK, NULL, CL_PERSIST_TASK_PRIO, &persist_task_handle) != pdPASS)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create the worker task", __func__);
+		persist_task_handle = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+esp_err_t cl_persist_deinit(void)
+{
+	if (persist_task_handle == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	stopped_sem = xSemaphoreCreateBinary();
+	if (stopped_sem == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+
+	// the records queued so far are committed first
+	stopping = true;
+	xTaskNotifyGive(persist_task_handle);
+	xSemaphoreTake(stopped_sem, portMAX_DELAY);
+	vSemaphoreDelete(stopped_sem);
+	stopped_sem = NULL;
+	stopping = false;
+	persist_task_handle = NULL;
+
+	portENTER_CRITICAL(&records_mux);
+	memset(&stats, 0, sizeof(stats));
+	portEXIT_CRITICAL(&records_mux);
+	return ESP_OK;
+}
+
+esp_err_t cl_persist_write(const char *ns, const char *key, const void *data, size_t len, cl_persist_done_cb_t cb, void *arg)
+{
+	if (ns == NULL || key == NULL || len > CL_PERSIST_MAX_LEN)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (persist_task_handle == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	esp_err_t ret = ESP_OK;
+	portENTER_CRITICAL(&records_mux);
+	// the same record, or a free slot
+	record_t *record = NULL;
+	bool coalesced = false;
+	for (int i = 0; i < CL_PERSIST_MAX_RECORDS && record == NULL; i++)
+	{
+		if (records[i].ns != NULL && strcmp(records[i].ns, ns) == 0 && strcmp(records[i].key, key) == 0)
+		{
+			record = &records[i];
+			coalesced = true;
+		}
+	}
+	for (int i = 0; i < CL_PERSIST_MAX_RECORDS && record == NULL; i++)
+	{
+		if (records[i].ns == NULL)
+		{
+			record = &records[i];
+			record->ns = ns;
+			record->key = key;
+			record->waiters_num = 0;
+		}
+	}
+
+	if (record == NULL || (cb != NULL && record->waiters_num == CL_PERSIST_MAX_WAITERS))
+	{
+		ret = ESP_ERR_NO_MEM;
+	}
+	else
+	{
+		stats.coalesced += coalesced;
+		memcpy(record->data, data, len);
+		record->len = len;
+		if (cb != NULL)
+		{
+			record->waiters[record->waiters_num].cb = cb;
+			record->waiters[record->waiters_num].arg = arg;
+			record->waiters_num++;
+		}
+		stats.writes++;
+	}
+	portEXIT_CRITICAL(&records_mux);
+
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Too many writes waiting; ns=%s key=%s", __func__, ns, key);
+		return ret;
+	}
+	xTaskNotifyGive(persist_task_handle);
+	return ESP_OK;
+}
+
+void cl_persist_get_stats(cl_persist_stats_t *out)
+{
+	portENTER_CRITICAL(&records_mux);
+	*out = stats;
+	portEXIT_CRITICAL(&records_mux);
+}
+
+/**
+ * @internal
+ * @brief The worker: commits the waiting records in batches, then completes their callbacks.
+ * Records written while a batch is committed wait for the next one, so bursts coalesce on their own.
+ */
+static void persist_task(void *arg)
+{
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		// awake only while committing, the device sleeps while the worker waits
+		cl_power_acquire(CL_POWER_LOCK_NVS);
+		int count;
+		while ((count = take_batch()) > 0)
+		{
+			// a single blob is atomic already, only several records need the journal
+			esp_err_t ret = count > 1 ? write_journal(count) : ESP_OK;
+			if (ret == ESP_OK)
+			{
+				ret = write_records(count);
+			}
+			if (ret == ESP_OK && count > 1)
+			{
+				// the batch is committed, a failed erase only replays it again at boot
+				erase_journal();
+			}
+
+			portENTER_CRITICAL(&records_mux);
+			stats.batches++;
+			stats.journaled += count > 1;
+			stats.failures += ret != ESP_OK;
+			portEXIT_CRITICAL(&records_mux);
+
+			for (int i = 0; i < count; i++)
+			{
+				for (int j = 0; j < batch[i].waiters_num; j++)
+				{
+					batch[i].waiters[j].cb(ret, batch[i].waiters[j].arg);
+				}
+			}
+		}
+		cl_power_release(CL_POWER_LOCK_NVS);
+
+		if (stopping)
+		{
+			xSemaphoreGive(stopped_sem);
+			vTaskDelete(NULL);
+		}
+	}
+}
+
+/**
+ * @internal
+ * @brief Move the waiting records into batch, freeing their slots.
+ *
+ * @return Number of records in batch.
+ */
+static int take_batch(void)
+{
+	int count = 0;
+	portENTER_CRITICAL(&records_mux);
+	for (int i = 0; i < CL_PERSIST_MAX_RECORDS; i++)
+	{
+		if (records[i].ns != NULL)
+		{
+			batch[count++] = records[i];
+			records[i].ns = NULL;
+		}
+	}
+	portEXIT_CRITICAL(&records_mux);
+	return count;
+}
+
+/**
+ * @internal
+ * @brief Write the batch to the journal and commit it, before any of its records is written.
+ */
+static esp_err_t write_journal(int count)
+{
+	journal.version = JOURNAL_VERSION;
+	journal.count = count;
+	for (int i = 0; i < count; i++)
+	{
+		strncpy(journal.entries[i].ns, batch[i].ns, sizeof(journal.entries[i].ns) - 1);
+		strncpy(journal.entries[i].key, batch[i].key, sizeof(journal.entries[i].key) - 1);
+		journal.entries[i].len = batch[i].len;
+		memcpy(journal.entries[i].data, batch[i].data, batch[i].len);
+	}
+
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_PERSIST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	ret = nvs_set_blob(nvs_handle, NVS_JOURNAL_KEY, &journal, JOURNAL_LEN(count));
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs_handle);
+	}
+	nvs_close(nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error writing journal: %s", __func__, esp_err_to_name(ret));
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Write the records of the batch, with one commit per namespace.
+ */
+static esp_err_t write_records(int count)
+{
+	bool written[CL_PERSIST_MAX_RECORDS] = {false};
+	for (int i = 0; i < count; i++)
+	{
+		if (written[i])
+		{
+			continue;
+		}
+
+		nvs_handle_t nvs_handle;
+		esp_err_t ret = nvs_open(batch[i].ns, NVS_READWRITE, &nvs_handle);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+			return ret;
+		}
+		// the records of the same namespace go in the same commit
+		for (int j = i; j < count && ret == ESP_OK; j++)
+		{
+			if (!written[j] && strcmp(batch[j].ns, batch[i].ns) == 0)
+			{
+				ret = nvs_set_blob(nvs_handle, batch[j].key, batch[j].data, batch[j].len);
+				written[j] = true;
+			}
+		}
+		if (ret == ESP_OK)
+		{
+			ret = nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error writing %s: %s", __func__, batch[i].ns, esp_err_to_name(ret));
+			return ret;
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Drop the journal once its batch is committed.
+ */
+static esp_err_t erase_journal(void)
+{
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_PERSIST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	ret = nvs_erase_key(nvs_handle, NVS_JOURNAL_KEY);
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs_handle);
+	}
+	nvs_close(nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error erasing journal: %s", __func__, esp_err_to_name(ret));
+	}
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Finish the batch of a commit interrupted by a reset, if the journal still holds one.
+ * Writing the records again is harmless when the reset came after them.
+ */
+static esp_err_t replay_journal(void)
+{
+	nvs_handle_t nvs_handle;
+	esp_err_t ret = nvs_open(NVS_PERSIST_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+	size_t journal_len = sizeof(journal);
+	ret = nvs_get_blob(nvs_handle, NVS_JOURNAL_KEY, &journal, &journal_len);
+	nvs_close(nvs_handle);
+	if (ret == ESP_ERR_NVS_NOT_FOUND)
+	{
+		return ESP_OK;
+	}
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	if (journal.version != JOURNAL_VERSION || journal.count > CL_PERSIST_MAX_RECORDS || journal_len != JOURNAL_LEN(journal.count))
+	{
+		// a journal of another layout can't be replayed, keeping it would only fail every boot
+		ESP_LOGE(LOG_TAG, "%s Unsupported journal: len=%u version=%d", __func__, (unsigned)journal_len, journal.version);
+		erase_journal();
+		return ESP_OK;
+	}
+
+	for (int i = 0; i < journal.count; i++)
+	{
+		// the names point into the journal, both live until the replay is done
+		journal.entries[i].ns[NVS_KEY_NAME_MAX_SIZE - 1] = '\0';
+		journal.entries[i].key[NVS_KEY_NAME_MAX_SIZE - 1] = '\0';
+		batch[i] = (record_t){
+				.ns = journal.entries[i].ns,
+				.key = journal.entries[i].key,
+				.len = journal.entries[i].len > CL_PERSIST_MAX_LEN ? CL_PERSIST_MAX_LEN : journal.entries[i].len,
+		};
+		memcpy(batch[i].data, journal.entries[i].data, batch[i].len);
+	}
+	ret = write_records(journal.count);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	ESP_LOGW(LOG_TAG, "%s Replayed a torn commit of %d records", __func__, journal.count);
+	return erase_journal();
+}
@@ -0,0 +1,80 @@
+#ifndef _CL_PERSIST_H_
+#define _CL_PERSIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define CL_PERSIST_MAX_RECORDS 4		//!< Records that can wait for a commit at the same time
+#define CL_PERSIST_MAX_LEN 40				//!< Maximum length of a record
+#define CL_PERSIST_MAX_WAITERS 4		//!< Completion callbacks that can wait on the same record
+#define CL_PERSIST_TASK_STACK 4096	//!< Stack size of the worker task
+#define CL_PERSIST_TASK_PRIO 3			//!< Priority of the worker task, below the tasks waiting for it
+
+/**
+ * Completion of a write, called from the worker task once the record is committed or failed.
+ *
+ * @param result ESP_OK if committed, otherwise the NVS error.
+ * @param arg Argument given with the write.
+ *
+ * @note It must not block, defer the work instead.
+ */
+typedef void (*cl_persist_done_cb_t)(esp_err_t result, void *arg);
+
+/**
+ * Counters of the worker, all since boot.
+ */
+typedef struct
+{
+	uint32_t writes;		//!< Writes accepted
+	uint32_t coalesced; //!< Writes superseded by a later write to the same record before their commit
+	uint32_t batches;		//!< Batches committed, one commit per namespace of the batch
+	uint32_t journaled; //!< Batches of several records that went through the journal
+	uint32_t failures;	//!< Batches that failed
+} cl_persist_stats_t;
+
+/**
+ * Start the worker task. A batch left in the journal by a reset in the middle of its commit is replayed first.
+ * NVS flash must be initialized.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if already started, ESP_ERR_NO_MEM if the task
+ * can't be created, otherwise the NVS error of the replay.
+ */
+extern esp_err_t cl_persist_init(void);
+
+/**
+ * Stop the worker task once the records queued so far are committed, as before a restart.
+ *
+ * @note Nothing may be written until the worker is started again.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the worker is not started, ESP_ERR_NO_MEM if it
+ * can't be waited for.
+ */
+extern esp_err_t cl_persist_deinit(void);
+
+/**
+ * Queue a record to be written to NVS as a blob, without waiting for flash.
+ * A record still waiting for its commit is replaced by the new value, and its callbacks get the result of the
+ * commit of the new value. Records queued together are committed together: either all or none of them are
+ * found after a reset.
+ *
+ * @param ns The NVS namespace, must outlive the commit (e.g. a string literal).
+ * @param key The NVS key, must outlive the commit (e.g. a string literal).
+ * @param data The value, copied.
+ * @param len Length of data, at most CL_PERSIST_MAX_LEN.
+ * @param cb Called once the value is committed or failed, can be NULL.
+ * @param arg Argument given to cb.
+ *
+ * @return Returns ESP_OK if queued. ESP_ERR_INVALID_ARG if the record is too long, ESP_ERR_INVALID_STATE if the
+ * worker is not started, ESP_ERR_NO_MEM if too many records or callbacks are waiting.
+ */
+extern esp_err_t cl_persist_write(const char *ns, const char *key, const void *data, size_t len, cl_persist_done_cb_t cb, void *arg);
+
+/**
+ * Read the worker counters.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_persist_get_stats(cl_persist_stats_t *stats);
+
+#endif // _CL_PERSIST_H_
@@ -1,50 +1,267 @@
 // Library
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <string.h>
 // FreeRTOS
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 // ESP32
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs.h"
 // Local
+#include "lazy_log.h"
 #include "stringify.h"
+#include "cl_gpio_hub.h"
+#include "cl_journal.h"
+#include "cl_persist.h"
+#include "cl_power.h"
 #include "cl_phy_lock_svc.h"
 
 // -- DEFINES --
 #define NVS_OWNER_NAMESPACE "LSVCO"					 //<! Lock Service Owner namespace used in NVS
-#define NVS_OWNER_KEY_PREFIX "UUID_"				 //<! Lock Owner UUID key prefix used in NVS for each byte of the UUID
-#define NVS_STATE_NAMESPACE "LSVCS"					 //<! Lock Service State namespace used in NVS
-#define NVS_STATE_KEY "STATE"								 //<! Lock State key used in NVS
-#define GPIO_QUEUE_PTR_SIZE sizeof(uint32_t) //<! Size of the GPIO queue ptrs
-#define GPIO_QUEUE_PTR_NUM 10								 //<! Number of GPIO queue ptrs
-#define GPIO_QUEUE_STACK 4096								 //<! Stack size of the GPIO queue task
-#define GPIO_QUEUE_PRIO 10									 //<! Priority of the GPIO queue task
+#define NVS_OWNER_KEY "OWNER"								 //<! Lock record key used in NVS, see lock_record_t
+#define NVS_OWNER_KEY_PREFIX "UUID_"				 //<! Legacy Lock Owner UUID key prefix, one key per byte of the UUID (migrated on load)
+#define LOCK_RECORD_VERSION 2								 //<! Layout version of the lock_record_t stored in NVS
+#define LOCK_RECORD_VERSION_OWNER 1					 //<! Previous version, only CLAIMED or UNCLAIMED with the committed owner
+#define LOCK_SENSOR_DEBOUNCE_US 50000			 //<! Time the lock sensor must be stable before its position is trusted
+#define LOCK_SENSOR_DEBOUNCE_SAMPLES 5			 //<! Samples of the lock sensor taken over the debounce window
+#define MOTOR_TRAVEL_US 500000							 //<! Time the motor takes to move the bolt, the device stays awake meanwhile
+#define STATE_INDEX_MASK 0x07								 //<! Mask folding the PHY_LOCK_STATE_* values into rows of the transition table
+#define STATE_INDEX(state) ((state) & STATE_INDEX_MASK)
+#define SNAPSHOT_WORDS ((sizeof(snapshot_t) + 3) / 4) //<! 32-bit words holding a snapshot_t
+
+_Static_assert(STATE_INDEX(PHY_LOCK_STATE_UNKNOWN) > PHY_LOCK_STATE_SUPPORT, "PHY_LOCK_STATE_UNKNOWN must not share a row of the transition table");
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief Lock record persisted as a single NVS blob on every transition.
+ * The whole record is written with one nvs_set_blob, so the state, the owner and the pending requester can never
+ * be observed half-updated, and the record alone is enough to restore the state machine at boot.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t version;	//!< Layout version, LOCK_RECORD_VERSION
+	uint8_t state;		//!< The PHY_LOCK_STATE_* value: UNCLAIMED, REQUESTED_CLAIM, CLAIMED or REQUESTED_RELEASE
+	uint16_t reserved; //!< Reserved, always 0
+	uint32_t seq;			//!< Sequence number, incremented on every write
+	uint8_t uuid[16];	//!< The owner, or the pending owner in REQUESTED_CLAIM, 16 null-bytes if unclaimed
+} lock_record_t;
+
+/**
+ * @internal
+ * @brief Message queued to the lock task: either an event to apply or a function to run.
+ */
+typedef struct
+{
+	cl_phy_lock_run_fn_t fn; //!< Function to run, NULL for an event
+	void *arg;							 //!< Argument of fn
+	esp_err_t *result;			 //!< Receives the outcome of the event before reply_sem is given, NULL if nobody waits
+	uint8_t type;						 //!< The PHY_LOCK_EVENT_* value
+	uint8_t has_uuid;				 //!< Whether uuid is set, the sensor events have none
+	uint8_t uuid[16];				 //!< Copy of the requester UUID
+} lock_msg_t;
+
+/**
+ * @internal
+ * @brief What the getters see of the lock, published as a whole by the lock task.
+ */
+typedef struct
+{
+	uint8_t state;				 //!< The PHY_LOCK_STATE_* value
+	uint8_t position;			 //!< The PHY_LOCK_POSITION_* value
+	uint8_t alarm;				 //!< Whether the alarm is on
+	uint8_t committing;		 //!< Whether an ownership change waits for the persistence worker
+	uint8_t commit_failed; //!< Whether the last ownership change failed to commit
+	uint8_t owner[16];		 //!< The current owner, or pending owner while requested
+} snapshot_t;
+
+/**
+ * @internal
+ * @brief Guard of a transition, checked before the action runs.
+ * It only reads its arguments so that requests can be checked against the published snapshot as well.
+ */
+typedef esp_err_t (*transition_guard_t)(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+
+/**
+ * @internal
+ * @brief Action run by a transition. The transition only happens if the action returns ESP_OK.
+ */
+typedef esp_err_t (*transition_action_t)(const cl_phy_lock_event_t *event);
+
+/**
+ * @internal
+ * @brief One cell of the (state, event) -> (guard, action, next state) table.
+ */
+typedef struct
+{
+	transition_guard_t guard;		//!< Guard of the event, never NULL
+	transition_action_t action; //!< Action run for the event if the guard passes, never NULL
+	uint8_t next_state;					//!< The PHY_LOCK_STATE_* entered if the action succeeds
+} transition_t;
 
 // -- INTERNAL FUNCTION DECLARATIONS --
-static void gpio_isr_handler(void *arg);
-static void process_gpio_queue(void *arg);
+static void lock_sensor_handler(const cl_gpio_event_t *event, void *arg);
+static esp_err_t restore_state(void);
+static void lock_dispatch_task(void *arg);
+static esp_err_t apply_event(const cl_phy_lock_event_t *event);
+static esp_err_t post_request(const cl_phy_lock_event_t *event);
 static inline void set_state(uint8_t state);
+static void publish_status(void);
+static void fill_snapshot(snapshot_t *snapshot);
+static void publish_snapshot(void);
+static void read_snapshot(snapshot_t *snapshot);
 static void set_physical_lock_open(void);
 static void set_physical_lock_closed(void);
+static void start_motor(void);
+static void motor_stopped(void *arg);
 static void set_alarm_on(void);
 static void set_alarm_off(void);
 static uint8_t read_physical_lock_position();
-static esp_err_t load_ownership(uint8_t *uuid);
-static esp_err_t save_ownership(const uint8_t *uuid);
-static esp_err_t load_state(uint8_t *state);
-static esp_err_t save_state(const uint8_t state);
+static esp_err_t load_record(uint8_t *state, uint8_t *uuid);
+static esp_err_t save_record(uint8_t state, const uint8_t *uuid, cl_persist_done_cb_t cb);
+static void persist_state(void);
+static void ownership_persisted(esp_err_t result, void *arg);
+static void journal(uint8_t event, uint8_t state);
+static esp_err_t migrate_legacy_ownership(nvs_handle_t nvs_handle, uint8_t *state, uint8_t *uuid);
 static inline uint8_t is_null_uuid(const uint8_t *uuid);
+static esp_err_t guard_none(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+static esp_err_t guard_reject(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+static esp_err_t guard_owner(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+static esp_err_t guard_idle(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+static esp_err_t guard_committing(const snapshot_t *lock, const cl_phy_lock_event_t *event);
+static esp_err_t action_ignore(const cl_phy_lock_event_t *event);
+static esp_err_t action_accept_claim(const cl_phy_lock_event_t *event);
+static esp_err_t action_cancel_claim(const cl_phy_lock_event_t *event);
+static esp_err_t action_commit_claim(const cl_phy_lock_event_t *event);
+static esp_err_t action_claim_persisted(const cl_phy_lock_event_t *event);
+static esp_err_t action_claim_failed(const cl_phy_lock_event_t *event);
+static esp_err_t action_accept_release(const cl_phy_lock_event_t *event);
+static esp_err_t action_commit_release(const cl_phy_lock_event_t *event);
+static esp_err_t action_release_persisted(const cl_phy_lock_event_t *event);
+static esp_err_t action_release_failed(const cl_phy_lock_event_t *event);
+static esp_err_t action_alarm_on(const cl_phy_lock_event_t *event);
+static esp_err_t action_alarm_off(const cl_phy_lock_event_t *event);
 
 // -- RUNTIME VARIABLES --
 static const char *LOG_TAG = "physvc_lock";
 
+// the lock state is only written by the lock task, other tasks read the snapshot
 static uint8_t null_owner[16] = {0};									 //!< 16 null-bytes used to clear the lock ownership
 static uint8_t current_owner[16] = {0};								 //!< The current owner of the lock, 16 null-bytes otherwise
 static uint8_t current_state = PHY_LOCK_STATE_UNKNOWN; //!< One of the PHY_LOCK_STATE_* value)s
+static uint32_t record_seq = 0;												 //!< Sequence number of the last lock record written
+static uint8_t record_state = PHY_LOCK_STATE_UNKNOWN;				 //!< State of the last lock record written, UNKNOWN to force the next write
+static uint8_t sensor_position = PHY_LOCK_POSITION_UNKNOWN; //!< One of the PHY_LOCK_POSITION_* values, last read by the lock sensor
+static uint8_t alarm_on = 0;																//!< Whether the alarm is on
+static uint8_t committing = 0;															//!< Whether an ownership change waits for the persistence worker
+static uint8_t commit_failed = 0;														//!< Whether the last ownership change failed to commit
+static cl_phy_lock_status_t published_status = {
+		.state = PHY_LOCK_STATE_UNKNOWN,
+		.position = PHY_LOCK_POSITION_UNKNOWN,
+}; //!< Status last given to the status callbacks
+
+static struct
+{
+	cl_phy_lock_state_cb_t cb;
+	void *arg;
+} state_cbs[PHY_LOCK_MAX_STATE_CBS]; //!< Callbacks notified on every state change
+static uint8_t state_cbs_num = 0;
+
+static struct
+{
+	cl_phy_lock_status_cb_t cb;
+	void *arg;
+} status_cbs[PHY_LOCK_MAX_STATUS_CBS]; //!< Callbacks notified on every status change
+static uint8_t status_cbs_num = 0;
+
+static QueueHandle_t lock_queue = NULL;		 //!< Messages to the lock task
+static TaskHandle_t lock_task = NULL;				 //!< The only task applying events
+static SemaphoreHandle_t reply_sem = NULL;	 //!< Given by the lock task once a waited event is applied
+static SemaphoreHandle_t reply_mutex = NULL; //!< Lets one waiting dispatcher at a time use reply_sem
+static esp_timer_handle_t motor_timer = NULL; //!< Releases the motor power lock once the bolt has moved
+
+// seqlock: odd while the lock task writes the words, readers retry until they see the same even value around them
+static atomic_uint_fast32_t snapshot_seq = 0;
+static atomic_uint_fast32_t snapshot_words[SNAPSHOT_WORDS];
+static portMUX_TYPE snapshot_mux = portMUX_INITIALIZER_UNLOCKED; //!< Keeps the writer from being preempted by a spinning reader
 
-static QueueHandle_t lock_gpio_queue = NULL; //!< Queue to handle GPIO events from ISR
+#define ACCEPT(action, state) {guard_none, action, state}
+#define OWNER(action, state) {guard_owner, action, state}
+#define COMMIT(action, state) {guard_idle, action, state}
+#define PERSISTED(action, state) {guard_committing, action, state}
+#define REJECT(state) {guard_reject, action_ignore, state}
+#define IGNORE(state) {guard_none, action_ignore, state}
+
+/**
+ * Transition table of the lock, indexed by STATE_INDEX(current_state) and the event type.
+ * Rows not listed (unused indexes) are zero-initialized and never reached.
+ */
+static const transition_t TRANSITIONS[STATE_INDEX_MASK + 1][PHY_LOCK_EVENT_MAX] = {
+		[PHY_LOCK_STATE_UNCLAIMED] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = ACCEPT(action_accept_claim, PHY_LOCK_STATE_REQUESTED_CLAIM),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = REJECT(PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = IGNORE(PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = IGNORE(PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_OK] = REJECT(PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = REJECT(PHY_LOCK_STATE_UNCLAIMED),
+		},
+		[PHY_LOCK_STATE_REQUESTED_CLAIM] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = REJECT(PHY_LOCK_STATE_REQUESTED_CLAIM),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = OWNER(action_cancel_claim, PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = IGNORE(PHY_LOCK_STATE_REQUESTED_CLAIM),
+				// the claim is only done once the ownership is committed
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = COMMIT(action_commit_claim, PHY_LOCK_STATE_REQUESTED_CLAIM),
+				[PHY_LOCK_EVENT_PERSIST_OK] = PERSISTED(action_claim_persisted, PHY_LOCK_STATE_CLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = PERSISTED(action_claim_failed, PHY_LOCK_STATE_REQUESTED_CLAIM),
+		},
+		[PHY_LOCK_STATE_CLAIMED] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = REJECT(PHY_LOCK_STATE_CLAIMED),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = OWNER(action_accept_release, PHY_LOCK_STATE_REQUESTED_RELEASE),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = ACCEPT(action_alarm_on, PHY_LOCK_STATE_CLAIMED),
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = ACCEPT(action_alarm_off, PHY_LOCK_STATE_CLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_OK] = REJECT(PHY_LOCK_STATE_CLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = REJECT(PHY_LOCK_STATE_CLAIMED),
+		},
+		[PHY_LOCK_STATE_REQUESTED_RELEASE] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = REJECT(PHY_LOCK_STATE_REQUESTED_RELEASE),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = REJECT(PHY_LOCK_STATE_REQUESTED_RELEASE),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = COMMIT(action_commit_release, PHY_LOCK_STATE_REQUESTED_RELEASE),
+				// the lock is expected to open, closing it again keeps the release pending
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = IGNORE(PHY_LOCK_STATE_REQUESTED_RELEASE),
+				[PHY_LOCK_EVENT_PERSIST_OK] = PERSISTED(action_release_persisted, PHY_LOCK_STATE_UNCLAIMED),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = PERSISTED(action_release_failed, PHY_LOCK_STATE_REQUESTED_RELEASE),
+		},
+		[PHY_LOCK_STATE_SUPPORT] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = REJECT(PHY_LOCK_STATE_SUPPORT),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = REJECT(PHY_LOCK_STATE_SUPPORT),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = IGNORE(PHY_LOCK_STATE_SUPPORT),
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = IGNORE(PHY_LOCK_STATE_SUPPORT),
+				[PHY_LOCK_EVENT_PERSIST_OK] = REJECT(PHY_LOCK_STATE_SUPPORT),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = REJECT(PHY_LOCK_STATE_SUPPORT),
+		},
+		[STATE_INDEX(PHY_LOCK_STATE_UNKNOWN)] = {
+				[PHY_LOCK_EVENT_REQUEST_CLAIM] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+				[PHY_LOCK_EVENT_REQUEST_RELEASE] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+				[PHY_LOCK_EVENT_SENSOR_OPEN] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+				[PHY_LOCK_EVENT_SENSOR_CLOSED] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+				[PHY_LOCK_EVENT_PERSIST_OK] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+				[PHY_LOCK_EVENT_PERSIST_FAIL] = REJECT(PHY_LOCK_STATE_UNKNOWN),
+		},
+};
+
+#undef ACCEPT
+#undef OWNER
+#undef COMMIT
+#undef PERSISTED
+#undef REJECT
+#undef IGNORE
 
 int cl_phy_lock_svc_init()
 {
@@ -53,6 +270,7 @@ int cl_phy_lock_svc_init()
 		ESP_LOGE(LOG_TAG, "%s Lock service already initialized", __func__);
 		return ESP_ERR_INVALID_STATE;
 	}
+	int64_t init_start_us = esp_timer_get_time();
 
 	// TODO init servo
 
@@ -70,116 +288,396 @@ int cl_phy_lock_svc_init()
 	gpio_reset_pin(LOCK_SENSOR_ALARM_PIN);
 	gpio_set_direction(LOCK_SENSOR_ALARM_PIN, GPIO_MODE_OUTPUT);
 	gpio_set_level(LOCK_SENSOR_ALARM_PIN, 0);
+	// keep driving the sensor loop and the alarm through light sleep, CONFIG_PM_SLP_DISABLE_GPIO isolates the others
+	gpio_sleep_sel_dis(LOCK_SENSOR_OUT_PIN);
+	gpio_sleep_sel_dis(LOCK_SENSOR_ALARM_PIN);
 	ESP_LOGD(LOG_TAG, "%s Lock GPIOs initialized: OUT GPIO_%d -> IN GPIO_%d, ALR GPIO_%d", __func__, LOCK_SENSOR_OUT_PIN, LOCK_SENSOR_IN_PIN, LOCK_SENSOR_ALARM_PIN);
 
-	// create a queue to handle gpio event from isr and run it in background
-	lock_gpio_queue = xQueueCreate(GPIO_QUEUE_PTR_NUM, GPIO_QUEUE_PTR_SIZE);
-	xTaskCreate(process_gpio_queue, "process_gpio_queue", GPIO_QUEUE_STACK, NULL, GPIO_QUEUE_PRIO, NULL);
-	ESP_LOGD(LOG_TAG, "%s Interrupt queue initialized", __func__);
+	lock_queue = xQueueCreate(PHY_LOCK_QUEUE_LEN, sizeof(lock_msg_t));
+	reply_sem = xSemaphoreCreateBinary();
+	reply_mutex = xSemaphoreCreateMutex();
+	if (lock_queue == NULL || reply_sem == NULL || reply_mutex == NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create lock queue", __func__);
+		return ESP_ERR_NO_MEM;
+	}
+
+	// restore_state() may already move the motor
+	const esp_timer_create_args_t motor_timer_args = {
+			.callback = motor_stopped,
+			.name = "phy_lock_motor",
+	};
+	int ret = esp_timer_create(&motor_timer_args, &motor_timer);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create motor timer: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	// serve the debounced lock sensor from the GPIO hub to detect when the lock changes
+	cl_debounce_config_t debounce_config = {
+			.window_us = LOCK_SENSOR_DEBOUNCE_US,
+			.samples = LOCK_SENSOR_DEBOUNCE_SAMPLES,
+	};
+	ret = cl_gpio_hub_add(LOCK_SENSOR_IN_PIN, &debounce_config, lock_sensor_handler, NULL);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to serve GPIO_%d: %s", __func__, LOCK_SENSOR_IN_PIN, esp_err_to_name(ret));
+		return ret;
+	}
+	ESP_LOGD(LOG_TAG, "%s Lock sensor GPIO_%d served by the GPIO hub", __func__, LOCK_SENSOR_IN_PIN);
+
+	// finish a commit torn by a reset before the ownership is loaded
+	ret = cl_persist_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to start persistence: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	// a missing journal only loses the audit trail, the lock works without it
+	ret = cl_journal_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to start journal: %s", __func__, esp_err_to_name(ret));
+	}
+
+	// restore before the task starts, it is the only writer afterwards
+	esp_err_t restored = restore_state();
+	journal(CL_JOURNAL_EVENT_BOOT, current_state);
+
+	int64_t ready_us = esp_timer_get_time();
+	ESP_LOGI(LOG_TAG, "%s Lock restored in state %d: %" PRId64 "us since boot, init took %" PRId64 "us", __func__, current_state, ready_us, ready_us - init_start_us);
+	return restored;
+}
+
+esp_err_t cl_phy_lock_svc_start(void)
+{
+	if (lock_queue == NULL || lock_task != NULL)
+	{
+		ESP_LOGE(LOG_TAG, "%s Lock service not initialized or already started", __func__);
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (xTaskCreate(lock_dispatch_task, "phy_lock", PHY_LOCK_TASK_STACK, NULL, PHY_LOCK_TASK_PRIO, &lock_task) != pdPASS)
+	{
+		ESP_LOGE(LOG_TAG, "%s Failed to create lock task", __func__);
+		return ESP_ERR_NO_MEM;
+	}
+
+	// a request pending at the reset completes now if the lock moved meanwhile, see restore_state()
+	if (current_state == PHY_LOCK_STATE_REQUESTED_CLAIM || current_state == PHY_LOCK_STATE_REQUESTED_RELEASE)
+	{
+		cl_phy_lock_event_t event = {
+				.type = PHY_LOCK_EVENT_FROM_POSITION(sensor_position),
+		};
+		cl_phy_lock_svc_post(&event, 0);
+	}
 
-	// install interrupt on lock sensor to detect when the lock changes
-	int ret = gpio_isr_handler_add(LOCK_SENSOR_IN_PIN, gpio_isr_handler, (void *)LOCK_SENSOR_IN_PIN);
-	ESP_LOGD(LOG_TAG, "%s Interrupt handler attached to GPIO_%d", __func__, LOCK_SENSOR_IN_PIN);
+	ESP_LOGI(LOG_TAG, "%s Lock ready in state %d: %" PRId64 "us since boot", __func__, current_state, esp_timer_get_time());
+	return ESP_OK;
+}
 
-	// Load the lock ownership into memory
-	ret = load_ownership(current_owner);
+/**
+ * @internal
+ * @brief Restore the state machine from the lock record, read once from NVS.
+ * A pending request is restored as is, the position read here is replayed to it once the lock task runs.
+ */
+static esp_err_t restore_state(void)
+{
+	uint8_t state;
+	esp_err_t ret = load_record(&state, current_owner);
 	if (ret != ESP_OK)
 	{
 		// go into support mode
 		set_state(PHY_LOCK_STATE_SUPPORT);
-		ESP_LOGE(LOG_TAG, "%s Failed to load lock ownership: %s", __func__, esp_err_to_name(ret));
+		ESP_LOGE(LOG_TAG, "%s Failed to load lock record: %s", __func__, esp_err_to_name(ret));
 		return ret;
 	}
-	ESP_LOGD(LOG_TAG, "%s Lock ownership loaded: %s", __func__, UUID_TO_STRING(current_owner));
+	LAZY_LOGD(LOG_TAG, "%s Lock record loaded: state=%d owner=%s", __func__, state, UUID_TO_STRING(current_owner));
+
+	sensor_position = read_physical_lock_position();
+	ESP_LOGD(LOG_TAG, "%s Physical lock position read: %d", __func__, sensor_position);
 
-	// set state according to the ownership
-	if (is_null_uuid(current_owner))
+	// only the unclaimed state goes without an owner
+	if (state > PHY_LOCK_STATE_REQUESTED_RELEASE || (state == PHY_LOCK_STATE_UNCLAIMED) != is_null_uuid(current_owner))
 	{
-		uint8_t current_position = read_physical_lock_position();
-		ESP_LOGD(LOG_TAG, "%s Physical lock position read: %d", __func__, current_position);
-		if (current_position == PHY_LOCK_POSITION_OPEN)
-		{
-			ESP_LOGE(LOG_TAG, "%s Lock has been tampered", __func__);
-			set_state(PHY_LOCK_STATE_SUPPORT);
-			// TODO: what should we do here?
-			ESP_LOGI(LOG_TAG, "%s Alarm on", __func__);
-			set_alarm_on();
-			return ESP_ERR_INVALID_STATE;
-		}
-		else
-		{
-			set_state(PHY_LOCK_STATE_CLAIMED);
-		}
+		ESP_LOGE(LOG_TAG, "%s Inconsistent lock record: state=%d", __func__, state);
+		set_state(PHY_LOCK_STATE_SUPPORT);
+		return ESP_ERR_INVALID_STATE;
 	}
-	else
+
+	if (state == PHY_LOCK_STATE_CLAIMED && sensor_position == PHY_LOCK_POSITION_OPEN)
+	{
+		ESP_LOGE(LOG_TAG, "%s Lock has been tampered", __func__);
+		set_state(PHY_LOCK_STATE_SUPPORT);
+		// TODO: what should we do here?
+		ESP_LOGI(LOG_TAG, "%s Alarm on", __func__);
+		set_alarm_on();
+		publish_status();
+		return ESP_ERR_INVALID_STATE;
+	}
+	// the actuator lost its position with the reset, a pending release needs the lock open again
+	if (state == PHY_LOCK_STATE_REQUESTED_RELEASE && sensor_position == PHY_LOCK_POSITION_CLOSED)
 	{
-		set_state(PHY_LOCK_STATE_UNCLAIMED);
+		set_physical_lock_open();
 	}
 
+	record_state = state;
+	set_state(state);
 	return ESP_OK;
 }
 
 uint8_t cl_phy_lock_svc_get_state(void)
 {
-	return current_state;
+	snapshot_t snapshot;
+	read_snapshot(&snapshot);
+	return snapshot.state;
+}
+
+void cl_phy_lock_svc_get_status(cl_phy_lock_status_t *status)
+{
+	snapshot_t snapshot;
+	read_snapshot(&snapshot);
+	status->state = snapshot.state;
+	status->position = snapshot.position;
+	status->alarm = snapshot.alarm;
+	status->commit_failed = snapshot.commit_failed;
 }
 
-esp_err_t cl_phy_lock_svc_request_claim(uint8_t *uuid)
+bool cl_phy_lock_svc_is_busy(void)
 {
-	switch (current_state)
+	uint8_t state = cl_phy_lock_svc_get_state();
+	return state == PHY_LOCK_STATE_REQUESTED_CLAIM || state == PHY_LOCK_STATE_REQUESTED_RELEASE ||
+				 (motor_timer != NULL && esp_timer_is_active(motor_timer));
+}
+
+esp_err_t cl_phy_lock_svc_add_status_cb(cl_phy_lock_status_cb_t cb, void *arg)
+{
+	if (cb == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	// the lock task reads the callbacks without a lock
+	if (lock_task != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (status_cbs_num == PHY_LOCK_MAX_STATUS_CBS)
 	{
-	case PHY_LOCK_STATE_UNCLAIMED:
-		set_state(PHY_LOCK_STATE_REQUESTED_CLAIM);
-		memcpy(current_owner, uuid, 16);
-		ESP_LOGI(LOG_TAG, "%s Accept claim: unclaimed -> %s", __func__, UUID_TO_STRING(current_owner));
+		return ESP_ERR_NO_MEM;
+	}
+	status_cbs[status_cbs_num].cb = cb;
+	status_cbs[status_cbs_num].arg = arg;
+	status_cbs_num++;
+	return ESP_OK;
+}
 
-		// if the lock is closed, we need to open it first
-		if (read_physical_lock_position() == PHY_LOCK_POSITION_CLOSED)
-		{
-			ESP_LOGD(LOG_TAG, "%s Opening physical lock", __func__);
-			set_physical_lock_open();
-		}
+esp_err_t cl_phy_lock_svc_add_state_cb(cl_phy_lock_state_cb_t cb, void *arg)
+{
+	if (cb == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	// the lock task reads the callbacks without a lock
+	if (lock_task != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (state_cbs_num == PHY_LOCK_MAX_STATE_CBS)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	state_cbs[state_cbs_num].cb = cb;
+	state_cbs[state_cbs_num].arg = arg;
+	state_cbs_num++;
+	return ESP_OK;
+}
 
-		return ESP_OK;
+esp_err_t cl_phy_lock_svc_request_claim(const uint8_t *uuid)
+{
+	cl_phy_lock_event_t event = {
+			.type = PHY_LOCK_EVENT_REQUEST_CLAIM,
+			.uuid = uuid,
+	};
+	return post_request(&event);
+}
+
+esp_err_t cl_phy_lock_svc_request_release(const uint8_t *uuid)
+{
+	cl_phy_lock_event_t event = {
+			.type = PHY_LOCK_EVENT_REQUEST_RELEASE,
+			.uuid = uuid,
+	};
+	return post_request(&event);
+}
+
+esp_err_t cl_phy_lock_svc_dispatch(const cl_phy_lock_event_t *event)
+{
+	if (event == NULL || event->type >= PHY_LOCK_EVENT_MAX)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (lock_task == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (xTaskGetCurrentTaskHandle() == lock_task)
+	{
+		return apply_event(event);
 	}
-	// TODO: handle other states with better error reporting?
 
-	return ESP_ERR_INVALID_STATE;
+	esp_err_t result = ESP_FAIL;
+	lock_msg_t msg = {
+			.result = &result,
+			.type = event->type,
+			.has_uuid = event->uuid != NULL,
+	};
+	if (event->uuid != NULL)
+	{
+		memcpy(msg.uuid, event->uuid, sizeof(msg.uuid));
+	}
+
+	xSemaphoreTake(reply_mutex, portMAX_DELAY);
+	xQueueSend(lock_queue, &msg, portMAX_DELAY);
+	xSemaphoreTake(reply_sem, portMAX_DELAY);
+	xSemaphoreGive(reply_mutex);
+	return result;
 }
 
-esp_err_t cl_phy_lock_svc_request_release(uint8_t *uuid)
+esp_err_t cl_phy_lock_svc_post(const cl_phy_lock_event_t *event, uint32_t ticks_to_wait)
 {
-	switch (current_state)
+	if (event == NULL || event->type >= PHY_LOCK_EVENT_MAX)
 	{
-	case PHY_LOCK_STATE_CLAIMED:
-		if (memcmp(current_owner, uuid, 16) == 0)
-		{
-			set_state(PHY_LOCK_STATE_REQUESTED_RELEASE);
-			ESP_LOGI(LOG_TAG, "%s Accepted release: claimed -> %s", __func__, UUID_TO_STRING(uuid));
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (lock_task == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	lock_msg_t msg = {
+			.type = event->type,
+			.has_uuid = event->uuid != NULL,
+	};
+	if (event->uuid != NULL)
+	{
+		memcpy(msg.uuid, event->uuid, sizeof(msg.uuid));
+	}
+	if (xQueueSend(lock_queue, &msg, ticks_to_wait) != pdTRUE)
+	{
+		ESP_LOGW(LOG_TAG, "%s Lock queue full, event %d dropped", __func__, event->type);
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
 
-			// if the lock is closed, we need to open it first
-			if (read_physical_lock_position() == PHY_LOCK_POSITION_CLOSED)
-			{
-				ESP_LOGD(LOG_TAG, "%s Opening physical lock", __func__);
-				set_physical_lock_open();
-			}
+esp_err_t cl_phy_lock_svc_run(cl_phy_lock_run_fn_t fn, void *arg)
+{
+	if (fn == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (lock_task == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
 
-			return ESP_OK;
+	lock_msg_t msg = {
+			.fn = fn,
+			.arg = arg,
+	};
+	if (xQueueSend(lock_queue, &msg, 0) != pdTRUE)
+	{
+		ESP_LOGW(LOG_TAG, "%s Lock queue full", __func__);
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The lock task: applies the queued events and runs the queued functions, one at a time.
+ */
+static void lock_dispatch_task(void *arg)
+{
+	lock_msg_t msg;
+	for (;;)
+	{
+		if (xQueueReceive(lock_queue, &msg, portMAX_DELAY) != pdTRUE)
+		{
+			continue;
 		}
-		else
+		if (msg.fn != NULL)
 		{
-			ESP_LOGE(LOG_TAG, "%s Rejected release: owner doesn't match", __func__);
-			ESP_LOGD(LOG_TAG, "%s Current: %s <=> Requester: %s", __func__, UUID_TO_STRING(current_owner), UUID_TO_STRING(uuid));
-			return ESP_ERR_INVALID_STATE;
+			msg.fn(msg.arg);
+			continue;
+		}
+
+		cl_phy_lock_event_t event = {
+				.type = msg.type,
+				.uuid = msg.has_uuid ? msg.uuid : NULL,
+		};
+		esp_err_t ret = apply_event(&event);
+		if (msg.result != NULL)
+		{
+			*msg.result = ret;
+			xSemaphoreGive(reply_sem);
 		}
 	}
+}
 
-	return ESP_ERR_INVALID_STATE;
+/**
+ * @internal
+ * @brief Run the transition of an event, on the lock task.
+ */
+static esp_err_t apply_event(const cl_phy_lock_event_t *event)
+{
+	if (event->type == PHY_LOCK_EVENT_SENSOR_OPEN || event->type == PHY_LOCK_EVENT_SENSOR_CLOSED)
+	{
+		sensor_position = event->type;
+	}
+
+	snapshot_t lock;
+	fill_snapshot(&lock);
+	const transition_t *transition = &TRANSITIONS[STATE_INDEX(current_state)][event->type];
+	esp_err_t ret = transition->guard(&lock, event);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGD(LOG_TAG, "%s Event %d rejected in state %d: %s", __func__, event->type, current_state, esp_err_to_name(ret));
+	}
+	else
+	{
+		ret = transition->action(event);
+		if (ret == ESP_OK && transition->next_state != current_state)
+		{
+			set_state(transition->next_state);
+		}
+	}
+	// the position and the alarm change without a transition too
+	publish_status();
+	return ret;
+}
+
+/**
+ * @internal
+ * @brief Check a request against the snapshot and queue it without waiting.
+ * The lock task checks the guard again when applying it, the snapshot may be behind by then.
+ */
+static esp_err_t post_request(const cl_phy_lock_event_t *event)
+{
+	snapshot_t snapshot;
+	read_snapshot(&snapshot);
+	esp_err_t ret = TRANSITIONS[STATE_INDEX(snapshot.state)][event->type].guard(&snapshot, event);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	return cl_phy_lock_svc_post(event, 0);
 }
 
 /**
  * @internal
- * @brief Sets the state of the lock.
+ * @brief Sets the state of the lock and notifies the state callbacks.
  *
  * @param state The new state of the lock.
  */
@@ -187,6 +685,106 @@ static inline void set_state(uint8_t state)
 {
 	ESP_LOGD(LOG_TAG, "%s State changed from %d -> %d", __func__, current_state, state);
 	current_state = state;
+	persist_state();
+	if (state == PHY_LOCK_STATE_SUPPORT)
+	{
+		journal(CL_JOURNAL_EVENT_SUPPORT, state);
+	}
+	publish_snapshot();
+	for (int i = 0; i < state_cbs_num; i++)
+	{
+		state_cbs[i].cb(state, state_cbs[i].arg);
+	}
+	publish_status();
+}
+
+/**
+ * @internal
+ * @brief Notifies the status callbacks if the status changed since it was last published.
+ */
+static void publish_status(void)
+{
+	publish_snapshot();
+
+	cl_phy_lock_status_t status = {
+			.state = current_state,
+			.position = sensor_position,
+			.alarm = alarm_on,
+			.commit_failed = commit_failed,
+	};
+	if (memcmp(&status, &published_status, sizeof(status)) == 0)
+	{
+		return;
+	}
+
+	published_status = status;
+	for (int i = 0; i < status_cbs_num; i++)
+	{
+		status_cbs[i].cb(&status, status_cbs[i].arg);
+	}
+}
+
+/**
+ * @internal
+ * @brief Copy the lock state into a snapshot, on the lock task.
+ */
+static void fill_snapshot(snapshot_t *snapshot)
+{
+	snapshot->state = current_state;
+	snapshot->position = sensor_position;
+	snapshot->alarm = alarm_on;
+	snapshot->committing = committing;
+	snapshot->commit_failed = commit_failed;
+	memcpy(snapshot->owner, current_owner, sizeof(snapshot->owner));
+}
+
+/**
+ * @internal
+ * @brief Publish the state, the status and the owner as one snapshot, on the lock task.
+ */
+static void publish_snapshot(void)
+{
+	snapshot_t snapshot;
+	fill_snapshot(&snapshot);
+	uint32_t words[SNAPSHOT_WORDS] = {0};
+	memcpy(words, &snapshot, sizeof(snapshot));
+
+	portENTER_CRITICAL(&snapshot_mux);
+	uint32_t seq = atomic_load_explicit(&snapshot_seq, memory_order_relaxed);
+	atomic_store_explicit(&snapshot_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int i = 0; i < SNAPSHOT_WORDS; i++)
+	{
+		atomic_store_explicit(&snapshot_words[i], words[i], memory_order_relaxed);
+	}
+	atomic_store_explicit(&snapshot_seq, seq + 2, memory_order_release);
+	portEXIT_CRITICAL(&snapshot_mux);
+}
+
+/**
+ * @internal
+ * @brief Read a consistent snapshot, from any task.
+ */
+static void read_snapshot(snapshot_t *snapshot)
+{
+	uint32_t words[SNAPSHOT_WORDS];
+	uint32_t seq;
+	if (atomic_load_explicit(&snapshot_seq, memory_order_acquire) == 0)
+	{
+		// nothing published before init
+		*snapshot = (snapshot_t){.state = PHY_LOCK_STATE_UNKNOWN, .position = PHY_LOCK_POSITION_UNKNOWN};
+		return;
+	}
+	do
+	{
+		seq = atomic_load_explicit(&snapshot_seq, memory_order_acquire);
+		for (int i = 0; i < SNAPSHOT_WORDS; i++)
+		{
+			words[i] = atomic_load_explicit(&snapshot_words[i], memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != atomic_load_explicit(&snapshot_seq, memory_order_relaxed));
+	memcpy(snapshot, words, sizeof(*snapshot));
 }
 
 /**
@@ -197,6 +795,7 @@ static inline void set_state(uint8_t state)
 static void set_physical_lock_open()
 {
 	ESP_LOGD(LOG_TAG, "%s set lock open", __func__);
+	start_motor();
 }
 
 /**
@@ -207,6 +806,36 @@ static void set_physical_lock_open()
 static void set_physical_lock_closed()
 {
 	ESP_LOGD(LOG_TAG, "%s set lock closed", __func__);
+	start_motor();
+}
+
+/**
+ * @internal
+ * @brief Keep the device awake for the travel of the bolt. A move started during another one extends it.
+ */
+static void start_motor(void)
+{
+	// a restart fails once the timer fired, its release is then done or pending and the lock is taken anew
+	if (esp_timer_restart(motor_timer, MOTOR_TRAVEL_US) == ESP_OK)
+	{
+		return;
+	}
+	cl_power_acquire(CL_POWER_LOCK_MOTOR);
+	esp_err_t ret = esp_timer_start_once(motor_timer, MOTOR_TRAVEL_US);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error starting motor timer: %s", __func__, esp_err_to_name(ret));
+		cl_power_release(CL_POWER_LOCK_MOTOR);
+	}
+}
+
+/**
+ * @internal
+ * @brief The bolt has moved, let the device sleep again. Runs in the esp_timer task.
+ */
+static void motor_stopped(void *arg)
+{
+	cl_power_release(CL_POWER_LOCK_MOTOR);
 }
 
 /**
@@ -217,6 +846,8 @@ static void set_physical_lock_closed()
 static void set_alarm_on()
 {
 	gpio_set_level(LOCK_SENSOR_ALARM_PIN, 1);
+	alarm_on = 1;
+	journal(CL_JOURNAL_EVENT_ALARM_ON, current_state);
 	ESP_LOGD(LOG_TAG, "%s set GPIO_%d on HIGH", __func__, LOCK_SENSOR_ALARM_PIN);
 }
 
@@ -228,6 +859,8 @@ static void set_alarm_on()
 static void set_alarm_off()
 {
 	gpio_set_level(LOCK_SENSOR_ALARM_PIN, 0);
+	alarm_on = 0;
+	journal(CL_JOURNAL_EVENT_ALARM_OFF, current_state);
 	ESP_LOGD(LOG_TAG, "%s set GPIO_%d on LOW", __func__, LOCK_SENSOR_ALARM_PIN);
 }
 
@@ -245,285 +878,470 @@ static uint8_t read_physical_lock_position()
 
 /**
  * @internal
- * @brief Save the lock state to the NVS.
+ * @brief Queue the lock record to the persistence worker.
+ *
+ * @param state The PHY_LOCK_STATE_* value to record.
+ * @param uuid The owner or pending owner, null_owner if unclaimed.
+ * @param cb Called with the result of the commit, NULL if nothing waits for it.
  *
- * @param state The lock state to save.
+ * @return esp_err_t ESP_OK if queued, otherwise the error of the worker.
  */
-static esp_err_t save_state(const uint8_t state)
+static esp_err_t save_record(uint8_t state, const uint8_t *uuid, cl_persist_done_cb_t cb)
 {
-	ESP_LOGD(LOG_TAG, "%s Saving lock state: %d", __func__, state);
-	nvs_handle_t nvs_handle;
-	esp_err_t ret = nvs_open(NVS_STATE_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	lock_record_t record = {
+			.version = LOCK_RECORD_VERSION,
+			.state = state,
+			.seq = ++record_seq,
+	};
+	memcpy(record.uuid, uuid, sizeof(record.uuid));
+
+	esp_err_t ret = cl_persist_write(NVS_OWNER_NAMESPACE, NVS_OWNER_KEY, &record, sizeof(record), cb, NULL);
 	if (ret != ESP_OK)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error opening NVS handle: %s", __func__, esp_err_to_name(ret));
+		ESP_LOGE(LOG_TAG, "%s Error queuing lock record: %s", __func__, esp_err_to_name(ret));
+		record_state = PHY_LOCK_STATE_UNKNOWN;
 		return ret;
 	}
+	record_state = state;
+	return ESP_OK;
+}
 
-	ret = nvs_set_u8(nvs_handle, NVS_STATE_KEY, state);
-	if (ret != ESP_OK)
+/**
+ * @internal
+ * @brief Record a new state of the state machine, unless the commit of the transition already did.
+ * The requested states are recorded without waiting: a reset before the commit restores the previous state.
+ */
+static void persist_state(void)
+{
+	// the support mode is entered from whatever the record says, it is not a state to come back to
+	if (current_state > PHY_LOCK_STATE_REQUESTED_RELEASE || current_state == record_state)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error setting lock state: %s", __func__, esp_err_to_name(ret));
+		return;
 	}
+	save_record(current_state, current_owner, NULL);
+}
 
-	// if the operation failed
-	if (ret != ESP_OK)
-	{
-		nvs_erase_all(nvs_handle);
-	}
+/**
+ * @internal
+ * @brief Completion of the commit of a transition, called from the persistence worker: hands the result to the
+ * lock task.
+ */
+static void ownership_persisted(esp_err_t result, void *arg)
+{
+	cl_phy_lock_event_t event = {
+			.type = result == ESP_OK ? PHY_LOCK_EVENT_PERSIST_OK : PHY_LOCK_EVENT_PERSIST_FAIL,
+	};
+	// the state machine waits for it, it must not be dropped
+	cl_phy_lock_svc_post(&event, portMAX_DELAY);
+}
 
-	ret = nvs_commit(nvs_handle);
-	if (ret != ESP_OK)
+/**
+ * @internal
+ * @brief Add an event to the audit journal with the current owner, without waiting for flash.
+ *
+ * @param event The CL_JOURNAL_EVENT_* value.
+ * @param state The state the event leads to, the transition may not have happened yet.
+ */
+static void journal(uint8_t event, uint8_t state)
+{
+	esp_err_t ret = cl_journal_append(event, is_null_uuid(current_owner) ? NULL : current_owner, state);
+	if (ret == ESP_ERR_NO_MEM)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error committing lock state: %s", __func__, esp_err_to_name(ret));
-		return ret;
+		ESP_LOGW(LOG_TAG, "%s Journal full, event %d dropped", __func__, event);
 	}
-
-	nvs_close(nvs_handle);
-	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Load the lock state from the NVS.
+ * @brief Load the lock record from NVS.
+ * Reads the lock_record_t blob with a single lookup. If the record is missing, the legacy
+ * per-byte keys are migrated into a record once.
+ *
+ * @param state Set to the recorded PHY_LOCK_STATE_* value, UNCLAIMED if nothing is recorded.
+ * @param uuid Set to the recorded owner, left untouched if nothing is recorded.
  *
- * @param state The lock state to load.
+ * @return esp_err_t This is the results of the NVS operation.
  */
-static esp_err_t load_state(uint8_t *state)
+static esp_err_t load_record(uint8_t *state, uint8_t *uuid)
 {
-	ESP_LOGD(LOG_TAG, "%s Loading lock state", __func__);
 	nvs_handle_t nvs_handle;
-	esp_err_t ret = nvs_open(NVS_STATE_NAMESPACE, NVS_READONLY, &nvs_handle);
+	esp_err_t ret = nvs_open(NVS_OWNER_NAMESPACE, NVS_READWRITE, &nvs_handle);
 	if (ret != ESP_OK)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error opening NVS handle: %s", __func__, esp_err_to_name(ret));
+		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
 		return ret;
 	}
 
-	ret = nvs_get_u8(nvs_handle, NVS_STATE_KEY, state);
-	if (ret != ESP_OK)
+	lock_record_t record;
+	size_t record_len = sizeof(record);
+	ret = nvs_get_blob(nvs_handle, NVS_OWNER_KEY, &record, &record_len);
+	// if the record is not there yet, it might still be stored with the legacy keys
+	if (ret == ESP_ERR_NVS_NOT_FOUND)
+	{
+		ret = migrate_legacy_ownership(nvs_handle, state, uuid);
+		nvs_close(nvs_handle);
+		return ret;
+	}
+	else if (ret != ESP_OK)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error getting lock state: %s", __func__, esp_err_to_name(ret));
+		ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
+		nvs_close(nvs_handle);
 		return ret;
 	}
 
+	// the previous version has the same layout, it only ever recorded the committed states
+	if (record_len != sizeof(record) || (record.version != LOCK_RECORD_VERSION && record.version != LOCK_RECORD_VERSION_OWNER))
+	{
+		ESP_LOGE(LOG_TAG, "%s Unsupported lock record: len=%u version=%d", __func__, (unsigned)record_len, record.version);
+		nvs_close(nvs_handle);
+		return ESP_ERR_INVALID_VERSION;
+	}
+
+	*state = record.state;
+	memcpy(uuid, record.uuid, sizeof(record.uuid));
+	record_seq = record.seq;
+	ESP_LOGD(LOG_TAG, "%s Lock record loaded: seq=%" PRIu32 " state=%d", __func__, record.seq, record.state);
+
 	nvs_close(nvs_handle);
 	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Save the lock ownership to NVS.
+ * @brief Migrate the legacy per-byte ownership keys into a lock_record_t.
+ * The legacy keys are erased in the same commit as the record is written, so the migration only runs once.
+ *
+ * @param nvs_handle An open read-write handle on the owner namespace.
+ * @param state Set to the state of the migrated owner, UNCLAIMED if no legacy ownership is found.
+ * @param uuid Set to the migrated owner, or left untouched if no legacy ownership is found.
  *
  * @return esp_err_t This is the results of the NVS operation.
  */
-static esp_err_t save_ownership(const uint8_t *uuid)
+static esp_err_t migrate_legacy_ownership(nvs_handle_t nvs_handle, uint8_t *state, uint8_t *uuid)
 {
-	nvs_handle_t nvs_handle;
-	esp_err_t ret = nvs_open(NVS_OWNER_NAMESPACE, NVS_READWRITE, &nvs_handle);
-	if (ret != ESP_OK)
-	{
-		ESP_LOGE(LOG_TAG, "%s Error opening NVS handle: %s", __func__, esp_err_to_name(ret));
-		return ret;
-	}
+	uint8_t legacy_uuid[16];
+	esp_err_t ret = ESP_OK;
 
 	for (int i = 0; i < 16; i++)
 	{
-		char key[32];
-		sprintf(key, "%s%d", NVS_OWNER_KEY_PREFIX, i);
-		ret = nvs_set_u8(nvs_handle, key, uuid[i]);
+		char key[NVS_KEY_NAME_MAX_SIZE];
+		snprintf(key, sizeof(key), "%s%d", NVS_OWNER_KEY_PREFIX, i);
+		ret = nvs_get_u8(nvs_handle, key, &legacy_uuid[i]);
 		if (ret != ESP_OK)
 		{
-			ESP_LOGE(LOG_TAG, "%s Error setting NVS value: %s", __func__, esp_err_to_name(ret));
 			break;
 		}
 	}
 
-	// if any of the set operations failed, erase all the values from the owner namespace
+	// if no ownership is found, return esp_ok
+	if (ret == ESP_ERR_NVS_NOT_FOUND)
+	{
+		ESP_LOGD(LOG_TAG, "%s No lock ownership found", __func__);
+		*state = PHY_LOCK_STATE_UNCLAIMED;
+		return ESP_OK;
+	}
+	else if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error getting legacy NVS value: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	lock_record_t record = {
+			.version = LOCK_RECORD_VERSION,
+			.state = is_null_uuid(legacy_uuid) ? PHY_LOCK_STATE_UNCLAIMED : PHY_LOCK_STATE_CLAIMED,
+			.seq = 1,
+	};
+	memcpy(record.uuid, legacy_uuid, sizeof(record.uuid));
+
+	ret = nvs_set_blob(nvs_handle, NVS_OWNER_KEY, &record, sizeof(record));
 	if (ret != ESP_OK)
 	{
-		nvs_erase_all(nvs_handle);
+		ESP_LOGE(LOG_TAG, "%s Error setting NVS value: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		char key[NVS_KEY_NAME_MAX_SIZE];
+		snprintf(key, sizeof(key), "%s%d", NVS_OWNER_KEY_PREFIX, i);
+		nvs_erase_key(nvs_handle, key);
 	}
 
-	// commit the changes to NVS
 	ret = nvs_commit(nvs_handle);
 	if (ret != ESP_OK)
 	{
 		ESP_LOGE(LOG_TAG, "%s Error committing NVS: %s", __func__, esp_err_to_name(ret));
+		return ret;
 	}
 
-	nvs_close(nvs_handle);
-	return ret;
+	*state = record.state;
+	memcpy(uuid, legacy_uuid, sizeof(legacy_uuid));
+	record_seq = record.seq;
+	ESP_LOGI(LOG_TAG, "%s Legacy ownership migrated to record", __func__);
+
+	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Load the lock ownership from NVS.
- *
- * @return esp_err_t This is the results of the NVS operation.
+ * @brief Returns nonzero if the given uuid is the null uuid.
  */
-static esp_err_t load_ownership(uint8_t *uuid)
+static inline uint8_t is_null_uuid(const uint8_t *uuid)
 {
-	nvs_handle_t nvs_handle;
-	esp_err_t ret = nvs_open(NVS_OWNER_NAMESPACE, NVS_READONLY, &nvs_handle);
-	// if the no ownership is found, return esp_ok
-	if (ret == ESP_ERR_NVS_NOT_FOUND)
+	return memcmp(uuid, null_owner, 16) == 0;
+}
+
+/**
+ * @internal
+ * @brief Lets every event through.
+ */
+static esp_err_t guard_none(const snapshot_t *lock, const cl_phy_lock_event_t *event)
+{
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Rejects the event as it is not allowed from the current state.
+ */
+static esp_err_t guard_reject(const snapshot_t *lock, const cl_phy_lock_event_t *event)
+{
+	return ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * @internal
+ * @brief Only lets the (pending) owner through, once the ownership is no longer being committed.
+ */
+static esp_err_t guard_owner(const snapshot_t *lock, const cl_phy_lock_event_t *event)
+{
+	if (lock->committing)
 	{
-		ESP_LOGD(LOG_TAG, "%s No lock ownership found", __func__);
-		return ESP_OK;
+		return ESP_ERR_INVALID_STATE;
 	}
-	// otherwise process all other errors
-	else if (ret != ESP_OK)
+	if (event->uuid == NULL || memcmp(lock->owner, event->uuid, 16) != 0)
 	{
-		ESP_LOGE(LOG_TAG, "%s Error opening NVS: %s", __func__, esp_err_to_name(ret));
-		return ret;
+		LAZY_LOGD(LOG_TAG, "%s Requester doesn't match: %s", __func__, UUID_TO_STRING(lock->owner));
+		return ESP_ERR_NOT_ALLOWED;
 	}
+	return ESP_OK;
+}
 
-	for (int i = 0; i < 16; i++)
+/**
+ * @internal
+ * @brief Lets the event through unless the ownership is being committed, it is ignored meanwhile.
+ */
+static esp_err_t guard_idle(const snapshot_t *lock, const cl_phy_lock_event_t *event)
+{
+	return lock->committing ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Only lets the result of a commit through while one is waited for.
+ */
+static esp_err_t guard_committing(const snapshot_t *lock, const cl_phy_lock_event_t *event)
+{
+	return lock->committing ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * @internal
+ * @brief Accepts the event without doing anything, e.g. the bolt moving while the lock is unclaimed.
+ */
+static esp_err_t action_ignore(const cl_phy_lock_event_t *event)
+{
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Takes the requester as pending owner and opens the lock so the user can close it to confirm.
+ */
+static esp_err_t action_accept_claim(const cl_phy_lock_event_t *event)
+{
+	memcpy(current_owner, event->uuid, 16);
+	LAZY_LOGI(LOG_TAG, "%s Accept claim: unclaimed -> %s", __func__, UUID_TO_STRING(current_owner));
+
+	// if the lock is closed, we need to open it first
+	if (read_physical_lock_position() == PHY_LOCK_POSITION_CLOSED)
 	{
-		char key[32];
-		sprintf(key, "%s%d", NVS_OWNER_KEY_PREFIX, i);
-		uint8_t value = 0;
-		ret = nvs_get_u8(nvs_handle, key, &value);
-		if (ret != ESP_OK)
-		{
-			ESP_LOGE(LOG_TAG, "%s Error getting NVS value: %s", __func__, esp_err_to_name(ret));
-			break;
-		}
-		uuid[i] = value;
+		ESP_LOGD(LOG_TAG, "%s Opening physical lock", __func__);
+		set_physical_lock_open();
 	}
 
-	nvs_close(nvs_handle);
-	return ret;
+	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Returns 0 if the given uuid is the null uuid.
+ * @brief Drops a pending claim when the requester itself asks to release before closing the lock, checked by its guard.
  */
-static inline uint8_t is_null_uuid(const uint8_t *uuid)
+static esp_err_t action_cancel_claim(const cl_phy_lock_event_t *event)
 {
-	return memcmp(uuid, null_owner, 16) != 0;
+	LAZY_LOGI(LOG_TAG, "%s Cancel claim: %s", __func__, UUID_TO_STRING(current_owner));
+	memcpy(current_owner, null_owner, 16);
+	return ESP_OK;
 }
 
-static void lock_sensor_trigger()
+/**
+ * @internal
+ * @brief Commits the pending ownership once the lock has been closed, the claim completes with the commit.
+ */
+static esp_err_t action_commit_claim(const cl_phy_lock_event_t *event)
 {
-	uint8_t read_position = read_physical_lock_position();
-	ESP_LOGD(LOG_TAG, "%s Lock sensor triggered: %d", __func__, read_position);
-	switch (current_state)
+	// close the lock
+	set_physical_lock_closed();
+	// commit the ownership
+	LAZY_LOGI(LOG_TAG, "%s Commit ownership: %s", __func__, UUID_TO_STRING(current_owner));
+	esp_err_t ret = save_record(PHY_LOCK_STATE_CLAIMED, current_owner, ownership_persisted);
+	if (ret != ESP_OK)
 	{
-	case PHY_LOCK_STATE_REQUESTED_CLAIM:
-		// it has been locked
-		if (read_position == PHY_LOCK_POSITION_CLOSED)
-		{
-			// close the lock
-			set_physical_lock_closed();
-			// commit the ownership
-			ESP_LOGI(LOG_TAG, "%s Commit ownership: %s", __func__, UUID_TO_STRING(current_owner));
-			esp_err_t ret = save_ownership(current_owner);
-			if (ret != ESP_OK)
-			{
-				ESP_LOGE(LOG_TAG, "%s Error saving ownership: %s", __func__, esp_err_to_name(ret));
-				// release the lock
-				set_physical_lock_open();
-				// TODO: somehow report error
-				return;
-			}
-
-			// set the state to claimed
-			set_state(PHY_LOCK_STATE_CLAIMED);
-			// TODO: somehow notify success
-		}
-		break;
-	case PHY_LOCK_STATE_CLAIMED:
-		// TODO implement proper handling of alarm and tamper notification
-		// it has been unlocked / tempered with
-		if (read_position == PHY_LOCK_POSITION_OPEN)
-		{
-			ESP_LOGI(LOG_TAG, "%s Alarm on", __func__);
-			set_alarm_on();
-		}
-		// NOTE ideally we don't turn off the alarm once it has been triggered
-		else
-		{
-			ESP_LOGI(LOG_TAG, "%s Alarm off", __func__);
-			set_alarm_off();
-		}
-		break;
-	case PHY_LOCK_STATE_REQUESTED_RELEASE:
-		// TODO: if it has been opened after the requested release, clear the ownership and move to unclaimed state
-		// it has been opened, means we commit the release
-		if (read_position == PHY_LOCK_POSITION_OPEN)
-		{
-			// clear the ownership
-			ESP_LOGI(LOG_TAG, "%s Clear ownership", __func__);
-			esp_err_t ret = save_ownership(null_owner);
-			if (ret != ESP_OK)
-			{
-				ESP_LOGE(LOG_TAG, "%s Error clearing ownership: %s", __func__, esp_err_to_name(ret));
-				// TODO: somehow report error
-				return;
-			}
-			// clear the current owner memory address
-			memcpy(current_owner, null_owner, 16);
-			set_state(PHY_LOCK_STATE_UNCLAIMED);
-		}
-		// TODO handle if the position is closed (should not happen)
-		break;
+		// release the lock
+		set_physical_lock_open();
+		// published with the status once the transition is dropped
+		commit_failed = 1;
+		return ret;
 	}
+	committing = 1;
+	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Handle the lock GPIO interrupt and queue it for processing with the GPIO num as param.
+ * @brief The ownership is committed, the lock is claimed.
  */
-static void gpio_isr_handler(void *arg)
+static esp_err_t action_claim_persisted(const cl_phy_lock_event_t *event)
 {
-	uint32_t gpio_num = (intptr_t)arg;
-	xQueueSendFromISR(lock_gpio_queue, &gpio_num, NULL);
+	committing = 0;
+	commit_failed = 0;
+	journal(CL_JOURNAL_EVENT_CLAIMED, PHY_LOCK_STATE_CLAIMED);
+	// the owner learns about the commit from the state notification
+	return ESP_OK;
 }
 
 /**
  * @internal
- * @brief Process the lock GPIO queue.
- * This function is called from the @{gpio_isr_handler} and processes the GPIO queue.
- *
- * @param arg This is the GPIO number that triggered the interrupt.
+ * @brief The ownership could not be committed, the claim stays pending and the lock is released again.
  */
-static void process_gpio_queue(void *arg)
+static esp_err_t action_claim_failed(const cl_phy_lock_event_t *event)
 {
-	uint32_t gpio_num;
-	// debounce variables to prevent multiple triggers
-	TickType_t lastChangeTime = xTaskGetTickCount();
-	TickType_t debounceDelay = pdMS_TO_TICKS(200);
-	TickType_t currentTime;
-	TickType_t elapsedTime;
+	committing = 0;
+	// the record on flash is whichever write went through last, write the next state whatever it is
+	record_state = PHY_LOCK_STATE_UNKNOWN;
+	ESP_LOGE(LOG_TAG, "%s Error committing ownership", __func__);
+	set_physical_lock_open();
+	commit_failed = 1;
+	return ESP_OK;
+}
 
-	// Loop forever
-	for (;;)
+/**
+ * @internal
+ * @brief Accepts a release from the current owner, checked by its guard, and opens the lock.
+ */
+static esp_err_t action_accept_release(const cl_phy_lock_event_t *event)
+{
+	LAZY_LOGI(LOG_TAG, "%s Accepted release: claimed -> %s", __func__, UUID_TO_STRING(event->uuid));
+
+	// if the lock is closed, we need to open it first
+	if (read_physical_lock_position() == PHY_LOCK_POSITION_CLOSED)
 	{
-		if (xQueueReceive(lock_gpio_queue, &gpio_num, portMAX_DELAY))
-		{
-			// Debounce the signal
-			currentTime = xTaskGetTickCount();
-			elapsedTime = currentTime - lastChangeTime;
-
-			// Only process the signal if it has been stable for longer than the debounce delay
-			if (elapsedTime >= debounceDelay)
-			{
-				switch (gpio_num)
-				{
-				case LOCK_SENSOR_IN_PIN:
-					lock_sensor_trigger();
-					break;
-
-				default:
-					break;
-				}
-			}
-
-			// Update the last change time
-			lastChangeTime = currentTime;
-		}
+		ESP_LOGD(LOG_TAG, "%s Opening physical lock", __func__);
+		set_physical_lock_open();
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Clears the ownership once the lock has been opened after a release, the release completes with the commit.
+ */
+static esp_err_t action_commit_release(const cl_phy_lock_event_t *event)
+{
+	// clear the ownership
+	ESP_LOGI(LOG_TAG, "%s Clear ownership", __func__);
+	esp_err_t ret = save_record(PHY_LOCK_STATE_UNCLAIMED, null_owner, ownership_persisted);
+	if (ret != ESP_OK)
+	{
+		commit_failed = 1;
+		return ret;
 	}
+	committing = 1;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The cleared ownership is committed, the lock is unclaimed.
+ */
+static esp_err_t action_release_persisted(const cl_phy_lock_event_t *event)
+{
+	committing = 0;
+	commit_failed = 0;
+	journal(CL_JOURNAL_EVENT_RELEASED, PHY_LOCK_STATE_UNCLAIMED);
+	// clear the current owner memory address
+	memcpy(current_owner, null_owner, 16);
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The cleared ownership could not be committed, the release stays pending until the lock opens again.
+ */
+static esp_err_t action_release_failed(const cl_phy_lock_event_t *event)
+{
+	committing = 0;
+	record_state = PHY_LOCK_STATE_UNKNOWN;
+	ESP_LOGE(LOG_TAG, "%s Error clearing ownership", __func__);
+	commit_failed = 1;
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The lock has been opened while claimed, it has been tampered with.
+ */
+static esp_err_t action_alarm_on(const cl_phy_lock_event_t *event)
+{
+	// TODO implement proper handling of alarm and tamper notification
+	ESP_LOGI(LOG_TAG, "%s Alarm on", __func__);
+	set_alarm_on();
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief The lock has been closed again while claimed.
+ */
+static esp_err_t action_alarm_off(const cl_phy_lock_event_t *event)
+{
+	// NOTE ideally we don't turn off the alarm once it has been triggered
+	ESP_LOGI(LOG_TAG, "%s Alarm off", __func__);
+	set_alarm_off();
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Translates the debounced lock sensor level into an event for the state machine.
+ */
+static void lock_sensor_trigger(uint8_t position)
+{
+	ESP_LOGD(LOG_TAG, "%s Lock sensor triggered: %d", __func__, position);
+
+	cl_phy_lock_event_t event = {
+			.type = PHY_LOCK_EVENT_FROM_POSITION(position),
+	};
+	// the hub must not lose a level, wait for room rather than drop it
+	cl_phy_lock_svc_post(&event, portMAX_DELAY);
+}
+
+/**
+ * @internal
+ * @brief Handle the debounced lock sensor level, called from the GPIO hub task.
+ */
+static void lock_sensor_handler(const cl_gpio_event_t *event, void *arg)
+{
+	lock_sensor_trigger(event->level);
 }
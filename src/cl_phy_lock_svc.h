@@ -1,6 +1,7 @@
 #ifndef _CL_PHY_LOCK_SVC_H_
 #define _CL_PHY_LOCK_SVC_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "esp_err.h"
 
@@ -11,22 +12,99 @@
 #define ESP_ERR_PHY_LOCK_BASE 0x11000
 #define ESP_ERR_PHY_LOCK_INVALID_POSITION 0x11001
 
-// NOTE: The cl_ble_lock_svc.c has a descriptor which explains each state, adjust if changing any of the states
+/**
+ * Every lock state as X(id, value, name, explanation). The PHY_LOCK_STATE_* constants and the state descriptor of
+ * cl_ble_lock_svc.c are generated from it, so a state is added or changed in one place.
+ */
+#define PHY_LOCK_STATES(X)                                                                                                                  \
+	X(UNKNOWN, 255, "Unknown", "The device has not yet initialized the lock state. This should never happen.")                               \
+	X(UNCLAIMED, 0, "Unclaimed", "The device can accept claims requests as it has no owner yet.")                                              \
+	X(CLAIMED, 1, "Claimed", "The device is claimed and in use by a user and cannot be claimed by another user.")                             \
+	X(REQUESTED_CLAIM, 2, "Requested Claim", "The device has received a claim request and is waiting for the user to confirm the claim.")     \
+	X(REQUESTED_RELEASE, 3, "Requested Release", "The device has received a release request and is waiting for the user to confirm the release.") \
+	X(SUPPORT, 4, "Support", "The device is in support mode and need maintenance. Unavailable.")
 
-#define PHY_LOCK_STATE_UNKNOWN 255
-#define PHY_LOCK_STATE_UNCLAIMED 0
-#define PHY_LOCK_STATE_CLAIMED 1
-#define PHY_LOCK_STATE_REQUESTED_CLAIM 2
-#define PHY_LOCK_STATE_REQUESTED_RELEASE 3
-#define PHY_LOCK_STATE_SUPPORT 4
+#define PHY_LOCK_STATE_ENUM(id, value, name, explanation) PHY_LOCK_STATE_##id = value,
+enum
+{
+	PHY_LOCK_STATES(PHY_LOCK_STATE_ENUM)
+};
+#undef PHY_LOCK_STATE_ENUM
+
+#define PHY_LOCK_MAX_STATE_CBS 4	//!< Maximum number of state change callbacks
+#define PHY_LOCK_MAX_STATUS_CBS 2 //!< Maximum number of status change callbacks
+#define PHY_LOCK_QUEUE_LEN 16			//!< Number of messages buffered for the lock task
+#define PHY_LOCK_TASK_STACK 4096	//!< Stack size of the lock task, NVS commits run on it
+#define PHY_LOCK_TASK_PRIO 5			//!< Priority of the lock task, below the GPIO hub
 
 #define PHY_LOCK_POSITION_UNKNOWN 255
 #define PHY_LOCK_POSITION_OPEN 0
 #define PHY_LOCK_POSITION_CLOSED 1
 
+/**
+ * Events driving the lock state machine.
+ */
+typedef enum
+{
+	PHY_LOCK_EVENT_SENSOR_OPEN = PHY_LOCK_POSITION_OPEN,		 //!< The lock sensor reads the bolt as open
+	PHY_LOCK_EVENT_SENSOR_CLOSED = PHY_LOCK_POSITION_CLOSED, //!< The lock sensor reads the bolt as closed
+	PHY_LOCK_EVENT_REQUEST_CLAIM,														 //!< A user requests to claim the lock
+	PHY_LOCK_EVENT_REQUEST_RELEASE,													 //!< A user requests to release the lock
+	PHY_LOCK_EVENT_PERSIST_OK,															 //!< The ownership change of the transition is committed, posted by the service
+	PHY_LOCK_EVENT_PERSIST_FAIL,														 //!< The ownership change of the transition failed, posted by the service
+	PHY_LOCK_EVENT_MAX,
+} cl_phy_lock_event_type_t;
+
+/**
+ * Sensor event matching a PHY_LOCK_POSITION_OPEN or PHY_LOCK_POSITION_CLOSED reading.
+ */
+#define PHY_LOCK_EVENT_FROM_POSITION(position) ((cl_phy_lock_event_type_t)(position))
+
+typedef struct
+{
+	cl_phy_lock_event_type_t type; //!< One of the PHY_LOCK_EVENT_* values
+	const uint8_t *uuid;					 //!< The requester UUID for claim and release requests, NULL for sensor events
+} cl_phy_lock_event_t;
+
+/**
+ * Everything observable about the lock.
+ */
+typedef struct
+{
+	uint8_t state;				 //!< The PHY_LOCK_STATE_* value
+	uint8_t position;			 //!< The PHY_LOCK_POSITION_* value last read by the lock sensor
+	uint8_t alarm;				 //!< Whether the alarm is on
+	uint8_t commit_failed; //!< Whether the last ownership change failed to commit, until one goes through
+} cl_phy_lock_status_t;
+
+/**
+ * Called on every state change of the lock with the new PHY_LOCK_STATE_* value.
+ *
+ * @note Runs in the lock task, in the middle of a transition: it must not block nor dispatch to the lock service,
+ * defer the work instead. The getters already return the new state.
+ */
+typedef void (*cl_phy_lock_state_cb_t)(uint8_t state, void *arg);
+
+/**
+ * Called whenever any field of the lock status changes, with the new status.
+ *
+ * @note Same constraints as cl_phy_lock_state_cb_t.
+ */
+typedef void (*cl_phy_lock_status_cb_t)(const cl_phy_lock_status_t *status, void *arg);
+
+/**
+ * Function run by the lock task, see cl_phy_lock_svc_run().
+ */
+typedef void (*cl_phy_lock_run_fn_t)(void *arg);
+
 /**
  * Initialize the lock by setting up the GPIO pins connected to the lock, the step motor and loading state.
- * It also load data from the NVS flash back into memory, and initialize the lock state.
+ * It restores the state machine from the lock record in NVS, written on every transition, so a request pending
+ * at a reset is restored as well and completes if the lock moved meanwhile.
+ * The persistence worker is started first, so a commit torn by a reset is recovered before the state is loaded.
+ * Ownership changes are committed by the worker: the lock stays in the requested state until the commit completes.
+ * Events are queued until cl_phy_lock_svc_start(), leaving the modules following the lock the time to read the
+ * restored state and register their callbacks.
  *
  * @note This function must be called before any other phy_lock_svc function.
  *
@@ -34,6 +112,16 @@
  */
 extern int cl_phy_lock_svc_init(void);
 
+/**
+ * Start the lock task, once every state and status callback is registered. From then on it owns the state and
+ * applies every event, one at a time, while the getters read a consistent snapshot from any task without waiting
+ * for it. A request restored pending completes now if the lock moved meanwhile.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the lock is not initialized or already started,
+ * ESP_ERR_NO_MEM if the task can't be created.
+ */
+extern esp_err_t cl_phy_lock_svc_start(void);
+
 /**
  * Get the current state of the lock.
  *
@@ -41,24 +129,107 @@ extern int cl_phy_lock_svc_init(void);
  */
 extern uint8_t cl_phy_lock_svc_get_state(void);
 
+/**
+ * Get the current status of the lock, from the snapshot published by the lock task.
+ *
+ * @param status Set to the current status.
+ */
+extern void cl_phy_lock_svc_get_status(cl_phy_lock_status_t *status);
+
+/**
+ * Whether the lock is in the middle of something a restart would cut short: a claim or release waiting for its
+ * commit, or the bolt moving.
+ *
+ * @return Returns true while the state is PHY_LOCK_STATE_REQUESTED_CLAIM or PHY_LOCK_STATE_REQUESTED_RELEASE, or
+ * while the motor runs.
+ */
+extern bool cl_phy_lock_svc_is_busy(void);
+
+/**
+ * Register a callback for the state changes of the lock, e.g. to publish them.
+ *
+ * @note Callbacks must be registered before cl_phy_lock_svc_start(), the lock task reads them without a lock.
+ *
+ * @param cb Called with each new state.
+ * @param arg Argument given to cb.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NO_MEM if PHY_LOCK_MAX_STATE_CBS are already registered,
+ * ESP_ERR_INVALID_STATE once the lock is started.
+ */
+extern esp_err_t cl_phy_lock_svc_add_state_cb(cl_phy_lock_state_cb_t cb, void *arg);
+
+/**
+ * Register a callback for the status changes of the lock: state, sensor position and alarm.
+ *
+ * @note Callbacks must be registered before cl_phy_lock_svc_start(), the lock task reads them without a lock.
+ *
+ * @param cb Called with each new status.
+ * @param arg Argument given to cb.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NO_MEM if PHY_LOCK_MAX_STATUS_CBS are already registered,
+ * ESP_ERR_INVALID_STATE once the lock is started.
+ */
+extern esp_err_t cl_phy_lock_svc_add_status_cb(cl_phy_lock_status_cb_t cb, void *arg);
+
 /**
  * Request to claim the lock to a certain owner identified by UUID.
+ * The request is checked against the current snapshot and queued to the lock task without waiting, so it is
+ * safe to call from the NimBLE host task. The state callbacks report when it is applied.
  *
- * @param uuid The UUID of the owner.
+ * @param uuid The UUID of the owner, copied.
  *
- * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the lock cannot be claimed from
- * its current state.
+ * @return Returns ESP_OK if the request is queued. ESP_ERR_INVALID_STATE if the lock cannot be claimed from
+ * its current state. ESP_ERR_NO_MEM if the queue of the lock task is full.
  */
-extern esp_err_t cl_phy_lock_svc_request_claim(uint8_t *uuid);
+extern esp_err_t cl_phy_lock_svc_request_claim(const uint8_t *uuid);
 
 /**
  * Request to release the lock from a certain owner identified by UUID.
+ * Checked and queued like cl_phy_lock_svc_request_claim().
+ *
+ * @param uuid The UUID of the owner, copied.
+ *
+ * @return Returns ESP_OK if the request is queued. ESP_ERR_INVALID_STATE if the lock cannot be released from
+ * its current state. ESP_ERR_NOT_ALLOWED if the requester is not the owner, or not the pending owner to cancel a
+ * claim. ESP_ERR_NO_MEM if the queue of the lock task is full.
+ */
+extern esp_err_t cl_phy_lock_svc_request_release(const uint8_t *uuid);
+
+/**
+ * Feed an event to the lock state machine and wait for the outcome.
+ * The transition is looked up in a (state, event) table, its guard is checked and its action is run; the lock only
+ * moves to the next state if both succeed. The event is applied by the lock task, in place when called from it
+ * (e.g. from a cl_phy_lock_svc_run() function), otherwise the caller blocks until the lock task applied it.
+ *
+ * @note Never call it from the NimBLE host task, the lock task may be busy committing to NVS: use the requests or
+ * cl_phy_lock_svc_run() there.
+ *
+ * @param event The event to dispatch.
+ *
+ * @return Returns ESP_OK if the event was accepted. ESP_ERR_INVALID_STATE if the event is not allowed from
+ * the current state, ESP_ERR_NOT_ALLOWED if the requester doesn't match, otherwise the error of the failed action.
+ */
+extern esp_err_t cl_phy_lock_svc_dispatch(const cl_phy_lock_event_t *event);
+
+/**
+ * Queue an event to the lock state machine without waiting for the outcome.
+ *
+ * @param event The event to post, the UUID is copied.
+ * @param ticks_to_wait How long to wait for room in the queue, 0 to fail right away.
+ *
+ * @return Returns ESP_OK if queued. ESP_ERR_NO_MEM if the queue stayed full.
+ */
+extern esp_err_t cl_phy_lock_svc_post(const cl_phy_lock_event_t *event, uint32_t ticks_to_wait);
+
+/**
+ * Run a function on the lock task, serialized with the events: it can dispatch several events and read the
+ * status in between without any other event interleaving. Returns without waiting.
  *
- * @param uuid The UUID of the owner.
+ * @param fn The function, it must not block on anything but the lock service itself.
+ * @param arg Argument given to fn.
  *
- * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if the lock cannot be released from
- * its current state.
+ * @return Returns ESP_OK if queued. ESP_ERR_NO_MEM if the queue of the lock task is full.
  */
-extern esp_err_t cl_phy_lock_svc_request_release(uint8_t *uuid);
+extern esp_err_t cl_phy_lock_svc_run(cl_phy_lock_run_fn_t fn, void *arg);
 
 #endif // _CL_PHY_LOCK_SVC_H_
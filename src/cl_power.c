@@ -0,0 +1,187 @@
+// Library
+#include <stdbool.h>
+// FreeRTOS
+#include "freertos/FreeRTOS.h"
+// ESP32
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+// Local
+#include "cl_gpio_hub.h"
+#include "cl_power.h"
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief PM lock backing a CL_POWER_LOCK_* reason.
+ */
+typedef struct
+{
+	esp_pm_lock_type_t type;
+	const char *name;
+} lock_desc_t;
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static void account(void);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "power";
+
+static const lock_desc_t LOCK_DESCS[CL_POWER_LOCK_MAX] = {
+		// the motor driver times its pulses on the APB clock
+		[CL_POWER_LOCK_MOTOR] = {.type = ESP_PM_APB_FREQ_MAX, .name = "motor"},
+		// a commit at full speed gives the flash back sooner
+		[CL_POWER_LOCK_NVS] = {.type = ESP_PM_CPU_FREQ_MAX, .name = "nvs"},
+};
+
+static bool initialized = false;
+static esp_pm_lock_handle_t pm_locks[CL_POWER_LOCK_MAX]; //!< NULL while power management is disabled
+
+static portMUX_TYPE power_mux = portMUX_INITIALIZER_UNLOCKED; //!< Guards everything below
+static uint32_t held[CL_POWER_LOCK_MAX];											 //!< Nesting count of each lock
+static uint8_t phase = CL_POWER_MAX_PHASES - 1;
+static int64_t accounted_us = 0; //!< esp_timer_get_time() up to which stats are accounted
+static cl_power_stats_t stats;
+
+esp_err_t cl_power_init(void)
+{
+	if (initialized)
+	{
+		ESP_LOGE(LOG_TAG, "%s Power management already initialized", __func__);
+		return ESP_ERR_INVALID_STATE;
+	}
+	initialized = true;
+
+	esp_err_t ret = esp_sleep_enable_gpio_wakeup();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error enabling GPIO wakeup: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	for (int i = 0; i < CL_POWER_LOCK_MAX; i++)
+	{
+		ret = esp_pm_lock_create(LOCK_DESCS[i].type, 0, LOCK_DESCS[i].name, &pm_locks[i]);
+		if (ret == ESP_ERR_NOT_SUPPORTED)
+		{
+			ESP_LOGW(LOG_TAG, "%s Power management disabled, the device won't sleep", __func__);
+			pm_locks[i] = NULL;
+			return ESP_OK;
+		}
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "%s Error creating PM lock %s: %s", __func__, LOCK_DESCS[i].name, esp_err_to_name(ret));
+			return ret;
+		}
+	}
+
+	// the BLE controller holds its own lock between connection events, the tasks sleep through the rest
+	esp_pm_config_t config = {
+			.max_freq_mhz = CL_POWER_MAX_FREQ_MHZ,
+			.min_freq_mhz = CL_POWER_MIN_FREQ_MHZ,
+			.light_sleep_enable = true,
+	};
+	ret = esp_pm_configure(&config);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error configuring power management: %s", __func__, esp_err_to_name(ret));
+		return ret;
+	}
+
+	ESP_LOGI(LOG_TAG, "%s Light sleep enabled, CPU at %d-%d MHz", __func__, CL_POWER_MIN_FREQ_MHZ, CL_POWER_MAX_FREQ_MHZ);
+	return ESP_OK;
+}
+
+esp_err_t cl_power_add_wake_input(gpio_num_t pin)
+{
+	esp_err_t ret = cl_gpio_hub_set_wake(pin);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "%s Error waking on GPIO_%d: %s", __func__, pin, esp_err_to_name(ret));
+		return ret;
+	}
+	ESP_LOGD(LOG_TAG, "%s GPIO_%d wakes the device", __func__, pin);
+	return ESP_OK;
+}
+
+void cl_power_acquire(cl_power_lock_t lock)
+{
+	portENTER_CRITICAL(&power_mux);
+	account();
+	if (held[lock]++ == 0)
+	{
+		stats.locks[lock].acquired++;
+	}
+	portEXIT_CRITICAL(&power_mux);
+
+	if (pm_locks[lock] != NULL)
+	{
+		esp_pm_lock_acquire(pm_locks[lock]);
+	}
+}
+
+void cl_power_release(cl_power_lock_t lock)
+{
+	portENTER_CRITICAL(&power_mux);
+	account();
+	bool was_held = held[lock] > 0;
+	held[lock] -= was_held;
+	portEXIT_CRITICAL(&power_mux);
+
+	if (!was_held)
+	{
+		ESP_LOGE(LOG_TAG, "%s Lock %s released while not held", __func__, LOCK_DESCS[lock].name);
+		return;
+	}
+	if (pm_locks[lock] != NULL)
+	{
+		esp_pm_lock_release(pm_locks[lock]);
+	}
+}
+
+void cl_power_set_phase(uint8_t new_phase)
+{
+	portENTER_CRITICAL(&power_mux);
+	account();
+	phase = CL_POWER_PHASE_INDEX(new_phase);
+	stats.phases[phase].entered++;
+	portEXIT_CRITICAL(&power_mux);
+}
+
+void cl_power_get_stats(cl_power_stats_t *out)
+{
+	portENTER_CRITICAL(&power_mux);
+	account();
+	*out = stats;
+	portEXIT_CRITICAL(&power_mux);
+}
+
+/**
+ * @internal
+ * @brief Account the time since the last call to the current phase and to the locks held, under power_mux.
+ */
+static void account(void)
+{
+	int64_t now_us = esp_timer_get_time();
+	int64_t elapsed_us = now_us - accounted_us;
+	accounted_us = now_us;
+
+	cl_power_phase_stats_t *current = &stats.phases[phase];
+	current->time_us += elapsed_us;
+	bool blocked = false;
+	for (int i = 0; i < CL_POWER_LOCK_MAX; i++)
+	{
+		if (held[i] > 0)
+		{
+			stats.locks[i].held_us += elapsed_us;
+			current->held_us[i] += elapsed_us;
+			blocked = true;
+		}
+	}
+	if (blocked)
+	{
+		current->blocked_us += elapsed_us;
+	}
+}
@@ -0,0 +1,105 @@
+#ifndef _CL_POWER_H_
+#define _CL_POWER_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+#define CL_POWER_MAX_FREQ_MHZ 160 //!< CPU frequency while a lock or the BLE controller keeps the device busy
+#define CL_POWER_MIN_FREQ_MHZ 40	//!< CPU frequency when idle, the main XTAL
+#define CL_POWER_MAX_PHASES 8			//!< Phases accounted separately, folded with CL_POWER_PHASE_INDEX
+#define CL_POWER_PHASE_INDEX(phase) ((phase) & (CL_POWER_MAX_PHASES - 1))
+
+_Static_assert((CL_POWER_MAX_PHASES & (CL_POWER_MAX_PHASES - 1)) == 0, "CL_POWER_MAX_PHASES must be a power of 2");
+
+/**
+ * Reasons to keep the device out of light sleep. Each is backed by its own PM lock and taken by a single task, so
+ * the time it is held is the sleep-blocking time of that task.
+ */
+typedef enum
+{
+	CL_POWER_LOCK_MOTOR, //!< The lock motor moves, taken by the lock task and released by its travel timer
+	CL_POWER_LOCK_NVS,	 //!< Records are committed to NVS, taken by the persistence worker
+	CL_POWER_LOCK_MAX,
+} cl_power_lock_t;
+
+/**
+ * Counters of a lock, all since boot.
+ */
+typedef struct
+{
+	uint32_t acquired; //!< Times the lock was taken while released
+	int64_t held_us;	 //!< Time the lock was held, including the current hold
+} cl_power_lock_stats_t;
+
+/**
+ * Counters of a phase, all since boot.
+ * The device may only sleep for time_us - blocked_us of a phase, the BLE controller and the tasks still wake it
+ * within that time.
+ */
+typedef struct
+{
+	uint32_t entered;								 //!< Times the phase was entered
+	int64_t time_us;								 //!< Time spent in the phase, including the current one
+	int64_t blocked_us;							 //!< Time of the phase during which any lock was held
+	int64_t held_us[CL_POWER_LOCK_MAX]; //!< Time of the phase during which each lock was held
+} cl_power_phase_stats_t;
+
+typedef struct
+{
+	cl_power_lock_stats_t locks[CL_POWER_LOCK_MAX];
+	cl_power_phase_stats_t phases[CL_POWER_MAX_PHASES];
+} cl_power_stats_t;
+
+/**
+ * Enable dynamic frequency scaling between CL_POWER_MIN_FREQ_MHZ and CL_POWER_MAX_FREQ_MHZ and automatic light
+ * sleep whenever every task is idle, and create the locks. GPIO wakeup is enabled for the inputs added with
+ * cl_power_add_wake_input().
+ * Without CONFIG_PM_ENABLE the locks are still accounted, but the device never sleeps.
+ * Must be called before the tasks taking the locks start.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_INVALID_STATE if already initialized, otherwise the error of the
+ * PM or sleep driver.
+ */
+extern esp_err_t cl_power_init(void);
+
+/**
+ * Wake the device from light sleep on every level change of an input served by the GPIO hub.
+ *
+ * @param pin The input, already added to the GPIO hub.
+ *
+ * @return Returns ESP_OK if successful. ESP_ERR_NOT_FOUND if the hub doesn't serve the pin, otherwise the error
+ * of the GPIO driver.
+ */
+extern esp_err_t cl_power_add_wake_input(gpio_num_t pin);
+
+/**
+ * Keep the device out of light sleep until the lock is released. Takes nest, each needs its release.
+ *
+ * @param lock The CL_POWER_LOCK_* reason.
+ */
+extern void cl_power_acquire(cl_power_lock_t lock);
+
+/**
+ * Release a lock taken with cl_power_acquire(), from any task or the esp_timer task.
+ *
+ * @param lock The CL_POWER_LOCK_* reason.
+ */
+extern void cl_power_release(cl_power_lock_t lock);
+
+/**
+ * Start accounting the time and the lock holds to a phase, e.g. the lock state.
+ * Until the first call everything is accounted to phase CL_POWER_MAX_PHASES - 1.
+ *
+ * @param phase The phase, folded into CL_POWER_MAX_PHASES buckets with CL_POWER_PHASE_INDEX.
+ */
+extern void cl_power_set_phase(uint8_t phase);
+
+/**
+ * Read the counters, up to now.
+ *
+ * @param stats Set to the current counters.
+ */
+extern void cl_power_get_stats(cl_power_stats_t *stats);
+
+#endif // _CL_POWER_H_
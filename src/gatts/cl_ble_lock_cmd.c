@@ -0,0 +1,203 @@
+// Library
+#include <inttypes.h>
+#include <string.h>
+// ESP32
+#include "esp_log.h"
+#include "esp_err.h"
+// Local
+#include "lazy_log.h"
+#include "stringify.h"
+#include "cl_ble_lock_cmd.h"
+#include "cl_journal.h"
+#include "cl_phy_lock_svc.h"
+
+// -- INTERNAL FUNCTIONS --
+static uint8_t run_request(uint8_t opcode, const uint8_t *payload, uint8_t payload_len, uint8_t *rsp_payload, uint8_t *rsp_payload_len);
+static uint8_t read_log(uint32_t seq, uint8_t *rsp_payload, uint8_t *rsp_payload_len);
+static uint8_t to_status(esp_err_t err);
+static uint16_t put_response(uint8_t *rsp, uint8_t req_id, uint8_t opcode, uint8_t status, const uint8_t *payload, uint8_t payload_len);
+
+// -- RUNTIME VARIABLES --
+static const char *LOG_TAG = "blesvc_lock_cmd";
+
+uint16_t cl_ble_lock_cmd_run(const uint8_t *req, uint16_t req_len, uint8_t *rsp)
+{
+	// parse the whole batch first, so a malformed one never runs halfway
+	int count = 0;
+	uint16_t off = 0;
+	while (off < req_len)
+	{
+		if (req_len - off < CL_LOCK_CMD_REQ_HEADER_LEN || req_len - off - CL_LOCK_CMD_REQ_HEADER_LEN < req[off + 2] ||
+				count == CL_LOCK_CMD_MAX_BATCH)
+		{
+			ESP_LOGE(LOG_TAG, "Malformed batch; len=%d at=%d", req_len, off);
+			return put_response(rsp, req_len > 0 ? req[0] : 0, req_len > 1 ? req[1] : 0, CL_LOCK_CMD_ERR_MALFORMED, NULL, 0);
+		}
+		off += CL_LOCK_CMD_REQ_HEADER_LEN + req[off + 2];
+		count++;
+	}
+
+	uint16_t rsp_len = 0;
+	uint8_t status = CL_LOCK_CMD_OK;
+	for (off = 0; off < req_len; off += CL_LOCK_CMD_REQ_HEADER_LEN + req[off + 2])
+	{
+		uint8_t req_id = req[off];
+		uint8_t opcode = req[off + 1];
+		uint8_t rsp_payload[CL_LOCK_CMD_MAX_RSP_PAYLOAD];
+		uint8_t rsp_payload_len = 0;
+
+		status = status == CL_LOCK_CMD_OK
+								 ? run_request(opcode, &req[off + CL_LOCK_CMD_REQ_HEADER_LEN], req[off + 2], rsp_payload, &rsp_payload_len)
+								 : CL_LOCK_CMD_ERR_ABORTED;
+		rsp_len += put_response(&rsp[rsp_len], req_id, opcode, status, rsp_payload, rsp_payload_len);
+	}
+	return rsp_len;
+}
+
+/**
+ * @internal
+ * @brief Run a single request.
+ *
+ * @return The CL_LOCK_CMD_* status of the response.
+ */
+static uint8_t run_request(uint8_t opcode, const uint8_t *payload, uint8_t payload_len, uint8_t *rsp_payload, uint8_t *rsp_payload_len)
+{
+	esp_err_t ret;
+	// on the lock task the events apply in place, so the next request of the batch already sees them
+	cl_phy_lock_event_t event = {
+			.uuid = payload,
+	};
+
+	switch (opcode)
+	{
+	case CL_LOCK_CMD_OP_CLAIM:
+		if (payload_len != 16)
+		{
+			return CL_LOCK_CMD_ERR_MALFORMED;
+		}
+		event.type = PHY_LOCK_EVENT_REQUEST_CLAIM;
+		ret = cl_phy_lock_svc_dispatch(&event);
+		LAZY_LOGI(LOG_TAG, "Requested claim; uuid=%s ret=%s", UUID_TO_STRING(payload), esp_err_to_name(ret));
+		return to_status(ret);
+
+	case CL_LOCK_CMD_OP_RELEASE:
+		if (payload_len != 16)
+		{
+			return CL_LOCK_CMD_ERR_MALFORMED;
+		}
+		event.type = PHY_LOCK_EVENT_REQUEST_RELEASE;
+		ret = cl_phy_lock_svc_dispatch(&event);
+		LAZY_LOGI(LOG_TAG, "Requested release; uuid=%s ret=%s", UUID_TO_STRING(payload), esp_err_to_name(ret));
+		return to_status(ret);
+
+	case CL_LOCK_CMD_OP_STATUS:
+		if (payload_len != 0)
+		{
+			return CL_LOCK_CMD_ERR_MALFORMED;
+		}
+		cl_phy_lock_status_t status;
+		cl_phy_lock_svc_get_status(&status);
+		const cl_lock_cmd_status_t rsp_status = {
+				.state = status.state,
+				.position = status.position,
+				.alarm = status.alarm,
+				.commit_failed = status.commit_failed,
+		};
+		memcpy(rsp_payload, &rsp_status, sizeof(rsp_status));
+		*rsp_payload_len = sizeof(rsp_status);
+		return CL_LOCK_CMD_OK;
+
+	case CL_LOCK_CMD_OP_GET_LOG:
+		if (payload_len != 0 && payload_len != sizeof(uint32_t))
+		{
+			return CL_LOCK_CMD_ERR_MALFORMED;
+		}
+		uint32_t seq;
+		if (payload_len != 0)
+		{
+			memcpy(&seq, payload, sizeof(seq));
+		}
+		else
+		{
+			uint32_t head = cl_journal_head_seq();
+			seq = head > CL_LOCK_CMD_LOG_RECORDS ? head - CL_LOCK_CMD_LOG_RECORDS : 1;
+		}
+		return read_log(seq, rsp_payload, rsp_payload_len);
+
+	default:
+		ESP_LOGE(LOG_TAG, "Unknown opcode; opcode=%d", opcode);
+		return CL_LOCK_CMD_ERR_OPCODE;
+	}
+}
+
+/**
+ * @internal
+ * @brief Read up to CL_LOCK_CMD_LOG_RECORDS journal records from the sequence number seq on.
+ *
+ * @return The CL_LOCK_CMD_* status of the response.
+ */
+static uint8_t read_log(uint32_t seq, uint8_t *rsp_payload, uint8_t *rsp_payload_len)
+{
+	// records are packed, so they can be read in place
+	cl_journal_record_t *records = (cl_journal_record_t *)rsp_payload;
+	cl_journal_cursor_t cursor;
+	cl_journal_cursor_init(&cursor, seq);
+	size_t total = 0;
+	while (total < CL_LOCK_CMD_LOG_RECORDS)
+	{
+		// fewer records than asked for may only mean skipped torn ones, the head is reached once none is left
+		size_t count;
+		esp_err_t ret = cl_journal_read(&cursor, &records[total], CL_LOCK_CMD_LOG_RECORDS - total, &count);
+		if (ret != ESP_OK)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to read the journal; seq=%" PRIu32 " ret=%s", seq, esp_err_to_name(ret));
+			return CL_LOCK_CMD_ERR_STORAGE;
+		}
+		if (count == 0)
+		{
+			break;
+		}
+		total += count;
+	}
+	*rsp_payload_len = total * sizeof(cl_journal_record_t);
+	return CL_LOCK_CMD_OK;
+}
+
+/**
+ * @internal
+ * @brief Map an error of the lock service to a response status.
+ */
+static uint8_t to_status(esp_err_t err)
+{
+	switch (err)
+	{
+	case ESP_OK:
+		return CL_LOCK_CMD_OK;
+	case ESP_ERR_INVALID_STATE:
+		return CL_LOCK_CMD_ERR_STATE;
+	case ESP_ERR_NOT_ALLOWED:
+		return CL_LOCK_CMD_ERR_NOT_OWNER;
+	default:
+		// the actions only fail otherwise when persisting the ownership
+		return CL_LOCK_CMD_ERR_STORAGE;
+	}
+}
+
+/**
+ * @internal
+ * @brief Write a response frame.
+ *
+ * @return Length of the frame.
+ */
+static uint16_t put_response(uint8_t *rsp, uint8_t req_id, uint8_t opcode, uint8_t status, const uint8_t *payload, uint8_t payload_len)
+{
+	rsp[0] = req_id;
+	rsp[1] = opcode;
+	rsp[2] = status;
+	rsp[3] = payload_len;
+	if (payload_len > 0)
+	{
+		memcpy(&rsp[CL_LOCK_CMD_RSP_HEADER_LEN], payload, payload_len);
+	}
+	return CL_LOCK_CMD_RSP_HEADER_LEN + payload_len;
+}
@@ -0,0 +1,72 @@
+#ifndef _CL_BLE_LOCK_CMD_H_
+#define _CL_BLE_LOCK_CMD_H_
+
+#include <stdint.h>
+#include "cl_journal.h"
+
+/**
+ * Binary command protocol of the lock service.
+ *
+ * A write to the command characteristic carries one or more request frames back to back:
+ *   [request id: u8] [opcode: u8] [payload length: u8] [payload]
+ * A batch that doesn't parse, or holds more than CL_LOCK_CMD_MAX_BATCH requests, is rejected whole with a single
+ * CL_LOCK_CMD_ERR_MALFORMED response. Otherwise the requests run in order and the first failure aborts the rest. Each request gets a response frame, sent
+ * back together in notifications of the response characteristic, split at frame boundaries to fit the ATT MTU:
+ *   [request id: u8] [opcode: u8] [status: u8] [payload length: u8] [payload]
+ * E.g. a claim followed by a status request confirms the pending claim in a single round trip.
+ *
+ * GET_LOG answers with up to CL_LOCK_CMD_LOG_RECORDS journal records, oldest first: the latest ones without payload,
+ * or the ones from a sequence number on. The central pages through the journal from the last sequence number + 1
+ * until the response is empty; the bulk channel streams the whole journal faster, see CL_BLE_BULK_SRC_JOURNAL. A full
+ * GET_LOG response needs an ATT MTU above the default, which the connection manager negotiates on connection.
+ */
+
+// opcodes
+#define CL_LOCK_CMD_OP_CLAIM 0x01		//!< Payload: requester UUID, 16 bytes little-endian. No response payload
+#define CL_LOCK_CMD_OP_RELEASE 0x02 //!< Payload: requester UUID, 16 bytes little-endian. No response payload
+#define CL_LOCK_CMD_OP_STATUS 0x03	//!< No payload. Response payload: cl_lock_cmd_status_t
+#define CL_LOCK_CMD_OP_GET_LOG 0x04 //!< Payload: none, or first sequence number, u32. Response payload: cl_journal_record_t[]
+
+// statuses
+#define CL_LOCK_CMD_OK 0x00						 //!< The request was carried out
+#define CL_LOCK_CMD_ERR_MALFORMED 0x01		 //!< The batch doesn't parse, or the payload has the wrong length
+#define CL_LOCK_CMD_ERR_OPCODE 0x02				 //!< Unknown opcode
+#define CL_LOCK_CMD_ERR_STATE 0x03				 //!< The lock doesn't accept the request in its current state
+#define CL_LOCK_CMD_ERR_NOT_OWNER 0x04		 //!< The requester is not the owner of the lock or of the pending claim
+#define CL_LOCK_CMD_ERR_STORAGE 0x05			 //!< The lock failed to persist the change
+#define CL_LOCK_CMD_ERR_NOT_SUPPORTED 0x06 //!< The opcode is known but not available on this device
+#define CL_LOCK_CMD_ERR_ABORTED 0x07			 //!< Not run as an earlier request of the batch failed
+
+#define CL_LOCK_CMD_REQ_HEADER_LEN 3 //!< Request id, opcode and payload length
+#define CL_LOCK_CMD_RSP_HEADER_LEN 4 //!< Request id, opcode, status and payload length
+#define CL_LOCK_CMD_MAX_BATCH 8			 //!< Maximum number of requests in a write
+#define CL_LOCK_CMD_MAX_WRITE (CL_LOCK_CMD_MAX_BATCH * (CL_LOCK_CMD_REQ_HEADER_LEN + 16))
+#define CL_LOCK_CMD_LOG_RECORDS 4		 //!< Maximum number of journal records in a GET_LOG response
+
+/**
+ * Response payload of CL_LOCK_CMD_OP_STATUS.
+ */
+typedef struct __attribute__((packed))
+{
+	uint8_t state;				 //!< The PHY_LOCK_STATE_* value
+	uint8_t position;			 //!< The PHY_LOCK_POSITION_* value
+	uint8_t alarm;				 //!< Whether the alarm is on
+	uint8_t commit_failed; //!< Whether the last claim or release failed to commit, until one goes through
+} cl_lock_cmd_status_t;
+
+#define CL_LOCK_CMD_MAX_RSP_PAYLOAD (CL_LOCK_CMD_LOG_RECORDS * sizeof(cl_journal_record_t))
+#define CL_LOCK_CMD_MAX_RESPONSE (CL_LOCK_CMD_MAX_BATCH * (CL_LOCK_CMD_RSP_HEADER_LEN + CL_LOCK_CMD_MAX_RSP_PAYLOAD))
+
+/**
+ * Run a batch of requests against the lock and build their responses.
+ * Must run on the lock task, see cl_phy_lock_svc_run(), so that no other event interleaves with the batch.
+ *
+ * @param req The written request frames.
+ * @param req_len Length of req, at most CL_LOCK_CMD_MAX_WRITE.
+ * @param rsp Buffer of CL_LOCK_CMD_MAX_RESPONSE bytes receiving the response frames.
+ *
+ * @return Length of the response frames written to rsp.
+ */
+extern uint16_t cl_ble_lock_cmd_run(const uint8_t *req, uint16_t req_len, uint8_t *rsp);
+
+#endif // _CL_BLE_LOCK_CMD_H_
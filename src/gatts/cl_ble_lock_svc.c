@@ -1,20 +1,89 @@
 // Library
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <string.h>
 // ESP32
 #include "esp_log.h"
 #include "esp_err.h"
 // Bluetooth
 #include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
 // Local
+#include "lazy_log.h"
+#include "stringify.h"
 #include "uuid_utils.h"
+#include "cl_ble_bond.h"
+#include "cl_ble_conn.h"
+#include "cl_ble_lock_cmd.h"
 #include "cl_ble_lock_svc.h"
 #include "cl_phy_lock_svc.h"
 
+// -- DEFINES --
+#define STATE_NOT_NOTIFIED -1 //!< notified_state of a subscriber that didn't receive any state yet
+#define DEFAULT_MTU 23				//!< ATT MTU of a connection the connection manager doesn't know
+
+// -- INTERNAL TYPES --
+
+/**
+ * @internal
+ * @brief A connection subscribed to the state notifications.
+ */
+typedef struct
+{
+	uint16_t conn_handle;		//!< BLE_HS_CONN_HANDLE_NONE for a free slot
+	int16_t notified_state; //!< Last state notified to the connection, STATE_NOT_NOTIFIED if none
+} state_subscriber_t;
+
+/**
+ * @internal
+ * @brief A command write run by the lock task, and its responses notified once the batch has run.
+ * While busy the lock task owns req, len and data, the NimBLE host task leaves the slot alone.
+ */
+typedef struct
+{
+	uint16_t conn_handle; //!< BLE_HS_CONN_HANDLE_NONE for a free slot
+	atomic_bool busy;			//!< Set while the batch waits for or runs on the lock task
+	uint16_t req_len;			//!< Length of the request frames
+	uint16_t len;					//!< Length of the response frames, 0 once notified
+	uint8_t req[CL_LOCK_CMD_MAX_WRITE];
+	uint8_t data[CL_LOCK_CMD_MAX_RESPONSE];
+} cmd_response_t;
+
+/**
+ * @internal
+ * @brief A descriptor value, built at compile time and kept in flash.
+ */
+typedef struct
+{
+	uint8_t state;	//!< The PHY_LOCK_STATE_* value described, unused by the request descriptors
+	uint16_t len;		//!< Length of text, without the null-terminator
+	const char *text;
+} desc_text_t;
+
+#define DESC_TEXT(text) {0, sizeof(text) - 1, text}
+
+/**
+ * @internal
+ * @brief Explanation of a request characteristic: the accepted values and the ATT errors of a rejection.
+ */
+#define REQ_DESC_TEXT(action)                                                                                               \
+	DESC_TEXT("Write the requester UUID to " action ", as 16 bytes in little-endian order or as the 8-4-4-4-12 string. " \
+						"Errors: [0x0D] the value is neither, [0x0E] the lock refused the request in its current state or from this requester.")
+
 // -- INTERNAL FUNCTIONS --
+static int get_requester_uuid(struct os_mbuf *om, uint8_t buf[16], const uint8_t **uuid);
+static void state_changed(uint8_t state, void *arg);
+static void notify_state_event(struct ble_npl_event *ev);
+static void run_cmd_batch(void *arg);
+static void notify_cmd_response(cmd_response_t *response);
+static void notify_cmd_responses_event(struct ble_npl_event *ev);
 int cl_ble_lock_svc_state_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 int cl_ble_lock_svc_state_desc_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+int cl_ble_lock_svc_req_desc_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 int cl_ble_lock_svc_req_claim_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 int cl_ble_lock_svc_req_release_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+int cl_ble_lock_svc_cmd_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+int cl_ble_lock_svc_rsp_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 
 // -- RUNTIME VARIABLES --
 static const char *LOG_TAG = "blesvc_lock";
@@ -42,6 +111,13 @@ uint16_t cl_ble_lock_svc_state_char_val_handle;
  */
 const ble_uuid128_t cl_ble_lock_svc_state_desc_uuid = BLE_UUID128_INIT(0x94, 0x7f, 0x6b, 0x0c, 0x5b, 0x5e, 0xe3, 0x80, 0xd2, 0x47, 0xaf, 0x10, 0x83, 0x4a, 0x12, 0xb3);
 
+/**
+ * Bluetooth LE GATT uuid for the descriptors of the request characteristics.
+ *
+ * 55e8e165-15a6-4f05-aa8c-8d52553cb368
+ */
+const ble_uuid128_t cl_ble_lock_svc_req_desc_uuid = BLE_UUID128_INIT(0x68, 0xb3, 0x3c, 0x55, 0x52, 0x8d, 0x8c, 0xaa, 0x05, 0x4f, 0xa6, 0x15, 0x65, 0xe1, 0xe8, 0x55);
+
 /**
  * Bluetooth LE GATT uuid for the request claim characteristic.
  *
@@ -58,6 +134,46 @@ uint16_t cl_ble_lock_svc_req_claim_char_val_handle;
 const ble_uuid128_t cl_ble_lock_svc_req_release_char_uuid = BLE_UUID128_INIT(0x6a, 0x90, 0x5a, 0x8d, 0x37, 0x2c, 0x13, 0xb6, 0x64, 0x4c, 0x31, 0x3b, 0x3d, 0x4b, 0xe8, 0x68);
 uint16_t cl_ble_lock_svc_req_release_char_val_handle;
 
+/**
+ * Bluetooth LE GATT uuid for the command characteristic, see cl_ble_lock_cmd.h for the framing.
+ *
+ * 7136f857-d127-48cd-90d7-748129889091
+ */
+const ble_uuid128_t cl_ble_lock_svc_cmd_char_uuid = BLE_UUID128_INIT(0x91, 0x90, 0x88, 0x29, 0x81, 0x74, 0xd7, 0x90, 0xcd, 0x48, 0x27, 0xd1, 0x57, 0xf8, 0x36, 0x71);
+uint16_t cl_ble_lock_svc_cmd_char_val_handle;
+
+/**
+ * Bluetooth LE GATT uuid for the response characteristic, notifying the responses to the commands.
+ * This characteristic has a NOTIFY property only.
+ *
+ * 0b7acaae-1ad8-4a7a-aa26-a96ff8c92553
+ */
+const ble_uuid128_t cl_ble_lock_svc_rsp_char_uuid = BLE_UUID128_INIT(0x53, 0x25, 0xc9, 0xf8, 0x6f, 0xa9, 0x26, 0xaa, 0x7a, 0x4a, 0xd8, 0x1a, 0xae, 0xca, 0x7a, 0x0b);
+uint16_t cl_ble_lock_svc_rsp_char_val_handle;
+
+/**
+ * Subscribers of the state characteristic, only accessed from the NimBLE host task.
+ */
+static state_subscriber_t state_subscribers[CL_BLE_MAX_CONNECTIONS];
+static atomic_uint_fast8_t published_state = PHY_LOCK_STATE_UNKNOWN; //!< Latest state published by the lock
+static struct ble_npl_event state_notify_ev;													 //!< Queued on the NimBLE host task, at most once
+
+/**
+ * Command responses waiting to be notified, only accessed from the NimBLE host task.
+ */
+static cmd_response_t cmd_responses[CL_BLE_MAX_CONNECTIONS];
+static struct ble_npl_event cmd_notify_ev;
+
+/**
+ * Explanation of every state, generated from PHY_LOCK_STATES.
+ */
+#define STATE_DESC_TEXT(id, value, name, explanation) \
+	{PHY_LOCK_STATE_##id, sizeof("[uint " #value "] " name ": " explanation) - 1, "[uint " #value "] " name ": " explanation},
+static const desc_text_t state_desc_texts[] = {PHY_LOCK_STATES(STATE_DESC_TEXT)};
+
+static const desc_text_t req_claim_desc_text = REQ_DESC_TEXT("claim");
+static const desc_text_t req_release_desc_text = REQ_DESC_TEXT("release, or to cancel a claim not confirmed yet");
+
 const struct ble_gatt_svc_def cl_ble_lock_svc_def[] =
 		{{
 				 .type = BLE_GATT_SVC_TYPE_PRIMARY,
@@ -88,7 +204,17 @@ const struct ble_gatt_svc_def cl_ble_lock_svc_def[] =
 								 .access_cb = cl_ble_lock_svc_req_claim_char_cb,
 								 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
 								 .val_handle = &cl_ble_lock_svc_req_claim_char_val_handle,
-								 // TODO add descriptors explaining the request claim values and errors
+								 .descriptors = (struct ble_gatt_dsc_def[]){
+										 // Descriptor explaining the request values and errors
+										 {
+												 .uuid = &cl_ble_lock_svc_req_desc_uuid.u,
+												 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
+												 .att_flags = BLE_ATT_F_READ,
+												 .access_cb = cl_ble_lock_svc_req_desc_cb,
+												 .arg = (void *)&req_claim_desc_text,
+										 },
+										 {0},
+								 },
 						 },
 						 // Request release characteristic
 						 {
@@ -97,7 +223,34 @@ const struct ble_gatt_svc_def cl_ble_lock_svc_def[] =
 								 .access_cb = cl_ble_lock_svc_req_release_char_cb,
 								 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
 								 .val_handle = &cl_ble_lock_svc_req_release_char_val_handle,
-								 // TODO add descriptors explaining the request claim values and errors
+								 .descriptors = (struct ble_gatt_dsc_def[]){
+										 // Descriptor explaining the request values and errors
+										 {
+												 .uuid = &cl_ble_lock_svc_req_desc_uuid.u,
+												 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
+												 .att_flags = BLE_ATT_F_READ,
+												 .access_cb = cl_ble_lock_svc_req_desc_cb,
+												 .arg = (void *)&req_release_desc_text,
+										 },
+										 {0},
+								 },
+						 },
+						 // Command characteristic, batches of claim, release and status requests
+						 // Just Works pairing never authenticates the link, it takes encryption as the claim and release ones do
+						 {
+								 .uuid = &cl_ble_lock_svc_cmd_char_uuid.u,
+								 .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+								 .access_cb = cl_ble_lock_svc_cmd_char_cb,
+								 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
+								 .val_handle = &cl_ble_lock_svc_cmd_char_val_handle,
+						 },
+						 // Response characteristic
+						 {
+								 .uuid = &cl_ble_lock_svc_rsp_char_uuid.u,
+								 .flags = BLE_GATT_CHR_F_NOTIFY,
+								 .access_cb = cl_ble_lock_svc_rsp_char_cb,
+								 .min_key_size = CL_BLE_MIN_GATT_ENC_KEY_LEN,
+								 .val_handle = &cl_ble_lock_svc_rsp_char_val_handle,
 						 },
 						 {0},
 				 },
@@ -114,119 +267,196 @@ int cl_ble_lock_svc_state_char_cb(uint16_t conn_handle, uint16_t attr_handle, st
 
 int cl_ble_lock_svc_state_desc_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-	const char *state_explanations[] = {
-			[PHY_LOCK_STATE_UNKNOWN] = "[uint 255] Unknown: The device has not yet initialized the lock state. This should never happen.",
-			[PHY_LOCK_STATE_UNCLAIMED] = "[uint 0] Unclaimed: The device can accept claims requests as it has no owner yet.",
-			[PHY_LOCK_STATE_CLAIMED] = "[uint 1] Claimed: The device is claimed and in use by a user and cannot be claimed by another user.",
-			[PHY_LOCK_STATE_REQUESTED_CLAIM] = "[uint 2] Requested Claim: The device has received a claim request and is waiting for the user to confirm the claim.",
-			[PHY_LOCK_STATE_REQUESTED_RELEASE] = "[uint 3] Requested Release: The device has received a release request and is waiting for the user to confirm the release.",
-			[PHY_LOCK_STATE_SUPPORT] = "[uint 4] Support: The device is in support mode and need maintenance. Unavailable.",
-	}; // NOTE: Adjust this according to PHY_LOCK_STATE_* in cl_phy_lock_svc.h
-
 	uint8_t phy_svc_state = cl_phy_lock_svc_get_state();
 
-	// we cannot exceed the size of the state_explanations array as the states are known
-	const char *explanation = state_explanations[phy_svc_state];
+	// the state is always one of PHY_LOCK_STATES
+	const desc_text_t *desc = &state_desc_texts[0];
+	for (int i = 0; i < sizeof(state_desc_texts) / sizeof(state_desc_texts[0]); i++)
+	{
+		if (state_desc_texts[i].state == phy_svc_state)
+		{
+			desc = &state_desc_texts[i];
+			break;
+		}
+	}
 
-	// Copy the explanation into the response buffer
-	int ret = os_mbuf_append(ctxt->om, explanation, strlen(explanation));
+	// NimBLE answers long reads from the whole value, skipping the offset itself
+	int ret = os_mbuf_append(ctxt->om, desc->text, desc->len);
+	return ret == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+int cl_ble_lock_svc_req_desc_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+	const desc_text_t *desc = arg;
+	int ret = os_mbuf_append(ctxt->om, desc->text, desc->len);
 	return ret == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
 
 int cl_ble_lock_svc_req_claim_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-	uint16_t om_len = OS_MBUF_PKTLEN(ctxt->om);
-	int ret;
+	cl_ble_bond_on_request(conn_handle);
 
-	if (om_len < (BLE_UUID_STR_LEN - 1) || om_len > BLE_UUID_STR_LEN)
+	uint8_t uuid_buf[16];
+	const uint8_t *uuid;
+	int ret = get_requester_uuid(ctxt->om, uuid_buf, &uuid);
+	if (ret != 0)
 	{
-		ESP_LOGE(LOG_TAG, "Input mbuf not fitting uuid128 len; len=%d", om_len);
-		return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+		return ret;
 	}
-	// we expect a string uuid in the format of 8-4-4-4-12 null-terminated
-	char uuid_str[BLE_UUID_STR_LEN];
-	uint16_t len = 0;
-	ret = ble_hs_mbuf_to_flat(ctxt->om, uuid_str, BLE_UUID_STR_LEN, &len);
+
+	// TODO improve error reporting
+	ret = cl_phy_lock_svc_request_claim(uuid);
 	if (ret != 0)
 	{
-		ESP_LOGE(LOG_TAG, "Failed to convert mbuf to flat; ret=%d", ret);
+		ESP_LOGE(LOG_TAG, "Failed to request claim; ret=%d", ret);
 		return BLE_ATT_ERR_UNLIKELY;
 	}
-	// We add the null-termination if missing
-	if (len < BLE_UUID_STR_LEN)
-	{
-		uuid_str[len] = '\0';
-	}
-	// let's get the uuid
-	uint8_t uuid_bytes[16];
-	convert_uuid_to_bytes(uuid_str, uuid_bytes, 1);
-	ble_uuid_any_t requested_claim_uuid;
-	ret = ble_uuid_init_from_buf(&requested_claim_uuid, uuid_bytes, sizeof(uuid_bytes));
+
+	LAZY_LOGI(LOG_TAG, "Requested claim; uuid=%s", UUID_TO_STRING(uuid));
+
+	return 0;
+}
+
+int cl_ble_lock_svc_req_release_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+	cl_ble_bond_on_request(conn_handle);
+
+	uint8_t uuid_buf[16];
+	const uint8_t *uuid;
+	int ret = get_requester_uuid(ctxt->om, uuid_buf, &uuid);
 	if (ret != 0)
 	{
-		ESP_LOGE(LOG_TAG, "Failed to init uuid from buf; ret=%d", ret);
-		return BLE_ATT_ERR_UNLIKELY;
+		return ret;
 	}
 
 	// TODO improve error reporting
-	ret = cl_phy_lock_svc_request_claim(requested_claim_uuid.u128.value);
+	ret = cl_phy_lock_svc_request_release(uuid);
 	if (ret != 0)
 	{
-		ESP_LOGE(LOG_TAG, "Failed to request claim; ret=%d", ret);
+		ESP_LOGE(LOG_TAG, "Failed to request release; ret=%d", ret);
 		return BLE_ATT_ERR_UNLIKELY;
 	}
 
-	ESP_LOGI(LOG_TAG, "Requested claim; uuid=%s", uuid_str);
+	LAZY_LOGI(LOG_TAG, "Requested release; uuid=%s", UUID_TO_STRING(uuid));
 
 	return 0;
 }
 
-int cl_ble_lock_svc_req_release_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+int cl_ble_lock_svc_cmd_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-	uint16_t om_len = OS_MBUF_PKTLEN(ctxt->om);
-	int ret;
+	cl_ble_bond_on_request(conn_handle);
 
-	// we accept a uuid not null terminated as we will add it if missing
-	if (om_len < (BLE_UUID_STR_LEN - 1) || om_len > BLE_UUID_STR_LEN)
+	uint16_t req_len = OS_MBUF_PKTLEN(ctxt->om);
+	if (req_len == 0 || req_len > CL_LOCK_CMD_MAX_WRITE)
 	{
-		ESP_LOGE(LOG_TAG, "Input mbuf not fitting uuid128 length; len=%d", om_len);
+		ESP_LOGE(LOG_TAG, "Command batch too long; len=%d", req_len);
 		return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
 	}
-	// we expect a string uuid in the format of 8-4-4-4-12 null-terminated
-	char uuid_str[BLE_UUID_STR_LEN];
-	uint16_t len = 0;
-	ret = ble_hs_mbuf_to_flat(ctxt->om, uuid_str, BLE_UUID_STR_LEN, &len);
-	if (ret != 0)
+
+	// the connection's slot, or a free one the lock task is done with
+	cmd_response_t *response = NULL;
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS && response == NULL; i++)
 	{
-		ESP_LOGE(LOG_TAG, "Failed to convert mbuf to flat; ret=%d", ret);
-		return BLE_ATT_ERR_UNLIKELY;
+		if (cmd_responses[i].conn_handle == conn_handle)
+		{
+			response = &cmd_responses[i];
+		}
 	}
-	// We add the null-termination if missing
-	if (len < BLE_UUID_STR_LEN)
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS && response == NULL; i++)
 	{
-		uuid_str[len] = '\0';
+		if (cmd_responses[i].conn_handle == BLE_HS_CONN_HANDLE_NONE && !atomic_load(&cmd_responses[i].busy))
+		{
+			response = &cmd_responses[i];
+			response->len = 0;
+		}
 	}
-	// let's get the uuid
-	uint8_t uuid_bytes[16];
-	convert_uuid_to_bytes(uuid_str, uuid_bytes, 1);
-	ble_uuid_any_t requested_release_uuid;
-	ret = ble_uuid_init_from_buf(&requested_release_uuid, uuid_bytes, sizeof(uuid_bytes));
-	if (ret != 0)
+	// one batch in flight per connection
+	if (response == NULL || atomic_load(&response->busy))
 	{
-		ESP_LOGE(LOG_TAG, "Failed to init uuid from buf; ret=%d", ret);
-		return BLE_ATT_ERR_UNLIKELY;
+		return BLE_ATT_ERR_INSUFFICIENT_RES;
 	}
+	// responses to the previous write go out first
+	notify_cmd_response(response);
 
-	// TODO improve error reporting
-	ret = cl_phy_lock_svc_request_release(requested_release_uuid.u128.value);
-	if (ret != 0)
+	if (os_mbuf_copydata(ctxt->om, 0, req_len, response->req) != 0)
 	{
-		ESP_LOGE(LOG_TAG, "Failed to request release; ret=%d", ret);
 		return BLE_ATT_ERR_UNLIKELY;
 	}
+	response->conn_handle = conn_handle;
+	response->req_len = req_len;
+	atomic_store(&response->busy, true);
+	// the batch may wait on NVS commits, it runs on the lock task and the write is answered right away
+	if (cl_phy_lock_svc_run(run_cmd_batch, response) != ESP_OK)
+	{
+		atomic_store(&response->busy, false);
+		return BLE_ATT_ERR_INSUFFICIENT_RES;
+	}
+	return 0;
+}
 
-	ESP_LOGI(LOG_TAG, "Requested release; uuid=%s", uuid_str);
+int cl_ble_lock_svc_rsp_char_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+	// notify only, the stack never reads it
+	return BLE_ATT_ERR_READ_NOT_PERMITTED;
+}
 
+/**
+ * @internal
+ * @brief Get the requester UUID written to the claim or release characteristic, in NimBLE (little-endian) byte order.
+ * Two formats are accepted, told apart by length:
+ * - 16 bytes: the raw UUID in little-endian order, referenced in place when the first mbuf holds it whole.
+ * - 36 or 37 bytes: the 8-4-4-4-12 string, optionally null-terminated, parsed in place when contiguous.
+ *
+ * @param om The written value.
+ * @param buf Scratch buffer holding the UUID when it can't be referenced in place.
+ * @param uuid Set to the UUID, valid for the duration of the access callback.
+ *
+ * @return 0 on success, otherwise the ATT error to return.
+ */
+static int get_requester_uuid(struct os_mbuf *om, uint8_t buf[16], const uint8_t **uuid)
+{
+	uint16_t om_len = OS_MBUF_PKTLEN(om);
+
+	if (om_len == 16)
+	{
+		if (om->om_len >= 16)
+		{
+			*uuid = om->om_data;
+			return 0;
+		}
+		// the value is split across a chain, gather it
+		if (os_mbuf_copydata(om, 0, 16, buf) != 0)
+		{
+			return BLE_ATT_ERR_UNLIKELY;
+		}
+		*uuid = buf;
+		return 0;
+	}
+
+	// we accept a uuid not null terminated, the length tells
+	if (om_len < (BLE_UUID_STR_LEN - 1) || om_len > BLE_UUID_STR_LEN)
+	{
+		ESP_LOGE(LOG_TAG, "Input mbuf not fitting uuid128 length; len=%d", om_len);
+		return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+	}
+	// we expect a string uuid in the format of 8-4-4-4-12, parsed in place when contiguous
+	const char *uuid_str = (const char *)om->om_data;
+	char uuid_flat[BLE_UUID_STR_LEN];
+	if (om->om_len < om_len)
+	{
+		if (os_mbuf_copydata(om, 0, om_len, uuid_flat) != 0)
+		{
+			return BLE_ATT_ERR_UNLIKELY;
+		}
+		uuid_str = uuid_flat;
+	}
+	// a malformed string is no UUID either, 0x0E only tells a refusal of the lock
+	if (convert_uuid_n_to_bytes(uuid_str, om_len, buf, 1) != 0)
+	{
+		ESP_LOGE(LOG_TAG, "Invalid uuid string");
+		return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+	}
+	*uuid = buf;
 	return 0;
 }
 
@@ -246,5 +476,209 @@ int cl_ble_lock_svc_init(void)
 		return ret;
 	}
 
+	// publish the state changes to the subscribers
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		state_subscribers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+	}
+	ble_npl_event_init(&state_notify_ev, notify_state_event, NULL);
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		cmd_responses[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+	}
+	ble_npl_event_init(&cmd_notify_ev, notify_cmd_responses_event, NULL);
+	atomic_store(&published_state, cl_phy_lock_svc_get_state());
+	ret = cl_phy_lock_svc_add_state_cb(state_changed, NULL);
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to register state callback; ret=%d", ret);
+		return ret;
+	}
+
 	return ret;
-}
\ No newline at end of file
+}
+
+void cl_ble_lock_svc_on_gap_event(const struct ble_gap_event *event)
+{
+	switch (event->type)
+	{
+	case BLE_GAP_EVENT_SUBSCRIBE:
+		if (event->subscribe.attr_handle != cl_ble_lock_svc_state_char_val_handle)
+		{
+			return;
+		}
+		// drop any previous subscription of the connection, then take a free slot if it subscribes
+		for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+		{
+			if (state_subscribers[i].conn_handle == event->subscribe.conn_handle)
+			{
+				state_subscribers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+			}
+		}
+		if (!event->subscribe.cur_notify)
+		{
+			return;
+		}
+		for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+		{
+			state_subscriber_t *subscriber = &state_subscribers[i];
+			if (subscriber->conn_handle == BLE_HS_CONN_HANDLE_NONE)
+			{
+				subscriber->conn_handle = event->subscribe.conn_handle;
+				subscriber->notified_state = STATE_NOT_NOTIFIED;
+				// bring the new subscriber up to date right away
+				ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &state_notify_ev);
+				return;
+			}
+		}
+		return;
+
+	case BLE_GAP_EVENT_DISCONNECT:
+		for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+		{
+			if (state_subscribers[i].conn_handle == event->disconnect.conn.conn_handle)
+			{
+				state_subscribers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+			}
+			if (cmd_responses[i].conn_handle == event->disconnect.conn.conn_handle)
+			{
+				// a batch still running drops its responses, see notify_cmd_responses_event
+				cmd_responses[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+				if (!atomic_load(&cmd_responses[i].busy))
+				{
+					cmd_responses[i].len = 0;
+				}
+			}
+		}
+		return;
+
+	default:
+		return;
+	}
+}
+
+/**
+ * @internal
+ * @brief Lock state callback: records the state and defers the notifications to the NimBLE host task.
+ * The event is queued at most once, so a burst of transitions is coalesced into one notification of the latest
+ * state.
+ */
+static void state_changed(uint8_t state, void *arg)
+{
+	atomic_store(&published_state, state);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &state_notify_ev);
+}
+
+/**
+ * @internal
+ * @brief Notify the latest state to every subscriber that hasn't received it yet.
+ */
+static void notify_state_event(struct ble_npl_event *ev)
+{
+	uint8_t state = atomic_load(&published_state);
+
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		state_subscriber_t *subscriber = &state_subscribers[i];
+		if (subscriber->conn_handle == BLE_HS_CONN_HANDLE_NONE || subscriber->notified_state == state)
+		{
+			continue;
+		}
+
+		struct os_mbuf *om = ble_hs_mbuf_from_flat(&state, sizeof(state));
+		if (om == NULL)
+		{
+			ESP_LOGE(LOG_TAG, "No mbuf for state notification; conn_handle=%d", subscriber->conn_handle);
+			continue;
+		}
+		// the mbuf is consumed even on failure
+		int ret = ble_gatts_notify_custom(subscriber->conn_handle, cl_ble_lock_svc_state_char_val_handle, om);
+		if (ret != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to notify state; conn_handle=%d ret=%d", subscriber->conn_handle, ret);
+			continue;
+		}
+		subscriber->notified_state = state;
+	}
+}
+
+/**
+ * @internal
+ * @brief Run a command batch, on the lock task, and hand its responses back to the NimBLE host task.
+ */
+static void run_cmd_batch(void *arg)
+{
+	cmd_response_t *response = arg;
+	response->len = cl_ble_lock_cmd_run(response->req, response->req_len, response->data);
+	atomic_store(&response->busy, false);
+	ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &cmd_notify_ev);
+}
+
+/**
+ * @internal
+ * @brief Notify the pending responses of a connection, as many frames per notification as the ATT MTU allows.
+ */
+static void notify_cmd_response(cmd_response_t *response)
+{
+	if (response->len == 0)
+	{
+		return;
+	}
+
+	cl_ble_conn_info_t info;
+	uint16_t max_len = (cl_ble_conn_get_info(response->conn_handle, &info) == ESP_OK ? info.mtu : DEFAULT_MTU) - 3;
+	uint16_t off = 0;
+	while (off < response->len)
+	{
+		// whole frames only, a response never straddles two notifications
+		uint16_t len = 0;
+		while (off + len < response->len)
+		{
+			uint16_t frame_len = CL_LOCK_CMD_RSP_HEADER_LEN + response->data[off + len + 3];
+			if (len > 0 && len + frame_len > max_len)
+			{
+				break;
+			}
+			len += frame_len;
+		}
+
+		struct os_mbuf *om = ble_hs_mbuf_from_flat(&response->data[off], len);
+		if (om == NULL)
+		{
+			ESP_LOGE(LOG_TAG, "No mbuf for command response; conn_handle=%d", response->conn_handle);
+			break;
+		}
+		int ret = ble_gatts_notify_custom(response->conn_handle, cl_ble_lock_svc_rsp_char_val_handle, om);
+		if (ret != 0)
+		{
+			ESP_LOGE(LOG_TAG, "Failed to notify command response; conn_handle=%d ret=%d", response->conn_handle, ret);
+			break;
+		}
+		off += len;
+	}
+	response->len = 0;
+}
+
+/**
+ * @internal
+ * @brief Notify the command responses pending on every connection.
+ */
+static void notify_cmd_responses_event(struct ble_npl_event *ev)
+{
+	for (int i = 0; i < CL_BLE_MAX_CONNECTIONS; i++)
+	{
+		if (atomic_load(&cmd_responses[i].busy))
+		{
+			continue;
+		}
+		if (cmd_responses[i].conn_handle != BLE_HS_CONN_HANDLE_NONE)
+		{
+			notify_cmd_response(&cmd_responses[i]);
+		}
+		else
+		{
+			// the connection went away while its batch ran
+			cmd_responses[i].len = 0;
+		}
+	}
+}
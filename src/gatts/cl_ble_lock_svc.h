@@ -12,9 +12,21 @@ extern uint16_t cl_ble_lock_svc_req_claim_char_val_handle;
 
 extern uint16_t cl_ble_lock_svc_req_release_char_val_handle;
 
+extern uint16_t cl_ble_lock_svc_cmd_char_val_handle;
+
+extern uint16_t cl_ble_lock_svc_rsp_char_val_handle;
+
 /**
  * Initialize the BLE lock service by adding it to the BLE GATT server db.
+ * It also starts publishing the lock state changes to the subscribed centrals.
  */
 extern int cl_ble_lock_svc_init(void);
 
+/**
+ * Track the state subscriptions of the centrals, to be called from the GAP event handler.
+ * Handles BLE_GAP_EVENT_SUBSCRIBE and BLE_GAP_EVENT_DISCONNECT, other events are ignored.
+ * Disconnecting also drops the command responses not notified yet.
+ */
+extern void cl_ble_lock_svc_on_gap_event(const struct ble_gap_event *event);
+
 #endif // _CL_BLE_LOCK_SVC_H_
\ No newline at end of file
@@ -1,4 +1,5 @@
 // Library
+#include <inttypes.h>
 #include <stdio.h>
 // FreeRTOS
 #include "freertos/FreeRTOS.h"
@@ -8,11 +9,20 @@
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
+#include "esp_ota_ops.h"
 #include "nvs_flash.h"
 // Local
+#include "board_info.h"
 #include "device_info.h"
 #include "cl_ble_svc.h"
+#include "cl_gpio_hub.h"
 #include "cl_phy_lock_svc.h"
+#include "cl_power.h"
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static esp_err_t init_board_inputs(void);
+static void board_input_handler(const cl_gpio_event_t *event, void *arg);
+static void lock_state_changed(uint8_t state, void *arg);
 
 // -- RUNTIME VARIABLES --
 static const char *LOG_TAG = "main";
@@ -37,8 +47,17 @@ void app_main(void)
 	}
 	ESP_LOGI(LOG_TAG, "NVS flash initialized");
 
-	// Initialize the GPIO interrupt service.
-	ret = gpio_install_isr_service(ESP_INTR_FLAG_LOWMED | ESP_INTR_FLAG_SHARED);
+	// Initialize power management before the tasks taking its locks start.
+	ret = cl_power_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init power management; ret=%s", esp_err_to_name(ret));
+		return;
+	}
+	ESP_LOGI(LOG_TAG, "Power management initialized");
+
+	// Initialize the GPIO interrupt service, in IRAM so that edges are recorded while NVS or OTA writes the flash.
+	ret = gpio_install_isr_service(ESP_INTR_FLAG_LOWMED | ESP_INTR_FLAG_SHARED | ESP_INTR_FLAG_IRAM);
 	if (ret != ESP_OK)
 	{
 		ESP_LOGE(LOG_TAG, "Failed to install GPIO isr service; ret=%s", esp_err_to_name(ret));
@@ -46,21 +65,129 @@ void app_main(void)
 	}
 	ESP_LOGI(LOG_TAG, "GPIO isr service installed");
 
-	// Initialize the physical lock.
+	// Initialize the GPIO event hub shared by every input.
+	ret = cl_gpio_hub_init();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init GPIO hub; ret=%s", esp_err_to_name(ret));
+		return;
+	}
+	ret = init_board_inputs();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to init board inputs; ret=%s", esp_err_to_name(ret));
+		return;
+	}
+	ESP_LOGI(LOG_TAG, "GPIO hub initialized");
+
+	// Initialize the physical lock, its states are the phases of the power accounting from the restore on.
+	// A lock that fails to restore stays in support mode: BLE still comes up so it can be serviced and updated.
+	cl_phy_lock_svc_add_state_cb(lock_state_changed, NULL);
 	ret = cl_phy_lock_svc_init();
 	if (ret != ESP_OK)
 	{
 		ESP_LOGE(LOG_TAG, "Failed to init physical lock; ret=%s", esp_err_to_name(ret));
-		return;
 	}
-	ESP_LOGI(LOG_TAG, "Physical lock initialized");
+	else
+	{
+		ESP_LOGI(LOG_TAG, "Physical lock initialized");
+	}
 
-	// Initialize the BLE service.
-	ret = cl_ble_svc_init();
+	// Wake from light sleep when the bolt moves or the button is pressed.
+	ret = cl_power_add_wake_input(LOCK_SENSOR_IN_PIN);
+	if (ret == ESP_OK)
+	{
+		ret = cl_power_add_wake_input(USER_BUTTON_PIN);
+	}
 	if (ret != ESP_OK)
 	{
-		ESP_LOGE(LOG_TAG, "BLE init failed; ret=%s", esp_err_to_name(ret));
+		ESP_LOGE(LOG_TAG, "Failed to set wake inputs; ret=%s", esp_err_to_name(ret));
+	}
+	else
+	{
+		ESP_LOGI(LOG_TAG, "Wake inputs set");
+	}
+
+	// Initialize the BLE service, its modules follow the lock state from the one restored.
+	esp_err_t ble_ret = cl_ble_svc_init();
+	if (ble_ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "BLE init failed; ret=%s", esp_err_to_name(ble_ret));
+	}
+	else
+	{
+		ESP_LOGI(LOG_TAG, "BLE init success");
+	}
+
+	// Start the lock once every module follows its state, the bolt is watched even without BLE.
+	ret = cl_phy_lock_svc_start();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to start physical lock; ret=%s", esp_err_to_name(ret));
+	}
+	else
+	{
+		ESP_LOGI(LOG_TAG, "Physical lock started");
+	}
+	if (ble_ret != ESP_OK)
+	{
 		return;
 	}
-	ESP_LOGI(LOG_TAG, "BLE init success");
+
+	// The image works as far as it can take the next update, whatever the lock restored: the bootloader rolls back to
+	// the previous one otherwise.
+	ret = esp_ota_mark_app_valid_cancel_rollback();
+	if (ret != ESP_OK)
+	{
+		ESP_LOGE(LOG_TAG, "Failed to confirm the image; ret=%s", esp_err_to_name(ret));
+	}
+}
+
+/**
+ * @internal
+ * @brief Serve the board inputs (user button, PMU and modem interrupts) from the GPIO hub.
+ * All of them are active low.
+ */
+static esp_err_t init_board_inputs(void)
+{
+	static const gpio_num_t board_inputs[] = {USER_BUTTON_PIN, PMU_INPUT_PIN, BOARD_MODEM_RI_PIN};
+	const cl_debounce_config_t button_debounce = CL_DEBOUNCE_CONFIG_DEFAULT();
+
+	for (int i = 0; i < sizeof(board_inputs) / sizeof(board_inputs[0]); i++)
+	{
+		gpio_num_t pin = board_inputs[i];
+		gpio_reset_pin(pin);
+		gpio_set_direction(pin, GPIO_MODE_INPUT);
+		gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+		gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+		// keep the pull-ups through light sleep, a floating line would give spurious edges on wakeup
+		gpio_sleep_sel_dis(pin);
+
+		// only the button is mechanical, the PMU and modem lines are driven cleanly
+		esp_err_t ret = cl_gpio_hub_add(pin, pin == USER_BUTTON_PIN ? &button_debounce : NULL, board_input_handler, NULL);
+		if (ret != ESP_OK)
+		{
+			return ret;
+		}
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * @internal
+ * @brief Log the board inputs until they get a service of their own.
+ */
+static void board_input_handler(const cl_gpio_event_t *event, void *arg)
+{
+	ESP_LOGI(LOG_TAG, "GPIO_%d -> %d at %" PRId64 "us", event->pin, event->level, event->time_us);
+}
+
+/**
+ * @internal
+ * @brief Account the power of each lock state separately.
+ */
+static void lock_state_changed(uint8_t state, void *arg)
+{
+	cl_power_set_phase(state);
 }
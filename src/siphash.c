@@ -0,0 +1,80 @@
+#include "siphash.h"
+
+// -- DEFINES --
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) \
+	do                             \
+	{                              \
+		v0 += v1;                    \
+		v1 = ROTL(v1, 13);           \
+		v1 ^= v0;                    \
+		v0 = ROTL(v0, 32);           \
+		v2 += v3;                    \
+		v3 = ROTL(v3, 16);           \
+		v3 ^= v2;                    \
+		v0 += v3;                    \
+		v3 = ROTL(v3, 21);           \
+		v3 ^= v0;                    \
+		v2 += v1;                    \
+		v1 = ROTL(v1, 17);           \
+		v1 ^= v2;                    \
+		v2 = ROTL(v2, 32);           \
+	} while (0)
+
+// -- INTERNAL FUNCTION DECLARATIONS --
+static inline uint64_t read_le64(const uint8_t *p);
+
+uint64_t siphash24(const uint8_t key[SIPHASH_KEY_LEN], const void *data, size_t len)
+{
+	const uint8_t *in = data;
+	uint64_t k0 = read_le64(key);
+	uint64_t k1 = read_le64(key + 8);
+	uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+	// whole 8-byte words
+	const uint8_t *end = in + (len & ~(size_t)7);
+	for (; in != end; in += 8)
+	{
+		uint64_t m = read_le64(in);
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	// the remaining bytes, with the message length in the top byte
+	uint64_t b = (uint64_t)len << 56;
+	for (int i = len & 7; i > 0; i--)
+	{
+		b |= (uint64_t)in[i - 1] << (8 * (i - 1));
+	}
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * @internal
+ * @brief Read a little-endian 64-bit word, whatever the alignment.
+ */
+static inline uint64_t read_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--)
+	{
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
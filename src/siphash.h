@@ -0,0 +1,20 @@
+#ifndef _SIPHASH_H_
+#define _SIPHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIPHASH_KEY_LEN 16 //!< Length of a SipHash key, in bytes
+
+/**
+ * Compute the SipHash-2-4 of a message: a 64-bit keyed MAC suited to short messages such as advertising frames.
+ *
+ * @param key The 16-byte secret key.
+ * @param data The message.
+ * @param len Length of the message, in bytes.
+ *
+ * @return The MAC, to be serialized in little-endian order.
+ */
+extern uint64_t siphash24(const uint8_t key[SIPHASH_KEY_LEN], const void *data, size_t len);
+
+#endif // _SIPHASH_H_
@@ -1,39 +1,93 @@
 // Library
 #include <inttypes.h>
-#include <stdio.h>
 #include <string.h>
 // Local
+#include "stringify.h"
 #include "uuid_utils.h"
 
+// -- DEFINES --
+#define HEX_VALID 0x10 //!< Set in HEX_NIBBLES for the hex digits
+
+// -- RUNTIME VARIABLES --
+
+/**
+ * Nibble value of every char, or-ed with HEX_VALID for the hex digits and 0 for anything else, so that a pair
+ * of digits is decoded and validated without branching.
+ */
+static const uint8_t HEX_NIBBLES[256] = {
+		['0'] = HEX_VALID | 0x0, ['1'] = HEX_VALID | 0x1, ['2'] = HEX_VALID | 0x2, ['3'] = HEX_VALID | 0x3,
+		['4'] = HEX_VALID | 0x4, ['5'] = HEX_VALID | 0x5, ['6'] = HEX_VALID | 0x6, ['7'] = HEX_VALID | 0x7,
+		['8'] = HEX_VALID | 0x8, ['9'] = HEX_VALID | 0x9,
+		['a'] = HEX_VALID | 0xa, ['b'] = HEX_VALID | 0xb, ['c'] = HEX_VALID | 0xc,
+		['d'] = HEX_VALID | 0xd, ['e'] = HEX_VALID | 0xe, ['f'] = HEX_VALID | 0xf,
+		['A'] = HEX_VALID | 0xa, ['B'] = HEX_VALID | 0xb, ['C'] = HEX_VALID | 0xc,
+		['D'] = HEX_VALID | 0xd, ['E'] = HEX_VALID | 0xe, ['F'] = HEX_VALID | 0xf,
+};
+
+/**
+ * Offset in the 8-4-4-4-12 string of the first digit of each byte.
+ */
+static const uint8_t BYTE_OFFSETS[16] = {0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34};
+
 int convert_uuid_to_bytes(const char *uuid_string, uint8_t *bytes, uint8_t reverse_order)
 {
-	size_t uuid_string_length = strlen(uuid_string);
-	if (uuid_string_length != 36)
+	// never read past the null-terminator, nor further than a valid uuid
+	return convert_uuid_n_to_bytes(uuid_string, strnlen(uuid_string, UUID_STRING_LEN + 1), bytes, reverse_order);
+}
+
+int convert_uuid_n_to_bytes(const char *uuid_string, size_t len, uint8_t *bytes, uint8_t reverse_order)
+{
+	if (len != UUID_STRING_LEN && (len != UUID_STRING_LEN + 1 || uuid_string[UUID_STRING_LEN] != '\0'))
 	{
 		// Invalid UUID string length
 		return 1;
 	}
 
-	int start = 0;
-	int end = 16;
-	int step = 1;
+	const uint8_t *str = (const uint8_t *)uuid_string;
+	uint8_t valid = (str[8] == '-') & (str[13] == '-') & (str[18] == '-') & (str[23] == '-');
+	uint8_t decoded[16];
 
-	if (reverse_order)
+	for (int i = 0; i < 16; i++)
+	{
+		uint8_t hi = HEX_NIBBLES[str[BYTE_OFFSETS[i]]];
+		uint8_t lo = HEX_NIBBLES[str[BYTE_OFFSETS[i] + 1]];
+		valid &= (hi & lo) >> 4;
+		decoded[i] = (hi << 4) | (lo & 0x0f);
+	}
+
+	if (!valid)
 	{
-		start = 15;
-		end = -1;
-		step = -1;
+		return 1;
 	}
 
-	for (int i = start, j = 0; i != end; i += step, j += 2)
+	if (reverse_order)
 	{
-		while (uuid_string[j] == '-' || uuid_string[j] == '\0')
+		for (int i = 0; i < 16; i++)
 		{
-			j++; // Skip dashes and null characters
+			bytes[i] = decoded[15 - i];
 		}
-
-		sscanf(&uuid_string[j], "%2hhx", &bytes[i]);
+	}
+	else
+	{
+		memcpy(bytes, decoded, sizeof(decoded));
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+void convert_bytes_to_uuid(const uint8_t *bytes, char *uuid_string, uint8_t reverse_order)
+{
+	// uuid_to_str reads the bytes in reverse order, as stored in ble_uuid128_t
+	if (reverse_order)
+	{
+		uuid_to_str(bytes, uuid_string);
+		return;
+	}
+
+	uint8_t reversed[16];
+	for (int i = 0; i < 16; i++)
+	{
+		reversed[i] = bytes[15 - i];
+	}
+	uuid_to_str(reversed, uuid_string);
+}
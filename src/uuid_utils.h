@@ -2,11 +2,14 @@
 #define _UUID_UTILS_H_
 
 #include <inttypes.h>
+#include <stddef.h>
+
+#define UUID_STRING_LEN 36 //!< Length of an 8-4-4-4-12 UUID string, without the null-terminator
 
 /**
  * Convert a UUID string to a byte array.
  *
- * @param uuid_string The UUID string to convert.
+ * @param uuid_string The null-terminated UUID string to convert.
  * @param bytes The byte array to store the converted UUID.
  * @param reverse_order Whether to reverse the order of the bytes.
  *
@@ -14,4 +17,27 @@
  */
 extern int convert_uuid_to_bytes(const char *uuid_string, uint8_t *bytes, uint8_t reverse_order);
 
-#endif // _UUID_UTILS_H_
\ No newline at end of file
+/**
+ * Convert a UUID string of known length to a byte array.
+ * The dash positions and every hex digit (either case) are validated in a single pass, bytes is left untouched
+ * if the string is invalid.
+ *
+ * @param uuid_string The UUID string to convert, it doesn't need to be null-terminated.
+ * @param len Length of uuid_string: UUID_STRING_LEN, or UUID_STRING_LEN + 1 if it ends with a null-terminator.
+ * @param bytes The byte array to store the converted UUID.
+ * @param reverse_order Whether to reverse the order of the bytes.
+ *
+ * @return 0 on success, others if not a valid uuid-128.
+ */
+extern int convert_uuid_n_to_bytes(const char *uuid_string, size_t len, uint8_t *bytes, uint8_t reverse_order);
+
+/**
+ * Convert a byte array to an uppercase UUID string, the inverse of convert_uuid_to_bytes.
+ *
+ * @param bytes The UUID bytes to convert.
+ * @param uuid_string Buffer of at least UUID_STRING_LEN + 1 chars receiving the null-terminated string.
+ * @param reverse_order Whether the bytes are in reverse order.
+ */
+extern void convert_bytes_to_uuid(const uint8_t *bytes, char *uuid_string, uint8_t reverse_order);
+
+#endif // _UUID_UTILS_H_